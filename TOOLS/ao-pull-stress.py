@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+
+"""
+Stress the audio callback path of pull based audio outputs.
+
+    TOOLS/ao-pull-stress.py [--mpv=PATH] [--outburst=N] [--duration=SECS]
+                            [--seek-interval=SECS]
+
+This plays a generated tone with --ao=null --ao-null-pull, once with and once
+without --audio-lookahead. While playing, the player is kept busy through the
+JSON IPC: properties are polled in a tight loop, and a random seek is done
+every --seek-interval seconds (0 disables seeking). A small --ao-null-outburst
+(default: 64 samples, 1.3 ms at 48 kHz) makes the callback deadlines short.
+
+For each run, it prints the number of callbacks, how many of them returned
+after their deadline (the device would have played a dropout), the longest
+callback time, and with --audio-lookahead the underruns counted by mpv.
+"""
+
+import json
+import os
+import random
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def connect(path, proc):
+    for _ in range(100):
+        try:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(path)
+            return sock
+        except (FileNotFoundError, ConnectionRefusedError):
+            if proc.poll() is not None:
+                sys.exit("mpv exited")
+            time.sleep(0.05)
+    sys.exit("could not connect to mpv")
+
+
+class Client:
+    def __init__(self, sock):
+        self.sock = sock
+        self.reader = sock.makefile("rb")
+        self.next_id = 0
+
+    def command(self, *args):
+        self.next_id += 1
+        cmd = {"command": list(args), "request_id": self.next_id}
+        self.sock.sendall((json.dumps(cmd) + "\n").encode())
+        while True:
+            msg = json.loads(self.reader.readline())
+            if msg.get("request_id") == self.next_id:
+                return msg.get("data")
+
+
+def run(mpv, lookahead, outburst, duration, seek_interval):
+    tmpdir = tempfile.mkdtemp(prefix="mpv-ao-pull-stress-")
+    sockpath = os.path.join(tmpdir, "socket")
+    logpath = os.path.join(tmpdir, "log")
+    length = duration + 10
+    url = "av://lavfi:sine=frequency=440:sample_rate=48000:duration=%d" % length
+    proc = subprocess.Popen([mpv, "--no-config", "--ao=null", "--ao-null-pull",
+                             "--ao-null-outburst=%d" % outburst,
+                             "--audio-lookahead=%s" % lookahead,
+                             "--msg-level=all=error,ao/null=v",
+                             "--input-ipc-server=" + sockpath, url],
+                            stdout=open(logpath, "wb"),
+                            stderr=subprocess.STDOUT)
+    try:
+        client = Client(connect(sockpath, proc))
+        # Stats are collected only after the first query.
+        client.command("get_property", "perf-info")
+        start = time.monotonic()
+        last_seek = start
+        polls = 0
+        while time.monotonic() - start < duration:
+            client.command("get_property", "audio-pts")
+            client.command("get_property", "time-pos")
+            polls += 1
+            now = time.monotonic()
+            if seek_interval > 0 and now - last_seek >= seek_interval:
+                client.command("seek", random.uniform(0, length - 5),
+                               "absolute")
+                last_seek = now
+        stats = {e["name"]: e["value"]
+                 for e in client.command("get_property", "perf-info")}
+        client.command("quit")
+        proc.wait()
+        with open(logpath, "rb") as f:
+            out = f.read().decode(errors="replace")
+    finally:
+        if proc.poll() is None:
+            proc.kill()
+            proc.wait()
+        shutil.rmtree(tmpdir)
+
+    m = re.search(r"(\d+) callbacks, (\d+) late, max\. ([\d.]+) ms", out)
+    if not m:
+        sys.exit("no callback statistics in mpv output:\n" + out)
+    line = ("lookahead=%-3s %8s callbacks, %6s late, max. %7s ms, "
+            "%d polls/sec" % (lookahead, m.group(1), m.group(2), m.group(3),
+                              polls / duration))
+    if "ao/xruns" in stats:
+        line += ", %d xruns" % stats["ao/xruns"]
+    print(line)
+
+
+def main():
+    mpv = "mpv"
+    outburst, duration, seek_interval = 64, 10, 1.0
+    for arg in sys.argv[1:]:
+        if arg.startswith("--mpv="):
+            mpv = arg[len("--mpv="):]
+        elif arg.startswith("--outburst="):
+            outburst = int(arg[len("--outburst="):])
+        elif arg.startswith("--duration="):
+            duration = float(arg[len("--duration="):])
+        elif arg.startswith("--seek-interval="):
+            seek_interval = float(arg[len("--seek-interval="):])
+        else:
+            sys.exit(__doc__)
+
+    for lookahead in ["no", "yes"]:
+        run(mpv, lookahead, outburst, duration, seek_interval)
+
+
+if __name__ == "__main__":
+    main()
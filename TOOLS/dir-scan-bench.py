@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+
+"""
+Measure how long loading a large directory tree takes.
+
+    TOOLS/dir-scan-bench.py [--mpv=PATH] [--depth=N] [--fanout=N] [--files=N]
+
+This creates a synthetic tree of empty files in a temporary directory (each
+directory has --files files and --fanout subdirectories, down to --depth
+levels), starts an idle mpv instance, and loads the tree with
+--directory-mode=recursive through the JSON IPC. It reports the time until the
+first playlist entries appear, and until the playlist contains all files.
+"""
+
+import json
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def make_tree(path, depth, fanout, files):
+    os.mkdir(path)
+    count = 0
+    for n in range(files):
+        open(os.path.join(path, "file%04d.mkv" % n), "w").close()
+        count += 1
+    if depth > 0:
+        for n in range(fanout):
+            count += make_tree(os.path.join(path, "dir%04d" % n), depth - 1,
+                               fanout, files)
+    return count
+
+
+def connect(path, proc):
+    for _ in range(100):
+        try:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(path)
+            return sock
+        except (FileNotFoundError, ConnectionRefusedError):
+            if proc.poll() is not None:
+                sys.exit("mpv exited")
+            time.sleep(0.05)
+    sys.exit("could not connect to mpv")
+
+
+def main():
+    mpv = "mpv"
+    depth, fanout, files = 3, 10, 20
+    for arg in sys.argv[1:]:
+        if arg.startswith("--mpv="):
+            mpv = arg[len("--mpv="):]
+        elif arg.startswith("--depth="):
+            depth = int(arg[len("--depth="):])
+        elif arg.startswith("--fanout="):
+            fanout = int(arg[len("--fanout="):])
+        elif arg.startswith("--files="):
+            files = int(arg[len("--files="):])
+        else:
+            sys.exit(__doc__)
+
+    tmpdir = tempfile.mkdtemp(prefix="mpv-dir-scan-bench-")
+    root = os.path.join(tmpdir, "tree")
+    total = make_tree(root, depth, fanout, files)
+    print("created %d files" % total)
+
+    sockpath = os.path.join(tmpdir, "socket")
+    proc = subprocess.Popen([mpv, "--no-config", "--idle", "--really-quiet",
+                             "--vo=null", "--ao=null",
+                             "--directory-mode=recursive",
+                             "--input-ipc-server=" + sockpath])
+    try:
+        sock = connect(sockpath, proc)
+        reader = sock.makefile("rb")
+        sock.sendall(b'{"command": ["observe_property", 1, "playlist-count"]}\n')
+        start = time.monotonic()
+        cmd = {"command": ["loadfile", root]}
+        sock.sendall((json.dumps(cmd) + "\n").encode())
+        first = None
+        count = 0
+        while count < total:
+            msg = json.loads(reader.readline())
+            if msg.get("event") != "property-change":
+                continue
+            count = msg.get("data") or 0
+            # The directory itself is the only entry until it's expanded.
+            if count > 1 and first is None:
+                first = time.monotonic() - start
+        secs = time.monotonic() - start
+        print("first entries after %.3f s, %d entries after %.3f s "
+              "(%.0f entries/sec)" % (first, count, secs, count / secs))
+    finally:
+        proc.terminate()
+        proc.wait()
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == "__main__":
+    main()
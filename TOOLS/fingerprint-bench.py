@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+
+"""
+Measure the cost of vf_fingerprint per frame.
+
+    TOOLS/fingerprint-bench.py [--mpv=PATH]
+
+A generated test pattern (lavfi testsrc2) is decoded for FRAMES frames at each
+size in SIZES, with --vo=null discarding them. Each size is run once without
+the filter, and then once for each fingerprint type, with the fingerprints
+written to a file (so every frame's fingerprint is formatted and output). The
+difference is reported as ms/frame spent in the filter, and the resulting
+number of frames per second the filter alone could process.
+"""
+
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+FRAMES = 300
+
+SIZES = ["1920x1080", "3840x2160"]
+
+TYPES = ["gray-hex-16x16", "ahash", "dhash", "phash"]
+
+
+def run(mpv, size, vf):
+    src = "av://lavfi:testsrc2=size=%s:rate=30,format=yuv420p" % size
+    cmd = [mpv, "--no-config", "--really-quiet", "--untimed", "--ao=null",
+           "--vo=null", "--frames=%d" % FRAMES, "--vf=" + vf, src]
+    start = time.monotonic()
+    subprocess.run(cmd, check=True, stdin=subprocess.DEVNULL)
+    return (time.monotonic() - start) * 1e3 / FRAMES
+
+
+def main():
+    args = sys.argv[1:]
+    mpv = "mpv"
+    if args and args[0].startswith("--mpv="):
+        mpv = args.pop(0)[len("--mpv="):]
+    if args:
+        sys.exit(__doc__)
+    with tempfile.TemporaryDirectory() as tmp:
+        out = os.path.join(tmp, "prints.txt")
+        for size in SIZES:
+            base = run(mpv, size, "")
+            for t in TYPES:
+                ms = run(mpv, size, "fingerprint=type=%s:file=%s" % (t, out))
+                os.remove(out)
+                cost = max(ms - base, 1e-3)
+                print("%-10s %-15s %7.3f ms/frame (%8.0f frames/sec), "
+                      "%.2f ms/frame without filter" %
+                      (size, t, cost, 1e3 / cost, base))
+
+
+if __name__ == "__main__":
+    main()
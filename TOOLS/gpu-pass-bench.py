@@ -0,0 +1,278 @@
+#!/usr/bin/env python3
+
+"""
+Measure the GPU time of each render pass of --vo=gpu, and compare runs.
+
+    TOOLS/gpu-pass-bench.py [--mpv=PATH] [--frames=N] [--size=WxH]
+                            [--clip=URL] [--warmup=N] [--output=FILE]
+                            [-- MPV_OPTION...]
+    TOOLS/gpu-pass-bench.py --compare [--threshold=PCT] OLD.json NEW.json
+
+The first form plays a clip (by default FRAMES frames of a generated test
+pattern, lavfi testsrc2) as fast as possible with --untimed, and reads the
+vo-passes property over IPC while it plays. Every pass timing measured during
+playback is collected (using vo-passes/TYPE/N/total to find the new samples),
+except for the first WARMUP samples of each pass, which include shader
+compilation and resource creation. Passes are identified by their description
+(and position, if a description occurs multiple times in a frame). The result
+is written as JSON to stdout or FILE: for each frame type (fresh, redraw) and
+pass, the number of samples and the mean, median, 99th percentile and maximum
+time in microseconds.
+
+Options after -- are passed to mpv, and select the renderer configuration,
+e.g. "-- --scale=ewa_lanczossharp --glsl-shader=foo.glsl". For CI on a
+software rasterizer, run it with e.g. "xvfb-run" and "LIBGL_ALWAYS_SOFTWARE=1"
+(llvmpipe), or with "-- --gpu-api=vulkan" and lavapipe as the only Vulkan
+device. VOs that don't report vo-passes/TYPE/N/total (like --vo=gpu-next) only
+provide the last 256 samples of each pass at the end of playback.
+
+The second form compares two result files, and prints the change of the mean
+and 99th percentile of each pass. It exits with status 1 if any of them got
+slower by more than PCT percent (default: 10).
+"""
+
+import json
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+FRAMES = 600
+SIZE = "1920x1080"
+WARMUP = 10
+POLL_INTERVAL = 0.05
+TYPES = ["fresh", "redraw"]
+
+
+def connect(path, proc):
+    for _ in range(200):
+        try:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(path)
+            return sock
+        except (FileNotFoundError, ConnectionRefusedError):
+            if proc.poll() is not None:
+                sys.exit("mpv exited")
+            time.sleep(0.05)
+    sys.exit("could not connect to mpv")
+
+
+class Client:
+    def __init__(self, sock):
+        self.sock = sock
+        self.reader = sock.makefile("rb")
+        self.request_id = 0
+
+    def command(self, *args):
+        self.request_id += 1
+        self.sock.sendall((json.dumps({"command": list(args),
+                                       "request_id": self.request_id}) +
+                           "\n").encode())
+        while True:
+            line = self.reader.readline()
+            if not line:
+                sys.exit("mpv closed the IPC connection")
+            msg = json.loads(line)
+            if msg.get("request_id") == self.request_id:
+                return msg.get("data")
+
+
+class Pass:
+    def __init__(self):
+        self.seen = 0       # value of "total" when last read
+        self.samples = []   # collected samples in ns
+        self.window = []    # last samples read, for VOs without "total"
+        self.dropped = 0    # samples lost because of slow polling
+
+
+def collect(passes, data, warmup):
+    for t in TYPES:
+        occurrences = {}
+        for entry in data.get(t) or []:
+            desc = entry["desc"]
+            n = occurrences.get(desc, 0)
+            occurrences[desc] = n + 1
+            key = (t, desc if not n else "%s #%d" % (desc, n + 1))
+            p = passes.setdefault(key, Pass())
+            samples = entry.get("samples") or []
+            total = entry.get("total", 0)
+            p.window = samples
+            if not total or total <= p.seen:
+                continue
+            new = total - p.seen
+            if new > len(samples):
+                p.dropped += new - len(samples)
+                new = len(samples)
+            # samples[i] is sample number first + i (0-based, since creation)
+            first = total - len(samples)
+            for i in range(len(samples) - new, len(samples)):
+                if first + i >= warmup:
+                    p.samples.append(samples[i])
+            p.seen = total
+
+
+def percentile(sorted_values, pct):
+    # nearest-rank method
+    rank = max(1, -(-len(sorted_values) * pct // 100))
+    return sorted_values[int(rank) - 1]
+
+
+def summarize(passes):
+    res = {t: [] for t in TYPES}
+    for (t, desc), p in passes.items():
+        windowed = not p.samples and not p.seen
+        values = sorted(p.window if windowed else p.samples)
+        if not values:
+            continue
+        entry = {
+            "desc": desc,
+            "samples": len(values),
+            "mean_us": sum(values) / len(values) / 1e3,
+            "p50_us": percentile(values, 50) / 1e3,
+            "p99_us": percentile(values, 99) / 1e3,
+            "max_us": values[-1] / 1e3,
+        }
+        if p.dropped:
+            entry["dropped"] = p.dropped
+        if windowed:
+            entry["windowed"] = True
+        res[t].append(entry)
+    return res
+
+
+def run(mpv, clip, frames, warmup, mpv_args):
+    tmpdir = tempfile.mkdtemp(prefix="mpv-gpu-pass-bench-")
+    sockpath = os.path.join(tmpdir, "socket")
+    cmd = [mpv, "--no-config", "--really-quiet", "--untimed", "--no-audio",
+           "--keep-open=yes", "--osd-level=0", "--vo=gpu",
+           "--input-ipc-server=" + sockpath] + mpv_args + [clip]
+    proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL)
+    passes = {}
+    try:
+        client = Client(connect(sockpath, proc))
+        start = time.monotonic()
+        while True:
+            eof = client.command("get_property", "eof-reached")
+            data = client.command("get_property", "vo-passes")
+            if data:
+                collect(passes, data, warmup)
+            if eof:
+                break
+            if proc.poll() is not None:
+                sys.exit("mpv exited")
+            time.sleep(POLL_INTERVAL)
+        elapsed = time.monotonic() - start
+        client.command("quit")
+        proc.wait()
+    finally:
+        if proc.poll() is None:
+            proc.kill()
+            proc.wait()
+        shutil.rmtree(tmpdir)
+
+    res = {
+        "clip": clip,
+        "mpv_options": mpv_args,
+        "warmup": warmup,
+        "elapsed_sec": elapsed,
+    }
+    if frames:
+        res["frames"] = frames
+    res.update(summarize(passes))
+    return res
+
+
+def compare(old_file, new_file, threshold):
+    with open(old_file) as f:
+        old = json.load(f)
+    with open(new_file) as f:
+        new = json.load(f)
+    regressed = False
+    for t in TYPES:
+        old_passes = {p["desc"]: p for p in old.get(t, [])}
+        new_passes = {p["desc"]: p for p in new.get(t, [])}
+        if not old_passes and not new_passes:
+            continue
+        print("%s:" % t)
+        for desc, n in new_passes.items():
+            o = old_passes.get(desc)
+            if not o:
+                print("  %s: new pass, mean %.1fus p99 %.1fus"
+                      % (desc, n["mean_us"], n["p99_us"]))
+                continue
+            line = "  %s:" % desc
+            for stat in ["mean_us", "p99_us"]:
+                change = (n[stat] - o[stat]) * 100 / max(o[stat], 1e-3)
+                mark = ""
+                if change > threshold:
+                    mark = " (!)"
+                    regressed = True
+                line += " %s %.1f -> %.1fus (%+.1f%%)%s" % (
+                    stat[:-3], o[stat], n[stat], change, mark)
+            print(line)
+        for desc in old_passes:
+            if desc not in new_passes:
+                print("  %s: removed pass" % desc)
+    return 1 if regressed else 0
+
+
+def main():
+    args = sys.argv[1:]
+    mpv_args = []
+    if "--" in args:
+        mpv_args = args[args.index("--") + 1:]
+        args = args[:args.index("--")]
+
+    mpv = "mpv"
+    frames, size, clip, warmup, output = FRAMES, SIZE, None, WARMUP, None
+    do_compare, threshold = False, 10.0
+    files = []
+    for arg in args:
+        if arg.startswith("--mpv="):
+            mpv = arg[len("--mpv="):]
+        elif arg.startswith("--frames="):
+            frames = int(arg[len("--frames="):])
+        elif arg.startswith("--size="):
+            size = arg[len("--size="):]
+        elif arg.startswith("--clip="):
+            clip = arg[len("--clip="):]
+        elif arg.startswith("--warmup="):
+            warmup = int(arg[len("--warmup="):])
+        elif arg.startswith("--output="):
+            output = arg[len("--output="):]
+        elif arg == "--compare":
+            do_compare = True
+        elif arg.startswith("--threshold="):
+            threshold = float(arg[len("--threshold="):])
+        elif not arg.startswith("--"):
+            files.append(arg)
+        else:
+            sys.exit(__doc__)
+
+    if do_compare:
+        if len(files) != 2:
+            sys.exit(__doc__)
+        sys.exit(compare(files[0], files[1], threshold))
+    if files:
+        sys.exit(__doc__)
+
+    if clip:
+        frames = None
+    else:
+        clip = ("av://lavfi:testsrc2=size=%s:rate=60:duration=%f"
+                % (size, frames / 60))
+
+    res = run(mpv, clip, frames, warmup, mpv_args)
+    text = json.dumps(res, indent=2) + "\n"
+    if output:
+        with open(output, "w") as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,282 @@
+#!/usr/bin/env python3
+
+"""
+Measure IPC throughput and event latency of a running mpv instance.
+
+Start mpv with e.g.:
+
+    mpv --idle --input-ipc-server=/tmp/mpvsocket [--input-ipc-multiplex]
+
+and run:
+
+    TOOLS/ipc-bench.py [--protocol=json|msgpack|both] /tmp/mpvsocket [clients...]
+
+For each client count (default: 1 10 100), this opens that many connections
+and reports:
+
+ - commands/sec: all clients send pipelined get_property requests as fast as
+   possible, and the total number of replies per second is printed.
+ - mpv CPU time per 1000 commands (Linux only), which is the cost on the
+   player side independent of how fast this script is.
+ - fan-out latency: all clients observe a user-data property, one client sets
+   it, and the time until every client received the property-change event is
+   printed (mean and max over several rounds).
+
+The connections use newline-delimited JSON or length-prefixed MessagePack
+(switched with the ipc_protocol command). By default, both are measured.
+"""
+
+import json
+import os
+import selectors
+import socket
+import struct
+import sys
+import time
+
+COMMANDS_PER_CLIENT = 2000
+PIPELINE = 50
+FANOUT_ROUNDS = 50
+
+
+# Minimal MessagePack codec, covering what mpv sends and what this script
+# needs to send.
+def mp_pack(obj, out):
+    if obj is None:
+        out.append(0xc0)
+    elif obj is True or obj is False:
+        out.append(0xc3 if obj else 0xc2)
+    elif isinstance(obj, int):
+        if 0 <= obj <= 0x7f:
+            out.append(obj)
+        elif -32 <= obj < 0:
+            out.append(obj & 0xff)
+        else:
+            out += struct.pack(">Bq", 0xd3, obj)
+    elif isinstance(obj, float):
+        out += struct.pack(">Bd", 0xcb, obj)
+    elif isinstance(obj, str):
+        data = obj.encode()
+        if len(data) <= 31:
+            out.append(0xa0 | len(data))
+        else:
+            out += struct.pack(">BI", 0xdb, len(data))
+        out += data
+    elif isinstance(obj, (list, tuple)):
+        out += struct.pack(">BI", 0xdd, len(obj))
+        for v in obj:
+            mp_pack(v, out)
+    elif isinstance(obj, dict):
+        out += struct.pack(">BI", 0xdf, len(obj))
+        for k, v in obj.items():
+            mp_pack(k, out)
+            mp_pack(v, out)
+    else:
+        raise TypeError("can't pack %r" % (obj,))
+    return out
+
+
+def mp_unpack(data, pos=0):
+    c = data[pos]
+    pos += 1
+    if c <= 0x7f:
+        return c, pos
+    if c >= 0xe0:
+        return c - 0x100, pos
+    if 0x80 <= c <= 0x9f:
+        num, is_map = c & 0x0f, c < 0x90
+    elif 0xa0 <= c <= 0xbf:
+        n = c & 0x1f
+        return data[pos:pos + n].decode(errors="replace"), pos + n
+    elif c == 0xc0:
+        return None, pos
+    elif c in (0xc2, 0xc3):
+        return c == 0xc3, pos
+    elif c in (0xc4, 0xc5, 0xc6, 0xd9, 0xda, 0xdb):
+        fmt = ">" + "BHI"[(c - 0xc4) % 3 if c < 0xd9 else c - 0xd9]
+        (n,) = struct.unpack_from(fmt, data, pos)
+        pos += struct.calcsize(fmt)
+        raw = data[pos:pos + n]
+        return (bytes(raw) if c < 0xd9 else raw.decode(errors="replace")), pos + n
+    elif c in (0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf, 0xd0, 0xd1, 0xd2, 0xd3):
+        fmt = ">" + {0xca: "f", 0xcb: "d", 0xcc: "B", 0xcd: "H", 0xce: "I",
+                     0xcf: "Q", 0xd0: "b", 0xd1: "h", 0xd2: "i", 0xd3: "q"}[c]
+        (v,) = struct.unpack_from(fmt, data, pos)
+        return v, pos + struct.calcsize(fmt)
+    elif c in (0xdc, 0xdd, 0xde, 0xdf):
+        fmt = ">H" if c in (0xdc, 0xde) else ">I"
+        (num,) = struct.unpack_from(fmt, data, pos)
+        pos += struct.calcsize(fmt)
+        is_map = c >= 0xde
+    else:
+        raise ValueError("unsupported MessagePack type 0x%02x" % c)
+    if is_map:
+        res = {}
+        for _ in range(num):
+            k, pos = mp_unpack(data, pos)
+            res[k], pos = mp_unpack(data, pos)
+    else:
+        res = []
+        for _ in range(num):
+            v, pos = mp_unpack(data, pos)
+            res.append(v)
+    return res, pos
+
+
+class Client:
+    def __init__(self, path, protocol):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.buf = b""
+        self.msgpack = False
+        if protocol == "msgpack":
+            # The reply still uses JSON; read it before switching.
+            self.send({"command": ["ipc_protocol", "msgpack"]})
+            while b"\n" not in self.buf:
+                self.buf += self.sock.recv(65536)
+            self.buf = self.buf.split(b"\n", 1)[1]
+            self.msgpack = True
+        self.sock.setblocking(False)
+
+    def send(self, obj):
+        if self.msgpack:
+            data = mp_pack(obj, bytearray())
+            self.sock.sendall(struct.pack(">I", len(data)) + data)
+        else:
+            self.sock.sendall((json.dumps(obj) + "\n").encode())
+
+    def read_messages(self):
+        try:
+            data = self.sock.recv(65536)
+        except BlockingIOError:
+            return []
+        if not data:
+            raise EOFError("mpv closed the connection")
+        self.buf += data
+        if not self.msgpack:
+            lines = self.buf.split(b"\n")
+            self.buf = lines.pop()
+            return [json.loads(line) for line in lines if line]
+        msgs = []
+        pos = 0
+        while len(self.buf) - pos >= 4:
+            (size,) = struct.unpack_from(">I", self.buf, pos)
+            if len(self.buf) - pos - 4 < size:
+                break
+            msgs.append(mp_unpack(self.buf, pos + 4)[0])
+            pos += 4 + size
+        self.buf = self.buf[pos:]
+        return msgs
+
+
+def get_pid(client):
+    client.send({"command": ["get_property", "pid"], "request_id": 1})
+    while True:
+        for msg in client.read_messages():
+            if msg.get("request_id") == 1:
+                return msg.get("data")
+        time.sleep(0.001)
+
+
+# User + system CPU time of the process in seconds, or None if unavailable.
+def cpu_time(pid):
+    try:
+        with open("/proc/%d/stat" % pid) as f:
+            fields = f.read().rsplit(")", 1)[1].split()
+    except (OSError, TypeError):
+        return None
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def bench_commands(clients):
+    sel = selectors.DefaultSelector()
+    state = {}
+    for c in clients:
+        sel.register(c.sock, selectors.EVENT_READ, c)
+        state[c] = [0, 0]  # sent, received
+    start = time.monotonic()
+    for c in clients:
+        for _ in range(PIPELINE):
+            c.send({"command": ["get_property", "pid"], "request_id": 1})
+            state[c][0] += 1
+    remaining = len(clients)
+    while remaining:
+        for key, _ in sel.select():
+            c = key.data
+            for msg in c.read_messages():
+                if "request_id" not in msg:
+                    continue
+                st = state[c]
+                st[1] += 1
+                if st[0] < COMMANDS_PER_CLIENT:
+                    c.send({"command": ["get_property", "pid"],
+                            "request_id": 1})
+                    st[0] += 1
+                elif st[1] == COMMANDS_PER_CLIENT:
+                    remaining -= 1
+    elapsed = time.monotonic() - start
+    sel.close()
+    return len(clients) * COMMANDS_PER_CLIENT / elapsed
+
+
+def bench_fanout(clients):
+    sel = selectors.DefaultSelector()
+    for c in clients:
+        sel.register(c.sock, selectors.EVENT_READ, c)
+        c.send({"command": ["observe_property", 1, "user-data/ipc-bench"]})
+    # Swallow the initial notifications and replies.
+    time.sleep(0.5)
+    for c in clients:
+        while c.read_messages():
+            pass
+
+    latencies = []
+    for n in range(FANOUT_ROUNDS):
+        pending = set(clients)
+        start = time.monotonic()
+        clients[0].send({"command": ["set_property", "user-data/ipc-bench", n]})
+        while pending:
+            for key, _ in sel.select():
+                c = key.data
+                for msg in c.read_messages():
+                    if msg.get("event") == "property-change" and \
+                            msg.get("data") == n:
+                        pending.discard(c)
+        latencies.append(time.monotonic() - start)
+    sel.close()
+    return (sum(latencies) / len(latencies), max(latencies))
+
+
+def main():
+    args = sys.argv[1:]
+    protocols = ["json", "msgpack"]
+    if args and args[0].startswith("--protocol="):
+        proto = args.pop(0)[len("--protocol="):]
+        if proto != "both":
+            protocols = [proto]
+    if not args:
+        sys.exit("usage: ipc-bench.py [--protocol=json|msgpack|both] <socket> "
+                 "[clients...]")
+    path = args[0]
+    counts = [int(n) for n in args[1:]] or [1, 10, 100]
+    for count in counts:
+        for proto in protocols:
+            clients = [Client(path, proto) for _ in range(count)]
+            pid = get_pid(clients[0])
+            cpu_start = cpu_time(pid)
+            cps = bench_commands(clients)
+            cpu_end = cpu_time(pid)
+            mean, worst = bench_fanout(clients)
+            line = "%4d clients, %-7s: %9.0f commands/sec" % (count, proto, cps)
+            if cpu_start is not None and cpu_end is not None:
+                line += ", mpv CPU %.1f ms/1000 commands" % (
+                    (cpu_end - cpu_start) * 1e6 / (count * COMMANDS_PER_CLIENT))
+            line += ", fan-out latency mean %.2f ms, max %.2f ms" % (
+                mean * 1e3, worst * 1e3)
+            print(line)
+            for c in clients:
+                c.sock.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+
+"""
+Measure the software render API (MPV_RENDER_API_TYPE_SW) throughput.
+
+    TOOLS/libmpv-sw-bench.py [--lib=PATH] [--duration=SECS]
+
+This loads libmpv with ctypes, plays a generated test pattern (lavfi testsrc2)
+as fast as possible (--untimed), and renders every frame into a memory buffer
+with mpv_render_context_render(). For each configuration in CONFIGS (video
+size, decoded pixel format, target size, target pixel format), it prints the
+number of frames rendered per second, and the average time spent in the render
+call per frame.
+
+The decoded pixel format is forced with --vf=format, so configurations where
+it matches the target format and size use the copy path without conversion.
+"""
+
+import ctypes
+import ctypes.util
+import sys
+import threading
+import time
+
+CONFIGS = [
+    # video size, video format, target size, target format
+    ("1920x1080", "rgb0", "1920x1080", "rgb0"),
+    ("1920x1080", "bgr0", "1920x1080", "rgb0"),
+    ("1920x1080", "yuv420p", "1920x1080", "rgb0"),
+    ("1920x1080", "yuv420p", "1280x720", "rgb0"),
+    ("3840x2160", "rgb0", "3840x2160", "rgb0"),
+    ("3840x2160", "yuv420p", "3840x2160", "rgb0"),
+]
+
+MPV_RENDER_PARAM_INVALID = 0
+MPV_RENDER_PARAM_API_TYPE = 1
+MPV_RENDER_PARAM_SW_SIZE = 17
+MPV_RENDER_PARAM_SW_FORMAT = 18
+MPV_RENDER_PARAM_SW_STRIDE = 19
+MPV_RENDER_PARAM_SW_POINTER = 20
+MPV_RENDER_UPDATE_FRAME = 1 << 0
+
+
+class RenderParam(ctypes.Structure):
+    _fields_ = [("type", ctypes.c_int), ("data", ctypes.c_void_p)]
+
+
+UPDATE_CB = ctypes.CFUNCTYPE(None, ctypes.c_void_p)
+
+
+def load(path):
+    lib = ctypes.CDLL(path or ctypes.util.find_library("mpv") or "libmpv.so")
+    lib.mpv_create.restype = ctypes.c_void_p
+    lib.mpv_set_option_string.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                          ctypes.c_char_p]
+    lib.mpv_initialize.argtypes = [ctypes.c_void_p]
+    lib.mpv_command.argtypes = [ctypes.c_void_p,
+                                ctypes.POINTER(ctypes.c_char_p)]
+    lib.mpv_wait_event.argtypes = [ctypes.c_void_p, ctypes.c_double]
+    lib.mpv_wait_event.restype = ctypes.c_void_p
+    lib.mpv_terminate_destroy.argtypes = [ctypes.c_void_p]
+    lib.mpv_render_context_create.argtypes = [
+        ctypes.POINTER(ctypes.c_void_p), ctypes.c_void_p,
+        ctypes.POINTER(RenderParam)]
+    lib.mpv_render_context_set_update_callback.argtypes = [
+        ctypes.c_void_p, UPDATE_CB, ctypes.c_void_p]
+    lib.mpv_render_context_update.argtypes = [ctypes.c_void_p]
+    lib.mpv_render_context_update.restype = ctypes.c_uint64
+    lib.mpv_render_context_render.argtypes = [ctypes.c_void_p,
+                                              ctypes.POINTER(RenderParam)]
+    lib.mpv_render_context_free.argtypes = [ctypes.c_void_p]
+    return lib
+
+
+def params(*pairs):
+    arr = (RenderParam * (len(pairs) + 1))()
+    for n, (t, data) in enumerate(pairs):
+        arr[n].type = t
+        arr[n].data = ctypes.cast(data, ctypes.c_void_p)
+    arr[len(pairs)].type = MPV_RENDER_PARAM_INVALID
+    return arr
+
+
+def run(lib, duration, vsize, vfmt, tsize, tfmt):
+    mpv = lib.mpv_create()
+    for k, v in [("vo", "libmpv"), ("untimed", "yes"), ("audio", "no"),
+                 ("terminal", "no"), ("vf", "format=" + vfmt),
+                 ("loop-file", "inf")]:
+        lib.mpv_set_option_string(mpv, k.encode(), v.encode())
+    if lib.mpv_initialize(mpv) < 0:
+        sys.exit("mpv_initialize failed")
+
+    api = ctypes.c_char_p(b"sw")
+    ctx = ctypes.c_void_p()
+    if lib.mpv_render_context_create(ctypes.byref(ctx), mpv,
+                                     params((MPV_RENDER_PARAM_API_TYPE,
+                                             api))) < 0:
+        sys.exit("mpv_render_context_create failed")
+
+    wakeup = threading.Event()
+    cb = UPDATE_CB(lambda _: wakeup.set())
+    lib.mpv_render_context_set_update_callback(ctx, cb, None)
+
+    w, h = (int(v) for v in tsize.split("x"))
+    stride = (w * 4 + 63) // 64 * 64
+    buf = ctypes.create_string_buffer(stride * h + 64)
+    ptr = ctypes.c_void_p((ctypes.addressof(buf) + 63) // 64 * 64)
+    size = (ctypes.c_int * 2)(w, h)
+    c_stride = ctypes.c_size_t(stride)
+    c_fmt = ctypes.c_char_p(tfmt.encode())
+    render_params = params((MPV_RENDER_PARAM_SW_SIZE, size),
+                           (MPV_RENDER_PARAM_SW_FORMAT, c_fmt),
+                           (MPV_RENDER_PARAM_SW_STRIDE,
+                            ctypes.pointer(c_stride)),
+                           (MPV_RENDER_PARAM_SW_POINTER, ptr))
+
+    url = "av://lavfi:testsrc2=size=%s:rate=1000" % vsize
+    cmd = (ctypes.c_char_p * 3)(b"loadfile", url.encode(), None)
+    lib.mpv_command(mpv, cmd)
+
+    frames = 0
+    render_time = 0.0
+    start = None
+    while start is None or time.monotonic() - start < duration:
+        wakeup.wait(1)
+        wakeup.clear()
+        # Drain the event queue (event_id is the first field of mpv_event).
+        while ctypes.cast(lib.mpv_wait_event(mpv, 0),
+                          ctypes.POINTER(ctypes.c_int))[0]:
+            pass
+        if not lib.mpv_render_context_update(ctx) & MPV_RENDER_UPDATE_FRAME:
+            continue
+        t = time.perf_counter()
+        lib.mpv_render_context_render(ctx, render_params)
+        t = time.perf_counter() - t
+        # Skip the first frame (setup costs).
+        if start is None:
+            start = time.monotonic()
+            continue
+        frames += 1
+        render_time += t
+    elapsed = time.monotonic() - start
+
+    lib.mpv_render_context_free(ctx)
+    lib.mpv_terminate_destroy(mpv)
+
+    print("%9s %-7s -> %9s %-4s: %7.1f frames/sec, %6.2f ms/frame in render"
+          % (vsize, vfmt, tsize, tfmt, frames / elapsed,
+             render_time * 1e3 / max(frames, 1)))
+
+
+def main():
+    path = None
+    duration = 5.0
+    for arg in sys.argv[1:]:
+        if arg.startswith("--lib="):
+            path = arg[len("--lib="):]
+        elif arg.startswith("--duration="):
+            duration = float(arg[len("--duration="):])
+        else:
+            sys.exit(__doc__)
+    lib = load(path)
+    for config in CONFIGS:
+        run(lib, duration, *config)
+
+
+if __name__ == "__main__":
+    main()
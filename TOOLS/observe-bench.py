@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+
+"""
+Measure the cost of property observation with many clients.
+
+    TOOLS/observe-bench.py [--mpv=PATH] [--duration=SECS] [--rate=HZ]
+                           [CLIENTSxPROPERTIES...]
+
+This plays a small generated video as fast as possible (--untimed, --vo=null),
+while N IPC clients each observe the first M properties of a list of
+frequently changing ones (time-pos, estimated-vf-fps, ...). Every property
+changes on every frame, so the player core has to read N x M values per
+frame. With --rate, the observations are limited to that many updates per
+second (the optional 4th observe_property argument).
+
+For each configuration (default: 1x1 10x5 30x10), it prints the number of
+frames played per second, the mpv CPU time per frame (Linux only), and the
+number of property-change events received per second.
+"""
+
+import json
+import os
+import selectors
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+PROPERTIES = [
+    "time-pos", "estimated-vf-fps", "audio-pts", "playback-time",
+    "percent-pos", "estimated-frame-number", "time-remaining",
+    "playtime-remaining", "avsync", "frame-drop-count", "video-frame-info",
+    "estimated-display-fps",
+]
+
+
+def connect(path, proc):
+    for _ in range(100):
+        try:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(path)
+            return sock
+        except (FileNotFoundError, ConnectionRefusedError):
+            if proc.poll() is not None:
+                sys.exit("mpv exited")
+            time.sleep(0.05)
+    sys.exit("could not connect to mpv")
+
+
+def command(sock, reader, *args):
+    sock.sendall((json.dumps({"command": list(args), "request_id": 1}) +
+                  "\n").encode())
+    while True:
+        msg = json.loads(reader.readline())
+        if msg.get("request_id") == 1:
+            return msg.get("data")
+
+
+# User + system CPU time of the process in seconds, or None if unavailable.
+def cpu_time(pid):
+    try:
+        with open("/proc/%d/stat" % pid) as f:
+            fields = f.read().rsplit(")", 1)[1].split()
+    except OSError:
+        return None
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def run(mpv, num_clients, num_props, duration, rate):
+    tmpdir = tempfile.mkdtemp(prefix="mpv-observe-bench-")
+    sockpath = os.path.join(tmpdir, "socket")
+    url = "av://lavfi:testsrc=size=64x64:rate=1000:duration=100000"
+    proc = subprocess.Popen([mpv, "--no-config", "--really-quiet", "--untimed",
+                             "--vo=null", "--no-audio", "--pause",
+                             "--input-ipc-server=" + sockpath, url])
+    try:
+        ctrl = connect(sockpath, proc)
+        reader = ctrl.makefile("rb")
+        pid = command(ctrl, reader, "get_property", "pid")
+
+        sel = selectors.DefaultSelector()
+        clients = []
+        for _ in range(num_clients):
+            sock = connect(sockpath, proc)
+            for n, name in enumerate(PROPERTIES[:num_props]):
+                args = ["observe_property", n + 1, name]
+                if rate:
+                    args.append(rate)
+                sock.sendall((json.dumps({"command": args}) + "\n").encode())
+            sock.setblocking(False)
+            sel.register(sock, selectors.EVENT_READ)
+            clients.append(sock)
+
+        frame_start = command(ctrl, reader, "get_property",
+                              "estimated-frame-number") or 0
+        cpu_start = cpu_time(pid)
+        command(ctrl, reader, "set_property", "pause", False)
+        start = time.monotonic()
+        events = 0
+        while time.monotonic() - start < duration:
+            for key, _ in sel.select(timeout=0.1):
+                try:
+                    data = key.fileobj.recv(1 << 20)
+                except BlockingIOError:
+                    continue
+                events += data.count(b'"property-change"')
+        command(ctrl, reader, "set_property", "pause", True)
+        elapsed = time.monotonic() - start
+        cpu_end = cpu_time(pid)
+        frames = (command(ctrl, reader, "get_property",
+                          "estimated-frame-number") or 0) - frame_start
+        command(ctrl, reader, "quit")
+        proc.wait()
+    finally:
+        if proc.poll() is None:
+            proc.kill()
+            proc.wait()
+        shutil.rmtree(tmpdir)
+
+    line = "%3d clients x %2d properties: %8.0f frames/sec" % (
+        num_clients, num_props, frames / elapsed)
+    if cpu_start is not None and cpu_end is not None and frames:
+        line += ", %6.1f us CPU/frame" % ((cpu_end - cpu_start) * 1e6 / frames)
+    line += ", %8.0f events/sec" % (events / elapsed)
+    print(line)
+
+
+def main():
+    args = sys.argv[1:]
+    mpv = "mpv"
+    duration, rate = 5.0, 0
+    while args and args[0].startswith("--"):
+        arg = args.pop(0)
+        if arg.startswith("--mpv="):
+            mpv = arg[len("--mpv="):]
+        elif arg.startswith("--duration="):
+            duration = float(arg[len("--duration="):])
+        elif arg.startswith("--rate="):
+            rate = float(arg[len("--rate="):])
+        else:
+            sys.exit(__doc__)
+    configs = []
+    for arg in args or ["1x1", "10x5", "30x10"]:
+        try:
+            clients, props = (int(v) for v in arg.split("x"))
+        except ValueError:
+            sys.exit(__doc__)
+        configs.append((clients, min(props, len(PROPERTIES))))
+
+    for clients, props in configs:
+        run(mpv, clients, props, duration, rate)
+
+
+if __name__ == "__main__":
+    main()
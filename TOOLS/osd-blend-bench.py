@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+
+"""
+Measure the cost of blending subtitles onto software frames (sub/draw_bmp.c).
+
+    TOOLS/osd-blend-bench.py [--mpv=PATH] [SCRIPT.ass]
+
+A generated test pattern (lavfi testsrc2) is decoded for FRAMES frames at each
+size and pixel format in CONFIGS, with --vf=sub rendering the subtitles into the
+video frames and --vo=null discarding them. Each configuration is run once
+without subtitles, and the difference is reported as ms/frame spent on
+subtitle rendering and blending.
+
+If no script is given, a generated one is used: several lines of large text
+moving across the screen (so the overlay changes on every frame), plus a
+static semi-transparent box.
+"""
+
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+FRAMES = 200
+
+CONFIGS = [
+    ("1920x1080", "yuv420p"),
+    ("1920x1080", "rgb24"),
+    ("3840x2160", "yuv420p"),
+    ("3840x2160", "yuv420p10"),
+    ("3840x2160", "rgb24"),
+]
+
+SCRIPT_HEADER = """[Script Info]
+ScriptType: v4.00+
+PlayResX: 1920
+PlayResY: 1080
+
+[V4+ Styles]
+Format: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, Bold, Italic, Underline, StrikeOut, ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, Shadow, Alignment, MarginL, MarginR, MarginV, Encoding
+Style: Default,sans-serif,72,&H00FFFFFF,&H000000FF,&H00000000,&H80000000,0,0,0,0,100,100,0,0,1,4,2,2,40,40,40,1
+
+[Events]
+Format: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text
+"""
+
+
+def generate_script(path):
+    with open(path, "w") as f:
+        f.write(SCRIPT_HEADER)
+        f.write("Dialogue: 0,0:00:00.00,1:00:00.00,Default,,0,0,0,,"
+                "{\\an7\\pos(0,0)\\bord0\\shad0\\1c&H202020&\\1a&H60&"
+                "\\p1}m 0 0 l 1920 0 1920 1080 0 1080{\\p0}\n")
+        for n in range(8):
+            y = 120 + n * 120
+            f.write("Dialogue: 1,0:00:00.00,0:01:00.00,Default,,0,0,0,,"
+                    "{\\an4\\move(-1200,%d,1920,%d)}Subtitle blending benchmark "
+                    "line %d with some more text\n" % (y, y, n))
+
+
+def run(mpv, size, fmt, sub_args):
+    src = "av://lavfi:testsrc2=size=%s:rate=30,format=%s" % (size, fmt)
+    cmd = [mpv, "--no-config", "--really-quiet", "--untimed", "--ao=null",
+           "--vo=null", "--frames=%d" % FRAMES] + sub_args + [src]
+    start = time.monotonic()
+    subprocess.run(cmd, check=True, stdin=subprocess.DEVNULL)
+    return (time.monotonic() - start) * 1e3 / FRAMES
+
+
+def main():
+    args = sys.argv[1:]
+    mpv = "mpv"
+    if args and args[0].startswith("--mpv="):
+        mpv = args.pop(0)[len("--mpv="):]
+    with tempfile.TemporaryDirectory() as tmp:
+        script = args[0] if args else os.path.join(tmp, "bench.ass")
+        if not args:
+            generate_script(script)
+        for size, fmt in CONFIGS:
+            base = run(mpv, size, fmt, ["--sid=no"])
+            subs = run(mpv, size, fmt, ["--sub-file=" + script, "--vf=sub"])
+            print("%-10s %-10s  %7.2f ms/frame (%.2f without subtitles)" %
+                  (size, fmt, subs - base, base))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+
+"""
+Measure the throughput of the storyboard command in files/sec.
+
+    TOOLS/storyboard-bench.py [--mpv=PATH] [--jobs=N] FILES...
+
+This starts an idle mpv instance, and runs the storyboard command on every
+file through the JSON IPC, with up to N commands (default: 1) running in
+parallel. The sprite sheets are written to a temporary directory and deleted
+afterwards.
+"""
+
+import json
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def connect(path, proc):
+    for _ in range(100):
+        try:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(path)
+            return sock
+        except (FileNotFoundError, ConnectionRefusedError):
+            if proc.poll() is not None:
+                sys.exit("mpv exited")
+            time.sleep(0.05)
+    sys.exit("could not connect to mpv")
+
+
+def main():
+    args = sys.argv[1:]
+    mpv = "mpv"
+    jobs = 1
+    while args and args[0].startswith("--"):
+        arg = args.pop(0)
+        if arg.startswith("--mpv="):
+            mpv = arg[len("--mpv="):]
+        elif arg.startswith("--jobs="):
+            jobs = int(arg[len("--jobs="):])
+        else:
+            sys.exit("unknown option " + arg)
+    if not args:
+        sys.exit(__doc__)
+
+    tmpdir = tempfile.mkdtemp(prefix="mpv-storyboard-bench-")
+    sockpath = os.path.join(tmpdir, "socket")
+    proc = subprocess.Popen([mpv, "--no-config", "--idle", "--really-quiet",
+                             "--input-ipc-server=" + sockpath])
+    try:
+        sock = connect(sockpath, proc)
+        reader = sock.makefile("rb")
+        pending = list(enumerate(args))
+        running = 0
+        done = failed = keyframes = 0
+        start = time.monotonic()
+        while pending or running:
+            while pending and running < jobs:
+                n, f = pending.pop(0)
+                out = os.path.join(tmpdir, "%d.jpg" % n)
+                cmd = {"command": {"name": "storyboard", "url": f,
+                                   "filename": out},
+                       "request_id": n, "async": True}
+                sock.sendall((json.dumps(cmd) + "\n").encode())
+                running += 1
+            msg = json.loads(reader.readline())
+            if "request_id" not in msg:
+                continue
+            running -= 1
+            if msg["error"] == "success":
+                done += 1
+                keyframes += msg["data"]["keyframes"]
+            else:
+                failed += 1
+        secs = time.monotonic() - start
+        print("%d files (%d failed) in %.2f s: %.2f files/sec, "
+              "%.1f keyframes/sec" % (done, failed, secs, done / secs,
+                                       keyframes / secs))
+    finally:
+        proc.terminate()
+        proc.wait()
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == "__main__":
+    main()
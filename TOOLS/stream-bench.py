@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+
+"""
+Compare demuxer throughput for the different stream_file read paths.
+
+    TOOLS/stream-bench.py [--mpv=PATH] FILE...
+
+For each file, mpv is run with demux_mkv (only if the file looks like
+Matroska) and demux_lavf, with each of these settings:
+
+ - read():     plain read() calls (the default)
+ - readahead:  --stream-file-readahead=32MiB
+ - mmap:       --stream-file-mmap
+ - mmap+ra:    both of the above
+
+mpv is told to cache the entire file in the demuxer cache, and to quit as soon
+as that is done, so the elapsed time is dominated by stream reading and
+demuxing. The file should be large compared to the stream buffer. Run it once
+to warm the page cache, or drop the page cache before each run (as root:
+echo 3 > /proc/sys/vm/drop_caches) to include disk I/O.
+"""
+
+import os
+import subprocess
+import sys
+import time
+
+RUNS = 3
+
+MODES = [
+    ("read()", []),
+    ("readahead", ["--stream-file-readahead=32MiB"]),
+    ("mmap", ["--stream-file-mmap"]),
+    ("mmap+ra", ["--stream-file-mmap", "--stream-file-readahead=32MiB"]),
+]
+
+
+def run(mpv, path, demuxer, args):
+    size = os.path.getsize(path)
+    cmd = [mpv, "--no-config", "--really-quiet", "--vo=null", "--ao=null",
+           "--demuxer=" + demuxer, "--cache=yes", "--demuxer-cache-wait",
+           "--demuxer-max-bytes=%d" % (size * 2 + (64 << 20)),
+           "--frames=1", "--length=0.1"] + args + ["--", path]
+    best = None
+    for _ in range(RUNS):
+        start = time.monotonic()
+        subprocess.run(cmd, check=True, stdin=subprocess.DEVNULL)
+        elapsed = time.monotonic() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return size / best / (1 << 20)
+
+
+def main():
+    args = sys.argv[1:]
+    mpv = "mpv"
+    if args and args[0].startswith("--mpv="):
+        mpv = args.pop(0)[len("--mpv="):]
+    if not args:
+        sys.exit("usage: stream-bench.py [--mpv=PATH] FILE...")
+    for path in args:
+        demuxers = ["lavf"]
+        if path.lower().endswith((".mkv", ".mka", ".webm")):
+            demuxers.insert(0, "mkv")
+        print(path)
+        for demuxer in demuxers:
+            for name, mode_args in MODES:
+                rate = run(mpv, path, demuxer, mode_args)
+                print("  %-5s %-10s %8.1f MiB/s" % (demuxer, name, rate))
+
+
+if __name__ == "__main__":
+    main()
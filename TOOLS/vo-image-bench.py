@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+
+"""
+Measure frames/sec of --vo=image for each output format.
+
+    TOOLS/vo-image-bench.py [--mpv=PATH] [FILE]
+
+mpv writes FRAMES frames with --untimed into a temporary directory, once with
+a single encoder thread and once with --vo-image-threads=auto. By default, a
+generated test pattern (lavfi testsrc2) is used.
+"""
+
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+FRAMES = 200
+
+FORMATS = [
+    ("jpg", []),
+    ("png", []),
+    ("png fast", ["--vo-image-png-compression=1"]),
+    ("webp", []),
+    ("webp lossless", ["--vo-image-webp-lossless"]),
+    ("jxl", []),
+    ("avif", []),
+]
+
+
+def run(mpv, src, args):
+    outdir = tempfile.mkdtemp(prefix="mpv-vo-image-bench-")
+    try:
+        cmd = [mpv, "--no-config", "--really-quiet", "--untimed", "--ao=null",
+               "--frames=%d" % FRAMES, "--vo=image",
+               "--vo-image-outdir=" + outdir] + args + [src]
+        start = time.monotonic()
+        r = subprocess.run(cmd, stdin=subprocess.DEVNULL,
+                           stdout=subprocess.DEVNULL)
+        if r.returncode:
+            return None
+        return FRAMES / (time.monotonic() - start)
+    finally:
+        shutil.rmtree(outdir)
+
+
+def main():
+    args = sys.argv[1:]
+    mpv = "mpv"
+    if args and args[0].startswith("--mpv="):
+        mpv = args.pop(0)[len("--mpv="):]
+    src = args[0] if args else "av://lavfi:testsrc2=size=1920x1080:rate=60"
+    for name, fmt_args in FORMATS:
+        fmt_args = ["--vo-image-format=" + name.split()[0]] + fmt_args
+        single = run(mpv, src, fmt_args + ["--vo-image-threads=1"])
+        if single is None:
+            print("%-14s  (not supported)" % name)
+            continue
+        multi = run(mpv, src, fmt_args + ["--vo-image-threads=auto"])
+        print("%-14s  1 thread: %7.1f fps   auto: %7.1f fps" %
+              (name, single, multi))
+
+
+if __name__ == "__main__":
+    main()
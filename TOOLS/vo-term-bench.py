@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+
+"""
+Measure frames/sec of the terminal video outputs (tct and kitty).
+
+    TOOLS/vo-term-bench.py [--mpv=PATH] [FILE]
+
+mpv renders FRAMES frames with --untimed and discards the terminal output, so
+the result is the rate at which the VO can produce frames. By default, a
+generated test pattern (lavfi testsrc2) is used, which changes every frame.
+Pass a FILE to benchmark real content instead; the damage tracking of vo_tct
+benefits from content where parts of the image stay static.
+"""
+
+import subprocess
+import sys
+import time
+
+FRAMES = 300
+
+# (columns, rows, pixel width, pixel height) of common terminal sizes
+SIZES = [
+    (80, 25, 640, 400),
+    (160, 50, 1280, 800),
+    (240, 67, 1920, 1072),
+    (480, 135, 3840, 2160),
+]
+
+CONFIGS = [
+    ("tct", ["--vo=tct"]),
+    ("tct 256", ["--vo=tct", "--vo-tct-256"]),
+    ("kitty", ["--vo=kitty"]),
+]
+
+
+def size_args(vo, size):
+    cols, rows, width, height = size
+    if vo.startswith("tct"):
+        return ["--vo-tct-width=%d" % cols, "--vo-tct-height=%d" % rows]
+    return ["--vo-kitty-cols=%d" % cols, "--vo-kitty-rows=%d" % rows,
+            "--vo-kitty-width=%d" % width, "--vo-kitty-height=%d" % height]
+
+
+def run(mpv, src, args):
+    cmd = [mpv, "--no-config", "--really-quiet", "--untimed", "--ao=null",
+           "--frames=%d" % FRAMES, "--profile=sw-fast"] + args + [src]
+    start = time.monotonic()
+    subprocess.run(cmd, check=True, stdin=subprocess.DEVNULL,
+                   stdout=subprocess.DEVNULL)
+    return FRAMES / (time.monotonic() - start)
+
+
+def main():
+    args = sys.argv[1:]
+    mpv = "mpv"
+    if args and args[0].startswith("--mpv="):
+        mpv = args.pop(0)[len("--mpv="):]
+    src = args[0] if args else "av://lavfi:testsrc2=size=1920x1080:rate=60"
+    for name, vo_args in CONFIGS:
+        opt = "--vo-tct-threads" if name.startswith("tct") else "--vo-kitty-threads"
+        for size in SIZES:
+            single = run(mpv, src, vo_args + size_args(name, size) +
+                         [opt + "=1"])
+            multi = run(mpv, src, vo_args + size_args(name, size) +
+                        [opt + "=auto"])
+            print("%-8s %3dx%-3d  1 thread: %7.1f fps   auto: %7.1f fps" %
+                  (name, size[0], size[1], single, multi))
+
+
+if __name__ == "__main__":
+    main()
@@ -1,5 +1,6 @@
 #include <float.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "audio/chmap.h"
 #include "audio/filter/af_scaletempo2_internals.h"
@@ -63,6 +64,152 @@ static void zero_2d_partial(float **a, int x, int y)
     }
 }
 
+// Dot-product of |num_frames| floats of a and b.
+typedef float (*dot_product_fn)(const float *a, const float *b, int num_frames);
+
+#if HAVE_VECTOR
+
+typedef float v8sf __attribute__ ((vector_size (32), aligned (1)));
+
+static float dot_product_c(const float *a, const float *b, int num_frames)
+{
+    float sum = 0.0;
+    if (num_frames < 32)
+        goto rest;
+
+    const v8sf *va = (const v8sf *) a;
+    const v8sf *vb = (const v8sf *) b;
+    v8sf vsum[4] = {
+        // Initialize to product of first 32 floats
+        va[0] * vb[0],
+        va[1] * vb[1],
+        va[2] * vb[2],
+        va[3] * vb[3],
+    };
+    va += 4;
+    vb += 4;
+
+    // Process `va` and `vb` across four vertical stripes
+    for (int n = 1; n < num_frames / 32; n++) {
+        vsum[0] += va[0] * vb[0];
+        vsum[1] += va[1] * vb[1];
+        vsum[2] += va[2] * vb[2];
+        vsum[3] += va[3] * vb[3];
+        va += 4;
+        vb += 4;
+    }
+
+    // Vertical sum across `vsum` entries
+    vsum[0] += vsum[1];
+    vsum[2] += vsum[3];
+    vsum[0] += vsum[2];
+
+    // Horizontal sum across `vsum[0]`, could probably be done better but
+    // this section is not super performance critical
+    float *vf = (float *) &vsum[0];
+    sum = vf[0] + vf[1] + vf[2] + vf[3] + vf[4] + vf[5] + vf[6] + vf[7];
+    a = (const float *) va;
+    b = (const float *) vb;
+
+rest:
+    // Process the remainder
+    for (int n = 0; n < num_frames % 32; n++)
+        sum += *a++ * *b++;
+
+    return sum;
+}
+
+#else // !HAVE_VECTOR
+
+static float dot_product_c(const float *a, const float *b, int num_frames)
+{
+    float sum = 0.0;
+    for (int n = 0; n < num_frames; n++)
+        sum += *a++ * *b++;
+    return sum;
+}
+
+#endif // HAVE_VECTOR
+
+// The generic code above is limited to the baseline instruction set of the
+// target, and can't use fused multiply-add (mpv is built in ISO C mode, which
+// disables FP contraction). Dedicated kernels about double the throughput.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_DOT_PRODUCT_AVX2 1
+
+#include <immintrin.h>
+
+__attribute__((target("avx2,fma")))
+static float dot_product_avx2(const float *a, const float *b, int num_frames)
+{
+    __m256 vsum[4] = {
+        _mm256_setzero_ps(), _mm256_setzero_ps(),
+        _mm256_setzero_ps(), _mm256_setzero_ps(),
+    };
+    int n = 0;
+    for (; n + 32 <= num_frames; n += 32) {
+        for (int i = 0; i < 4; i++) {
+            vsum[i] = _mm256_fmadd_ps(_mm256_loadu_ps(a + n + i * 8),
+                                      _mm256_loadu_ps(b + n + i * 8), vsum[i]);
+        }
+    }
+    __m256 v = _mm256_add_ps(_mm256_add_ps(vsum[0], vsum[1]),
+                             _mm256_add_ps(vsum[2], vsum[3]));
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(v),
+                          _mm256_extractf128_ps(v, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_movehdup_ps(h));
+    float sum = _mm_cvtss_f32(h);
+    for (; n < num_frames; n++)
+        sum += a[n] * b[n];
+    return sum;
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define HAVE_DOT_PRODUCT_NEON 1
+
+#include <arm_neon.h>
+
+static float dot_product_neon(const float *a, const float *b, int num_frames)
+{
+    float32x4_t vsum[4] = {
+        vdupq_n_f32(0), vdupq_n_f32(0), vdupq_n_f32(0), vdupq_n_f32(0),
+    };
+    int n = 0;
+    for (; n + 16 <= num_frames; n += 16) {
+        for (int i = 0; i < 4; i++) {
+            vsum[i] = vfmaq_f32(vsum[i], vld1q_f32(a + n + i * 4),
+                                vld1q_f32(b + n + i * 4));
+        }
+    }
+    float32x4_t v = vaddq_f32(vaddq_f32(vsum[0], vsum[1]),
+                              vaddq_f32(vsum[2], vsum[3]));
+    float sum = vaddvq_f32(v);
+    for (; n < num_frames; n++)
+        sum += a[n] * b[n];
+    return sum;
+}
+
+#endif
+
+static dot_product_fn dot_product = dot_product_c;
+static pthread_once_t dot_product_once = PTHREAD_ONCE_INIT;
+
+static void select_dot_product(void)
+{
+#if HAVE_DOT_PRODUCT_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        dot_product = dot_product_avx2;
+#elif HAVE_DOT_PRODUCT_NEON
+    // NEON is part of the aarch64 baseline.
+    dot_product = dot_product_neon;
+#endif
+}
+
+// Number of independent running sums in multi_channel_moving_block_energies().
+#define ENERGY_CHAINS 4
+
 // Energies of sliding windows of channels are interleaved.
 // The number windows is |input_frames| - (|frames_per_window| - 1), hence,
 // the method assumes |energy| must be, at least, of size
@@ -73,21 +220,33 @@ static void multi_channel_moving_block_energies(
 {
     int num_blocks = input_frames - (frames_per_block - 1);
 
+    // Each energy is computed from the previous one, which is a long chain of
+    // dependent floating point operations. Split the blocks into segments that
+    // start with a directly computed energy, and advance all segments in the
+    // same loop, so that the CPU can overlap them.
+    int seg_len = (num_blocks + ENERGY_CHAINS - 1) / ENERGY_CHAINS;
+    int num_chains = (num_blocks + seg_len - 1) / seg_len;
+    int last_len = num_blocks - (num_chains - 1) * seg_len;
+
     for (int k = 0; k < channels; ++k) {
         const float* input_channel = input[k];
 
-        energy[k] = 0;
-
-        // First block of channel |k|.
-        for (int m = 0; m < frames_per_block; ++m) {
-            energy[k] += input_channel[m] * input_channel[m];
+        float e[ENERGY_CHAINS];
+        for (int c = 0; c < num_chains; ++c) {
+            const float *block = input_channel + c * seg_len;
+            e[c] = dot_product(block, block, frames_per_block);
+            energy[k + c * seg_len * channels] = e[c];
         }
 
-        const float* slide_out = input_channel;
-        const float* slide_in = input_channel + frames_per_block;
-        for (int n = 1; n < num_blocks; ++n, ++slide_in, ++slide_out) {
-            energy[k + n * channels] = energy[k + (n - 1) * channels]
-                - *slide_out * *slide_out + *slide_in * *slide_in;
+        for (int n = 1; n < seg_len; ++n) {
+            int chains = n < last_len ? num_chains : num_chains - 1;
+            for (int c = 0; c < chains; ++c) {
+                int block = c * seg_len + n;
+                const float *slide_out = input_channel + block - 1;
+                const float *slide_in = slide_out + frames_per_block;
+                e[c] = e[c] - *slide_out * *slide_out + *slide_in * *slide_in;
+                energy[k + block * channels] = e[c];
+            }
         }
     }
 }
@@ -106,10 +265,6 @@ static float multi_channel_similarity_measure(
     return similarity_measure;
 }
 
-#if HAVE_VECTOR
-
-typedef float v8sf __attribute__ ((vector_size (32), aligned (1)));
-
 // Dot-product of channels of two AudioBus. For each AudioBus an offset is
 // given. |dot_product[k]| is the dot-product of channel |k|. The caller should
 // allocate sufficient space for |dot_product|.
@@ -117,84 +272,17 @@ static void multi_channel_dot_product(
     float **a, int frame_offset_a,
     float **b, int frame_offset_b,
     int channels,
-    int num_frames, float *dot_product)
+    int num_frames, float *dot_prod)
 {
     assert(frame_offset_a >= 0);
     assert(frame_offset_b >= 0);
 
     for (int k = 0; k < channels; ++k) {
-        const float* ch_a = a[k] + frame_offset_a;
-        const float* ch_b = b[k] + frame_offset_b;
-        float sum = 0.0;
-        if (num_frames < 32)
-            goto rest;
-
-        const v8sf *va = (const v8sf *) ch_a;
-        const v8sf *vb = (const v8sf *) ch_b;
-        v8sf vsum[4] = {
-            // Initialize to product of first 32 floats
-            va[0] * vb[0],
-            va[1] * vb[1],
-            va[2] * vb[2],
-            va[3] * vb[3],
-        };
-        va += 4;
-        vb += 4;
-
-        // Process `va` and `vb` across four vertical stripes
-        for (int n = 1; n < num_frames / 32; n++) {
-            vsum[0] += va[0] * vb[0];
-            vsum[1] += va[1] * vb[1];
-            vsum[2] += va[2] * vb[2];
-            vsum[3] += va[3] * vb[3];
-            va += 4;
-            vb += 4;
-        }
-
-        // Vertical sum across `vsum` entries
-        vsum[0] += vsum[1];
-        vsum[2] += vsum[3];
-        vsum[0] += vsum[2];
-
-        // Horizontal sum across `vsum[0]`, could probably be done better but
-        // this section is not super performance critical
-        float *vf = (float *) &vsum[0];
-        sum = vf[0] + vf[1] + vf[2] + vf[3] + vf[4] + vf[5] + vf[6] + vf[7];
-        ch_a = (const float *) va;
-        ch_b = (const float *) vb;
-
-rest:
-        // Process the remainder
-        for (int n = 0; n < num_frames % 32; n++)
-            sum += *ch_a++ * *ch_b++;
-
-        dot_product[k] = sum;
+        dot_prod[k] = dot_product(a[k] + frame_offset_a,
+                                  b[k] + frame_offset_b, num_frames);
     }
 }
 
-#else // !HAVE_VECTOR
-
-static void multi_channel_dot_product(
-    float **a, int frame_offset_a,
-    float **b, int frame_offset_b,
-    int channels,
-    int num_frames, float *dot_product)
-{
-    assert(frame_offset_a >= 0);
-    assert(frame_offset_b >= 0);
-
-    for (int k = 0; k < channels; ++k) {
-        const float* ch_a = a[k] + frame_offset_a;
-        const float* ch_b = b[k] + frame_offset_b;
-        float sum = 0.0;
-        for (int n = 0; n < num_frames; n++)
-            sum += *ch_a++ * *ch_b++;
-        dot_product[k] = sum;
-    }
-}
-
-#endif // HAVE_VECTOR
-
 // Fit the curve f(x) = a * x^2 + b * x + c such that
 //   f(-1) = y[0]
 //   f(0) = y[1]
@@ -808,6 +896,8 @@ static void get_symmetric_hanning_window(int window_length, float* window)
 
 void mp_scaletempo2_init(struct mp_scaletempo2 *p, int channels, int rate)
 {
+    pthread_once(&dot_product_once, select_dot_product);
+
     p->muted_partial_frame = 0;
     p->output_time = 0;
     p->search_block_index = 0;
@@ -80,6 +80,7 @@ struct ao_opts {
     char *audio_device;
     char *audio_client_name;
     double audio_buffer;
+    bool audio_lookahead;
 };
 
 struct ao *ao_init_best(struct mpv_global *global,
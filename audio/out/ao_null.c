@@ -24,10 +24,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "mpv_talloc.h"
 
+#include "osdep/threads.h"
 #include "osdep/timer.h"
 #include "options/m_option.h"
 #include "common/common.h"
@@ -58,8 +61,23 @@ struct priv {
 
     struct m_channels channel_layouts;
     int format;
+
+    // Pull mode: a thread calls ao_read_data() like an audio API callback.
+    bool pull;
+    pthread_t thread;
+    bool thread_valid;
+    pthread_mutex_t lock;       // held while calling ao_read_data()
+    pthread_cond_t wakeup;
+    bool terminate;             // protected by lock
+    void *pull_buf[MP_NUM_CHANNELS];
+    // Callback statistics, shown on uninit.
+    int64_t num_calls, num_late;
+    int64_t max_call_ns;
 };
 
+static const struct ao_driver audio_out_null_pull;
+static void *pull_thread(void *arg);
+
 static void drain(struct ao *ao)
 {
     struct priv *priv = ao->priv;
@@ -108,6 +126,19 @@ static int init(struct ao *ao)
 
     priv->last_time = mp_time_sec();
 
+    if (priv->pull) {
+        // Same priv and options, but callback based.
+        ao->driver = &audio_out_null_pull;
+        pthread_mutex_init(&priv->lock, NULL);
+        pthread_cond_init(&priv->wakeup, NULL);
+        priv->thread_valid = !pthread_create(&priv->thread, NULL, pull_thread, ao);
+        if (!priv->thread_valid) {
+            pthread_cond_destroy(&priv->wakeup);
+            pthread_mutex_destroy(&priv->lock);
+            return -1;
+        }
+    }
+
     return 0;
 }
 
@@ -196,6 +227,93 @@ static void get_state(struct ao *ao, struct mp_pcm_state *state)
     state->playing = priv->playing && priv->buffered > 0;
 }
 
+static void *pull_thread(void *arg)
+{
+    struct ao *ao = arg;
+    struct priv *priv = ao->priv;
+    mpthread_set_name("ao/null");
+
+    int64_t next = 0;
+    pthread_mutex_lock(&priv->lock);
+    while (!priv->terminate) {
+        if (!priv->playing) {
+            pthread_cond_wait(&priv->wakeup, &priv->lock);
+            next = mp_time_ns();
+            continue;
+        }
+
+        // Wait for the end of the current period, like a device would.
+        double period = priv->outburst / (ao->samplerate * priv->speed);
+        int64_t now = mp_time_ns();
+        if (now < next) {
+            double wait = MP_TIME_NS_TO_S(next - now);
+            struct timespec ts = mp_rel_time_to_timespec(wait);
+            pthread_cond_timedwait(&priv->wakeup, &priv->lock, &ts);
+            continue;
+        }
+        int64_t deadline = next + MP_TIME_S_TO_NS(period);
+        next = ao->untimed ? now : MPMAX(deadline, now);
+
+        if (!priv->pull_buf[0]) {
+            for (int n = 0; n < ao->num_planes; n++)
+                priv->pull_buf[n] = talloc_size(ao, priv->outburst * ao->sstride);
+        }
+
+        int64_t out_time = now + MP_TIME_S_TO_NS(period + priv->latency_sec);
+        int got = ao_read_data(ao, priv->pull_buf, priv->outburst, out_time);
+
+        int64_t end = mp_time_ns();
+        priv->num_calls++;
+        priv->max_call_ns = MPMAX(priv->max_call_ns, end - now);
+        // The device would have played silence if the data arrived after the
+        // previous period ended.
+        if (!ao->untimed && end > deadline)
+            priv->num_late++;
+        // Don't busy loop with untimed if there's nothing to play.
+        if (ao->untimed && got < priv->outburst)
+            next = end + MP_TIME_S_TO_NS(period);
+    }
+    pthread_mutex_unlock(&priv->lock);
+    return NULL;
+}
+
+static void pull_uninit(struct ao *ao)
+{
+    struct priv *priv = ao->priv;
+
+    pthread_mutex_lock(&priv->lock);
+    priv->terminate = true;
+    pthread_cond_signal(&priv->wakeup);
+    pthread_mutex_unlock(&priv->lock);
+    pthread_join(priv->thread, NULL);
+    pthread_cond_destroy(&priv->wakeup);
+    pthread_mutex_destroy(&priv->lock);
+
+    MP_VERBOSE(ao, "%"PRId64" callbacks, %"PRId64" late, max. %.3f ms\n",
+               priv->num_calls, priv->num_late,
+               MP_TIME_NS_TO_MS(priv->max_call_ns));
+}
+
+// Wait until a running ao_read_data() call returned.
+static void pull_reset(struct ao *ao)
+{
+    struct priv *priv = ao->priv;
+
+    pthread_mutex_lock(&priv->lock);
+    priv->playing = false;
+    pthread_mutex_unlock(&priv->lock);
+}
+
+static void pull_start(struct ao *ao)
+{
+    struct priv *priv = ao->priv;
+
+    pthread_mutex_lock(&priv->lock);
+    priv->playing = true;
+    pthread_cond_signal(&priv->wakeup);
+    pthread_mutex_unlock(&priv->lock);
+}
+
 #define OPT_BASE_STRUCT struct priv
 
 const struct ao_driver audio_out_null = {
@@ -224,7 +342,17 @@ const struct ao_driver audio_out_null = {
         {"broken-delay", OPT_BOOL(broken_delay)},
         {"channel-layouts", OPT_CHANNELS(channel_layouts)},
         {"format", OPT_AUDIOFORMAT(format)},
+        {"pull", OPT_BOOL(pull)},
         {0}
     },
     .options_prefix = "ao-null",
 };
+
+// Selected by init() with --ao-null-pull.
+static const struct ao_driver audio_out_null_pull = {
+    .description = "Null audio output (pull mode)",
+    .name      = "null",
+    .uninit    = pull_uninit,
+    .reset     = pull_reset,
+    .start     = pull_start,
+};
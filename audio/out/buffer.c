@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <inttypes.h>
 #include <math.h>
 #include <unistd.h>
@@ -30,10 +31,13 @@
 
 #include "common/msg.h"
 #include "common/common.h"
+#include "common/stats.h"
 
 #include "filters/f_async_queue.h"
 #include "filters/filter_internal.h"
 
+#include "misc/ring.h"
+
 #include "osdep/timer.h"
 #include "osdep/threads.h"
 
@@ -51,6 +55,17 @@ struct buffer_state {
 
     // Immutable.
     struct mp_async_queue *queue;
+    struct stats_ctx *stats;
+
+    // Pull AOs with --audio-lookahead only: the playthread moves audio from
+    // the queue to the ring, and ao_read_data() reads from the ring without
+    // taking any locks. The rt_ fields are the state ao_read_data() uses.
+    struct mp_ring *ring;
+    atomic_bool rt_active;          // playing && !paused
+    atomic_uint rt_short_reads;     // ao_read_data() calls missing data
+    _Atomic int64_t rt_max_call_ns; // longest ao_read_data() since last check
+
+    _Atomic int64_t end_time_ns;    // absolute output time of last played sample
 
     // --- protected by lock
 
@@ -62,10 +77,14 @@ struct buffer_state {
     bool playing;               // logically playing audio from buffer
     bool paused;                // logically paused
 
-    int64_t end_time_ns;        // absolute output time of last played sample
-
     bool initial_unblocked;
 
+    // Pull AOs with lookahead only.
+    unsigned short_reads_seen;  // last seen value of rt_short_reads
+    int64_t num_xruns;          // underruns with more audio in the queue
+    int64_t max_call_ns;        // longest ao_read_data() in stats interval
+    int64_t stats_time_ns;      // start of stats interval
+
     // "Push" AOs only (AOs with driver->write).
     bool hw_paused;             // driver->set_pause() was used successfully
     bool recover_pause;         // non-hw_paused: needs to recover delay
@@ -114,6 +133,37 @@ struct mp_async_queue *ao_get_queue(struct ao *ao)
     return p->queue;
 }
 
+// called locked
+// Make p->pending contain audio. Return false if there's none available now.
+static bool get_pending(struct ao *ao, bool *eof)
+{
+    struct buffer_state *p = ao->buffer_state;
+
+    while (!p->pending || !mp_aframe_get_size(p->pending)) {
+        TA_FREEP(&p->pending);
+        struct mp_frame frame = mp_pin_out_read(p->input->pins[0]);
+        if (!frame.type)
+            return false; // we can't/don't want to block
+        if (frame.type != MP_FRAME_AUDIO) {
+            if (frame.type == MP_FRAME_EOF)
+                *eof = true;
+            mp_frame_unref(&frame);
+            continue;
+        }
+        p->pending = frame.data;
+    }
+    return true;
+}
+
+// called locked
+static void update_rt_state(struct ao *ao)
+{
+    struct buffer_state *p = ao->buffer_state;
+
+    if (p->ring)
+        atomic_store(&p->rt_active, p->playing && !p->paused);
+}
+
 // Special behavior with data==NULL: caller uses p->pending.
 static int read_buffer(struct ao *ao, void **data, int samples, bool *eof)
 {
@@ -122,19 +172,8 @@ static int read_buffer(struct ao *ao, void **data, int samples, bool *eof)
     *eof = false;
 
     while (p->playing && !p->paused && pos < samples) {
-        if (!p->pending || !mp_aframe_get_size(p->pending)) {
-            TA_FREEP(&p->pending);
-            struct mp_frame frame = mp_pin_out_read(p->input->pins[0]);
-            if (!frame.type)
-                break; // we can't/don't want to block
-            if (frame.type != MP_FRAME_AUDIO) {
-                if (frame.type == MP_FRAME_EOF)
-                    *eof = true;
-                mp_frame_unref(&frame);
-                continue;
-            }
-            p->pending = frame.data;
-        }
+        if (!get_pending(ao, eof))
+            break;
 
         if (!data)
             break;
@@ -171,6 +210,82 @@ static int read_buffer(struct ao *ao, void **data, int samples, bool *eof)
     return pos;
 }
 
+// ao_read_data() with lookahead. This must not take any locks or wait.
+static int read_ring(struct ao *ao, void **data, int samples,
+                     int64_t out_time_ns)
+{
+    struct buffer_state *p = ao->buffer_state;
+    int64_t start = mp_time_ns();
+
+    bool active = atomic_load(&p->rt_active);
+    int pos = 0;
+    if (active)
+        pos = mp_ring_read(p->ring, data, samples * ao->sstride) / ao->sstride;
+
+    for (int n = 0; n < ao->num_planes; n++) {
+        af_fill_silence((char *)data[n] + pos * ao->sstride,
+                        (samples - pos) * ao->sstride,
+                        ao->format);
+    }
+    ao_post_process_data(ao, data, pos);
+
+    if (pos > 0)
+        atomic_store(&p->end_time_ns, out_time_ns);
+
+    // The playthread decides whether this was an underrun or EOF.
+    if (active && pos < samples)
+        atomic_fetch_add(&p->rt_short_reads, 1);
+
+    // Racing with the playthread resetting it is harmless.
+    int64_t duration = mp_time_ns() - start;
+    if (duration > atomic_load(&p->rt_max_call_ns))
+        atomic_store(&p->rt_max_call_ns, duration);
+
+    return pos;
+}
+
+// called locked
+// Move audio from the queue to the lookahead ring, and handle underruns and
+// EOF reported by read_ring().
+static void fill_ring(struct ao *ao)
+{
+    struct buffer_state *p = ao->buffer_state;
+    bool got_data = false;
+
+    while (p->playing && !p->paused) {
+        int space = mp_ring_available(p->ring) / ao->sstride;
+        if (!space || !get_pending(ao, &(bool){0}))
+            break;
+        int copy = MPMIN(space, mp_aframe_get_size(p->pending));
+        void **fdata = (void **)mp_aframe_get_data_ro(p->pending);
+        mp_ring_write(p->ring, fdata, copy * ao->sstride);
+        mp_aframe_skip_samples(p->pending, copy);
+        got_data = true;
+    }
+
+    unsigned short_reads = atomic_load(&p->rt_short_reads);
+    if (short_reads == p->short_reads_seen)
+        return;
+    p->short_reads_seen = short_reads;
+
+    if (!p->playing || p->paused)
+        return;
+
+    if (got_data || mp_ring_buffered(p->ring)) {
+        // More audio was available, but we were too slow to provide it.
+        p->num_xruns++;
+        MP_VERBOSE(ao, "lookahead underrun\n");
+        return;
+    }
+
+    // Same as ao_read_data() without lookahead.
+    p->playing = false;
+    update_rt_state(ao);
+    ao->wakeup_cb(ao->wakeup_ctx);
+    // For ao_drain().
+    pthread_cond_broadcast(&p->wakeup);
+}
+
 // Read the given amount of samples in the user-provided data buffer. Returns
 // the number of samples copied. If there is not enough data (buffer underrun
 // or EOF), return the number of samples that could be copied, and fill the
@@ -184,12 +299,15 @@ int ao_read_data(struct ao *ao, void **data, int samples, int64_t out_time_ns)
     struct buffer_state *p = ao->buffer_state;
     assert(!ao->driver->write);
 
+    if (p->ring)
+        return read_ring(ao, data, samples, out_time_ns);
+
     pthread_mutex_lock(&p->lock);
 
     int pos = read_buffer(ao, data, samples, &(bool){0});
 
     if (pos > 0)
-        p->end_time_ns = out_time_ns;
+        atomic_store(&p->end_time_ns, out_time_ns);
 
     if (pos < samples && p->playing && !p->paused) {
         p->playing = false;
@@ -270,7 +388,7 @@ double ao_get_delay(struct ao *ao)
         get_dev_state(ao, &state);
         driver_delay = state.delay;
     } else {
-        int64_t end = p->end_time_ns;
+        int64_t end = atomic_load(&p->end_time_ns);
         int64_t now = mp_time_ns();
         driver_delay = MPMAX(0, MP_TIME_NS_TO_S(end - now));
     }
@@ -278,6 +396,8 @@ double ao_get_delay(struct ao *ao)
     int pending = mp_async_queue_get_samples(p->queue);
     if (p->pending)
         pending += mp_aframe_get_size(p->pending);
+    if (p->ring)
+        pending += mp_ring_buffered(p->ring) / ao->sstride;
 
     pthread_mutex_unlock(&p->lock);
     return driver_delay + pending / (double)ao->samplerate;
@@ -296,6 +416,8 @@ void ao_reset(struct ao *ao)
     mp_async_queue_reset(p->queue);
     mp_filter_reset(p->filter_root);
     mp_async_queue_resume_reading(p->queue);
+    if (p->ring)
+        mp_ring_discard(p->ring);
 
     if (!ao->stream_silence && ao->driver->reset) {
         if (ao->driver->write) {
@@ -311,7 +433,8 @@ void ao_reset(struct ao *ao)
     p->playing = false;
     p->recover_pause = false;
     p->hw_paused = false;
-    p->end_time_ns = 0;
+    atomic_store(&p->end_time_ns, 0);
+    update_rt_state(ao);
 
     pthread_mutex_unlock(&p->lock);
 
@@ -340,6 +463,13 @@ void ao_start(struct ao *ao)
         do_start = true;
     }
 
+    if (p->ring) {
+        // Prefill, so that the first callback doesn't underrun.
+        p->short_reads_seen = atomic_load(&p->rt_short_reads);
+        fill_ring(ao);
+        update_rt_state(ao);
+    }
+
     pthread_mutex_unlock(&p->lock);
 
     // Pull AOs might call ao_read_data() so do this outside the lock.
@@ -394,6 +524,7 @@ void ao_set_paused(struct ao *ao, bool paused, bool eof)
         wakeup = true;
     }
     p->paused = paused;
+    update_rt_state(ao);
 
     pthread_mutex_unlock(&p->lock);
 
@@ -528,7 +659,18 @@ bool init_buffer_post(struct ao *ao)
     };
     mp_async_queue_set_config(p->queue, cfg);
 
-    if (ao->driver->write) {
+    p->stats = stats_ctx_create(p, ao->global, "ao");
+
+    if (!ao->driver->write && ao->lookahead) {
+        // Must cover the playthread wakeup interval (1/4 of it) and a device
+        // period. Drivers don't always set device_buffer in pull mode.
+        int samples = MPMAX(ao->device_buffer * 2, ao->samplerate / 10);
+        p->ring = mp_ring_new(p, ao->num_planes, samples * ao->sstride);
+        MP_VERBOSE(ao, "using lookahead of %d samples.\n",
+                   mp_ring_size(p->ring) / ao->sstride);
+    }
+
+    if (ao->driver->write || p->ring) {
         mp_filter_graph_set_wakeup_cb(p->filter_root, wakeup_filters, ao);
 
         p->thread_valid = true;
@@ -536,11 +678,11 @@ bool init_buffer_post(struct ao *ao)
             p->thread_valid = false;
             return false;
         }
-    } else {
-        if (ao->stream_silence) {
-            ao->driver->start(ao);
-            p->streaming = true;
-        }
+    }
+
+    if (!ao->driver->write && ao->stream_silence) {
+        ao->driver->start(ao);
+        p->streaming = true;
     }
 
     if (ao->stream_silence) {
@@ -655,22 +797,58 @@ eof:
     return true;
 }
 
+// called locked
+static void update_ring_stats(struct ao *ao)
+{
+    struct buffer_state *p = ao->buffer_state;
+
+    int64_t now = mp_time_ns();
+    p->max_call_ns = MPMAX(p->max_call_ns,
+                           atomic_exchange(&p->rt_max_call_ns, 0));
+    if (now - p->stats_time_ns >= MP_TIME_S_TO_NS(1)) {
+        stats_value(p->stats, "callback-max-ms",
+                    MP_TIME_NS_TO_MS(p->max_call_ns));
+        p->max_call_ns = 0;
+        p->stats_time_ns = now;
+    }
+
+    double lookahead = mp_ring_buffered(p->ring) / (double)ao->bps;
+    stats_value(p->stats, "lookahead-ms", lookahead * 1e3);
+    stats_value(p->stats, "xruns", p->num_xruns);
+}
+
 static void *playthread(void *arg)
 {
     struct ao *ao = arg;
     struct buffer_state *p = ao->buffer_state;
     mpthread_set_name("ao");
+    stats_register_thread_cputime(p->stats, "thread");
     while (1) {
         pthread_mutex_lock(&p->lock);
 
         bool retry = false;
-        if (!ao->driver->initially_blocked || p->initial_unblocked)
+        if (p->ring) {
+            fill_ring(ao);
+            update_ring_stats(ao);
+        } else if (!ao->driver->initially_blocked || p->initial_unblocked) {
             retry = ao_play_data(ao);
+        }
 
         // Wait until the device wants us to write more data to it.
         // Fallback to guessing.
         double timeout = INFINITY;
-        if (p->streaming && !retry && (!p->paused || ao->stream_silence)) {
+        if (p->ring) {
+            // Refill when a quarter of the ring has been played, or when it
+            // could have run empty (so EOF is noticed quickly). New data in
+            // the queue wakes us up as well.
+            if (p->playing && !p->paused) {
+                double size = mp_ring_size(p->ring) / (double)ao->bps;
+                double left = mp_ring_buffered(p->ring) / (double)ao->bps;
+                timeout = MPCLAMP(left, 0.005, size * 0.25);
+            }
+        } else if (p->streaming && !retry &&
+                   (!p->paused || ao->stream_silence))
+        {
             // Wake up again if half of the audio buffer has been played.
             // Since audio could play at a faster or slower pace, wake up twice
             // as often as ideally needed.
@@ -693,6 +871,7 @@ static void *playthread(void *arg)
         p->need_wakeup = false;
         pthread_mutex_unlock(&p->pt_lock);
     }
+    stats_unregister_thread(p->stats, "thread");
     return NULL;
 }
 
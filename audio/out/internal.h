@@ -67,6 +67,7 @@ struct ao {
 
     int buffer;
     double def_buffer;
+    bool lookahead;             // pull AOs: use lock-free ring (see buffer.c)
     struct buffer_state *buffer_state;
 };
 
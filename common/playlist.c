@@ -27,12 +27,24 @@
 #include "demux/demux.h"
 #include "stream/stream.h"
 
+// Maximum number of entries per chunk. Editing the playlist is O(CHUNK_SIZE)
+// for the affected chunk, plus O(num_chunks) to update the chunk positions.
+#define CHUNK_SIZE 512
+
+struct playlist_chunk {
+    struct playlist_entry *entries[CHUNK_SIZE];
+    int num_entries;
+    int index;  // in playlist.chunks
+    int start;  // playlist index of entries[0] (see playlist.num_valid_starts)
+};
+
 struct playlist_entry *playlist_entry_new(const char *filename)
 {
     struct playlist_entry *e = talloc_zero(NULL, struct playlist_entry);
     char *local_filename = mp_file_url_to_filename(e, bstr0(filename));
     e->filename = local_filename ? local_filename : talloc_strdup(e, filename);
     e->stream_flags = STREAM_ORIGIN_DIRECT;
+    e->pl_chunk_index = -1;
     e->original_index = -1;
     return e;
 }
@@ -51,21 +63,190 @@ void playlist_entry_add_params(struct playlist_entry *e,
         playlist_entry_add_param(e, params[n].name, params[n].value);
 }
 
-static void playlist_update_indexes(struct playlist *pl, int start, int end)
+// Make sure chunk starts are recomputed from chunk_index on.
+static void invalidate_starts(struct playlist *pl, int chunk_index)
+{
+    pl->num_valid_starts = MPMIN(pl->num_valid_starts, chunk_index);
+}
+
+static int get_chunk_start(struct playlist *pl, struct playlist_chunk *c)
 {
-    start = MPMAX(start, 0);
-    end = end < 0 ? pl->num_entries : MPMIN(end, pl->num_entries);
+    while (pl->num_valid_starts <= c->index) {
+        int n = pl->num_valid_starts++;
+        struct playlist_chunk *prev = n > 0 ? pl->chunks[n - 1] : NULL;
+        pl->chunks[n]->start = prev ? prev->start + prev->num_entries : 0;
+    }
+    return c->start;
+}
+
+static void update_chunk_indexes(struct playlist *pl, int start)
+{
+    for (int n = start; n < pl->num_chunks; n++)
+        pl->chunks[n]->index = n;
+    invalidate_starts(pl, start);
+}
 
-    for (int n = start; n < end; n++)
-        pl->entries[n]->pl_index = n;
+static void update_entry_indexes(struct playlist_chunk *c, int start)
+{
+    for (int n = start; n < c->num_entries; n++) {
+        c->entries[n]->pl_chunk = c;
+        c->entries[n]->pl_chunk_index = n;
+    }
+}
+
+static struct playlist_chunk *insert_chunk(struct playlist *pl, int index)
+{
+    struct playlist_chunk *c = talloc_zero(pl, struct playlist_chunk);
+    MP_TARRAY_INSERT_AT(pl, pl->chunks, pl->num_chunks, index, c);
+    update_chunk_indexes(pl, index);
+    return c;
+}
+
+static void remove_chunk(struct playlist *pl, struct playlist_chunk *c)
+{
+    int index = c->index;
+    MP_TARRAY_REMOVE_AT(pl->chunks, pl->num_chunks, index);
+    talloc_free(c);
+    update_chunk_indexes(pl, index);
+}
+
+// Move the entries starting at offset to a new chunk following c.
+static struct playlist_chunk *split_chunk(struct playlist *pl,
+                                          struct playlist_chunk *c, int offset)
+{
+    struct playlist_chunk *new = insert_chunk(pl, c->index + 1);
+    new->num_entries = c->num_entries - offset;
+    memcpy(new->entries, c->entries + offset,
+           new->num_entries * sizeof(new->entries[0]));
+    c->num_entries = offset;
+    update_entry_indexes(new, 0);
+    return new;
+}
+
+// Append the entries of the chunk following c to c, if they fit into max.
+static void merge_next_chunk(struct playlist *pl, struct playlist_chunk *c,
+                             int max)
+{
+    if (c->index + 1 >= pl->num_chunks)
+        return;
+    struct playlist_chunk *next = pl->chunks[c->index + 1];
+    if (c->num_entries + next->num_entries > max)
+        return;
+    int offset = c->num_entries;
+    memcpy(c->entries + offset, next->entries,
+           next->num_entries * sizeof(c->entries[0]));
+    c->num_entries += next->num_entries;
+    update_entry_indexes(c, offset);
+    remove_chunk(pl, next);
+}
+
+// Return the chunk containing the entry with the given playlist index, and
+// the entry's offset within it. index==num_entries returns the position after
+// the last entry. Returns NULL if the playlist is empty.
+static struct playlist_chunk *find_chunk(struct playlist *pl, int index,
+                                         int *offset)
+{
+    assert(index >= 0 && index <= pl->num_entries);
+    if (!pl->num_chunks)
+        return NULL;
+    get_chunk_start(pl, pl->chunks[pl->num_chunks - 1]);
+    // Chunks are never empty, so the starts are strictly increasing.
+    int lo = 0, hi = pl->num_chunks - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (pl->chunks[mid]->start <= index) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    struct playlist_chunk *c = pl->chunks[lo];
+    *offset = index - c->start;
+    return c;
+}
+
+static void insert_entry_at(struct playlist *pl, int index,
+                            struct playlist_entry *e)
+{
+    int offset = 0;
+    struct playlist_chunk *c = find_chunk(pl, index, &offset);
+    if (!c)
+        c = insert_chunk(pl, 0);
+    if (c->num_entries == CHUNK_SIZE) {
+        // Appending to the end of a full chunk starts a new one, so that
+        // building a playlist by appending doesn't leave half-empty chunks.
+        int split = offset == CHUNK_SIZE ? offset : CHUNK_SIZE / 2;
+        struct playlist_chunk *new = split_chunk(pl, c, split);
+        if (offset >= split) {
+            offset -= split;
+            c = new;
+        }
+    }
+    memmove(c->entries + offset + 1, c->entries + offset,
+            (c->num_entries - offset) * sizeof(c->entries[0]));
+    c->entries[offset] = e;
+    c->num_entries++;
+    update_entry_indexes(c, offset);
+    invalidate_starts(pl, c->index + 1);
+    pl->num_entries++;
+    e->pl = pl;
+}
+
+static void remove_entry(struct playlist *pl, struct playlist_entry *e)
+{
+    struct playlist_chunk *c = e->pl_chunk;
+    int offset = e->pl_chunk_index;
+    assert(c->entries[offset] == e);
+    MP_TARRAY_REMOVE_AT(c->entries, c->num_entries, offset);
+    update_entry_indexes(c, offset);
+    invalidate_starts(pl, c->index + 1);
+    pl->num_entries--;
+    if (!c->num_entries) {
+        remove_chunk(pl, c);
+    } else {
+        // Don't merge up to the full size, or alternating insertions and
+        // removals at a chunk boundary would split and merge every time.
+        merge_next_chunk(pl, c, CHUNK_SIZE / 2);
+    }
+    e->pl = NULL;
+    e->pl_chunk = NULL;
+    e->pl_chunk_index = -1;
+}
+
+// Return all entries in playlist order as a flat array allocated on ta_ctx.
+static struct playlist_entry **get_entries(struct playlist *pl, void *ta_ctx)
+{
+    struct playlist_entry **entries =
+        talloc_array(ta_ctx, struct playlist_entry *, pl->num_entries);
+    int num = 0;
+    for (int n = 0; n < pl->num_chunks; n++) {
+        struct playlist_chunk *c = pl->chunks[n];
+        memcpy(entries + num, c->entries, c->num_entries * sizeof(entries[0]));
+        num += c->num_entries;
+    }
+    assert(num == pl->num_entries);
+    return entries;
+}
+
+// Replace the playlist order with the given permutation of its entries.
+static void set_entries(struct playlist *pl, struct playlist_entry **entries)
+{
+    int num = pl->num_entries;
+    for (int n = 0; n < pl->num_chunks; n++)
+        talloc_free(pl->chunks[n]);
+    pl->num_chunks = 0;
+    for (int n = 0; n < num; n += CHUNK_SIZE) {
+        struct playlist_chunk *c = insert_chunk(pl, pl->num_chunks);
+        c->num_entries = MPMIN(num - n, CHUNK_SIZE);
+        memcpy(c->entries, entries + n, c->num_entries * sizeof(entries[0]));
+        update_entry_indexes(c, 0);
+    }
 }
 
 void playlist_add(struct playlist *pl, struct playlist_entry *add)
 {
     assert(add->filename);
-    MP_TARRAY_APPEND(pl, pl->entries, pl->num_entries, add);
-    add->pl = pl;
-    add->pl_index = pl->num_entries - 1;
+    insert_entry_at(pl, pl->num_entries, add);
     add->id = ++pl->id_alloc;
     talloc_steal(pl, add);
 }
@@ -88,11 +269,7 @@ void playlist_remove(struct playlist *pl, struct playlist_entry *entry)
         pl->current_was_replaced = true;
     }
 
-    MP_TARRAY_REMOVE_AT(pl->entries, pl->num_entries, entry->pl_index);
-    playlist_update_indexes(pl, entry->pl_index, -1);
-
-    entry->pl = NULL;
-    entry->pl_index = -1;
+    remove_entry(pl, entry);
     ta_set_parent(entry, NULL);
 
     entry->removed = true;
@@ -101,17 +278,20 @@ void playlist_remove(struct playlist *pl, struct playlist_entry *entry)
 
 void playlist_clear(struct playlist *pl)
 {
-    for (int n = pl->num_entries - 1; n >= 0; n--)
-        playlist_remove(pl, pl->entries[n]);
+    while (pl->num_entries)
+        playlist_remove(pl, playlist_get_last(pl));
     assert(!pl->current);
     pl->current_was_replaced = false;
 }
 
 void playlist_clear_except_current(struct playlist *pl)
 {
-    for (int n = pl->num_entries - 1; n >= 0; n--) {
-        if (pl->entries[n] != pl->current)
-            playlist_remove(pl, pl->entries[n]);
+    struct playlist_entry *e = playlist_get_last(pl);
+    while (e) {
+        struct playlist_entry *prev = playlist_entry_get_rel(e, -1);
+        if (e != pl->current)
+            playlist_remove(pl, e);
+        e = prev;
     }
 }
 
@@ -125,16 +305,9 @@ void playlist_move(struct playlist *pl, struct playlist_entry *entry,
     assert(entry && entry->pl == pl);
     assert(!at || at->pl == pl);
 
-    int index = at ? at->pl_index : pl->num_entries;
-    MP_TARRAY_INSERT_AT(pl, pl->entries, pl->num_entries, index, entry);
-
-    int old_index = entry->pl_index;
-    if (old_index >= index)
-        old_index += 1;
-    MP_TARRAY_REMOVE_AT(pl->entries, pl->num_entries, old_index);
-
-    playlist_update_indexes(pl, MPMIN(index - 1, old_index - 1),
-                                MPMAX(index + 1, old_index + 1));
+    remove_entry(pl, entry);
+    insert_entry_at(pl, at ? playlist_entry_to_index(pl, at) : pl->num_entries,
+                    entry);
 }
 
 void playlist_add_file(struct playlist *pl, const char *filename)
@@ -144,52 +317,73 @@ void playlist_add_file(struct playlist *pl, const char *filename)
 
 void playlist_populate_playlist_path(struct playlist *pl, const char *path)
 {
-    for (int n = 0; n < pl->num_entries; n++) {
-        struct playlist_entry *e = pl->entries[n];
+    for (struct playlist_entry *e = playlist_get_first(pl); e;
+         e = playlist_entry_get_rel(e, 1))
         e->playlist_path = talloc_strdup(e, path);
-    }
 }
 
 void playlist_shuffle(struct playlist *pl)
 {
+    void *tmp = talloc_new(NULL);
+    struct playlist_entry **entries = get_entries(pl, tmp);
     for (int n = 0; n < pl->num_entries; n++)
-        pl->entries[n]->original_index = n;
+        entries[n]->original_index = n;
     for (int n = 0; n < pl->num_entries - 1; n++) {
         size_t j = (size_t)((pl->num_entries - n) * mp_rand_next_double());
-        MPSWAP(struct playlist_entry *, pl->entries[n], pl->entries[n + j]);
+        MPSWAP(struct playlist_entry *, entries[n], entries[n + j]);
     }
-    playlist_update_indexes(pl, 0, -1);
+    set_entries(pl, entries);
+    talloc_free(tmp);
 }
 
 #define CMP_INT(a, b) ((a) == (b) ? 0 : ((a) > (b) ? 1 : -1))
 
+struct unshuffle_item {
+    struct playlist_entry *e;
+    int index;
+};
+
 static int cmp_unshuffle(const void *a, const void *b)
 {
-    struct playlist_entry *ea = *(struct playlist_entry **)a;
-    struct playlist_entry *eb = *(struct playlist_entry **)b;
+    const struct unshuffle_item *ia = a;
+    const struct unshuffle_item *ib = b;
 
-    if (ea->original_index >= 0 && ea->original_index != eb->original_index)
-        return CMP_INT(ea->original_index, eb->original_index);
-    return CMP_INT(ea->pl_index, eb->pl_index);
+    if (ia->e->original_index >= 0 &&
+        ia->e->original_index != ib->e->original_index)
+        return CMP_INT(ia->e->original_index, ib->e->original_index);
+    return CMP_INT(ia->index, ib->index);
 }
 
 void playlist_unshuffle(struct playlist *pl)
 {
-    if (pl->num_entries)
-        qsort(pl->entries, pl->num_entries, sizeof(pl->entries[0]), cmp_unshuffle);
-    playlist_update_indexes(pl, 0, -1);
+    if (!pl->num_entries)
+        return;
+    void *tmp = talloc_new(NULL);
+    struct playlist_entry **entries = get_entries(pl, tmp);
+    struct unshuffle_item *items =
+        talloc_array(tmp, struct unshuffle_item, pl->num_entries);
+    for (int n = 0; n < pl->num_entries; n++)
+        items[n] = (struct unshuffle_item){entries[n], n};
+    qsort(items, pl->num_entries, sizeof(items[0]), cmp_unshuffle);
+    for (int n = 0; n < pl->num_entries; n++)
+        entries[n] = items[n].e;
+    set_entries(pl, entries);
+    talloc_free(tmp);
 }
 
 // (Explicitly ignores current_was_replaced.)
 struct playlist_entry *playlist_get_first(struct playlist *pl)
 {
-    return pl->num_entries ? pl->entries[0] : NULL;
+    return pl->num_chunks ? pl->chunks[0]->entries[0] : NULL;
 }
 
 // (Explicitly ignores current_was_replaced.)
 struct playlist_entry *playlist_get_last(struct playlist *pl)
 {
-    return pl->num_entries ? pl->entries[pl->num_entries - 1] : NULL;
+    if (!pl->num_chunks)
+        return NULL;
+    struct playlist_chunk *c = pl->chunks[pl->num_chunks - 1];
+    return c->entries[c->num_entries - 1];
 }
 
 struct playlist_entry *playlist_get_next(struct playlist *pl, int direction)
@@ -209,9 +403,23 @@ struct playlist_entry *playlist_entry_get_rel(struct playlist_entry *e,
                                               int direction)
 {
     assert(direction == -1 || direction == +1);
-    if (!e->pl)
+    struct playlist *pl = e->pl;
+    if (!pl)
         return NULL;
-    return playlist_entry_from_index(e->pl, e->pl_index + direction);
+    struct playlist_chunk *c = e->pl_chunk;
+    int offset = e->pl_chunk_index + direction;
+    if (offset < 0) {
+        if (c->index == 0)
+            return NULL;
+        c = pl->chunks[c->index - 1];
+        offset = c->num_entries - 1;
+    } else if (offset >= c->num_entries) {
+        if (c->index + 1 >= pl->num_chunks)
+            return NULL;
+        c = pl->chunks[c->index + 1];
+        offset = 0;
+    }
+    return c->entries[offset];
 }
 
 struct playlist_entry *playlist_get_first_in_next_playlist(struct playlist *pl,
@@ -286,8 +494,9 @@ void playlist_add_base_path(struct playlist *pl, bstr base_path)
 {
     if (base_path.len == 0 || bstrcmp0(base_path, ".") == 0)
         return;
-    for (int n = 0; n < pl->num_entries; n++) {
-        struct playlist_entry *e = pl->entries[n];
+    for (struct playlist_entry *e = playlist_get_first(pl); e;
+         e = playlist_entry_get_rel(e, 1))
+    {
         if (!mp_is_url(bstr0(e->filename))) {
             char *new_file = mp_path_join_bstr(e, base_path, bstr0(e->filename));
             talloc_free(e->filename);
@@ -298,8 +507,9 @@ void playlist_add_base_path(struct playlist *pl, bstr base_path)
 
 void playlist_set_stream_flags(struct playlist *pl, int flags)
 {
-    for (int n = 0; n < pl->num_entries; n++)
-        pl->entries[n]->stream_flags = flags;
+    for (struct playlist_entry *e = playlist_get_first(pl); e;
+         e = playlist_entry_get_rel(e, 1))
+        e->stream_flags = flags;
 }
 
 static int64_t playlist_transfer_entries_to(struct playlist *pl, int dst_index,
@@ -307,23 +517,46 @@ static int64_t playlist_transfer_entries_to(struct playlist *pl, int dst_index,
 {
     assert(pl != source_pl);
     struct playlist_entry *first = playlist_get_first(source_pl);
+    if (!first)
+        return 0;
+
+    // Split the chunk at the destination, and move the source chunks as a
+    // whole in between, instead of inserting every entry separately.
+    int offset = 0;
+    int chunk_index = 0;
+    struct playlist_chunk *c = find_chunk(pl, dst_index, &offset);
+    if (c) {
+        chunk_index = c->index + (offset > 0);
+        if (offset > 0 && offset < c->num_entries)
+            split_chunk(pl, c, offset);
+    }
 
-    int count = source_pl->num_entries;
-    MP_TARRAY_INSERT_N_AT(pl, pl->entries, pl->num_entries, dst_index, count);
-
+    int count = source_pl->num_chunks;
+    MP_TARRAY_INSERT_N_AT(pl, pl->chunks, pl->num_chunks, chunk_index, count);
     for (int n = 0; n < count; n++) {
-        struct playlist_entry *e = source_pl->entries[n];
-        e->pl = pl;
-        e->pl_index = dst_index + n;
-        e->id = ++pl->id_alloc;
-        pl->entries[e->pl_index] = e;
-        talloc_steal(pl, e);
+        struct playlist_chunk *sc = source_pl->chunks[n];
+        for (int i = 0; i < sc->num_entries; i++) {
+            struct playlist_entry *e = sc->entries[i];
+            e->pl = pl;
+            e->id = ++pl->id_alloc;
+            talloc_steal(pl, e);
+        }
+        pl->chunks[chunk_index + n] = talloc_steal(pl, sc);
     }
+    update_chunk_indexes(pl, chunk_index);
+    pl->num_entries += source_pl->num_entries;
+
+    // Adding a few entries at a time (like "loadfile ... append") must not
+    // create a chunk per call.
+    merge_next_chunk(pl, pl->chunks[chunk_index + count - 1], CHUNK_SIZE);
+    if (chunk_index > 0)
+        merge_next_chunk(pl, pl->chunks[chunk_index - 1], CHUNK_SIZE);
 
-    playlist_update_indexes(pl, dst_index + count, -1);
+    source_pl->num_chunks = 0;
+    source_pl->num_valid_starts = 0;
     source_pl->num_entries = 0;
 
-    return first ? first->id : 0;
+    return first->id;
 }
 
 // Move all entries from source_pl to pl, appending them after the current entry
@@ -336,7 +569,7 @@ int64_t playlist_transfer_entries(struct playlist *pl, struct playlist *source_p
 
     int add_at = pl->num_entries;
     if (pl->current) {
-        add_at = pl->current->pl_index + 1;
+        add_at = playlist_entry_to_index(pl, pl->current) + 1;
         if (pl->current_was_replaced)
             add_at += 1;
     }
@@ -351,13 +584,24 @@ int64_t playlist_append_entries(struct playlist *pl, struct playlist *source_pl)
     return playlist_transfer_entries_to(pl, pl->num_entries, source_pl);
 }
 
+// Like playlist_transfer_entries(), but insert the entries after the given
+// entry, which must be part of pl.
+int64_t playlist_insert_entries_after(struct playlist *pl,
+                                      struct playlist_entry *at,
+                                      struct playlist *source_pl)
+{
+    assert(at->pl == pl);
+    return playlist_transfer_entries_to(pl, playlist_entry_to_index(pl, at) + 1,
+                                        source_pl);
+}
+
 // Return number of entries between list start and e.
 // Return -1 if e is not on the list, or if e is NULL.
 int playlist_entry_to_index(struct playlist *pl, struct playlist_entry *e)
 {
     if (!e || e->pl != pl)
         return -1;
-    return e->pl_index;
+    return get_chunk_start(pl, e->pl_chunk) + e->pl_chunk_index;
 }
 
 int playlist_entry_count(struct playlist *pl)
@@ -369,7 +613,11 @@ int playlist_entry_count(struct playlist *pl)
 // Return NULL if not found.
 struct playlist_entry *playlist_entry_from_index(struct playlist *pl, int index)
 {
-    return index >= 0 && index < pl->num_entries ? pl->entries[index] : NULL;
+    if (index < 0 || index >= pl->num_entries)
+        return NULL;
+    int offset = 0;
+    struct playlist_chunk *c = find_chunk(pl, index, &offset);
+    return c->entries[offset];
 }
 
 struct playlist *playlist_parse_file(const char *file, struct mp_cancel *cancel,
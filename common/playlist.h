@@ -25,10 +25,15 @@ struct playlist_param {
     bstr name, value;
 };
 
+struct playlist_chunk;
+
 struct playlist_entry {
-    // Invariant: (pl && pl->entries[pl_index] == this) || (!pl && pl_index < 0)
+    // Invariant: (pl && pl_chunk->entries[pl_chunk_index] == this) ||
+    //            (!pl && !pl_chunk && pl_chunk_index < 0)
+    // Use playlist_entry_to_index() to get the index within the playlist.
     struct playlist *pl;
-    int pl_index;
+    struct playlist_chunk *pl_chunk;
+    int pl_chunk_index;
 
     uint64_t id;
 
@@ -40,7 +45,7 @@ struct playlist_entry {
 
     char *title;
 
-    // Used for unshuffling: the pl_index before it was shuffled. -1 => unknown.
+    // Used for unshuffling: the index before it was shuffled. -1 => unknown.
     int original_index;
 
     // Set to true if this playlist entry was selected while trying to go backwards
@@ -62,7 +67,15 @@ struct playlist_entry {
 };
 
 struct playlist {
-    struct playlist_entry **entries;
+    // The entries are split into chunks of limited size, so that inserting or
+    // removing an entry only has to touch the entries of a single chunk.
+    // Don't access them directly; use playlist_get_first(),
+    // playlist_entry_get_rel() and playlist_entry_from_index().
+    struct playlist_chunk **chunks;
+    int num_chunks;
+    // chunks[n]->start is up to date for n < num_valid_starts.
+    int num_valid_starts;
+
     int num_entries;
 
     // This provides some sort of stable iterator. If this entry is removed from
@@ -106,6 +119,9 @@ void playlist_add_base_path(struct playlist *pl, bstr base_path);
 void playlist_set_stream_flags(struct playlist *pl, int flags);
 int64_t playlist_transfer_entries(struct playlist *pl, struct playlist *source_pl);
 int64_t playlist_append_entries(struct playlist *pl, struct playlist *source_pl);
+int64_t playlist_insert_entries_after(struct playlist *pl,
+                                      struct playlist_entry *at,
+                                      struct playlist *source_pl);
 
 int playlist_entry_to_index(struct playlist *pl, struct playlist_entry *e);
 int playlist_entry_count(struct playlist *pl);
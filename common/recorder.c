@@ -56,6 +56,9 @@ struct mp_recorder {
     // The output packet timestamp corresponding to base_ts. It's the timestamp
     // of the first packet of the current segment written to the output.
     double rebase_ts;
+    // If not NOPTS, the input timestamp at which the output should start (see
+    // mp_recorder_set_clip_start()).
+    double clip_start;
 
     AVFormatContext *mux;
 };
@@ -212,6 +215,7 @@ struct mp_recorder *mp_recorder_create(struct mpv_global *global,
 
     priv->base_ts = MP_NOPTS_VALUE;
     priv->rebase_ts = 0;
+    priv->clip_start = MP_NOPTS_VALUE;
 
     MP_WARN(priv, "This is an experimental feature. Output files might be "
                   "broken or not play correctly with various players "
@@ -309,6 +313,21 @@ static void check_restart(struct mp_recorder *priv)
     if (min_ts == MP_NOPTS_VALUE)
         return;
 
+    // Make the requested start timestamp 0, and the packets before it (from
+    // the preceding keyframe on) negative. Formats which allow this write an
+    // edit list, so that players skip the frames before the start. Only
+    // possible for the first segment.
+    if (priv->clip_start != MP_NOPTS_VALUE) {
+        if (priv->clip_start > min_ts && rebase_ts == 0 &&
+            (priv->mux->oformat->flags & AVFMT_TS_NEGATIVE))
+        {
+            MP_VERBOSE(priv, "Starting output at %f (keyframe at %f).\n",
+                       priv->clip_start, min_ts);
+            min_ts = priv->clip_start;
+        }
+        priv->clip_start = MP_NOPTS_VALUE;
+    }
+
     priv->rebase_ts = rebase_ts;
     priv->base_ts = min_ts;
 
@@ -363,6 +382,16 @@ void mp_recorder_mark_discontinuity(struct mp_recorder *priv)
     priv->muxing_from_start = false;
 }
 
+// Start the output at the given input timestamp, instead of the first keyframe
+// fed after this call. Applies to the next segment only (i.e. call this before
+// feeding packets, or after mp_recorder_mark_discontinuity()). Whether this
+// actually cuts precisely depends on the output format; if it does not support
+// it, the output starts at the keyframe as usual.
+void mp_recorder_set_clip_start(struct mp_recorder *priv, double pts)
+{
+    priv->clip_start = pts;
+}
+
 // Get a stream for writing. The pointer is valid until mp_recorder is
 // destroyed. The stream ptr. is the same as one passed to
 // mp_recorder_create() (returns NULL if it wasn't).
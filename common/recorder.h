@@ -16,6 +16,7 @@ struct mp_recorder *mp_recorder_create(struct mpv_global *global,
                                        int num_attachments);
 void mp_recorder_destroy(struct mp_recorder *r);
 void mp_recorder_mark_discontinuity(struct mp_recorder *r);
+void mp_recorder_set_clip_start(struct mp_recorder *r, double pts);
 
 struct mp_recorder_sink *mp_recorder_get_sink(struct mp_recorder *r,
                                               struct sh_stream *stream);
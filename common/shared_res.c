@@ -0,0 +1,168 @@
+#include <pthread.h>
+
+#include <libavutil/cpu.h>
+
+#include "common.h"
+#include "options/m_config.h"
+#include "options/m_option.h"
+#include "shared_res.h"
+
+struct shared_res_opts {
+    bool enable;
+    int decoder_threads;
+    int64_t demuxer_max_bytes;
+};
+
+#define OPT_BASE_STRUCT struct shared_res_opts
+const struct m_sub_options shared_res_conf = {
+    .opts = (const struct m_option[]){
+        {"shared-resources", OPT_BOOL(enable)},
+        {"shared-decoder-threads", OPT_INT(decoder_threads),
+            M_RANGE(0, 1024)},
+        {"shared-demuxer-max-bytes", OPT_BYTE_SIZE(demuxer_max_bytes),
+            M_RANGE(0, M_MAX_MEM_BYTES)},
+        {0}
+    },
+    .size = sizeof(struct shared_res_opts),
+};
+
+// Upper bound for the threads of a single decoder (see
+// mp_set_avcodec_threads()).
+#define MAX_DECODER_THREADS 16
+
+struct mp_shared_demuxer {
+    int64_t usage;
+};
+
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// All fields are protected by shared_lock. The budgets are taken from the
+// options of the instance that most recently registered a user.
+static struct {
+    bool active;
+    int decoders;
+    int decoder_threads;
+    int decoder_thread_budget;
+    int demuxers;
+    int64_t demuxer_bytes;
+    int64_t demuxer_max_bytes;
+} shared;
+
+// Return the options if shared resources are enabled, NULL otherwise.
+static struct shared_res_opts *get_opts(void *ta_parent,
+                                        struct mpv_global *global)
+{
+    struct shared_res_opts *opts =
+        mp_get_config_group(ta_parent, global, &shared_res_conf);
+    if (!opts->enable) {
+        talloc_free(opts);
+        return NULL;
+    }
+    return opts;
+}
+
+int mp_shared_res_acquire_threads(struct mpv_global *global, int requested)
+{
+    struct shared_res_opts *opts = get_opts(NULL, global);
+    if (!opts)
+        return 0;
+
+    int budget = opts->decoder_threads;
+    if (!budget)
+        budget = MPMAX(av_cpu_count(), 1);
+    talloc_free(opts);
+
+    pthread_mutex_lock(&shared_lock);
+    shared.active = true;
+    shared.decoder_thread_budget = budget;
+    shared.decoders++;
+    // Each decoder gets an equal share of the budget (relative to the number
+    // of decoders at the time it's created), but never more than what is left
+    // of it. Decoders can't change their thread count after creation, so
+    // the budget is only balanced as decoders are recreated.
+    int threads = MPMIN(budget / shared.decoders,
+                        budget - shared.decoder_threads);
+    if (requested > 0)
+        threads = MPMIN(threads, requested);
+    threads = MPCLAMP(threads, 1, MAX_DECODER_THREADS);
+    shared.decoder_threads += threads;
+    pthread_mutex_unlock(&shared_lock);
+
+    return threads;
+}
+
+void mp_shared_res_release_threads(int threads)
+{
+    if (!threads)
+        return;
+
+    pthread_mutex_lock(&shared_lock);
+    assert(shared.decoders > 0 && shared.decoder_threads >= threads);
+    shared.decoders--;
+    shared.decoder_threads -= threads;
+    pthread_mutex_unlock(&shared_lock);
+}
+
+static void demuxer_destroy(void *p)
+{
+    struct mp_shared_demuxer *d = p;
+
+    pthread_mutex_lock(&shared_lock);
+    assert(shared.demuxers > 0);
+    shared.demuxers--;
+    shared.demuxer_bytes -= d->usage;
+    pthread_mutex_unlock(&shared_lock);
+}
+
+struct mp_shared_demuxer *mp_shared_demuxer_create(void *ta_parent,
+                                                   struct mpv_global *global)
+{
+    struct shared_res_opts *opts = get_opts(NULL, global);
+    if (!opts)
+        return NULL;
+
+    struct mp_shared_demuxer *d = talloc_zero(ta_parent, struct mp_shared_demuxer);
+    talloc_set_destructor(d, demuxer_destroy);
+
+    pthread_mutex_lock(&shared_lock);
+    shared.active = true;
+    shared.demuxer_max_bytes = opts->demuxer_max_bytes;
+    shared.demuxers++;
+    pthread_mutex_unlock(&shared_lock);
+
+    talloc_free(opts);
+    return d;
+}
+
+int64_t mp_shared_demuxer_limit(struct mp_shared_demuxer *d)
+{
+    pthread_mutex_lock(&shared_lock);
+    int64_t limit = 0;
+    if (shared.demuxer_max_bytes)
+        limit = MPMAX(shared.demuxer_max_bytes / MPMAX(shared.demuxers, 1), 1);
+    pthread_mutex_unlock(&shared_lock);
+    return limit;
+}
+
+void mp_shared_demuxer_set_usage(struct mp_shared_demuxer *d, int64_t bytes)
+{
+    pthread_mutex_lock(&shared_lock);
+    shared.demuxer_bytes += bytes - d->usage;
+    d->usage = bytes;
+    pthread_mutex_unlock(&shared_lock);
+}
+
+void mp_shared_res_get_stats(struct mp_shared_res_stats *st)
+{
+    pthread_mutex_lock(&shared_lock);
+    *st = (struct mp_shared_res_stats){
+        .active = shared.active,
+        .decoders = shared.decoders,
+        .decoder_threads = shared.decoder_threads,
+        .decoder_thread_budget = shared.decoder_thread_budget,
+        .demuxers = shared.demuxers,
+        .demuxer_bytes = shared.demuxer_bytes,
+        .demuxer_max_bytes = shared.demuxer_max_bytes,
+    };
+    pthread_mutex_unlock(&shared_lock);
+}
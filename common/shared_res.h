@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mpv_global;
+
+// Process-wide budgets for resources used by all mpv instances in the process
+// (libmpv can create any number of them), enabled per instance with
+// --shared-resources. Instances without it are not accounted.
+
+// Return the number of threads a new software decoder should use, and account
+// for them until mp_shared_res_release_threads() is called with the returned
+// value. requested is the configured thread count (0 for auto). Returns 0 if
+// shared resources are disabled for this instance (nothing is accounted then).
+int mp_shared_res_acquire_threads(struct mpv_global *global, int requested);
+void mp_shared_res_release_threads(int threads);
+
+struct mp_shared_demuxer;
+
+// Register a demuxer cache. Returns NULL if shared resources are disabled for
+// this instance. Free it with talloc_free() (or the ta_parent) to unregister.
+struct mp_shared_demuxer *mp_shared_demuxer_create(void *ta_parent,
+                                                   struct mpv_global *global);
+
+// Number of bytes the demuxer may use for its cache, or 0 for unlimited. The
+// result changes as other demuxers are created or destroyed.
+int64_t mp_shared_demuxer_limit(struct mp_shared_demuxer *d);
+
+// Report the number of bytes currently used by the demuxer's cache (stats).
+void mp_shared_demuxer_set_usage(struct mp_shared_demuxer *d, int64_t bytes);
+
+struct mp_shared_res_stats {
+    bool active;                // any instance enabled shared resources
+    int decoders;
+    int decoder_threads;
+    int decoder_thread_budget;
+    int demuxers;
+    int64_t demuxer_bytes;
+    int64_t demuxer_max_bytes;  // 0 if unlimited
+};
+
+void mp_shared_res_get_stats(struct mp_shared_res_stats *st);
@@ -7,9 +7,11 @@
 #include "global.h"
 #include "misc/linked_list.h"
 #include "misc/node.h"
+#include "misc/thread_pool.h"
 #include "msg.h"
 #include "options/m_option.h"
 #include "osdep/timer.h"
+#include "shared_res.h"
 #include "stats.h"
 
 struct stats_base {
@@ -27,6 +29,10 @@ struct stats_base {
     int num_entries;
 
     int64_t last_time;
+
+    // Shared thread pool counters at last_time.
+    int64_t pool_busy_ns;
+    uint64_t pool_completed;
 };
 
 struct stats_ctx {
@@ -114,6 +120,70 @@ static void add_stat(struct mpv_node *list, struct stat_entry *e,
         node_map_add_string(ne, "text", text);
 }
 
+static void add_pool_stat(struct mpv_node *list, const char *name,
+                          double val, char *text)
+{
+    struct mpv_node *ne = node_array_add(list, MPV_FORMAT_NODE_MAP);
+    node_map_add_string(ne, "name", name);
+    node_map_add_double(ne, "value", val);
+    if (text)
+        node_map_add_string(ne, "text", text);
+}
+
+// Report the state of the process-wide thread pool. Utilization and completed
+// items are relative to the previous query.
+static void add_pool_stats(struct stats_base *stats, struct mpv_node *out,
+                           int64_t now)
+{
+    struct mp_thread_pool *pool = mp_thread_pool_shared();
+    if (!pool)
+        return;
+
+    struct mp_thread_pool_stats st;
+    mp_thread_pool_get_stats(pool, &st);
+
+    add_pool_stat(out, "thread-pool/threads", st.threads, NULL);
+    add_pool_stat(out, "thread-pool/max-threads", st.max_threads, NULL);
+    add_pool_stat(out, "thread-pool/busy", st.busy_threads, NULL);
+    add_pool_stat(out, "thread-pool/queued", st.queued, NULL);
+
+    if (stats->last_time && now > stats->last_time) {
+        double busy = st.busy_ns - stats->pool_busy_ns;
+        double util = busy / ((double)(now - stats->last_time) * st.max_threads);
+        add_pool_stat(out, "thread-pool/utilization", util * 100,
+                      mp_tprintf(80, "%.1f%%", util * 100));
+        add_pool_stat(out, "thread-pool/completed",
+                      st.completed - stats->pool_completed, NULL);
+    }
+
+    stats->pool_busy_ns = st.busy_ns;
+    stats->pool_completed = st.completed;
+}
+
+// Report the process-wide resources shared between instances (if any instance
+// uses --shared-resources).
+static void add_shared_res_stats(struct mpv_node *out)
+{
+    struct mp_shared_res_stats st;
+    mp_shared_res_get_stats(&st);
+    if (!st.active)
+        return;
+
+    add_pool_stat(out, "shared/decoders", st.decoders, NULL);
+    add_pool_stat(out, "shared/decoder-threads", st.decoder_threads, NULL);
+    add_pool_stat(out, "shared/decoder-thread-budget",
+                  st.decoder_thread_budget, NULL);
+    add_pool_stat(out, "shared/demuxers", st.demuxers, NULL);
+    char *s = format_file_size(st.demuxer_bytes);
+    add_pool_stat(out, "shared/demuxer-bytes", st.demuxer_bytes, s);
+    talloc_free(s);
+    if (st.demuxer_max_bytes) {
+        s = format_file_size(st.demuxer_max_bytes);
+        add_pool_stat(out, "shared/demuxer-max-bytes", st.demuxer_max_bytes, s);
+        talloc_free(s);
+    }
+}
+
 static int cmp_entry(const void *p1, const void *p2)
 {
     struct stat_entry **e1 = (void *)p1;
@@ -167,6 +237,8 @@ void stats_global_query(struct mpv_global *global, struct mpv_node *out)
             }
         }
     }
+    add_pool_stats(stats, out, now);
+    add_shared_res_stats(out);
     stats->last_time = now;
 
     for (int n = 0; n < stats->num_entries; n++) {
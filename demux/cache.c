@@ -15,13 +15,23 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <libavutil/md5.h>
+
+#include "config.h"
+
+#if HAVE_POSIX
+#include <sys/file.h>
+#endif
+
 #include "cache.h"
 #include "common/msg.h"
 #include "common/av_common.h"
@@ -34,6 +44,8 @@
 struct demux_cache_opts {
     char *cache_dir;
     int unlink_files;
+    bool persistent;
+    int64_t persistent_max_bytes;
 };
 
 #define OPT_BASE_STRUCT struct demux_cache_opts
@@ -44,6 +56,9 @@ const struct m_sub_options demux_cache_conf = {
         {"demuxer-cache-unlink-files", OPT_CHOICE(unlink_files,
             {"immediate", 2}, {"whendone", 1}, {"no", 0}),
         },
+        {"demuxer-cache-persistent", OPT_BOOL(persistent)},
+        {"demuxer-cache-persistent-max-bytes",
+            OPT_BYTE_SIZE(persistent_max_bytes), M_RANGE(0, INT64_MAX)},
         {"cache-dir", OPT_REPLACED("demuxer-cache-dir")},
         {"cache-unlink-files", OPT_REPLACED("demuxer-cache-unlink-files")},
         {0}
@@ -51,6 +66,7 @@ const struct m_sub_options demux_cache_conf = {
     .size = sizeof(struct demux_cache_opts),
     .defaults = &(const struct demux_cache_opts){
         .unlink_files = 2,
+        .persistent_max_bytes = 10LL * 1024 * 1024 * 1024,
     },
 };
 
@@ -58,7 +74,9 @@ struct demux_cache {
     struct mp_log *log;
     struct demux_cache_opts *opts;
 
+    char *cache_dir;
     char *filename;
+    char *index_filename;   // set for persistent caches only
     bool need_unlink;
     int fd;
     int64_t file_pos;
@@ -76,10 +94,114 @@ struct sd_header {
     uint32_t len;
 };
 
+// Prefix for the files of persistent caches. Temporary cache files use
+// "mpv-cache-" instead, and are never touched by the pruning code.
+#define PERSISTENT_PREFIX "mpv-pcache-"
+
+// Try to lock the file exclusively, so that concurrently running players don't
+// write to the same persistent cache file. The lock is released on close().
+static bool lock_file(int fd)
+{
+#if HAVE_POSIX
+    return flock(fd, LOCK_EX | LOCK_NB) == 0;
+#else
+    return false;
+#endif
+}
+
+struct cache_file {
+    char *name;             // without extension
+    int64_t size;           // of data and index file
+    time_t mtime;
+};
+
+static int compare_mtime(const void *a, const void *b)
+{
+    const struct cache_file *f1 = a, *f2 = b;
+    return f1->mtime < f2->mtime ? -1 : (f1->mtime > f2->mtime ? 1 : 0);
+}
+
+static bool stat_file(const char *path, int64_t *size, time_t *mtime)
+{
+    struct stat st;
+    if (stat(path, &st))
+        return false;
+    *size += st.st_size;
+    *mtime = MPMAX(*mtime, st.st_mtime);
+    return true;
+}
+
+// Delete least recently used persistent cache files until the total size of
+// all of them fits into the configured limit. Files locked by other players
+// are skipped. The cache's own files are deleted only if they alone are over
+// the limit, and only if delete_own is set.
+static void prune_persistent_files(struct demux_cache *cache, bool delete_own)
+{
+    void *tmp = talloc_new(NULL);
+    struct cache_file *files = NULL;
+    int num_files = 0;
+    int64_t total = 0;
+
+    DIR *d = opendir(cache->cache_dir);
+    if (!d)
+        goto done;
+
+    char *own = mp_basename(cache->filename);
+    struct dirent *ep;
+    while ((ep = readdir(d))) {
+        bstr name = bstr0(ep->d_name);
+        if (!bstr_startswith0(name, PERSISTENT_PREFIX) ||
+            !bstr_eatend0(&name, ".dat"))
+            continue;
+
+        struct cache_file f = {
+            .name = mp_path_join_bstr(tmp, bstr0(cache->cache_dir), name),
+        };
+        char *dat = talloc_asprintf(tmp, "%s.dat", f.name);
+        if (!stat_file(dat, &f.size, &f.mtime))
+            continue;
+        stat_file(talloc_asprintf(tmp, "%s.idx", f.name), &f.size, &f.mtime);
+
+        total += f.size;
+        if (strcmp(ep->d_name, own) != 0)
+            MP_TARRAY_APPEND(tmp, files, num_files, f);
+    }
+    closedir(d);
+
+    qsort(files, num_files, sizeof(files[0]), compare_mtime);
+
+    for (int n = 0; n < num_files && total > cache->opts->persistent_max_bytes; n++) {
+        char *dat = talloc_asprintf(tmp, "%s.dat", files[n].name);
+        int fd = open(dat, O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        if (lock_file(fd)) {
+            MP_VERBOSE(cache, "Removing old cache file %s\n", dat);
+            unlink(dat);
+            unlink(talloc_asprintf(tmp, "%s.idx", files[n].name));
+            total -= files[n].size;
+        }
+        close(fd);
+    }
+
+    if (delete_own && total > cache->opts->persistent_max_bytes) {
+        MP_WARN(cache, "Cache file exceeds --demuxer-cache-persistent-max-bytes, "
+                "removing it.\n");
+        unlink(cache->filename);
+        unlink(cache->index_filename);
+    }
+
+done:
+    talloc_free(tmp);
+}
+
 static void cache_destroy(void *p)
 {
     struct demux_cache *cache = p;
 
+    if (cache->index_filename)
+        prune_persistent_files(cache, true);
+
     if (cache->fd >= 0)
         close(cache->fd);
 
@@ -89,11 +211,70 @@ static void cache_destroy(void *p)
     }
 }
 
+// Open the cache file for the given key. Returns false if this is not possible,
+// in which case a temporary cache file should be used.
+static bool open_persistent(struct demux_cache *cache, const char *key)
+{
+    if (!HAVE_POSIX) {
+        MP_WARN(cache, "Persistent cache files are not supported here.\n");
+        return false;
+    }
+
+    uint8_t md5[16];
+    av_md5_sum(md5, key, strlen(key));
+    char *name = talloc_strdup(cache, PERSISTENT_PREFIX);
+    for (int i = 0; i < 16; i++)
+        name = talloc_asprintf_append(name, "%02x", md5[i]);
+    char *base = mp_path_join(cache, cache->cache_dir, name);
+
+    cache->filename = talloc_asprintf(cache, "%s.dat", base);
+    cache->fd = open(cache->filename, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (cache->fd < 0) {
+        MP_ERR(cache, "Failed to open cache file %s.\n", cache->filename);
+        return false;
+    }
+
+    if (!lock_file(cache->fd)) {
+        MP_WARN(cache, "Cache file %s is in use, using a temporary file.\n",
+                cache->filename);
+        close(cache->fd);
+        cache->fd = -1;
+        return false;
+    }
+
+    cache->index_filename = talloc_asprintf(cache, "%s.idx", base);
+
+    // Without index, the data is useless (e.g. the player crashed before
+    // writing it), so start from scratch.
+    struct stat st;
+    if (stat(cache->index_filename, &st)) {
+        if (ftruncate(cache->fd, 0))
+            MP_WARN(cache, "Failed to truncate cache file.\n");
+    }
+
+    off_t size = lseek(cache->fd, 0, SEEK_END);
+    if (size == (off_t)-1) {
+        MP_ERR(cache, "Failed to seek in cache file.\n");
+        return false;
+    }
+    cache->file_pos = cache->file_size = size;
+
+    MP_VERBOSE(cache, "Using cache file %s (%"PRId64" bytes).\n",
+               cache->filename, (int64_t)size);
+
+    prune_persistent_files(cache, false);
+    return true;
+}
+
 // Create a cache. This also initializes the cache file from the options. The
 // log parameter must stay valid until demux_cache is destroyed.
+// If key is not NULL and --demuxer-cache-persistent is enabled, the cache file
+// is kept on disk after the cache is destroyed, and reused by the next cache
+// created with the same key (see demux_cache_read_index()). The key must
+// identify the media and its stream layout.
 // Free with talloc_free().
 struct demux_cache *demux_cache_create(struct mpv_global *global,
-                                       struct mp_log *log)
+                                       struct mp_log *log, const char *key)
 {
     struct demux_cache *cache = talloc_zero(NULL, struct demux_cache);
     talloc_set_destructor(cache, cache_destroy);
@@ -103,15 +284,25 @@ struct demux_cache *demux_cache_create(struct mpv_global *global,
 
     char *cache_dir = cache->opts->cache_dir;
     if (cache_dir && cache_dir[0]) {
-        cache_dir = mp_get_user_path(NULL, global, cache_dir);
+        cache_dir = mp_get_user_path(cache, global, cache_dir);
     } else {
-        cache_dir = mp_find_user_file(NULL, global, "cache", "");
+        cache_dir = mp_find_user_file(cache, global, "cache", "");
     }
 
     if (!cache_dir || !cache_dir[0])
         goto fail;
 
+    cache->cache_dir = cache_dir;
     mp_mkdirp(cache_dir);
+
+    if (key && cache->opts->persistent && open_persistent(cache, key))
+        return cache;
+
+    if (cache->fd >= 0)
+        close(cache->fd);
+    cache->fd = -1;
+    cache->index_filename = NULL;
+
     cache->filename = mp_path_join(cache, cache_dir, "mpv-cache-XXXXXX.dat");
     cache->fd = mp_mkostemps(cache->filename, 4, O_CLOEXEC);
     if (cache->fd < 0) {
@@ -133,6 +324,74 @@ fail:
     return NULL;
 }
 
+bool demux_cache_is_persistent(struct demux_cache *cache)
+{
+    return !!cache->index_filename;
+}
+
+// Return the index data written with demux_cache_write_index() by the previous
+// user of a persistent cache file. Returns an empty bstr if there is none.
+bstr demux_cache_read_index(struct demux_cache *cache, void *ta_parent)
+{
+    bstr res = {0};
+    if (!cache->index_filename)
+        return res;
+
+    int fd = open(cache->index_filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return res;
+
+    struct stat st;
+    if (!fstat(fd, &st) && st.st_size > 0 && st.st_size < INT_MAX) {
+        res.start = talloc_size(ta_parent, st.st_size);
+        ssize_t r = read(fd, res.start, st.st_size);
+        if (r == st.st_size) {
+            res.len = r;
+        } else {
+            MP_ERR(cache, "Failed to read cache index.\n");
+            TA_FREEP(&res.start);
+        }
+    }
+
+    close(fd);
+    return res;
+}
+
+// Store the index for a persistent cache. The positions referenced by it must
+// have been returned by demux_cache_write(). Packets not in the index are
+// wasted space in the file.
+bool demux_cache_write_index(struct demux_cache *cache, bstr data)
+{
+    if (!cache->index_filename)
+        return false;
+
+    char *tmp = talloc_asprintf(NULL, "%s.tmp", cache->index_filename);
+    bool ok = false;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        ok = write(fd, data.start, data.len) == data.len;
+        ok &= close(fd) == 0;
+        ok = ok && rename(tmp, cache->index_filename) == 0;
+    }
+    if (!ok) {
+        MP_ERR(cache, "Failed to write cache index.\n");
+        unlink(tmp);
+    }
+    talloc_free(tmp);
+    return ok;
+}
+
+// Drop all data of a persistent cache (e.g. if the index turned out to be
+// incompatible). Must be called before any packets are written.
+void demux_cache_reset(struct demux_cache *cache)
+{
+    if (ftruncate(cache->fd, 0))
+        MP_WARN(cache, "Failed to truncate cache file.\n");
+    cache->file_pos = cache->file_size = 0;
+    if (cache->index_filename)
+        unlink(cache->index_filename);
+}
+
 uint64_t demux_cache_get_size(struct demux_cache *cache)
 {
     return cache->file_size;
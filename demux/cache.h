@@ -1,7 +1,10 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "misc/bstr.h"
+
 struct demux_packet;
 struct mp_log;
 struct mpv_global;
@@ -9,7 +12,11 @@ struct mpv_global;
 struct demux_cache;
 
 struct demux_cache *demux_cache_create(struct mpv_global *global,
-                                       struct mp_log *log);
+                                       struct mp_log *log, const char *key);
+bool demux_cache_is_persistent(struct demux_cache *cache);
+bstr demux_cache_read_index(struct demux_cache *cache, void *ta_parent);
+bool demux_cache_write_index(struct demux_cache *cache, bstr data);
+void demux_cache_reset(struct demux_cache *cache);
 
 int64_t demux_cache_write(struct demux_cache *cache, struct demux_packet *pkt);
 struct demux_packet *demux_cache_read(struct demux_cache *cache, uint64_t pos);
@@ -40,6 +40,7 @@
 #include "common/msg.h"
 #include "common/global.h"
 #include "common/recorder.h"
+#include "common/shared_res.h"
 #include "common/stats.h"
 #include "misc/charset_conv.h"
 #include "misc/thread_tools.h"
@@ -84,6 +85,13 @@ static const demuxer_desc_t *const demuxer_list[] = {
     NULL
 };
 
+// Maximum memory held by free packet data buffers in a demuxer's packet pool.
+#define PACKET_POOL_BYTES (16 * 1024 * 1024)
+
+// How far to read past the end of a pinned range (see demux_set_cache_pin()),
+// to include packets the decoder needs for frames just before the end.
+#define PIN_END_MARGIN 1.0
+
 #define OPT_BASE_STRUCT struct demux_opts
 
 static bool get_demux_sub_opts(int index, const struct m_sub_options **sub);
@@ -186,6 +194,7 @@ struct demux_internal {
     int events;
 
     struct demux_cache *cache;
+    char *cache_identity;       // media identity when the cache was opened
 
     bool warned_queue_overflow;
     bool eof;                   // whether we're in EOF state
@@ -194,6 +203,9 @@ struct demux_internal {
     bool hyst_active;
     size_t max_bytes;
     size_t max_bytes_bw;
+    struct mp_shared_demuxer *shared; // --shared-resources (or NULL)
+    int64_t shared_limit;       // mp_shared_demuxer_limit() as last applied
+    int64_t shared_usage;       // total_bytes as last reported
     bool seekable_cache;
     bool using_network_cache_opts;
     char *record_filename;
@@ -267,6 +279,10 @@ struct demux_internal {
     struct mp_recorder *dumper;
     int dumper_status;
 
+    // Range the user wants to keep cached (A-B loop), see demux_set_cache_pin().
+    double pin_start, pin_end;
+    bool warned_pin_overflow;
+
     bool owns_stream;
 
     // -- Access from demuxer thread only
@@ -447,6 +463,8 @@ static struct demux_packet *find_seek_target(struct demux_queue *queue,
                                              double pts, int flags);
 static void prune_old_packets(struct demux_internal *in);
 static void dumper_close(struct demux_internal *in);
+static void write_cache_index(struct demux_internal *in);
+static void read_cache_index(struct demux_internal *in);
 static void demux_convert_tags_charset(struct demuxer *demuxer);
 
 static uint64_t get_forward_buffered_bytes(struct demux_stream *ds)
@@ -701,7 +719,7 @@ static void remove_head_packet(struct demux_queue *queue)
     if (!queue->head)
         queue->tail = NULL;
 
-    talloc_free(dp);
+    free_demux_packet(dp);
 }
 
 static void free_index(struct demux_queue *queue)
@@ -730,7 +748,7 @@ static void clear_queue(struct demux_queue *queue)
     while (dp) {
         struct demux_packet *dn = dp->next;
         assert(ds->reader_head != dp);
-        talloc_free(dp);
+        free_demux_packet(dp);
         dp = dn;
     }
     queue->head = queue->tail = NULL;
@@ -1084,6 +1102,9 @@ static void demux_shutdown(struct demux_internal *in)
     demuxer->priv = NULL;
     in->d_thread->priv = NULL;
 
+    if (in->cache && demux_cache_is_persistent(in->cache))
+        write_cache_index(in);
+
     demux_flush(demuxer);
     assert(in->total_bytes == 0);
 
@@ -1093,6 +1114,9 @@ static void demux_shutdown(struct demux_internal *in)
     talloc_free(in->cache);
     in->cache = NULL;
 
+    talloc_free(in->shared);
+    in->shared = NULL;
+
     if (in->owns_stream)
         free_stream(demuxer->stream);
     demuxer->stream = NULL;
@@ -1864,10 +1888,10 @@ static struct demux_packet *compute_keyframe_times(struct demux_packet *pkt,
 // This has to deal with a number of corner cases, such as demuxers potentially
 // starting output at non-keyframes.
 // Can join seek ranges, which messes with in->current_range and all.
-static void adjust_seek_range_on_packet(struct demux_stream *ds,
+static void adjust_seek_range_on_packet(struct demux_queue *queue,
                                         struct demux_packet *dp)
 {
-    struct demux_queue *queue = ds->queue;
+    struct demux_stream *ds = queue->ds;
 
     if (!ds->in->seekable_cache)
         return;
@@ -1994,7 +2018,7 @@ static void add_packet_locked(struct sh_stream *stream, demux_packet_t *dp)
 {
     struct demux_stream *ds = stream ? stream->ds : NULL;
     if (!dp->len || demux_cancel_test(ds->in->d_thread)) {
-        talloc_free(dp);
+        free_demux_packet(dp);
         return;
     }
 
@@ -2042,7 +2066,7 @@ static void add_packet_locked(struct sh_stream *stream, demux_packet_t *dp)
     }
 
     if (drop) {
-        talloc_free(dp);
+        free_demux_packet(dp);
         return;
     }
 
@@ -2107,7 +2131,7 @@ static void add_packet_locked(struct sh_stream *stream, demux_packet_t *dp)
              "[num=%s size=%zd]\n", stream_type_name(stream->type),
              dp->len, dp->pts, dp->dts, dp->pos, num_pkts, (size_t)fw_bytes);
 
-    adjust_seek_range_on_packet(ds, dp);
+    adjust_seek_range_on_packet(ds->queue, dp);
 
     // May need to reduce backward cache.
     prune_old_packets(in);
@@ -2142,7 +2166,7 @@ static void mark_stream_eof(struct demux_stream *ds)
 {
     if (!ds->eof) {
         ds->eof = true;
-        adjust_seek_range_on_packet(ds, NULL);
+        adjust_seek_range_on_packet(ds->queue, NULL);
         back_demux_see_packets(ds);
         wakeup_ds(ds);
     }
@@ -2159,6 +2183,17 @@ static bool lazy_stream_needs_wait(struct demux_stream *ds)
             in->demux_ts <= ds->force_read_until);
 }
 
+// Whether the stream has been read past the end of the pinned range, while
+// playback is inside of it. The packets after it are not needed while looping,
+// and would only take away cache space from the packets before it.
+static bool reached_pin_end(struct demux_internal *in, struct demux_stream *ds)
+{
+    if (in->pin_end == MP_NOPTS_VALUE || !in->seekable_cache)
+        return false;
+    return ds->base_ts >= in->pin_start && ds->base_ts <= in->pin_end &&
+           ds->queue->last_ts >= in->pin_end + PIN_END_MARGIN;
+}
+
 // Returns true if there was "progress" (lock was released temporarily).
 static bool read_packet(struct demux_internal *in)
 {
@@ -2193,7 +2228,7 @@ static bool read_packet(struct demux_internal *in)
             !in->back_demuxing) {
             if (ds->queue->last_ts - ds->base_ts <= in->hyst_secs)
                 in->hyst_active = false;
-            if (!in->hyst_active)
+            if (!in->hyst_active && !reached_pin_end(in, ds))
                 prefetch_more |= ds->queue->last_ts - ds->base_ts < in->min_secs;
         }
         total_fw_bytes += get_forward_buffered_bytes(ds);
@@ -2393,6 +2428,19 @@ static void prune_old_packets(struct demux_internal *in)
                 }
             }
 
+            // (The first keyframe of the pinned range was just pruned.)
+            if (in->pin_start != MP_NOPTS_VALUE && !in->warned_pin_overflow &&
+                range == in->current_range &&
+                queue->last_pruned != MP_NOPTS_VALUE &&
+                queue->last_pruned <= in->pin_start &&
+                queue->seek_start > in->pin_start)
+            {
+                MP_WARN(in, "The A-B loop does not fit into the demuxer cache. "
+                        "Increase --demuxer-max-back-bytes to avoid "
+                        "reading it again on every iteration.\n");
+                in->warned_pin_overflow = true;
+            }
+
             if (update_range)
                 update_seek_ranges(range);
         }
@@ -2448,6 +2496,31 @@ static void execute_seek(struct demux_internal *in)
     in->seeking_in_progress = MP_NOPTS_VALUE;
 }
 
+// Identity of the media for persistent disk caches. Returns NULL if the cache
+// should not be persisted (can't resume demuxing after a cached range without
+// seeking, and there is no way to tell whether the media changed).
+static char *get_cache_key(struct demux_internal *in)
+{
+    struct demuxer *d = in->d_thread;
+    int64_t size = d->stream ? stream_get_size(d->stream) : -1;
+    if (size <= 0 || !d->seekable || !d->filename)
+        return NULL;
+    return talloc_asprintf(NULL, "%s\n%s\n%"PRId64, d->desc->name,
+                           d->filename, size);
+}
+
+// Identity of the media contents, which is stored in the persistent cache
+// index to detect media that was replaced (e.g. a file that was rewritten with
+// the same size). NULL if the stream can't provide it.
+static char *get_cache_identity(struct demux_internal *in)
+{
+    struct demuxer *d = in->d_thread;
+    char *id = NULL;
+    if (d->stream)
+        stream_control(d->stream, STREAM_CTRL_GET_IDENTITY, &id);
+    return id;
+}
+
 static void update_opts(struct demuxer *demuxer)
 {
     struct demux_opts *opts = demuxer->opts;
@@ -2483,8 +2556,29 @@ static void update_opts(struct demuxer *demuxer)
         in->using_network_cache_opts = false;
     }
 
+    if (in->shared) {
+        // Scale both limits down to this demuxer's share of the process-wide
+        // limit.
+        in->shared_limit = mp_shared_demuxer_limit(in->shared);
+        double total = (double)in->max_bytes + in->max_bytes_bw;
+        if (in->shared_limit && total > in->shared_limit) {
+            double f = in->shared_limit / total;
+            in->max_bytes = MPMAX(in->max_bytes * f, 1);
+            in->max_bytes_bw = in->max_bytes_bw * f;
+        }
+    }
+
     if (in->seekable_cache && opts->disk_cache && !in->cache) {
-        in->cache = demux_cache_create(in->global, in->log);
+        char *key = get_cache_key(in);
+        in->cache = demux_cache_create(in->global, in->log, key);
+        talloc_free(key);
+        if (in->cache && demux_cache_is_persistent(in->cache)) {
+            in->cache_identity = talloc_steal(in, get_cache_identity(in));
+            if (!in->cache_identity) {
+                MP_VERBOSE(in, "Media identity unknown, the persistent cache "
+                           "can't detect changed contents.\n");
+            }
+        }
         if (!in->cache)
             MP_ERR(in, "Failed to create file cache.\n");
     }
@@ -2517,8 +2611,13 @@ static void update_opts(struct demuxer *demuxer)
 // Make demuxing progress. Return whether progress was made.
 static bool thread_work(struct demux_internal *in)
 {
-    if (m_config_cache_update(in->d_user->opts_cache))
+    if (m_config_cache_update(in->d_user->opts_cache) ||
+        (in->shared && mp_shared_demuxer_limit(in->shared) != in->shared_limit))
         update_opts(in->d_user);
+    if (in->shared && in->shared_usage != in->total_bytes) {
+        in->shared_usage = in->total_bytes;
+        mp_shared_demuxer_set_usage(in->shared, in->shared_usage);
+    }
     if (in->tracks_switched) {
         execute_trackswitch(in);
         return true;
@@ -2981,6 +3080,7 @@ static void demux_copy(struct demuxer *dst, struct demuxer *src)
     dst->num_attachments = src->num_attachments;
     dst->matroska_data = src->matroska_data;
     dst->playlist = src->playlist;
+    dst->playlist_stream = src->playlist_stream;
     dst->seekable = src->seekable;
     dst->partially_seekable = src->partially_seekable;
     dst->filetype = src->filetype;
@@ -3281,6 +3381,7 @@ static struct demuxer *open_given_type(struct mpv_global *global,
         .opts_cache = opts_cache,
         .events = DEMUX_EVENT_ALL,
         .duration = -1,
+        .packet_pool = demux_packet_pool_create(demuxer, PACKET_POOL_BYTES),
     };
 
     struct demux_internal *in = demuxer->in = talloc_ptrtype(demuxer, in);
@@ -3297,6 +3398,8 @@ static struct demuxer *open_given_type(struct mpv_global *global,
         .highest_av_pts = MP_NOPTS_VALUE,
         .seeking_in_progress = MP_NOPTS_VALUE,
         .demux_ts = MP_NOPTS_VALUE,
+        .pin_start = MP_NOPTS_VALUE,
+        .pin_end = MP_NOPTS_VALUE,
         .owns_stream = !params->external_stream,
     };
     pthread_mutex_init(&in->lock, NULL);
@@ -3358,8 +3461,13 @@ static struct demuxer *open_given_type(struct mpv_global *global,
 
         switch_to_fresh_cache_range(in);
 
+        if (in->can_cache)
+            in->shared = mp_shared_demuxer_create(in, global);
         update_opts(demuxer);
 
+        if (in->cache && demux_cache_is_persistent(in->cache))
+            read_cache_index(in);
+
         demux_update(demuxer, MP_NOPTS_VALUE);
 
         demuxer = sub ? sub : demuxer;
@@ -3777,6 +3885,257 @@ static void switch_to_fresh_cache_range(struct demux_internal *in)
     switch_current_range(in, range);
 }
 
+// Persistent disk cache index (see demux_cache_read_index()). It stores the
+// packet metadata of all cached ranges, while the packet data is in the cache
+// file. Like the cache file, this uses native byte order and struct layout.
+#define CACHE_INDEX_MAGIC "mpvcidx2"
+
+struct cache_index_queue {
+    uint32_t is_bof, is_eof;
+    uint64_t num_packets;
+};
+
+struct cache_index_packet {
+    uint64_t cache_pos;
+    int64_t pos;
+    double pts, dts, duration;
+    uint32_t keyframe;
+    uint32_t reserved;
+};
+
+static void append_raw(bstr *dst, void *ptr, size_t len)
+{
+    bstr_xappend(NULL, dst, (bstr){ptr, len});
+}
+
+static bool read_raw(bstr *src, void *ptr, size_t len)
+{
+    if (src->len < len)
+        return false;
+    memcpy(ptr, src->start, len);
+    *src = bstr_cut(*src, len);
+    return true;
+}
+
+static void append_stream_layout(struct demux_internal *in, bstr *dst)
+{
+    uint32_t num_streams = in->num_streams;
+    append_raw(dst, &num_streams, sizeof(num_streams));
+    for (int n = 0; n < in->num_streams; n++) {
+        struct sh_stream *sh = in->streams[n];
+        uint32_t hdr[2] = {sh->type, strlen(sh->codec->codec)};
+        append_raw(dst, hdr, sizeof(hdr));
+        append_raw(dst, (void *)sh->codec->codec, hdr[1]);
+    }
+}
+
+// Identity of the media contents (see get_cache_identity()). Media with the
+// same cache key, but a different identity was changed since the index was
+// written, and the cached data is stale.
+static void append_media_identity(struct demux_internal *in, bstr *dst)
+{
+    char *id = in->cache_identity;
+    uint32_t len = id ? strlen(id) : 0;
+    append_raw(dst, &len, sizeof(len));
+    append_raw(dst, id, len);
+}
+
+static bool range_is_persistable(struct demux_cached_range *range)
+{
+    if (range->seek_start == MP_NOPTS_VALUE)
+        return false;
+
+    for (int n = 0; n < range->num_streams; n++) {
+        for (struct demux_packet *dp = range->streams[n]->head; dp; dp = dp->next)
+        {
+            if (!dp->is_cached || dp->segmented)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Must be called before the cached ranges are freed.
+static void write_cache_index(struct demux_internal *in)
+{
+    bstr data = {0};
+
+    pthread_mutex_lock(&in->lock);
+
+    append_raw(&data, CACHE_INDEX_MAGIC, 8);
+    append_media_identity(in, &data);
+    append_stream_layout(in, &data);
+
+    uint32_t num_ranges = 0;
+    for (int n = 0; n < in->num_ranges; n++)
+        num_ranges += range_is_persistable(in->ranges[n]);
+    append_raw(&data, &num_ranges, sizeof(num_ranges));
+
+    for (int n = 0; n < in->num_ranges; n++) {
+        struct demux_cached_range *range = in->ranges[n];
+        if (!range_is_persistable(range))
+            continue;
+
+        for (int i = 0; i < range->num_streams; i++) {
+            struct demux_queue *queue = range->streams[i];
+
+            struct cache_index_queue qhdr = {
+                .is_bof = queue->is_bof,
+                .is_eof = queue->is_eof,
+            };
+            for (struct demux_packet *dp = queue->head; dp; dp = dp->next)
+                qhdr.num_packets++;
+            append_raw(&data, &qhdr, sizeof(qhdr));
+
+            for (struct demux_packet *dp = queue->head; dp; dp = dp->next) {
+                struct cache_index_packet pkt = {
+                    .cache_pos = dp->cached_data.pos,
+                    .pos = dp->pos,
+                    .pts = dp->pts,
+                    .dts = dp->dts,
+                    .duration = dp->duration,
+                    .keyframe = dp->keyframe,
+                };
+                append_raw(&data, &pkt, sizeof(pkt));
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&in->lock);
+
+    MP_VERBOSE(in, "Writing cache index with %d ranges.\n", (int)num_ranges);
+    demux_cache_write_index(in->cache, data);
+    talloc_free(data.start);
+}
+
+// Append a packet restored from the cache index to a queue that is not the
+// current one. This does the subset of add_packet_locked() that is needed for
+// seeking into the range and joining it.
+static void restore_cached_packet(struct demux_queue *queue,
+                                  struct demux_packet *dp)
+{
+    struct demux_stream *ds = queue->ds;
+    struct demux_internal *in = ds->in;
+
+    queue->correct_pos &= dp->pos >= 0 && dp->pos > queue->last_pos;
+    queue->correct_dts &= dp->dts != MP_NOPTS_VALUE && dp->dts > queue->last_dts;
+    queue->last_pos = dp->pos;
+    queue->last_dts = dp->dts;
+    ds->global_correct_pos &= queue->correct_pos;
+    ds->global_correct_dts &= queue->correct_dts;
+
+    size_t bytes = demux_packet_estimate_total_size(dp);
+    in->total_bytes += bytes;
+    dp->cum_pos = queue->tail_cum_pos;
+    queue->tail_cum_pos += bytes;
+
+    if (queue->tail) {
+        queue->tail->next = dp;
+        queue->tail = dp;
+    } else {
+        queue->head = queue->tail = dp;
+    }
+
+    double ts = MP_PTS_OR_DEF(dp->dts, dp->pts);
+    if (ts != MP_NOPTS_VALUE && (ts > queue->last_ts || ts + 10 < queue->last_ts))
+        queue->last_ts = ts;
+
+    adjust_seek_range_on_packet(queue, dp);
+}
+
+// Recreate the cached ranges written by write_cache_index() in an earlier
+// session. They are added as inactive ranges, so seeking into them or joining
+// them with the current range works as usual.
+static void read_cache_index(struct demux_internal *in)
+{
+    void *tmp = talloc_new(NULL);
+    bstr data = demux_cache_read_index(in->cache, tmp);
+    if (!data.len)
+        goto done;
+
+    bstr header = {0};
+    append_media_identity(in, &header);
+    append_stream_layout(in, &header);
+    talloc_steal(tmp, header.start);
+
+    uint32_t num_ranges;
+    if (!bstr_eatstart0(&data, CACHE_INDEX_MAGIC) ||
+        !bstr_eatstart(&data, header) ||
+        !read_raw(&data, &num_ranges, sizeof(num_ranges)))
+    {
+        MP_WARN(in, "Cache index does not match the media, discarding it.\n");
+        demux_cache_reset(in->cache);
+        goto done;
+    }
+
+    uint64_t cache_size = demux_cache_get_size(in->cache);
+    int restored = 0;
+
+    pthread_mutex_lock(&in->lock);
+
+    for (uint32_t r = 0; r < num_ranges; r++) {
+        // Don't restore more than the backbuffer can hold.
+        if (in->total_bytes >= in->max_bytes_bw ||
+            in->num_ranges >= MAX_SEEK_RANGES)
+            break;
+
+        struct demux_cached_range *range = talloc_ptrtype(NULL, range);
+        *range = (struct demux_cached_range){
+            .seek_start = MP_NOPTS_VALUE,
+            .seek_end = MP_NOPTS_VALUE,
+        };
+        // Insert as least recently used; current_range must stay the last one.
+        MP_TARRAY_INSERT_AT(in, in->ranges, in->num_ranges, 0, range);
+        add_missing_streams(in, range);
+
+        bool ok = true;
+        for (int n = 0; n < range->num_streams && ok; n++) {
+            struct demux_queue *queue = range->streams[n];
+
+            struct cache_index_queue qhdr;
+            ok = read_raw(&data, &qhdr, sizeof(qhdr));
+
+            for (uint64_t i = 0; ok && i < qhdr.num_packets; i++) {
+                struct cache_index_packet pkt;
+                ok = read_raw(&data, &pkt, sizeof(pkt)) &&
+                     pkt.cache_pos < cache_size;
+                if (!ok)
+                    break;
+
+                struct demux_packet *dp = new_demux_packet_cached(pkt.cache_pos);
+                dp->stream = n;
+                dp->pos = pkt.pos;
+                dp->pts = pkt.pts;
+                dp->dts = pkt.dts;
+                dp->duration = pkt.duration;
+                dp->keyframe = pkt.keyframe;
+                restore_cached_packet(queue, dp);
+            }
+
+            queue->is_bof = ok && qhdr.is_bof;
+            if (ok && qhdr.is_eof)
+                adjust_seek_range_on_packet(queue, NULL);
+        }
+
+        if (!ok) {
+            MP_WARN(in, "Cache index is truncated.\n");
+            clear_cached_range(in, range);
+            break;
+        }
+
+        update_seek_ranges(range);
+        restored++;
+    }
+
+    pthread_mutex_unlock(&in->lock);
+
+    MP_VERBOSE(in, "Restored %d cached ranges from previous session.\n",
+               restored);
+
+done:
+    talloc_free(tmp);
+}
+
 int demux_seek(demuxer_t *demuxer, double seek_pts, int flags)
 {
     struct demux_internal *in = demuxer->in;
@@ -4219,6 +4578,10 @@ static void dump_cache(struct demux_internal *in, double start, double end)
         int flags = 0;
         adjust_cache_seek_target(in, r, &pts, &flags);
 
+        // Cut precisely at the start, if it's within this range.
+        if (start > r->seek_start)
+            mp_recorder_set_clip_start(in->dumper, start);
+
         for (int i = 0; i < r->num_streams; i++) {
             struct demux_queue *q = r->streams[i];
             struct demux_stream *ds = q->ds;
@@ -4338,6 +4701,35 @@ bool demux_cache_dump_set(struct demuxer *demuxer, double start, double end,
     return res;
 }
 
+// Tell the cache that the range [start, end] is going to be played repeatedly
+// (A-B loop). While playback is inside of it, the demuxer does not read ahead
+// past its end, so that the cache space is used to keep the range itself, and
+// seeking back to the start does not need to read from the source again.
+// Pass NOPTS for both to unset it.
+void demux_set_cache_pin(struct demuxer *demuxer, double start, double end)
+{
+    struct demux_internal *in = demuxer->in;
+    assert(demuxer == in->d_user);
+
+    pthread_mutex_lock(&in->lock);
+
+    start = MP_ADD_PTS(start, -in->ts_offset);
+    end = MP_ADD_PTS(end, -in->ts_offset);
+    if (start == MP_NOPTS_VALUE || end == MP_NOPTS_VALUE)
+        start = end = MP_NOPTS_VALUE;
+
+    if (start != in->pin_start || end != in->pin_end) {
+        in->pin_start = start;
+        in->pin_end = end;
+        in->warned_pin_overflow = false;
+        // Reading ahead may have been stopped at the old end.
+        in->reading = true;
+        pthread_cond_signal(&in->wakeup);
+    }
+
+    pthread_mutex_unlock(&in->lock);
+}
+
 // Returns one of CONTROL_*. CONTROL_TRUE means dumping is in progress.
 int demux_cache_dump_get_status(struct demuxer *demuxer)
 {
@@ -4491,6 +4883,7 @@ void demux_get_reader_state(struct demuxer *demuxer, struct demux_reader_state *
         .byte_level_seeks = in->byte_level_seeks,
         .file_cache_bytes = in->cache ? demux_cache_get_size(in->cache) : -1,
     };
+    demux_packet_pool_get_stats(demuxer->packet_pool, &r->packet_pool);
     bool any_packets = false;
     for (int n = 0; n < in->num_streams; n++) {
         struct demux_stream *ds = in->streams[n]->ds;
@@ -28,6 +28,7 @@
 #include "common/common.h"
 #include "common/tags.h"
 #include "packet.h"
+#include "packet_pool.h"
 #include "stheader.h"
 
 #define MAX_SEEK_RANGES 10
@@ -45,6 +46,7 @@ struct demux_reader_state {
     int64_t total_bytes;
     int64_t fw_bytes;
     int64_t file_cache_bytes;
+    struct demux_packet_pool_stats packet_pool;
     double seeking; // current low level seek target, or NOPTS
     int low_level_seeks; // number of started low level seeks
     uint64_t byte_level_seeks; // number of byte stream level seeks
@@ -204,6 +206,7 @@ struct demuxer_params {
     bstr init_fragment;
     bool skip_lavf_probing;
     bool stream_record; // if true, enable stream recording if option is set
+    bool stream_playlist; // if true, demuxer.playlist_stream can be set
     int stream_flags;
     struct stream *external_stream; // if set, use this, don't open or close streams
     // result
@@ -252,10 +255,15 @@ typedef struct demuxer {
 
     // If the file is a playlist file
     struct playlist *playlist;
+    // If not NULL, more playlist entries are still being added in the
+    // background (directory scanning). Whoever uses this must steal it.
+    struct demux_playlist_stream *playlist_stream;
 
     struct mp_tags *metadata;
 
     void *priv;   // demuxer-specific internal data
+    // Use for packet allocations (new_demux_packet_*_pooled()); never NULL.
+    struct demux_packet_pool *packet_pool;
     struct mpv_global *global;
     struct mp_log *log, *glog;
     struct demuxer_params *params;
@@ -290,6 +298,15 @@ void demux_set_stream_wakeup_cb(struct sh_stream *sh,
                                 void (*cb)(void *ctx), void *ctx);
 struct demux_packet *demux_read_any_packet(struct demuxer *demuxer);
 
+// Append the playlist entries that have become available since the last call
+// to pl. Returns false if no more entries will be added. Free the stream with
+// talloc_free() to stop it.
+bool demux_playlist_stream_read(struct demux_playlist_stream *s,
+                                struct playlist *pl);
+// cb is called (from a worker thread) when new entries might be available.
+void demux_playlist_stream_set_wakeup_cb(struct demux_playlist_stream *s,
+                                         void (*cb)(void *ctx), void *ctx);
+
 struct sh_stream *demux_get_stream(struct demuxer *demuxer, int index);
 int demux_get_num_stream(struct demuxer *demuxer);
 
@@ -336,6 +353,7 @@ void demux_close_stream(struct demuxer *demuxer);
 void demux_metadata_changed(demuxer_t *demuxer);
 void demux_update(demuxer_t *demuxer, double playback_pts);
 
+void demux_set_cache_pin(struct demuxer *demuxer, double start, double end);
 bool demux_cache_dump_set(struct demuxer *demuxer, double start, double end,
                           char *file);
 int demux_cache_dump_get_status(struct demuxer *demuxer);
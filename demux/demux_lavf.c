@@ -1233,7 +1233,8 @@ static bool demux_lavf_read_packet(struct demuxer *demux,
         return true; // don't signal EOF if skipping a packet
     }
 
-    struct demux_packet *dp = new_demux_packet_from_avpacket(pkt);
+    struct demux_packet *dp =
+        new_demux_packet_from_avpacket_pooled(demuxer->packet_pool, pkt);
     if (!dp) {
         av_packet_unref(pkt);
         return true;
@@ -2221,7 +2221,8 @@ static int demux_mkv_open(demuxer_t *demuxer, enum demux_check check)
 
 // Read the laced block data at the current stream position (until endpos as
 // indicated by the block length field) into individual buffers.
-static int demux_mkv_read_block_lacing(struct block_info *block, int type,
+static int demux_mkv_read_block_lacing(struct demux_packet_pool *pool,
+                                       struct block_info *block, int type,
                                        struct stream *s, uint64_t endpos)
 {
     int laces;
@@ -2291,7 +2292,7 @@ static int demux_mkv_read_block_lacing(struct block_info *block, int type,
         if (stream_tell(s) + size > endpos || size > (1 << 30))
             goto error;
         int pad = MPMAX(AV_INPUT_BUFFER_PADDING_SIZE, AV_LZO_INPUT_PADDING);
-        AVBufferRef *buf = av_buffer_alloc(size + pad);
+        AVBufferRef *buf = demux_packet_pool_alloc_buffer(pool, size + pad);
         if (!buf)
             goto error;
         buf->size = size;
@@ -2664,7 +2665,8 @@ static int read_block(demuxer_t *demuxer, int64_t end, struct block_info *block)
     block->filepos = stream_tell(s);
 
     int lace_type = (header_flags >> 1) & 0x03;
-    if (demux_mkv_read_block_lacing(block, lace_type, s, endpos))
+    if (demux_mkv_read_block_lacing(demuxer->packet_pool, block, lace_type,
+                                    s, endpos))
         goto exit;
 
     if (block->simple)
@@ -2761,7 +2763,8 @@ static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
                 // (avoidable copy of the entire data)
                 dp = new_demux_packet_from(nblock.start, nblock.len);
             } else {
-                dp = new_demux_packet_from_buf(data);
+                dp = new_demux_packet_from_buf_pooled(demuxer->packet_pool,
+                                                      data);
             }
             if (!dp)
                 break;
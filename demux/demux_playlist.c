@@ -19,6 +19,9 @@
 #include <string.h>
 #include <strings.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
 
 #include <libavutil/common.h>
 
@@ -28,6 +31,7 @@
 #include "common/msg.h"
 #include "common/playlist.h"
 #include "misc/charset_conv.h"
+#include "misc/thread_pool.h"
 #include "misc/thread_tools.h"
 #include "options/path.h"
 #include "stream/stream.h"
@@ -89,6 +93,8 @@ struct pl_parser {
     bool line_allocated;
     enum demux_check check_level;
     struct stream *real_stream;
+    bool allow_stream;
+    struct demux_playlist_stream *playlist_stream;
     char *format;
     char *codepage;
     struct demux_playlist_opts *opts;
@@ -372,6 +378,10 @@ static int parse_txt(struct pl_parser *p)
 
 #define MAX_DIR_STACK 20
 
+// Directories are read on up to this many threads at once. This is mostly
+// waiting for I/O, so it's not tied to the number of CPUs.
+#define MAX_SCAN_THREADS 16
+
 static bool same_st(struct stat *st1, struct stat *st2)
 {
     return st1->st_dev == st2->st_dev && st1->st_ino == st2->st_ino;
@@ -380,7 +390,6 @@ static bool same_st(struct stat *st1, struct stat *st2)
 struct pl_dir_entry {
     char *path;
     char *name;
-    struct stat st;
     bool is_dir;
 };
 
@@ -395,71 +404,237 @@ static int cmp_dir_entry(const void *a, const void *b)
     }
 }
 
-// Return true if this was a readable directory.
-static bool scan_dir(struct pl_parser *p, char *path,
-                     struct stat *dir_stack, int num_dir_stack)
+// A directory in the tree being scanned. The playlist is the depth-first
+// traversal of the tree, with the files of each directory before its
+// subdirectories.
+struct dir_node {
+    struct demux_playlist_stream *s;
+    struct dir_node *parent;
+    int index;              // in parent->dirs[]
+    int depth;
+    char *path;
+    struct stat st;         // valid once the scan started
+
+    // -- protected by s->lock
+    bool scanned;
+    char **files;           // sorted playlist entries (files or lazy dirs)
+    int num_files;
+    struct dir_node **dirs; // sorted subdirectories (DIR_RECURSIVE only)
+    int num_dirs;
+};
+
+struct demux_playlist_stream {
+    struct mp_log *log;
+    int dir_mode;
+    int stream_flags;
+    struct mp_thread_pool *pool;
+    struct mp_cancel *cancel;
+    atomic_bool cancelled;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // -- protected by lock
+    int pending;            // directories queued or being read
+    struct dir_node *root;
+    // Traversal position of demux_playlist_stream_read(): the next thing to
+    // return is the files of cur (cur_dir < 0) or cur->dirs[cur_dir].
+    struct dir_node *cur;
+    int cur_dir;
+    void (*wakeup_cb)(void *ctx);
+    void *wakeup_ctx;
+};
+
+static bool scan_node(struct dir_node *node);
+
+static void scan_job(void *ptr)
+{
+    scan_node(ptr);
+}
+
+static void queue_node(struct dir_node *node)
+{
+    struct demux_playlist_stream *s = node->s;
+    if (!s->pool || !mp_thread_pool_queue(s->pool, scan_job, node))
+        scan_node(node);
+}
+
+// Read the directory entries, without holding the lock.
+static bool read_dir(struct dir_node *node, void *ta_ctx,
+                     struct pl_dir_entry **out_entries, int *out_num)
 {
-    if (strlen(path) >= 8192 || num_dir_stack == MAX_DIR_STACK)
+    struct demux_playlist_stream *s = node->s;
+
+    if (strlen(node->path) >= 8192 || node->depth == MAX_DIR_STACK)
         return false; // things like mount bind loops
 
-    DIR *dp = opendir(path);
+    if (s->dir_mode == DIR_RECURSIVE) {
+        if (stat(node->path, &node->st))
+            return false;
+        for (struct dir_node *a = node->parent; a; a = a->parent) {
+            if (same_st(&a->st, &node->st)) {
+                MP_VERBOSE(s, "Skip recursive entry: %s\n", node->path);
+                return false;
+            }
+        }
+    }
+
+    DIR *dp = opendir(node->path);
     if (!dp) {
-        MP_ERR(p, "Could not read directory.\n");
+        MP_ERR(s, "Could not read directory %s.\n", node->path);
         return false;
     }
 
-    struct pl_dir_entry *dir_entries = NULL;
-    int num_dir_entries = 0;
-    int path_len = strlen(path);
-    int dir_mode = p->opts->dir_mode;
+    struct pl_dir_entry *entries = NULL;
+    int num_entries = 0;
+    int path_len = strlen(node->path);
 
     struct dirent *ep;
     while ((ep = readdir(dp))) {
         if (ep->d_name[0] == '.')
             continue;
 
-        if (mp_cancel_test(p->s->cancel))
+        if (atomic_load(&s->cancelled))
             break;
 
-        char *file = mp_path_join(p, path, ep->d_name);
-
-        struct stat st;
-        if (stat(file, &st) == 0 && S_ISDIR(st.st_mode)) {
-            if (dir_mode != DIR_IGNORE) {
-                for (int n = 0; n < num_dir_stack; n++) {
-                    if (same_st(&dir_stack[n], &st)) {
-                        MP_VERBOSE(p, "Skip recursive entry: %s\n", file);
-                        goto skip;
-                    }
-                }
+        char *file = mp_path_join(ta_ctx, node->path, ep->d_name);
 
-                struct pl_dir_entry d = {file, &file[path_len], st, true};
-                MP_TARRAY_APPEND(p, dir_entries, num_dir_entries, d);
-            }
-        } else {
-            struct pl_dir_entry f = {file, &file[path_len], .is_dir = false};
-            MP_TARRAY_APPEND(p, dir_entries, num_dir_entries, f);
+        // Avoid stat() calls if possible; on network filesystems, they're
+        // much slower than reading the directory itself.
+        bool is_dir;
+#ifdef DT_DIR
+        if (ep->d_type == DT_DIR || ep->d_type == DT_REG) {
+            is_dir = ep->d_type == DT_DIR;
+        } else
+#endif
+        {
+            struct stat st;
+            is_dir = stat(file, &st) == 0 && S_ISDIR(st.st_mode);
         }
 
-        skip: ;
+        if (is_dir && s->dir_mode == DIR_IGNORE)
+            continue;
+
+        struct pl_dir_entry e = {file, &file[path_len], is_dir};
+        MP_TARRAY_APPEND(ta_ctx, entries, num_entries, e);
     }
     closedir(dp);
 
-    if (dir_entries)
-        qsort(dir_entries, num_dir_entries, sizeof(dir_entries[0]), cmp_dir_entry);
+    if (entries)
+        qsort(entries, num_entries, sizeof(entries[0]), cmp_dir_entry);
+
+    *out_entries = entries;
+    *out_num = num_entries;
+    return true;
+}
+
+// Return true if this was a readable directory.
+static bool scan_node(struct dir_node *node)
+{
+    struct demux_playlist_stream *s = node->s;
+    void *tmp = talloc_new(NULL);
+
+    struct pl_dir_entry *entries = NULL;
+    int num_entries = 0;
+    bool ok = !atomic_load(&s->cancelled) &&
+              read_dir(node, tmp, &entries, &num_entries);
+
+    pthread_mutex_lock(&s->lock);
+    for (int n = 0; n < num_entries; n++) {
+        struct pl_dir_entry *e = &entries[n];
+        if (e->is_dir && s->dir_mode == DIR_RECURSIVE) {
+            struct dir_node *child = talloc_zero(node, struct dir_node);
+            *child = (struct dir_node){
+                .s = s,
+                .parent = node,
+                .index = node->num_dirs,
+                .depth = node->depth + 1,
+                .path = talloc_steal(child, e->path),
+            };
+            MP_TARRAY_APPEND(node, node->dirs, node->num_dirs, child);
+        } else {
+            MP_TARRAY_APPEND(node, node->files, node->num_files,
+                             talloc_steal(node, e->path));
+        }
+    }
+    for (int n = 0; n < node->num_files; n++)
+        talloc_steal(node->files, node->files[n]);
+    node->scanned = true;
+    s->pending += node->num_dirs - 1;
+    pthread_cond_broadcast(&s->wakeup);
+    if (s->wakeup_cb)
+        s->wakeup_cb(s->wakeup_ctx);
+    pthread_mutex_unlock(&s->lock);
+
+    talloc_free(tmp);
+
+    // The node is immutable now, except for the fields protected by the lock.
+    for (int n = 0; n < node->num_dirs; n++)
+        queue_node(node->dirs[n]);
+
+    return ok;
+}
 
-    for (int n = 0; n < num_dir_entries; n++) {
-        if (dir_mode == DIR_RECURSIVE && dir_entries[n].is_dir) {
-            dir_stack[num_dir_stack] = dir_entries[n].st;
-            char *file = dir_entries[n].path;
-            scan_dir(p, file, dir_stack, num_dir_stack + 1);
+// Move all entries that can be returned in order to pl. Call with lock held.
+static void read_entries(struct demux_playlist_stream *s, struct playlist *pl)
+{
+    while (s->cur && s->cur->scanned) {
+        struct dir_node *node = s->cur;
+        if (s->cur_dir < 0) {
+            for (int n = 0; n < node->num_files; n++) {
+                struct playlist_entry *e = playlist_entry_new(node->files[n]);
+                e->stream_flags = s->stream_flags;
+                playlist_add(pl, e);
+            }
+            TA_FREEP(&node->files);
+            node->num_files = 0;
+            s->cur_dir = 0;
         }
-        else {
-            playlist_add_file(p->pl, dir_entries[n].path);
+        if (s->cur_dir < node->num_dirs) {
+            s->cur = node->dirs[s->cur_dir];
+            s->cur_dir = -1;
+        } else {
+            s->cur = node->parent;
+            s->cur_dir = node->index + 1;
         }
     }
+}
 
-    return true;
+static void on_cancel(void *ctx)
+{
+    struct demux_playlist_stream *s = ctx;
+    pthread_mutex_lock(&s->lock);
+    atomic_store(&s->cancelled, true);
+    pthread_cond_broadcast(&s->wakeup);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void destroy_stream(void *ptr)
+{
+    struct demux_playlist_stream *s = ptr;
+    atomic_store(&s->cancelled, true);
+    talloc_free(s->pool); // waits until all queued directories are done
+    talloc_free(s->cancel);
+    pthread_cond_destroy(&s->wakeup);
+    pthread_mutex_destroy(&s->lock);
+}
+
+bool demux_playlist_stream_read(struct demux_playlist_stream *s,
+                                struct playlist *pl)
+{
+    pthread_mutex_lock(&s->lock);
+    read_entries(s, pl);
+    bool more = s->cur && !atomic_load(&s->cancelled);
+    pthread_mutex_unlock(&s->lock);
+    return more;
+}
+
+void demux_playlist_stream_set_wakeup_cb(struct demux_playlist_stream *s,
+                                         void (*cb)(void *ctx), void *ctx)
+{
+    pthread_mutex_lock(&s->lock);
+    s->wakeup_cb = cb;
+    s->wakeup_ctx = ctx;
+    pthread_mutex_unlock(&s->lock);
 }
 
 static int parse_dir(struct pl_parser *p)
@@ -473,15 +648,67 @@ static int parse_dir(struct pl_parser *p)
     if (!path)
         return -1;
 
-    struct stat dir_stack[MAX_DIR_STACK];
+    struct MPOpts *opts = mp_get_config_group(NULL, p->global, &mp_opt_root);
+    bool shuffle = opts->shuffle;
+    talloc_free(opts);
+
+    if (p->opts->dir_mode == DIR_AUTO)
+        p->opts->dir_mode = shuffle ? DIR_RECURSIVE : DIR_LAZY;
+
+    struct demux_playlist_stream *s =
+        talloc_zero(NULL, struct demux_playlist_stream);
+    talloc_set_destructor(s, destroy_stream);
+    s->log = p->log;
+    s->dir_mode = p->opts->dir_mode;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->wakeup, NULL);
+    s->cancel = mp_cancel_new(NULL);
+    mp_cancel_set_parent(s->cancel, p->real_stream->cancel);
+    mp_cancel_set_cb(s->cancel, on_cancel, s);
+    if (s->dir_mode == DIR_RECURSIVE)
+        s->pool = mp_thread_pool_create(s, 0, 1, MAX_SCAN_THREADS);
+
+    s->root = talloc_zero(s, struct dir_node);
+    *s->root = (struct dir_node){
+        .s = s,
+        .path = talloc_strdup(s->root, path),
+    };
+    s->cur = s->root;
+    s->cur_dir = -1;
+    s->pending = 1;
+
+    // Read the top directory on this thread, so an unreadable directory is
+    // reported as failure.
+    if (!scan_node(s->root)) {
+        talloc_free(s);
+        return -1;
+    }
+
+    // If the playlist is not going to be shuffled, the player can start
+    // playing the first files while the rest of the tree is still being
+    // scanned. Otherwise wait for the whole tree.
+    bool stream = p->allow_stream && !shuffle;
 
-    if (p->opts->dir_mode == DIR_AUTO) {
-        struct MPOpts *opts = mp_get_config_group(NULL, p->global, &mp_opt_root);
-        p->opts->dir_mode = opts->shuffle ? DIR_RECURSIVE : DIR_LAZY;
-        talloc_free(opts);
+    pthread_mutex_lock(&s->lock);
+    while (s->pending && !atomic_load(&s->cancelled)) {
+        read_entries(s, p->pl);
+        if (stream && p->pl->num_entries)
+            break;
+        pthread_cond_wait(&s->wakeup, &s->lock);
     }
+    read_entries(s, p->pl);
+    bool more = s->cur && !atomic_load(&s->cancelled);
+    pthread_mutex_unlock(&s->lock);
 
-    scan_dir(p, path, dir_stack, 0);
+    // The stream's cancel must not be referenced after this.
+    mp_cancel_set_parent(s->cancel, NULL);
+
+    if (more) {
+        MP_VERBOSE(p, "Continuing directory scan in the background.\n");
+        p->playlist_stream = s;
+    } else {
+        talloc_free(s);
+    }
 
     p->add_base = false;
 
@@ -538,6 +765,7 @@ static int open_file(struct demuxer *demuxer, enum demux_check check)
     p->pl = talloc_zero(p, struct playlist);
     p->real_stream = demuxer->stream;
     p->add_base = true;
+    p->allow_stream = demuxer->params && demuxer->params->stream_playlist;
 
     struct demux_opts *opts = mp_get_config_group(p, p->global, &demux_conf);
     p->codepage = opts->meta_cp;
@@ -568,6 +796,14 @@ static int open_file(struct demuxer *demuxer, enum demux_check check)
         playlist_add_base_path(p->pl, mp_dirname(demuxer->filename));
     playlist_set_stream_flags(p->pl, demuxer->stream_origin);
     demuxer->playlist = talloc_steal(demuxer, p->pl);
+    if (p->playlist_stream) {
+        if (ok) {
+            p->playlist_stream->stream_flags = demuxer->stream_origin;
+            demuxer->playlist_stream = talloc_steal(demuxer, p->playlist_stream);
+        } else {
+            talloc_free(p->playlist_stream);
+        }
+    }
     demuxer->filetype = p->format ? p->format : fmt->name;
     demuxer->fully_read = true;
     talloc_free(p);
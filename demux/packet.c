@@ -26,6 +26,7 @@
 #include "common/av_common.h"
 #include "common/common.h"
 #include "demux.h"
+#include "packet_pool.h"
 
 #include "packet.h"
 
@@ -47,12 +48,19 @@ static void packet_destroy(void *ptr)
 {
     struct demux_packet *dp = ptr;
     demux_packet_unref_contents(dp);
+    if (dp->pool)
+        demux_packet_pool_unref(dp->pool);
 }
 
-static struct demux_packet *packet_create(void)
+static struct demux_packet *packet_create(struct demux_packet_pool *pool)
 {
-    struct demux_packet *dp = talloc(NULL, struct demux_packet);
-    talloc_set_destructor(dp, packet_destroy);
+    struct demux_packet *dp = pool ? demux_packet_pool_get_packet(pool) : NULL;
+    AVPacket *avpacket = dp ? dp->avpacket : av_packet_alloc();
+    MP_HANDLE_OOM(avpacket);
+    if (!dp) {
+        dp = talloc(NULL, struct demux_packet);
+        talloc_set_destructor(dp, packet_destroy);
+    }
     *dp = (struct demux_packet) {
         .pts = MP_NOPTS_VALUE,
         .dts = MP_NOPTS_VALUE,
@@ -61,27 +69,51 @@ static struct demux_packet *packet_create(void)
         .start = MP_NOPTS_VALUE,
         .end = MP_NOPTS_VALUE,
         .stream = -1,
-        .avpacket = av_packet_alloc(),
+        .avpacket = avpacket,
+        .pool = pool,
     };
-    MP_HANDLE_OOM(dp->avpacket);
+    if (pool)
+        demux_packet_pool_ref(pool);
     return dp;
 }
 
+// Allocate the packet data like av_new_packet(), but from the pool.
+static int new_packet_data(struct demux_packet_pool *pool, AVPacket *avpkt,
+                           size_t len)
+{
+    if (!pool)
+        return av_new_packet(avpkt, len);
+    avpkt->buf =
+        demux_packet_pool_alloc_buffer(pool, len + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!avpkt->buf)
+        return AVERROR(ENOMEM);
+    avpkt->data = avpkt->buf->data;
+    avpkt->size = len;
+    memset(avpkt->data + len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    return 0;
+}
+
+struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt)
+{
+    return new_demux_packet_from_avpacket_pooled(NULL, avpkt);
+}
+
 // This actually preserves only data and side data, not PTS/DTS/pos/etc.
 // It also allows avpkt->data==NULL with avpkt->size!=0 - the libavcodec API
 // does not allow it, but we do it to simplify new_demux_packet().
-struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt)
+struct demux_packet *new_demux_packet_from_avpacket_pooled(
+    struct demux_packet_pool *pool, struct AVPacket *avpkt)
 {
     if (avpkt->size > 1000000000)
         return NULL;
-    struct demux_packet *dp = packet_create();
+    struct demux_packet *dp = packet_create(pool);
     int r = -1;
     if (avpkt->data) {
         // We hope that this function won't need/access AVPacket input padding,
         // because otherwise new_demux_packet_from() wouldn't work.
         r = av_packet_ref(dp->avpacket, avpkt);
     } else {
-        r = av_new_packet(dp->avpacket, avpkt->size);
+        r = new_packet_data(pool, dp->avpacket, avpkt->size);
     }
     if (r < 0) {
         talloc_free(dp);
@@ -92,15 +124,21 @@ struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt)
     return dp;
 }
 
-// (buf must include proper padding)
 struct demux_packet *new_demux_packet_from_buf(struct AVBufferRef *buf)
+{
+    return new_demux_packet_from_buf_pooled(NULL, buf);
+}
+
+// (buf must include proper padding)
+struct demux_packet *new_demux_packet_from_buf_pooled(
+    struct demux_packet_pool *pool, struct AVBufferRef *buf)
 {
     if (!buf)
         return NULL;
     if (buf->size > 1000000000)
         return NULL;
 
-    struct demux_packet *dp = packet_create();
+    struct demux_packet *dp = packet_create(pool);
     dp->avpacket->buf = av_buffer_ref(buf);
     if (!dp->avpacket->buf) {
         talloc_free(dp);
@@ -122,12 +160,18 @@ struct demux_packet *new_demux_packet_from(void *data, size_t len)
 }
 
 struct demux_packet *new_demux_packet(size_t len)
+{
+    return new_demux_packet_pooled(NULL, len);
+}
+
+struct demux_packet *new_demux_packet_pooled(struct demux_packet_pool *pool,
+                                             size_t len)
 {
     if (len > INT_MAX)
         return NULL;
 
-    struct demux_packet *dp = packet_create();
-    int r = av_new_packet(dp->avpacket, len);
+    struct demux_packet *dp = packet_create(pool);
+    int r = new_packet_data(pool, dp->avpacket, len);
     if (r < 0) {
         talloc_free(dp);
         return NULL;
@@ -137,6 +181,17 @@ struct demux_packet *new_demux_packet(size_t len)
     return dp;
 }
 
+// Create a packet whose data is stored in the disk cache at the given position
+// (see demux_cache_write()). Only the metadata is kept in memory.
+struct demux_packet *new_demux_packet_cached(uint64_t pos)
+{
+    struct demux_packet *dp = packet_create(NULL);
+    av_packet_free(&dp->avpacket);
+    dp->is_cached = true;
+    dp->cached_data.pos = pos;
+    return dp;
+}
+
 void demux_packet_shorten(struct demux_packet *dp, size_t len)
 {
     assert(len <= dp->len);
@@ -146,8 +201,20 @@ void demux_packet_shorten(struct demux_packet *dp, size_t len)
     }
 }
 
+// Free the packet. Unlike talloc_free(dp), this recycles the packet if it was
+// allocated from a pool.
 void free_demux_packet(struct demux_packet *dp)
 {
+    struct demux_packet_pool *pool = dp ? dp->pool : NULL;
+    if (pool && dp->avpacket) {
+        av_packet_unref(dp->avpacket);
+        dp->buffer = NULL;
+        dp->len = 0;
+        if (demux_packet_pool_put_packet(pool, dp)) {
+            demux_packet_pool_unref(pool);
+            return;
+        }
+    }
     talloc_free(dp);
 }
 
@@ -171,7 +238,7 @@ struct demux_packet *demux_copy_packet(struct demux_packet *dp)
 {
     struct demux_packet *new = NULL;
     if (dp->avpacket) {
-        new = new_demux_packet_from_avpacket(dp->avpacket);
+        new = new_demux_packet_from_avpacket_pooled(dp->pool, dp->avpacket);
     } else {
         // Some packets might be not created by new_demux_packet*().
         new = new_demux_packet_from(dp->buffer, dp->len);
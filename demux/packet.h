@@ -61,15 +61,29 @@ typedef struct demux_packet {
     // private
     struct demux_packet *next;
     struct AVPacket *avpacket;   // keep the buffer allocation and sidedata
+    struct demux_packet_pool *pool; // recycle the packet to this, if not NULL
     uint64_t cum_pos; // demux.c internal: cumulative size until _start_ of pkt
 } demux_packet_t;
 
 struct AVBufferRef;
+struct demux_packet_pool;
 
 struct demux_packet *new_demux_packet(size_t len);
 struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt);
 struct demux_packet *new_demux_packet_from(void *data, size_t len);
 struct demux_packet *new_demux_packet_from_buf(struct AVBufferRef *buf);
+
+// Same as the functions above, but allocate from the pool (if not NULL). Such
+// packets are recycled by free_demux_packet(), and copies made with
+// demux_copy_packet() use the same pool.
+struct demux_packet *new_demux_packet_pooled(struct demux_packet_pool *pool,
+                                             size_t len);
+struct demux_packet *new_demux_packet_from_avpacket_pooled(
+    struct demux_packet_pool *pool, struct AVPacket *avpkt);
+struct demux_packet *new_demux_packet_from_buf_pooled(
+    struct demux_packet_pool *pool, struct AVBufferRef *buf);
+
+struct demux_packet *new_demux_packet_cached(uint64_t pos);
 void demux_packet_shorten(struct demux_packet *dp, size_t len);
 void free_demux_packet(struct demux_packet *dp);
 struct demux_packet *demux_copy_packet(struct demux_packet *dp);
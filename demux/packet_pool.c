@@ -0,0 +1,227 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <libavutil/buffer.h>
+#include <libavutil/mem.h>
+
+#include "common/common.h"
+#include "packet.h"
+
+#include "packet_pool.h"
+
+// Buffer size classes are 2^n and 1.5*2^n bytes, from 256 bytes to 2 MiB, so
+// at most 1/3 of a buffer is wasted. Larger buffers are not pooled.
+#define MIN_CLASS_SHIFT 8
+#define MAX_CLASS_SHIFT 21
+#define NUM_CLASSES ((MAX_CLASS_SHIFT - MIN_CLASS_SHIFT) * 2 + 1)
+
+// Maximum number of free packet structs kept around.
+#define MAX_FREE_PACKETS 4096
+
+struct size_class {
+    struct demux_packet_pool *pool;
+    size_t size;
+    uint8_t **bufs;
+    int num_bufs;
+};
+
+struct demux_packet_pool {
+    // 1 for the owner, plus 1 for each allocated packet and buffer.
+    atomic_int refcount;
+
+    pthread_mutex_t lock;
+
+    // -- protected by lock
+    bool released; // owner is gone, don't keep free packets/buffers anymore
+    size_t max_cached_bytes;
+    struct demux_packet *free_packets; // singly linked via next
+    int num_free_packets;
+    struct size_class classes[NUM_CLASSES];
+    struct demux_packet_pool_stats stats;
+};
+
+struct pool_owner {
+    struct demux_packet_pool *pool;
+};
+
+// Free all cached packets and buffers. Must be called with the lock held.
+static void flush_pool(struct demux_packet_pool *pool)
+{
+    while (pool->free_packets) {
+        struct demux_packet *dp = pool->free_packets;
+        pool->free_packets = dp->next;
+        talloc_free(dp); // no buffer references, doesn't call back into pool
+    }
+    pool->num_free_packets = 0;
+    for (int n = 0; n < NUM_CLASSES; n++) {
+        struct size_class *cls = &pool->classes[n];
+        for (int i = 0; i < cls->num_bufs; i++)
+            av_free(cls->bufs[i]);
+        cls->num_bufs = 0;
+    }
+    pool->stats.cached_bytes = 0;
+}
+
+void demux_packet_pool_ref(struct demux_packet_pool *pool)
+{
+    atomic_fetch_add(&pool->refcount, 1);
+}
+
+void demux_packet_pool_unref(struct demux_packet_pool *pool)
+{
+    if (atomic_fetch_add(&pool->refcount, -1) == 1) {
+        flush_pool(pool);
+        pthread_mutex_destroy(&pool->lock);
+        talloc_free(pool);
+    }
+}
+
+static void destroy_owner(void *ptr)
+{
+    struct pool_owner *owner = ptr;
+    struct demux_packet_pool *pool = owner->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->released = true;
+    flush_pool(pool);
+    pthread_mutex_unlock(&pool->lock);
+
+    demux_packet_pool_unref(pool);
+}
+
+struct demux_packet_pool *demux_packet_pool_create(void *ta_parent,
+                                                   size_t max_cached_bytes)
+{
+    struct demux_packet_pool *pool = talloc_zero(NULL, struct demux_packet_pool);
+    pool->refcount = 1;
+    pool->max_cached_bytes = max_cached_bytes;
+    pthread_mutex_init(&pool->lock, NULL);
+    for (int n = 0; n < NUM_CLASSES; n++) {
+        int shift = MIN_CLASS_SHIFT + n / 2;
+        pool->classes[n] = (struct size_class){
+            .pool = pool,
+            .size = (n & 1) ? (size_t)3 << (shift - 1) : (size_t)1 << shift,
+        };
+    }
+
+    struct pool_owner *owner = talloc_zero(ta_parent, struct pool_owner);
+    owner->pool = pool;
+    talloc_set_destructor(owner, destroy_owner);
+    return pool;
+}
+
+void demux_packet_pool_get_stats(struct demux_packet_pool *pool,
+                                 struct demux_packet_pool_stats *st)
+{
+    pthread_mutex_lock(&pool->lock);
+    *st = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void buffer_free(void *opaque, uint8_t *data)
+{
+    struct size_class *cls = opaque;
+    struct demux_packet_pool *pool = cls->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->released &&
+        pool->stats.cached_bytes + cls->size <= pool->max_cached_bytes)
+    {
+        MP_TARRAY_APPEND(pool, cls->bufs, cls->num_bufs, data);
+        pool->stats.cached_bytes += cls->size;
+        data = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    av_free(data);
+    demux_packet_pool_unref(pool);
+}
+
+struct AVBufferRef *demux_packet_pool_alloc_buffer(struct demux_packet_pool *pool,
+                                                   size_t size)
+{
+    if (!pool)
+        return av_buffer_alloc(size);
+
+    struct size_class *cls = NULL;
+    for (int n = 0; n < NUM_CLASSES; n++) {
+        if (pool->classes[n].size >= size) {
+            cls = &pool->classes[n];
+            break;
+        }
+    }
+
+    uint8_t *data = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (cls && cls->num_bufs) {
+        data = cls->bufs[--cls->num_bufs];
+        pool->stats.cached_bytes -= cls->size;
+        pool->stats.buffer_hits++;
+    } else {
+        pool->stats.buffer_misses++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!cls)
+        return av_buffer_alloc(size);
+
+    if (!data)
+        data = av_malloc(cls->size);
+    if (!data)
+        return NULL;
+    AVBufferRef *ref = av_buffer_create(data, size, buffer_free, cls, 0);
+    if (!ref) {
+        av_free(data);
+        return NULL;
+    }
+    demux_packet_pool_ref(pool);
+    return ref;
+}
+
+struct demux_packet *demux_packet_pool_get_packet(struct demux_packet_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    struct demux_packet *dp = pool->free_packets;
+    if (dp) {
+        pool->free_packets = dp->next;
+        pool->num_free_packets -= 1;
+        pool->stats.packet_hits++;
+    } else {
+        pool->stats.packet_misses++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return dp;
+}
+
+// dp must not reference any buffers.
+bool demux_packet_pool_put_packet(struct demux_packet_pool *pool,
+                                  struct demux_packet *dp)
+{
+    pthread_mutex_lock(&pool->lock);
+    bool ok = !pool->released && pool->num_free_packets < MAX_FREE_PACKETS;
+    if (ok) {
+        dp->pool = NULL;
+        dp->next = pool->free_packets;
+        pool->free_packets = dp;
+        pool->num_free_packets += 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return ok;
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_DEMUX_PACKET_POOL_H
+#define MPLAYER_DEMUX_PACKET_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Recycles demux_packet structs (including their AVPacket) and packet data
+// buffers (in size classes), to avoid allocator churn with high packet rates.
+// Packets are recycled with free_demux_packet(), buffers when their last
+// reference is dropped. All functions are thread-safe; packets and buffers
+// can be freed on any thread, and can outlive the pool owner.
+struct demux_packet_pool;
+
+struct demux_packet_pool_stats {
+    uint64_t packet_hits, packet_misses; // packet allocations
+    uint64_t buffer_hits, buffer_misses; // data buffer allocations
+    int64_t cached_bytes; // data held by free buffers
+};
+
+// The pool is released when ta_parent is freed. max_cached_bytes limits the
+// memory kept in free data buffers.
+struct demux_packet_pool *demux_packet_pool_create(void *ta_parent,
+                                                   size_t max_cached_bytes);
+
+void demux_packet_pool_get_stats(struct demux_packet_pool *pool,
+                                 struct demux_packet_pool_stats *st);
+
+// Like av_buffer_alloc(size), but possibly reusing a freed buffer. The
+// returned buffer is writable. pool==NULL is allowed and uses av_buffer_alloc().
+struct AVBufferRef *demux_packet_pool_alloc_buffer(struct demux_packet_pool *pool,
+                                                   size_t size);
+
+// Internal to demux/packet.c.
+struct demux_packet;
+void demux_packet_pool_ref(struct demux_packet_pool *pool);
+void demux_packet_pool_unref(struct demux_packet_pool *pool);
+struct demux_packet *demux_packet_pool_get_packet(struct demux_packet_pool *pool);
+bool demux_packet_pool_put_packet(struct demux_packet_pool *pool,
+                                  struct demux_packet *dp);
+
+#endif /* MPLAYER_DEMUX_PACKET_POOL_H */
@@ -6,6 +6,8 @@
 #include "common/common.h"
 #include "common/msg.h"
 
+#include "misc/spsc_queue.h"
+
 #include "f_async_queue.h"
 #include "filter_internal.h"
 
@@ -18,34 +20,60 @@ struct mp_async_queue {
 struct async_queue {
     _Atomic uint64_t refcount;
 
+    // Serializes control operations (reset, config changes, connecting
+    // filters). Producer and consumer never take it while processing frames;
+    // control operations get exclusive access to the frame queue with
+    // mp_spsc_queue_lock() while holding this.
     pthread_mutex_t lock;
 
-    // -- protected by lock
+    // -- changed only with lock held and frames locked
     struct mp_async_queue_config cfg;
-    bool active; // queue was resumed; consumer may request frames
-    bool reading; // data flow: reading => consumer has requested frames
-    int64_t samples_size; // queue size in the cfg.sample_unit
-    size_t byte_size; // queue size in bytes (using approx. frame sizes)
-    int num_frames;
-    struct mp_frame *frames;
-    int eof_count; // number of MP_FRAME_EOF in frames[], for draining
     struct mp_filter *conn[2]; // filters: in (0), out (1)
+
+    // -- producer (conn[0]) writes, consumer (conn[1]) reads
+    struct mp_spsc_queue *frames; // struct entry items
+
+    // -- atomic, so the producer/consumer and the API user don't need the lock
+    atomic_bool active; // queue was resumed; consumer may request frames
+    atomic_bool reading; // data flow: reading => consumer has requested frames
+    atomic_bool notify_empty; // producer wants a wakeup if the queue drains
+    _Atomic int64_t samples_size; // queue size in the cfg.sample_unit
+    _Atomic int64_t byte_size; // queue size in bytes (using approx. frame sizes)
+    // copies of the cfg limits, for is_full() outside of the queue threads
+    _Atomic int64_t max_samples;
+    _Atomic int64_t max_bytes;
+    _Atomic double max_duration;
+};
+
+struct entry {
+    struct mp_frame frame;
+    // Copy of the frame PTS: the producer may look at entries the consumer
+    // has concurrently removed (and whose frame data may be freed already).
+    double pts;
 };
 
 static void reset_queue(struct async_queue *q)
 {
     pthread_mutex_lock(&q->lock);
-    q->active = q->reading = false;
-    for (int n = 0; n < q->num_frames; n++)
-        mp_frame_unref(&q->frames[n]);
-    q->num_frames = 0;
-    q->eof_count = 0;
-    q->samples_size = 0;
-    q->byte_size = 0;
+    mp_spsc_queue_lock(q->frames);
+    atomic_store(&q->active, false);
+    atomic_store(&q->reading, false);
+    size_t num_frames = mp_spsc_queue_count(q->frames);
+    for (size_t n = 0; n < num_frames; n++) {
+        struct entry *e = mp_spsc_queue_peek(q->frames, n);
+        mp_frame_unref(&e->frame);
+    }
+    mp_spsc_queue_clear(q->frames);
+    atomic_store(&q->samples_size, 0);
+    atomic_store(&q->byte_size, 0);
+    // Waiting flags are meaningless now; both sides are woken up anyway.
+    mp_spsc_queue_take_waiting(q->frames, MP_SPSC_PRODUCER);
+    mp_spsc_queue_take_waiting(q->frames, MP_SPSC_CONSUMER);
     for (int n = 0; n < 2; n++) {
         if (q->conn[n])
             mp_filter_wakeup(q->conn[n]);
     }
+    mp_spsc_queue_unlock(q->frames);
     pthread_mutex_unlock(&q->lock);
 }
 
@@ -76,6 +104,7 @@ struct mp_async_queue *mp_async_queue_create(void)
         .refcount = 1,
     };
     pthread_mutex_init(&r->q->lock, NULL);
+    r->q->frames = mp_spsc_queue_create(r->q, sizeof(struct entry));
     talloc_set_destructor(r, on_free_queue);
     mp_async_queue_set_config(r, (struct mp_async_queue_config){0});
     return r;
@@ -93,15 +122,21 @@ static int64_t frame_get_samples(struct async_queue *q, struct mp_frame frame)
     return res;
 }
 
+// Caller must be the producer, or have the frames locked.
 static bool is_full(struct async_queue *q)
 {
-    if (q->samples_size >= q->cfg.max_samples || q->byte_size >= q->cfg.max_bytes)
+    if (atomic_load(&q->samples_size) >= atomic_load(&q->max_samples) ||
+        atomic_load(&q->byte_size) >= atomic_load(&q->max_bytes))
         return true;
-    if (q->num_frames >= 2 && q->cfg.max_duration > 0) {
-        double pts1 = mp_frame_get_pts(q->frames[q->num_frames - 1]);
-        double pts2 = mp_frame_get_pts(q->frames[0]);
-        if (pts1 != MP_NOPTS_VALUE && pts2 != MP_NOPTS_VALUE &&
-            pts2 - pts1 >= q->cfg.max_duration)
+    double max_duration = atomic_load(&q->max_duration);
+    size_t num_frames = mp_spsc_queue_count(q->frames);
+    if (num_frames >= 2 && max_duration > 0) {
+        // The consumer might remove entries concurrently, so these can be
+        // NULL. This is fine: the queue is not full then.
+        struct entry *e1 = mp_spsc_queue_peek(q->frames, 0);
+        struct entry *e2 = mp_spsc_queue_peek(q->frames, num_frames - 1);
+        if (e1 && e2 && e1->pts != MP_NOPTS_VALUE && e2->pts != MP_NOPTS_VALUE &&
+            e2->pts - e1->pts >= max_duration)
             return true;
     }
     return false;
@@ -114,20 +149,22 @@ static void account_frame(struct async_queue *q, struct mp_frame frame,
 {
     assert(dir == 1 || dir == -1);
 
-    q->samples_size += dir * frame_get_samples(q, frame);
-    q->byte_size += dir * mp_frame_approx_size(frame);
-
-    if (frame.type == MP_FRAME_EOF)
-        q->eof_count += dir;
+    int64_t samples = dir * frame_get_samples(q, frame);
+    int64_t old = atomic_fetch_add(&q->samples_size, samples);
+    assert(old + samples >= 0);
+    atomic_fetch_add(&q->byte_size, dir * (int64_t)mp_frame_approx_size(frame));
 }
 
+// Caller must have the frames locked.
 static void recompute_sizes(struct async_queue *q)
 {
-    q->eof_count = 0;
-    q->samples_size = 0;
-    q->byte_size = 0;
-    for (int n = 0; n < q->num_frames; n++)
-        account_frame(q, q->frames[n], 1);
+    atomic_store(&q->samples_size, 0);
+    atomic_store(&q->byte_size, 0);
+    size_t num_frames = mp_spsc_queue_count(q->frames);
+    for (size_t n = 0; n < num_frames; n++) {
+        struct entry *e = mp_spsc_queue_peek(q->frames, n);
+        account_frame(q, e->frame, 1);
+    }
 }
 
 void mp_async_queue_set_config(struct mp_async_queue *queue,
@@ -143,10 +180,18 @@ void mp_async_queue_set_config(struct mp_async_queue *queue,
     cfg.max_samples = MPMAX(cfg.max_samples, 1);
 
     pthread_mutex_lock(&q->lock);
+    mp_spsc_queue_lock(q->frames);
     bool recompute = q->cfg.sample_unit != cfg.sample_unit;
     q->cfg = cfg;
+    atomic_store(&q->max_samples, cfg.max_samples);
+    atomic_store(&q->max_bytes, cfg.max_bytes);
+    atomic_store(&q->max_duration, cfg.max_duration);
     if (recompute)
         recompute_sizes(q);
+    // The producer might be waiting for the queue to become non-full.
+    if (q->conn[0] && mp_spsc_queue_take_waiting(q->frames, MP_SPSC_PRODUCER))
+        mp_filter_wakeup(q->conn[0]);
+    mp_spsc_queue_unlock(q->frames);
     pthread_mutex_unlock(&q->lock);
 }
 
@@ -157,18 +202,19 @@ void mp_async_queue_reset(struct mp_async_queue *queue)
 
 bool mp_async_queue_is_active(struct mp_async_queue *queue)
 {
-    struct async_queue *q = queue->q;
-    pthread_mutex_lock(&q->lock);
-    bool res = q->active;
-    pthread_mutex_unlock(&q->lock);
-    return res;
+    return atomic_load(&queue->q->active);
 }
 
 bool mp_async_queue_is_full(struct mp_async_queue *queue)
 {
     struct async_queue *q = queue->q;
+    // Only the duration check needs to look at the queued frames.
+    if (atomic_load(&q->max_duration) <= 0)
+        return is_full(q);
     pthread_mutex_lock(&q->lock);
+    mp_spsc_queue_lock(q->frames);
     bool res = is_full(q);
+    mp_spsc_queue_unlock(q->frames);
     pthread_mutex_unlock(&q->lock);
     return res;
 }
@@ -178,8 +224,8 @@ void mp_async_queue_resume(struct mp_async_queue *queue)
     struct async_queue *q = queue->q;
 
     pthread_mutex_lock(&q->lock);
-    if (!q->active) {
-        q->active = true;
+    if (!atomic_load(&q->active)) {
+        atomic_store(&q->active, true);
         // Possibly make the consumer request new frames.
         if (q->conn[1])
             mp_filter_wakeup(q->conn[1]);
@@ -192,9 +238,9 @@ void mp_async_queue_resume_reading(struct mp_async_queue *queue)
     struct async_queue *q = queue->q;
 
     pthread_mutex_lock(&q->lock);
-    if (!q->active || !q->reading) {
-        q->active = true;
-        q->reading = true;
+    if (!atomic_load(&q->active) || !atomic_load(&q->reading)) {
+        atomic_store(&q->active, true);
+        atomic_store(&q->reading, true);
         // Possibly start producer/consumer.
         for (int n = 0; n < 2; n++) {
             if (q->conn[n])
@@ -206,20 +252,12 @@ void mp_async_queue_resume_reading(struct mp_async_queue *queue)
 
 int64_t mp_async_queue_get_samples(struct mp_async_queue *queue)
 {
-    struct async_queue *q = queue->q;
-    pthread_mutex_lock(&q->lock);
-    int64_t res = q->samples_size;
-    pthread_mutex_unlock(&q->lock);
-    return res;
+    return atomic_load(&queue->q->samples_size);
 }
 
 int mp_async_queue_get_frames(struct mp_async_queue *queue)
 {
-    struct async_queue *q = queue->q;
-    pthread_mutex_lock(&q->lock);
-    int res = q->num_frames;
-    pthread_mutex_unlock(&q->lock);
-    return res;
+    return mp_spsc_queue_count(queue->q->frames);
 }
 
 struct priv {
@@ -233,23 +271,36 @@ static void destroy(struct mp_filter *f)
     struct async_queue *q = p->q;
 
     pthread_mutex_lock(&q->lock);
+    mp_spsc_queue_lock(q->frames);
     for (int n = 0; n < 2; n++) {
         if (q->conn[n] == f)
             q->conn[n] = NULL;
     }
+    mp_spsc_queue_unlock(q->frames);
     pthread_mutex_unlock(&q->lock);
 
     unref_queue(q);
 }
 
+// Producer: stop requesting frames until the consumer removed some.
+static void wait_for_consumer(struct mp_filter *f, struct async_queue *q)
+{
+    mp_spsc_queue_set_waiting(q->frames, MP_SPSC_PRODUCER);
+    // Re-check, in case the consumer drained the queue before it could see
+    // the flag.
+    if (!is_full(q) && mp_spsc_queue_take_waiting(q->frames, MP_SPSC_PRODUCER))
+        mp_filter_wakeup(f);
+}
+
 static void process_in(struct mp_filter *f)
 {
     struct priv *p = f->priv;
     struct async_queue *q = p->q;
     assert(q->conn[0] == f);
 
-    pthread_mutex_lock(&q->lock);
-    if (!q->reading) {
+    mp_spsc_queue_reserve(q->frames);
+    mp_spsc_queue_enter(q->frames, MP_SPSC_PRODUCER);
+    if (!atomic_load(&q->reading)) {
         // mp_async_queue_reset()/reset_queue() is usually called asynchronously,
         // so we might have requested a frame earlier, and now can't use it.
         // Discard it; the expectation is that this is a benign logical race
@@ -259,22 +310,29 @@ static void process_in(struct mp_filter *f)
             mp_frame_unref(&frame);
             MP_DBG(f, "discarding frame due to async reset\n");
         }
-    } else if (!is_full(q) && mp_pin_out_request_data(f->ppins[0])) {
+    } else if (is_full(q)) {
+        wait_for_consumer(f, q);
+    } else if (mp_pin_out_request_data(f->ppins[0])) {
         struct mp_frame frame = mp_pin_out_read(f->ppins[0]);
         account_frame(q, frame, 1);
-        MP_TARRAY_INSERT_AT(q, q->frames, q->num_frames, 0, frame);
-        // Notify reader that we have new frames.
-        if (q->conn[1])
+        struct entry e = {frame, mp_frame_get_pts(frame)};
+        mp_spsc_queue_write(q->frames, &e);
+        // Notify reader that we have new frames, if it ran out of them. A
+        // consumer that still has frames queued doesn't need to be woken up.
+        if (q->conn[1] && mp_spsc_queue_take_waiting(q->frames, MP_SPSC_CONSUMER))
             mp_filter_wakeup(q->conn[1]);
         bool full = is_full(q);
-        if (!full)
+        if (full) {
+            wait_for_consumer(f, q);
+        } else {
             mp_pin_out_request_data_next(f->ppins[0]);
+        }
         if (p->notify && full)
             mp_filter_wakeup(p->notify);
     }
-    if (p->notify && !q->num_frames)
+    if (p->notify && !mp_spsc_queue_count(q->frames))
         mp_filter_wakeup(p->notify);
-    pthread_mutex_unlock(&q->lock);
+    mp_spsc_queue_leave(q->frames, MP_SPSC_PRODUCER);
 }
 
 static void process_out(struct mp_filter *f)
@@ -286,22 +344,33 @@ static void process_out(struct mp_filter *f)
     if (!mp_pin_in_needs_data(f->ppins[0]))
         return;
 
-    pthread_mutex_lock(&q->lock);
-    if (q->active && !q->reading) {
-        q->reading = true;
+    mp_spsc_queue_enter(q->frames, MP_SPSC_CONSUMER);
+    bool active = atomic_load(&q->active);
+    if (active && !atomic_load(&q->reading)) {
+        atomic_store(&q->reading, true);
         mp_filter_wakeup(q->conn[0]);
     }
-    if (q->active && q->num_frames) {
-        struct mp_frame frame = q->frames[q->num_frames - 1];
-        q->num_frames -= 1;
-        account_frame(q, frame, -1);
-        assert(q->samples_size >= 0);
-        mp_pin_in_write(f->ppins[0], frame);
-        // Notify writer that we need new frames.
-        if (q->conn[0])
+    struct entry e;
+    if (active && mp_spsc_queue_read(q->frames, &e)) {
+        account_frame(q, e.frame, -1);
+        mp_pin_in_write(f->ppins[0], e.frame);
+        // Notify writer that we need new frames, if it stopped because the
+        // queue was full, or if its notifier wants to know that the queue
+        // ran empty.
+        bool wake = mp_spsc_queue_take_waiting(q->frames, MP_SPSC_PRODUCER);
+        if (atomic_load(&q->notify_empty) && !mp_spsc_queue_count(q->frames))
+            wake = true;
+        if (wake && q->conn[0])
             mp_filter_wakeup(q->conn[0]);
+    } else if (active) {
+        mp_spsc_queue_set_waiting(q->frames, MP_SPSC_CONSUMER);
+        // Re-check, in case the producer added a frame before it could see
+        // the flag.
+        if (mp_spsc_queue_count(q->frames) &&
+            mp_spsc_queue_take_waiting(q->frames, MP_SPSC_CONSUMER))
+            mp_filter_wakeup(f);
     }
-    pthread_mutex_unlock(&q->lock);
+    mp_spsc_queue_leave(q->frames, MP_SPSC_CONSUMER);
 }
 
 static void reset(struct mp_filter *f)
@@ -309,12 +378,10 @@ static void reset(struct mp_filter *f)
     struct priv *p = f->priv;
     struct async_queue *q = p->q;
 
-    pthread_mutex_lock(&q->lock);
     // If the queue is in reading state, it is logical that it should request
     // input immediately.
-    if (mp_pin_get_dir(f->pins[0]) == MP_PIN_IN && q->reading)
+    if (mp_pin_get_dir(f->pins[0]) == MP_PIN_IN && atomic_load(&q->reading))
         mp_filter_wakeup(f);
-    pthread_mutex_unlock(&q->lock);
 }
 
 // producer
@@ -340,6 +407,7 @@ void mp_async_queue_set_notifier(struct mp_filter *f, struct mp_filter *notify)
     struct priv *p = f->priv;
     if (p->notify != notify) {
         p->notify = notify;
+        atomic_store(&p->q->notify_empty, !!notify);
         if (notify)
             mp_filter_wakeup(notify);
     }
@@ -366,9 +434,11 @@ struct mp_filter *mp_async_queue_create_filter(struct mp_filter *parent,
     p->q = q;
 
     pthread_mutex_lock(&q->lock);
+    mp_spsc_queue_lock(q->frames);
     int slot = is_in ? 0 : 1;
     assert(!q->conn[slot]); // fails if already connected on this end
     q->conn[slot] = f;
+    mp_spsc_queue_unlock(q->frames);
     pthread_mutex_unlock(&q->lock);
 
     return f;
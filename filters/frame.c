@@ -85,6 +85,11 @@ static void *packet_ref(void *data)
     return demux_copy_packet(data);
 }
 
+static void packet_free(void *data)
+{
+    free_demux_packet(data);
+}
+
 static const struct frame_handler frame_handlers[] = {
     [MP_FRAME_NONE] = {
         .name = "none",
@@ -119,7 +124,7 @@ static const struct frame_handler frame_handlers[] = {
         .name = "packet",
         .is_data = true,
         .new_ref = packet_ref,
-        .free = talloc_free,
+        .free = packet_free,
     },
 };
 
@@ -227,13 +227,32 @@ bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct mpv_handle *h,
                               int out_fd[2]);
 void mp_uninit_ipc(struct mp_ipc_ctx *ctx);
 
-// Serialize the given mpv_event structure to JSON. Returns an allocated string.
-struct mpv_event;
-char *mp_json_encode_event(struct mpv_event *event);
+// Wire format of an IPC connection. Connections start with MP_IPC_JSON, and
+// the client can switch with the "ipc_protocol" command.
+enum mp_ipc_protocol {
+    MP_IPC_JSON,        // one JSON object per line
+    MP_IPC_MSGPACK,     // 32 bit big endian length, followed by MessagePack
+};
 
-// Given the raw IPC input buffer "buf", remove the first newline-separated
-// command, execute it and return the result (if any) as an allocated string.
+// Serialize the given mpv_event structure, and append the message (including
+// the newline or length prefix) to *dst, which is (re)allocated under
+// ta_parent.
+struct mpv_event;
+void mp_ipc_write_event(void *ta_parent, bstr *dst, struct mpv_event *event,
+                        enum mp_ipc_protocol proto);
+
+// Return the size of the first message in buf (including the newline or
+// length prefix), 0 if it is incomplete, or -1 if the data is invalid and the
+// client should be disconnected.
+ptrdiff_t mp_ipc_message_size(enum mp_ipc_protocol proto, bstr buf);
+
+// Execute a single message, as delimited by mp_ipc_message_size(). The data
+// is parsed in place and may be overwritten. If reply is not NULL, the reply
+// (if any) is appended to it (allocated under ta_parent). *proto is updated
+// if the message switched the protocol; the reply still uses the old one.
 struct mpv_handle;
-char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *buf);
+void mp_ipc_execute_message(struct mpv_handle *client,
+                            enum mp_ipc_protocol *proto, bstr msg,
+                            void *ta_parent, bstr *reply);
 
 #endif /* MPLAYER_INPUT_H */
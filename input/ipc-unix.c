@@ -43,10 +43,18 @@
 #define MSG_NOSIGNAL 0
 #endif
 
+// Stop reading commands and events from a client if this much output is
+// queued and could not be written yet.
+#define IPC_MAX_OUTPUT (1024 * 1024)
+
+// Maximum amount of data read from a client socket at once.
+#define IPC_READ_SIZE (16 * 1024)
+
 struct mp_ipc_ctx {
     struct mp_log *log;
     struct mp_client_api *client_api;
     const char *path;
+    bool multiplex;
 
     pthread_t thread;
     int death_pipe[2];
@@ -62,166 +70,275 @@ struct client_arg {
     bool quit_on_close;
 
     bool writable;
+
+    int wakeup_fd;
+    bstr client_msg;        // received data, not parsed yet (talloc root)
+    size_t client_msg_pos;  // start of unparsed data in client_msg
+    bstr out_buf;           // data that could not be written yet
+    bool events_pending;    // client wakeup pipe was triggered
+    bool eof;               // client closed its end of the connection
+    enum mp_ipc_protocol protocol;
 };
 
-static int ipc_write_str(struct client_arg *client, const char *buf)
+static void ignore_sigpipe(void)
+{
+    // We don't use MSG_NOSIGNAL because the moldy fruit OS doesn't support it.
+    struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_RESTART };
+    sigfillset(&sa.sa_mask);
+    sigaction(SIGPIPE, &sa, NULL);
+}
+
+// Write as much of the queued output as possible without blocking.
+static int ipc_flush(struct client_arg *client)
 {
-    size_t count = strlen(buf);
-    while (count > 0) {
-        ssize_t rc = send(client->client_fd, buf, count, MSG_NOSIGNAL);
+    size_t done = 0;
+    while (done < client->out_buf.len) {
+        ssize_t rc = send(client->client_fd, client->out_buf.start + done,
+                          client->out_buf.len - done, MSG_NOSIGNAL);
         if (rc <= 0) {
             if (rc == 0)
                 return -1;
 
             if (errno == EBADF || errno == ENOTSOCK) {
                 client->writable = false;
+                client->out_buf.len = 0;
                 return 0;
             }
 
-            if (errno == EINTR || errno == EAGAIN)
+            if (errno == EINTR)
                 continue;
 
+            if (errno == EAGAIN)
+                break;
+
             return rc;
         }
 
-        count -= rc;
-        buf   += rc;
+        done += rc;
     }
 
+    client->out_buf.len -= done;
+    memmove(client->out_buf.start, client->out_buf.start + done,
+            client->out_buf.len);
     return 0;
 }
 
-static void *client_thread(void *p)
+static bool ipc_output_full(struct client_arg *client)
 {
-    pthread_detach(pthread_self());
-
-    // We don't use MSG_NOSIGNAL because the moldy fruit OS doesn't support it.
-    struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_RESTART };
-    sigfillset(&sa.sa_mask);
-    sigaction(SIGPIPE, &sa, NULL);
-
-    int rc;
-
-    struct client_arg *arg = p;
-    bstr client_msg = { talloc_strdup(NULL, ""), 0 };
+    return client->out_buf.len >= IPC_MAX_OUTPUT;
+}
 
-    char *tname = talloc_asprintf(NULL, "ipc/%s", arg->client_name);
-    mpthread_set_name(tname);
-    talloc_free(tname);
+// Invalid input counts as a command too; client_run_commands() handles it.
+static bool ipc_have_command(struct client_arg *client)
+{
+    bstr rest = bstr_cut(client->client_msg, client->client_msg_pos);
+    return mp_ipc_message_size(client->protocol, rest) != 0;
+}
 
-    int pipe_fd = mpv_get_wakeup_pipe(arg->client);
-    if (pipe_fd < 0) {
+static bool client_init(struct client_arg *arg)
+{
+    arg->wakeup_fd = mpv_get_wakeup_pipe(arg->client);
+    if (arg->wakeup_fd < 0) {
         MP_ERR(arg, "Could not get wakeup pipe\n");
-        goto done;
+        return false;
     }
 
     MP_VERBOSE(arg, "Client connected\n");
 
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = pipe_fd},
-        {.events = POLLIN, .fd = arg->client_fd},
+    fcntl(arg->client_fd, F_SETFL, fcntl(arg->client_fd, F_GETFL, 0) | O_NONBLOCK);
+    return true;
+}
+
+static void client_destroy(struct client_arg *arg)
+{
+    if (arg->client_msg.len > arg->client_msg_pos)
+        MP_WARN(arg, "Ignoring unterminated command on disconnect.\n");
+    talloc_free(arg->client_msg.start);
+    if (arg->close_client_fd)
+        close(arg->client_fd);
+    struct mpv_handle *h = arg->client;
+    bool quit = arg->quit_on_close;
+    talloc_free(arg);
+    if (quit) {
+        mpv_terminate_destroy(h);
+    } else {
+        mpv_destroy(h);
+    }
+}
+
+// Fill in the 2 pollfd entries for the client. Returns true if the client can
+// make progress without waiting for I/O (i.e. the poll timeout must be 0).
+static bool client_prepare_poll(struct client_arg *arg, struct pollfd fds[2])
+{
+    bool full = ipc_output_full(arg);
+    fds[0] = (struct pollfd){
+        .fd = arg->wakeup_fd,
+        .events = full || arg->eof ? 0 : POLLIN,
+    };
+    fds[1] = (struct pollfd){
+        .fd = arg->client_fd,
+        .events = (full || arg->eof ? 0 : POLLIN) |
+                  (arg->out_buf.len ? POLLOUT : 0),
     };
+    return !full && ((arg->events_pending && !arg->eof) || ipc_have_command(arg));
+}
 
-    fcntl(arg->client_fd, F_SETFL, fcntl(arg->client_fd, F_GETFL, 0) | O_NONBLOCK);
+// Returns false if the client should be disconnected.
+static bool client_read_events(struct client_arg *arg)
+{
+    while (arg->events_pending && !arg->eof && !ipc_output_full(arg)) {
+        mpv_event *event = mpv_wait_event(arg->client, 0);
 
-    while (1) {
-        rc = poll(fds, 2, 0);
-        if (rc == 0)
-            rc = poll(fds, 2, -1);
-        if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
-            continue;
+        if (event->event_id == MPV_EVENT_NONE) {
+            arg->events_pending = false;
+            break;
         }
 
-        if (fds[0].revents & POLLIN) {
-            mp_flush_wakeup_pipe(pipe_fd);
+        if (event->event_id == MPV_EVENT_SHUTDOWN)
+            return false;
 
-            while (1) {
-                mpv_event *event = mpv_wait_event(arg->client, 0);
+        if (!arg->writable)
+            continue;
 
-                if (event->event_id == MPV_EVENT_NONE)
-                    break;
+        mp_ipc_write_event(arg, &arg->out_buf, event, arg->protocol);
+    }
+    return true;
+}
 
-                if (event->event_id == MPV_EVENT_SHUTDOWN)
-                    goto done;
+// Returns false if the client should be disconnected.
+static bool client_read_input(struct client_arg *arg)
+{
+    unsigned char buf[IPC_READ_SIZE];
+    ssize_t bytes = read(arg->client_fd, buf, sizeof(buf));
+    if (bytes < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return true;
 
-                if (!arg->writable)
-                    continue;
+        MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
+        return false;
+    }
 
-                char *event_msg = mp_json_encode_event(event);
-                if (!event_msg) {
-                    MP_ERR(arg, "Encoding error\n");
-                    goto done;
-                }
+    if (bytes == 0) {
+        MP_VERBOSE(arg, "Client disconnected\n");
+        arg->eof = true;
+        return true;
+    }
 
-                rc = ipc_write_str(arg, event_msg);
-                talloc_free(event_msg);
-                if (rc < 0) {
-                    MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
-            }
+    // Drop data that was already parsed before appending new data.
+    if (arg->client_msg_pos) {
+        arg->client_msg.len -= arg->client_msg_pos;
+        memmove(arg->client_msg.start,
+                arg->client_msg.start + arg->client_msg_pos,
+                arg->client_msg.len);
+        arg->client_msg_pos = 0;
+    }
+
+    bstr_xappend(NULL, &arg->client_msg, (bstr){buf, bytes});
+    return true;
+}
+
+// Returns false if the client should be disconnected.
+static bool client_run_commands(struct client_arg *arg)
+{
+    while (!ipc_output_full(arg) || arg->eof) {
+        bstr rest = bstr_cut(arg->client_msg, arg->client_msg_pos);
+        ptrdiff_t len = mp_ipc_message_size(arg->protocol, rest);
+        if (len < 0) {
+            MP_ERR(arg, "Invalid message length received.\n");
+            return false;
         }
+        if (len == 0)
+            break;
+
+        // Parse the message in place, and write the reply directly to the
+        // output buffer. The input data is dropped after this anyway.
+        arg->client_msg_pos += len;
+
+        mp_ipc_execute_message(arg->client, &arg->protocol,
+                               (bstr){rest.start, len}, arg,
+                               arg->writable ? &arg->out_buf : NULL);
+    }
+    return true;
+}
 
-        if (fds[1].revents & (POLLIN | POLLHUP | POLLNVAL)) {
-            while (1) {
-                char buf[128];
-                bstr append = { buf, 0 };
+// Handle the results of poll() for fds as set by client_prepare_poll().
+// Returns false if the client should be disconnected.
+static bool client_process(struct client_arg *arg, struct pollfd fds[2])
+{
+    if (fds[0].revents & POLLIN) {
+        mp_flush_wakeup_pipe(arg->wakeup_fd);
+        arg->events_pending = true;
+    }
 
-                ssize_t bytes = read(arg->client_fd, buf, sizeof(buf));
-                if (bytes < 0) {
-                    if (errno == EAGAIN)
-                        break;
+    if ((fds[1].revents & (POLLIN | POLLHUP | POLLNVAL)) && !arg->eof &&
+        !ipc_output_full(arg))
+    {
+        if (!client_read_input(arg))
+            return false;
+    }
 
-                    MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
+    if (!client_read_events(arg))
+        return false;
 
-                if (bytes == 0) {
-                    MP_VERBOSE(arg, "Client disconnected\n");
-                    goto done;
-                }
+    if (!client_run_commands(arg))
+        return false;
 
-                append.len = bytes;
+    if (ipc_flush(arg) < 0) {
+        MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
+        return false;
+    }
 
-                bstr_xappend(NULL, &client_msg, append);
+    // Wait until all replies were written before closing the connection.
+    return !arg->eof || arg->out_buf.len;
+}
 
-                while (bstrchr(client_msg, '\n') != -1) {
-                    char *reply_msg = mp_ipc_consume_next_command(arg->client,
-                        NULL, &client_msg);
+static void *client_thread(void *p)
+{
+    pthread_detach(pthread_self());
 
-                    if (reply_msg && arg->writable) {
-                        rc = ipc_write_str(arg, reply_msg);
-                        if (rc < 0) {
-                            MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                            talloc_free(reply_msg);
-                            goto done;
-                        }
-                    }
+    ignore_sigpipe();
 
-                    talloc_free(reply_msg);
-                }
-            }
+    struct client_arg *arg = p;
+
+    char *tname = talloc_asprintf(NULL, "ipc/%s", arg->client_name);
+    mpthread_set_name(tname);
+    talloc_free(tname);
+
+    if (!client_init(arg))
+        goto done;
+
+    while (1) {
+        struct pollfd fds[2];
+        bool busy = client_prepare_poll(arg, fds);
+        int rc = poll(fds, 2, busy ? 0 : -1);
+        if (rc < 0) {
+            MP_ERR(arg, "Poll error\n");
+            continue;
         }
+
+        if (!client_process(arg, fds))
+            break;
     }
 
 done:
-    if (client_msg.len > 0)
-        MP_WARN(arg, "Ignoring unterminated command on disconnect.\n");
-    talloc_free(client_msg.start);
-    if (arg->close_client_fd)
-        close(arg->client_fd);
-    struct mpv_handle *h = arg->client;
-    bool quit = arg->quit_on_close;
-    talloc_free(arg);
-    if (quit) {
-        mpv_terminate_destroy(h);
-    } else {
-        mpv_destroy(h);
-    }
+    client_destroy(arg);
     return NULL;
 }
 
+static struct client_arg *ipc_new_client(struct mp_ipc_ctx *ctx, int id, int fd)
+{
+    struct client_arg *client = talloc_ptrtype(NULL, client);
+    *client = (struct client_arg){
+        .client_name =
+            id >= 0 ? talloc_asprintf(client, "ipc-%d", id) : "ipc",
+        .client_fd = fd,
+        .close_client_fd = id >= 0,
+        .quit_on_close = id < 0,
+        .writable = true,
+    };
+    return client;
+}
+
 static bool ipc_start_client(struct mp_ipc_ctx *ctx, struct client_arg *client,
                              bool free_on_init_fail)
 {
@@ -253,17 +370,30 @@ err:
 
 static void ipc_start_client_json(struct mp_ipc_ctx *ctx, int id, int fd)
 {
-    struct client_arg *client = talloc_ptrtype(NULL, client);
-    *client = (struct client_arg){
-        .client_name =
-            id >= 0 ? talloc_asprintf(client, "ipc-%d", id) : "ipc",
-        .client_fd = fd,
-        .close_client_fd = id >= 0,
-        .quit_on_close = id < 0,
-        .writable = true,
-    };
+    ipc_start_client(ctx, ipc_new_client(ctx, id, fd), true);
+}
+
+// Like ipc_start_client_json(), but the client is served by the caller's
+// poll loop instead of a separate thread.
+static struct client_arg *ipc_add_client_json(struct mp_ipc_ctx *ctx, int id,
+                                              int fd)
+{
+    struct client_arg *client = ipc_new_client(ctx, id, fd);
+    client->client = mp_new_client(ctx->client_api, client->client_name);
+    if (!client->client) {
+        close(fd);
+        talloc_free(client);
+        return NULL;
+    }
+
+    client->log = mp_client_get_log(client->client);
+
+    if (!client_init(client)) {
+        client_destroy(client);
+        return NULL;
+    }
 
-    ipc_start_client(ctx, client, true);
+    return client;
 }
 
 bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct mpv_handle *h,
@@ -304,6 +434,11 @@ static void *ipc_thread(void *p)
 
     struct mp_ipc_ctx *arg = p;
 
+    // Only used with --input-ipc-multiplex.
+    struct client_arg **clients = NULL;
+    int num_clients = 0;
+    struct pollfd *fds = NULL;
+
     mpthread_set_name("ipc/socket");
 
     MP_VERBOSE(arg, "Starting IPC master\n");
@@ -349,13 +484,20 @@ static void *ipc_thread(void *p)
 
     int client_num = 0;
 
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = arg->death_pipe[0]},
-        {.events = POLLIN, .fd = ipc_fd},
-    };
+    if (arg->multiplex)
+        ignore_sigpipe();
 
     while (1) {
-        rc = poll(fds, 2, -1);
+        int num_polled = num_clients;
+        MP_TARRAY_GROW(NULL, fds, 2 + num_polled * 2);
+        fds[0] = (struct pollfd){.events = POLLIN, .fd = arg->death_pipe[0]};
+        fds[1] = (struct pollfd){.events = POLLIN, .fd = ipc_fd};
+
+        bool busy = false;
+        for (int n = 0; n < num_polled; n++)
+            busy |= client_prepare_poll(clients[n], &fds[2 + n * 2]);
+
+        rc = poll(fds, 2 + num_polled * 2, busy ? 0 : -1);
         if (rc < 0) {
             MP_ERR(arg, "Poll error\n");
             continue;
@@ -371,11 +513,31 @@ static void *ipc_thread(void *p)
                 goto done;
             }
 
-            ipc_start_client_json(arg, client_num++, client_fd);
+            if (arg->multiplex) {
+                struct client_arg *client =
+                    ipc_add_client_json(arg, client_num++, client_fd);
+                if (client)
+                    MP_TARRAY_APPEND(NULL, clients, num_clients, client);
+            } else {
+                ipc_start_client_json(arg, client_num++, client_fd);
+            }
+        }
+
+        // Backwards, so that removing entries doesn't disturb the fds indexes.
+        for (int n = num_polled - 1; n >= 0; n--) {
+            if (!client_process(clients[n], &fds[2 + n * 2])) {
+                client_destroy(clients[n]);
+                MP_TARRAY_REMOVE_AT(clients, num_clients, n);
+            }
         }
     }
 
 done:
+    for (int n = 0; n < num_clients; n++)
+        client_destroy(clients[n]);
+    talloc_free(clients);
+    talloc_free(fds);
+
     if (ipc_fd >= 0)
         close(ipc_fd);
 
@@ -392,6 +554,7 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
         .log        = mp_log_new(arg, global->log, "ipc"),
         .client_api = client_api,
         .path       = mp_get_user_path(arg, global, opts->ipc_path),
+        .multiplex  = opts->ipc_multiplex,
         .death_pipe = {-1, -1},
     };
 
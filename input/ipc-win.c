@@ -165,11 +165,11 @@ static bool pipe_error_is_fatal(DWORD error)
     return true;
 }
 
-static DWORD ipc_write_str(struct client_arg *arg, const char *buf)
+static DWORD ipc_write(struct client_arg *arg, bstr buf)
 {
     DWORD error = 0;
 
-    if ((error = async_write(arg->client_h, buf, strlen(buf), &arg->write_ol)))
+    if ((error = async_write(arg->client_h, buf.start, buf.len, &arg->write_ol)))
         goto done;
     if (!GetOverlappedResult(arg->client_h, &arg->write_ol, &(DWORD){0}, TRUE)) {
         error = GetLastError();
@@ -207,6 +207,8 @@ static void *client_thread(void *p)
     HANDLE wakeup_event = CreateEventW(NULL, TRUE, FALSE, NULL);
     OVERLAPPED ol = { .hEvent = CreateEventW(NULL, TRUE, TRUE, NULL) };
     bstr client_msg = { talloc_strdup(NULL, ""), 0 };
+    bstr out_msg = {0};
+    enum mp_ipc_protocol protocol = MP_IPC_JSON;
     DWORD ioerr = 0;
     DWORD r;
 
@@ -252,14 +254,9 @@ static void *client_thread(void *p)
                 if (!arg->writable)
                     continue;
 
-                char *event_msg = mp_json_encode_event(event);
-                if (!event_msg) {
-                    MP_ERR(arg, "Encoding error\n");
-                    goto done;
-                }
-
-                ipc_write_str(arg, event_msg);
-                talloc_free(event_msg);
+                out_msg.len = 0;
+                mp_ipc_write_event(NULL, &out_msg, event, protocol);
+                ipc_write(arg, out_msg);
             }
 
             break;
@@ -271,13 +268,27 @@ static void *client_thread(void *p)
             }
 
             bstr_xappend(NULL, &client_msg, (bstr){buf, r});
-            while (bstrchr(client_msg, '\n') != -1) {
-                char *reply_msg = mp_ipc_consume_next_command(arg->client,
-                    NULL, &client_msg);
-                if (reply_msg && arg->writable)
-                    ipc_write_str(arg, reply_msg);
-                talloc_free(reply_msg);
+            size_t pos = 0;
+            while (1) {
+                bstr rest = bstr_cut(client_msg, pos);
+                ptrdiff_t len = mp_ipc_message_size(protocol, rest);
+                if (len < 0) {
+                    MP_ERR(arg, "Invalid message length received.\n");
+                    goto done;
+                }
+                if (len == 0)
+                    break;
+                pos += len;
+
+                out_msg.len = 0;
+                mp_ipc_execute_message(arg->client, &protocol,
+                                       (bstr){rest.start, len}, NULL, &out_msg);
+                if (out_msg.len && arg->writable)
+                    ipc_write(arg, out_msg);
             }
+            // Drop the executed messages.
+            client_msg.len -= pos;
+            memmove(client_msg.start, client_msg.start + pos, client_msg.len);
 
             // Begin the next read operation on the pipe
             if ((ioerr = async_read(arg->client_h, buf, 4096, &ol))) {
@@ -304,6 +315,9 @@ done:
     if (arg->write_ol.hEvent)
         CloseHandle(arg->write_ol.hEvent);
 
+    talloc_free(client_msg.start);
+    talloc_free(out_msg.start);
+
     CloseHandle(arg->client_h);
     mpv_destroy(arg->client);
     talloc_free(arg);
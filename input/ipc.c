@@ -18,8 +18,8 @@
 #include "common/msg.h"
 #include "input/input.h"
 #include "misc/json.h"
+#include "misc/msgpack.h"
 #include "misc/node.h"
-#include "options/m_option.h"
 #include "options/options.h"
 #include "options/path.h"
 #include "player/client.h"
@@ -35,110 +35,156 @@ static mpv_node *mpv_node_array_get(mpv_node *src, int index)
     return &src->u.list->values[index];
 }
 
-static void mpv_node_map_add(void *ta_parent, mpv_node *src, const char *key, mpv_node *val)
-{
-    if (src->format != MPV_FORMAT_NODE_MAP)
-        return;
-
-    if (!src->u.list)
-        src->u.list = talloc_zero(ta_parent, mpv_node_list);
-
-    MP_TARRAY_GROW(src->u.list, src->u.list->keys, src->u.list->num);
-    MP_TARRAY_GROW(src->u.list, src->u.list->values, src->u.list->num);
-
-    src->u.list->keys[src->u.list->num] = talloc_strdup(ta_parent, key);
+// Maximum size of a single length-prefixed message received from a client.
+// Anything larger is assumed to be garbage.
+#define MAX_MSGPACK_MESSAGE (16 * 1024 * 1024)
 
-    static const struct m_option type = { .type = CONF_TYPE_NODE };
-    m_option_get_node(&type, ta_parent, &src->u.list->values[src->u.list->num], val);
-
-    src->u.list->num++;
-}
-
-static void mpv_node_map_add_null(void *ta_parent, mpv_node *src, const char *key)
+static void write_be32(unsigned char *dst, uint32_t v)
 {
-    mpv_node val_node = {.format = MPV_FORMAT_NONE};
-    mpv_node_map_add(ta_parent, src, key, &val_node);
+    for (int n = 0; n < 4; n++)
+        dst[n] = v >> (8 * (3 - n));
 }
 
-static void mpv_node_map_add_int64(void *ta_parent, mpv_node *src, const char *key, int64_t val)
+// Start a message in *dst. Returns the position of the message.
+static size_t begin_message(void *ta_parent, bstr *dst,
+                            enum mp_ipc_protocol proto)
 {
-    mpv_node val_node = {.format = MPV_FORMAT_INT64, .u.int64 = val};
-    mpv_node_map_add(ta_parent, src, key, &val_node);
+    size_t start = dst->len;
+    // Reserve the length prefix; it's filled in by end_message().
+    if (proto == MP_IPC_MSGPACK)
+        bstr_xappend(ta_parent, dst, (bstr){(unsigned char[4]){0}, 4});
+    return start;
 }
 
-static void mpv_node_map_add_string(void *ta_parent, mpv_node *src, const char *key, const char *val)
+static void end_message(void *ta_parent, bstr *dst,
+                        enum mp_ipc_protocol proto, size_t start)
 {
-    mpv_node val_node = {.format = MPV_FORMAT_STRING, .u.string = (char*)val};
-    mpv_node_map_add(ta_parent, src, key, &val_node);
+    if (proto == MP_IPC_MSGPACK) {
+        write_be32(dst->start + start, dst->len - start - 4);
+    } else {
+        bstr_xappend(ta_parent, dst, bstr0("\n"));
+    }
 }
 
-// This is supposed to write a reply that looks like "normal" command execution.
-static void mpv_format_command_reply(void *ta_parent, mpv_event *event,
-                                     mpv_node *dst)
+// Write a command reply. data is omitted if NULL, and request_id is 0 if
+// reqid is NULL.
+static void write_reply(void *ta_parent, bstr *dst, enum mp_ipc_protocol proto,
+                        const mpv_node *data, const mpv_node *reqid, int error)
 {
-    assert(event->event_id == MPV_EVENT_COMMAND_REPLY);
-    mpv_event_command *cmd = event->data;
-
-    mpv_node_map_add_int64(ta_parent, dst, "request_id", event->reply_userdata);
-
-    mpv_node_map_add_string(ta_parent, dst, "error",
-                            mpv_error_string(event->error));
+    size_t start = begin_message(ta_parent, dst, proto);
+    const mpv_node reqid_def = {.format = MPV_FORMAT_INT64, .u.int64 = 0};
+    if (!reqid)
+        reqid = &reqid_def;
+
+    if (proto == MP_IPC_MSGPACK) {
+        struct msgpack_writer w;
+        msgpack_writer_init(&w, ta_parent, dst);
+        msgpack_writer_map(&w, data ? 3 : 2);
+        if (data) {
+            msgpack_writer_string(&w, "data");
+            msgpack_writer_node(&w, data);
+        }
+        msgpack_writer_string(&w, "request_id");
+        msgpack_writer_node(&w, reqid);
+        msgpack_writer_string(&w, "error");
+        msgpack_writer_string(&w, mpv_error_string(error));
+    } else {
+        struct json_writer w;
+        json_writer_init(&w, ta_parent, dst);
+        json_writer_begin(&w, true);
+        if (data) {
+            json_writer_key(&w, "data");
+            json_writer_node(&w, data);
+        }
+        json_writer_key(&w, "request_id");
+        json_writer_node(&w, reqid);
+        json_writer_key(&w, "error");
+        json_writer_string(&w, mpv_error_string(error));
+        json_writer_end(&w, true);
+    }
 
-    mpv_node_map_add(ta_parent, dst, "data", &cmd->result);
+    end_message(ta_parent, dst, proto, start);
 }
 
-char *mp_json_encode_event(mpv_event *event)
+void mp_ipc_write_event(void *ta_parent, bstr *dst, mpv_event *event,
+                        enum mp_ipc_protocol proto)
 {
-    void *ta_parent = talloc_new(NULL);
+    if (event->event_id == MPV_EVENT_COMMAND_REPLY) {
+        // This is supposed to write a reply that looks like "normal" command
+        // execution.
+        mpv_event_command *cmd = event->data;
+        mpv_node reqid = {.format = MPV_FORMAT_INT64,
+                          .u.int64 = event->reply_userdata};
+        write_reply(ta_parent, dst, proto, &cmd->result, &reqid, event->error);
+        return;
+    }
+
+    size_t start = begin_message(ta_parent, dst, proto);
 
     struct mpv_node event_node;
-    if (event->event_id == MPV_EVENT_COMMAND_REPLY) {
-        event_node = (mpv_node){.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
-        mpv_format_command_reply(ta_parent, event, &event_node);
+    mpv_event_to_node(&event_node, event);
+    if (proto == MP_IPC_MSGPACK) {
+        struct msgpack_writer w;
+        msgpack_writer_init(&w, ta_parent, dst);
+        msgpack_writer_node(&w, &event_node);
     } else {
-        mpv_event_to_node(&event_node, event);
-        // Abuse mpv_event_to_node() internals.
-        talloc_steal(ta_parent, node_get_alloc(&event_node));
+        struct json_writer w;
+        json_writer_init(&w, ta_parent, dst);
+        json_writer_node(&w, &event_node);
     }
+    // Abuse mpv_event_to_node() internals.
+    talloc_free(node_get_alloc(&event_node));
 
-    char *output = talloc_strdup(NULL, "");
-    json_write(&output, &event_node);
-    output = ta_talloc_strdup_append(output, "\n");
-
-    talloc_free(ta_parent);
+    end_message(ta_parent, dst, proto, start);
+}
 
-    return output;
+static bool parse_protocol(const char *name, enum mp_ipc_protocol *out)
+{
+    if (!strcmp(name, "json")) {
+        *out = MP_IPC_JSON;
+    } else if (!strcmp(name, "msgpack")) {
+        *out = MP_IPC_MSGPACK;
+    } else {
+        return false;
+    }
+    return true;
 }
 
-// Function is allowed to modify src[n].
-static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
-                                  char *src)
+// Execute the parsed message msg_node (NULL if it could not be parsed). The
+// reply, if any, is appended to *reply using the protocol in *proto, which is
+// updated if the client switches protocols.
+static void execute_command(struct mpv_handle *client, mpv_node *msg_node,
+                            enum mp_ipc_protocol *proto, void *ta_parent,
+                            bstr *reply)
 {
     int rc;
     const char *cmd = NULL;
     struct mp_log *log = mp_client_get_log(client);
-
-    mpv_node msg_node;
-    mpv_node reply_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
+    // The reply to the protocol switch is sent using the old protocol.
+    enum mp_ipc_protocol reply_proto = *proto;
+
+    // The reply data is written directly from these, without copying them.
+    mpv_node reply_data = {.format = MPV_FORMAT_NONE};
+    bool has_reply_data = false;
+    mpv_node result_node = {0};
+    char *result_str = NULL;
     mpv_node *reqid_node = NULL;
     int64_t reqid = 0;
     mpv_node *async_node = NULL;
     bool async = false;
     bool send_reply = true;
 
-    rc = json_parse(ta_parent, &msg_node, &src, MAX_JSON_DEPTH);
-    if (rc < 0) {
-        mp_err(log, "malformed JSON received: '%s'\n", src);
+    if (!msg_node) {
         rc = MPV_ERROR_INVALID_PARAMETER;
         goto error;
     }
 
-    if (msg_node.format != MPV_FORMAT_NODE_MAP) {
+    if (msg_node->format != MPV_FORMAT_NODE_MAP) {
         rc = MPV_ERROR_INVALID_PARAMETER;
         goto error;
     }
 
-    async_node = node_map_get(&msg_node, "async");
+    async_node = node_map_get(msg_node, "async");
     if (async_node) {
         if (async_node->format != MPV_FORMAT_FLAG) {
             rc = MPV_ERROR_INVALID_PARAMETER;
@@ -147,7 +193,7 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
         async = async_node->u.flag;
     }
 
-    reqid_node = node_map_get(&msg_node, "request_id");
+    reqid_node = node_map_get(msg_node, "request_id");
     if (reqid_node) {
         if (reqid_node->format == MPV_FORMAT_INT64) {
             reqid = reqid_node->u.int64;
@@ -161,7 +207,7 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
         }
     }
 
-    mpv_node *cmd_node = node_map_get(&msg_node, "command");
+    mpv_node *cmd_node = node_map_get(msg_node, "command");
     if (!cmd_node) {
         rc = MPV_ERROR_INVALID_PARAMETER;
         goto error;
@@ -178,20 +224,34 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
     }
 
     if (cmd && !strcmp("client_name", cmd)) {
-        const char *client_name = mpv_client_name(client);
-        mpv_node_map_add_string(ta_parent, &reply_node, "data", client_name);
+        reply_data = (mpv_node){.format = MPV_FORMAT_STRING,
+                                .u.string = (char *)mpv_client_name(client)};
+        has_reply_data = true;
         rc = MPV_ERROR_SUCCESS;
     } else if (cmd && !strcmp("get_time_us", cmd)) {
-        int64_t time_us = mpv_get_time_us(client);
-        mpv_node_map_add_int64(ta_parent, &reply_node, "data", time_us);
+        reply_data = (mpv_node){.format = MPV_FORMAT_INT64,
+                                .u.int64 = mpv_get_time_us(client)};
+        has_reply_data = true;
         rc = MPV_ERROR_SUCCESS;
     } else if (cmd && !strcmp("get_version", cmd)) {
-        int64_t ver = mpv_client_api_version();
-        mpv_node_map_add_int64(ta_parent, &reply_node, "data", ver);
+        reply_data = (mpv_node){.format = MPV_FORMAT_INT64,
+                                .u.int64 = mpv_client_api_version()};
+        has_reply_data = true;
         rc = MPV_ERROR_SUCCESS;
-    } else if (cmd && !strcmp("get_property", cmd)) {
-        mpv_node result_node;
+    } else if (cmd && !strcmp("ipc_protocol", cmd)) {
+        if (cmd_node->u.list->num != 2) {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
 
+        if (cmd_node->u.list->values[1].format != MPV_FORMAT_STRING ||
+            !parse_protocol(cmd_node->u.list->values[1].u.string, proto))
+        {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+        rc = MPV_ERROR_SUCCESS;
+    } else if (cmd && !strcmp("get_property", cmd)) {
         if (cmd_node->u.list->num != 2) {
             rc = MPV_ERROR_INVALID_PARAMETER;
             goto error;
@@ -205,8 +265,8 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
         rc = mpv_get_property(client, cmd_node->u.list->values[1].u.string,
                               MPV_FORMAT_NODE, &result_node);
         if (rc >= 0) {
-            mpv_node_map_add(ta_parent, &reply_node, "data", &result_node);
-            mpv_free_node_contents(&result_node);
+            reply_data = result_node;
+            has_reply_data = true;
         }
     } else if (cmd && !strcmp("get_property_string", cmd)) {
         if (cmd_node->u.list->num != 2) {
@@ -219,14 +279,13 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
             goto error;
         }
 
-        char *result = mpv_get_property_string(client,
+        result_str = mpv_get_property_string(client,
                                         cmd_node->u.list->values[1].u.string);
-        if (result) {
-            mpv_node_map_add_string(ta_parent, &reply_node, "data", result);
-            mpv_free(result);
-        } else {
-            mpv_node_map_add_null(ta_parent, &reply_node, "data");
+        if (result_str) {
+            reply_data = (mpv_node){.format = MPV_FORMAT_STRING,
+                                    .u.string = result_str};
         }
+        has_reply_data = true;
     } else if (cmd && (!strcmp("set_property", cmd) ||
                        !strcmp("set_property_string", cmd)))
     {
@@ -242,8 +301,12 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
 
         rc = mpv_set_property(client, cmd_node->u.list->values[1].u.string,
                               MPV_FORMAT_NODE, &cmd_node->u.list->values[2]);
-    } else if (cmd && !strcmp("observe_property", cmd)) {
-        if (cmd_node->u.list->num != 3) {
+    } else if (cmd && (!strcmp("observe_property", cmd) ||
+                       !strcmp("observe_property_string", cmd)))
+    {
+        bool is_string = !strcmp("observe_property_string", cmd);
+        int num_args = cmd_node->u.list->num;
+        if (num_args != 3 && num_args != 4) {
             rc = MPV_ERROR_INVALID_PARAMETER;
             goto error;
         }
@@ -258,30 +321,32 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
             goto error;
         }
 
-        rc = mpv_observe_property(client,
-                                  cmd_node->u.list->values[1].u.int64,
-                                  cmd_node->u.list->values[2].u.string,
-                                  MPV_FORMAT_NODE);
-    } else if (cmd && !strcmp("observe_property_string", cmd)) {
-        if (cmd_node->u.list->num != 3) {
-            rc = MPV_ERROR_INVALID_PARAMETER;
-            goto error;
-        }
-
-        if (cmd_node->u.list->values[1].format != MPV_FORMAT_INT64) {
-            rc = MPV_ERROR_INVALID_PARAMETER;
-            goto error;
-        }
-
-        if (cmd_node->u.list->values[2].format != MPV_FORMAT_STRING) {
-            rc = MPV_ERROR_INVALID_PARAMETER;
-            goto error;
+        // Optional maximum number of updates per second.
+        double max_rate = 0;
+        if (num_args == 4) {
+            mpv_node *rate_node = &cmd_node->u.list->values[3];
+            if (rate_node->format == MPV_FORMAT_INT64) {
+                max_rate = rate_node->u.int64;
+            } else if (rate_node->format == MPV_FORMAT_DOUBLE) {
+                max_rate = rate_node->u.double_;
+            } else {
+                max_rate = -1;
+            }
+            if (!(max_rate >= 0)) {
+                rc = MPV_ERROR_INVALID_PARAMETER;
+                goto error;
+            }
         }
 
         rc = mpv_observe_property(client,
                                   cmd_node->u.list->values[1].u.int64,
                                   cmd_node->u.list->values[2].u.string,
-                                  MPV_FORMAT_STRING);
+                                  is_string ? MPV_FORMAT_STRING : MPV_FORMAT_NODE);
+        if (rc >= 0 && max_rate > 0) {
+            mp_client_set_property_rate(client,
+                                        cmd_node->u.list->values[1].u.int64,
+                                        max_rate);
+        }
     } else if (cmd && !strcmp("unobserve_property", cmd)) {
         if (cmd_node->u.list->num != 2) {
             rc = MPV_ERROR_INVALID_PARAMETER;
@@ -342,19 +407,17 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
             rc = mpv_request_event(client, event, enable);
         }
     } else {
-        mpv_node result_node = {0};
-
         if (async) {
             rc = mpv_command_node_async(client, reqid, cmd_node);
             if (rc >= 0)
                 send_reply = false;
         } else {
             rc = mpv_command_node(client, cmd_node, &result_node);
-            if (rc >= 0)
-                mpv_node_map_add(ta_parent, &reply_node, "data", &result_node);
+            if (rc >= 0) {
+                reply_data = result_node;
+                has_reply_data = true;
+            }
         }
-
-        mpv_free_node_contents(&result_node);
     }
 
 error:
@@ -362,53 +425,74 @@ error:
      * This makes it easier on the requester to match up the IPC results with
      * the original requests.
      */
-    if (reqid_node) {
-        mpv_node_map_add(ta_parent, &reply_node, "request_id", reqid_node);
-    } else {
-        mpv_node_map_add_int64(ta_parent, &reply_node, "request_id", 0);
-    }
-
-    mpv_node_map_add_string(ta_parent, &reply_node, "error", mpv_error_string(rc));
-
-    char *output = talloc_strdup(ta_parent, "");
-
-    if (send_reply) {
-        json_write(&output, &reply_node);
-        output = ta_talloc_strdup_append(output, "\n");
+    if (send_reply && reply) {
+        write_reply(ta_parent, reply, reply_proto,
+                    has_reply_data ? &reply_data : NULL, reqid_node, rc);
     }
 
-    return output;
+    mpv_free_node_contents(&result_node);
+    mpv_free(result_str);
 }
 
-static char *text_execute_command(struct mpv_handle *client, void *tmp, char *src)
+ptrdiff_t mp_ipc_message_size(enum mp_ipc_protocol proto, bstr buf)
 {
-    mpv_command_string(client, src);
+    if (proto == MP_IPC_MSGPACK) {
+        if (buf.len < 4)
+            return 0;
+        uint32_t len = 0;
+        for (int n = 0; n < 4; n++)
+            len = (len << 8) | buf.start[n];
+        if (len > MAX_MSGPACK_MESSAGE)
+            return -1;
+        return buf.len - 4 >= len ? 4 + len : 0;
+    }
 
-    return NULL;
+    int len = bstrchr(buf, '\n');
+    return len < 0 ? 0 : len + 1;
 }
 
-char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *buf)
+void mp_ipc_execute_message(struct mpv_handle *client,
+                            enum mp_ipc_protocol *proto, bstr msg,
+                            void *ta_parent, bstr *reply)
 {
     void *tmp = talloc_new(NULL);
+    struct mp_log *log = mp_client_get_log(client);
+
+    if (*proto == MP_IPC_MSGPACK) {
+        mpv_node msg_node;
+        bstr src = bstr_cut(msg, 4);
+        if (msgpack_parse(tmp, &msg_node, &src, MAX_MSGPACK_DEPTH) < 0 ||
+            src.len)
+        {
+            mp_err(log, "malformed MessagePack message received\n");
+            execute_command(client, NULL, proto, ta_parent, reply);
+        } else {
+            execute_command(client, &msg_node, proto, ta_parent, reply);
+        }
+        talloc_free(tmp);
+        return;
+    }
 
-    bstr rest;
-    bstr line = bstr_getline(*buf, &rest);
-    char *line0 = bstrto0(tmp, line);
-    talloc_steal(tmp, buf->start);
-    *buf = bstrdup(NULL, rest);
+    // Parse the line in place, replacing the terminating newline.
+    char *line = (char *)msg.start;
+    line[msg.len - 1] = '\0';
 
-    json_skip_whitespace(&line0);
+    json_skip_whitespace(&line);
 
-    char *reply_msg = NULL;
-    if (line0[0] == '\0' || line0[0] == '#') {
+    if (line[0] == '\0' || line[0] == '#') {
         // skip
-    } else if (line0[0] == '{') {
-        reply_msg = json_execute_command(client, tmp, line0);
+    } else if (line[0] == '{') {
+        mpv_node msg_node;
+        char *src = line;
+        if (json_parse(tmp, &msg_node, &src, MAX_JSON_DEPTH) < 0) {
+            mp_err(log, "malformed JSON received: '%s'\n", src);
+            execute_command(client, NULL, proto, ta_parent, reply);
+        } else {
+            execute_command(client, &msg_node, proto, ta_parent, reply);
+        }
     } else {
-        reply_msg = text_execute_command(client, tmp, line0);
+        mpv_command_string(client, line);
     }
 
-    talloc_steal(ctx, reply_msg);
     talloc_free(tmp);
-    return reply_msg;
 }
@@ -138,11 +138,18 @@ extern "C" {
  * MPV_RENDER_PARAM_SW_STRIDE, MPV_RENDER_PARAM_SW_POINTER.
  *
  * This method of rendering is very slow, because everything, including color
- * conversion, scaling, and OSD rendering, is done on the CPU, single-threaded.
- * In particular, large video or display sizes, as well as presence of OSD or
- * subtitles can make it too slow for realtime. As with other software rendering
- * VOs, setting "sw-fast" may help. Enabling or disabling zimg may help,
- * depending on the platform.
+ * conversion, scaling, and OSD rendering, is done on the CPU. In particular,
+ * large video or display sizes, as well as presence of OSD or subtitles can
+ * make it too slow for realtime. As with other software rendering VOs, setting
+ * "sw-fast" may help. Enabling or disabling zimg may help, depending on the
+ * platform. zimg can use multiple threads (see "zimg-threads" option).
+ *
+ * If the video frames already have the target pixel format, the displayed
+ * part of the video (after cropping) has the same size as the area it is
+ * rendered to, and there is no rotation or colorspace conversion, the frames
+ * are copied to the target surface without conversion, which is much faster.
+ * The "video-params/pixelformat" property returns the format of the decoded
+ * video.
  *
  * In addition, certain multimedia job creation measures like HDR may not work
  * properly, and will have to be manually handled by for example inserting
@@ -35,6 +35,10 @@
  *
  * Doesn't insert whitespace. It's literally a waste of space.
  *
+ * json_write() serializes a mpv_node tree. The json_writer functions append
+ * directly to a reusable buffer, which avoids building a tree just for the
+ * purpose of serializing it.
+ *
  * Can output invalid UTF-8, if input is invalid UTF-8. Consumers are supposed
  * to deal with somehow: either by using byte-strings for JSON, or by running
  * a "fixup" pass on the input data. The latter could for example change
@@ -123,7 +127,11 @@ static int read_str(void *ta_parent, struct mpv_node *dst, char **src)
         bstr r = bstr0(str);
         if (!mp_append_escaped_string(ta_parent, &unescaped, &r))
             return -1; // broken escapes
-        str = unescaped.start; // the function guarantees null-termination
+        // Unescaping never makes a string longer, so write it back into the
+        // input. This way all parsed strings point into the input string.
+        assert(unescaped.len <= cur - str);
+        memcpy(str, unescaped.start, unescaped.len + 1);
+        talloc_free(unescaped.start);
     }
     dst->format = MPV_FORMAT_STRING;
     dst->u.string = str;
@@ -182,7 +190,8 @@ static int read_sub(void *ta_parent, struct mpv_node *dst, char **src,
  *  -1: failure, *dst is invalid, there may be dead allocs under ta_parent
  *      (ta_free_children(ta_parent) is the only way to free them)
  * The input string can be mutated in both cases. *dst might contain string
- * elements, which point into the (mutated) input string.
+ * elements, which point into the (mutated) input string. (All strings do,
+ * except object keys which are not quoted and not followed by a space.)
  */
 int json_parse(void *ta_parent, struct mpv_node *dst, char **src, int max_depth)
 {
@@ -357,3 +366,65 @@ int json_write_pretty(char **dst, struct mpv_node *src)
 {
     return json_append_str(dst, src, 0);
 }
+
+void json_writer_init(struct json_writer *w, void *ta_parent, bstr *dst)
+{
+    *w = (struct json_writer){
+        .ta_parent = ta_parent,
+        .dst = dst,
+    };
+}
+
+static void writer_next(struct json_writer *w)
+{
+    if (!w->dst->start)
+        w->dst->start = (unsigned char *)talloc_strdup(w->ta_parent, "");
+    if (w->need_comma)
+        APPEND(w->dst, ",");
+    w->need_comma = true;
+}
+
+void json_writer_begin(struct json_writer *w, bool is_map)
+{
+    writer_next(w);
+    APPEND(w->dst, is_map ? "{" : "[");
+    w->need_comma = false;
+}
+
+void json_writer_end(struct json_writer *w, bool is_map)
+{
+    APPEND(w->dst, is_map ? "}" : "]");
+    w->need_comma = true;
+}
+
+void json_writer_key(struct json_writer *w, const char *key)
+{
+    writer_next(w);
+    write_json_str(w->dst, (unsigned char *)key);
+    APPEND(w->dst, ":");
+    w->need_comma = false;
+}
+
+void json_writer_null(struct json_writer *w)
+{
+    writer_next(w);
+    APPEND(w->dst, "null");
+}
+
+void json_writer_int64(struct json_writer *w, int64_t v)
+{
+    writer_next(w);
+    bstr_xappend_asprintf(NULL, w->dst, "%"PRId64, v);
+}
+
+void json_writer_string(struct json_writer *w, const char *str)
+{
+    writer_next(w);
+    write_json_str(w->dst, (unsigned char *)str);
+}
+
+int json_writer_node(struct json_writer *w, const struct mpv_node *src)
+{
+    writer_next(w);
+    return json_append(w->dst, src, -1);
+}
@@ -18,8 +18,12 @@
 #ifndef MP_JSON_H
 #define MP_JSON_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 // We reuse mpv_node.
 #include "libmpv/client.h"
+#include "misc/bstr.h"
 
 #define MAX_JSON_DEPTH 50
 
@@ -28,4 +32,25 @@ void json_skip_whitespace(char **src);
 int json_write(char **s, struct mpv_node *src);
 int json_write_pretty(char **s, struct mpv_node *src);
 
+// Streaming writer. Appends compact JSON to *dst, without building a mpv_node
+// tree for the message first. *dst is a talloc allocation (or NULL, in which
+// case it is allocated under ta_parent), and can be reused across messages by
+// setting dst->len = 0, so that serializing is usually allocation-free.
+// The caller is responsible for the structure being well-formed (keys only
+// within maps, matching begin/end calls).
+struct json_writer {
+    void *ta_parent;
+    bstr *dst;
+    bool need_comma;
+};
+
+void json_writer_init(struct json_writer *w, void *ta_parent, bstr *dst);
+void json_writer_begin(struct json_writer *w, bool is_map);
+void json_writer_end(struct json_writer *w, bool is_map);
+void json_writer_key(struct json_writer *w, const char *key);
+void json_writer_null(struct json_writer *w);
+void json_writer_int64(struct json_writer *w, int64_t v);
+void json_writer_string(struct json_writer *w, const char *str);
+int json_writer_node(struct json_writer *w, const struct mpv_node *src);
+
 #endif
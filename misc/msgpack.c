@@ -0,0 +1,357 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* MessagePack parser and writer, mapping to and from mpv_node.
+ *
+ * Only the subset of types mpv_node can represent is supported: nil, bool,
+ * integers (unsigned values must fit into int64_t), float 32/64, str, bin,
+ * array, and maps with str keys. ext types (including timestamps) are
+ * rejected by the parser.
+ *
+ * The writer always picks the shortest encoding, and writes doubles as
+ * float 64. Strings are written as str even if they're not valid UTF-8.
+ *
+ * Also see: https://github.com/msgpack/msgpack/blob/master/spec.md
+ */
+
+#include <string.h>
+
+#include "common/common.h"
+#include "misc/bstr.h"
+
+#include "msgpack.h"
+
+static bool read_bytes(bstr *src, size_t len, const uint8_t **out)
+{
+    if (src->len < len)
+        return false;
+    *out = src->start;
+    *src = bstr_cut(*src, len);
+    return true;
+}
+
+static bool read_uint(bstr *src, int bytes, uint64_t *out)
+{
+    const uint8_t *p;
+    if (!read_bytes(src, bytes, &p))
+        return false;
+    uint64_t v = 0;
+    for (int n = 0; n < bytes; n++)
+        v = (v << 8) | p[n];
+    *out = v;
+    return true;
+}
+
+// hdr is the start of the object (the type byte), which is overwritten.
+static int read_str(void *ta_parent, struct mpv_node *dst, bstr *src,
+                    uint8_t *hdr, uint64_t len, bool bin)
+{
+    const uint8_t *p;
+    if (!read_bytes(src, len, &p))
+        return -1;
+    if (bin) {
+        struct mpv_byte_array *ba = talloc_zero(ta_parent, struct mpv_byte_array);
+        ba->data = (void *)p;
+        ba->size = len;
+        dst->format = MPV_FORMAT_BYTE_ARRAY;
+        dst->u.ba = ba;
+    } else {
+        // Embedded 0 bytes can't be represented.
+        if (memchr(p, '\0', len))
+            return -1;
+        // Move the string over its header to make room for the terminator.
+        memmove(hdr, p, len);
+        hdr[len] = '\0';
+        dst->format = MPV_FORMAT_STRING;
+        dst->u.string = (char *)hdr;
+    }
+    return 0;
+}
+
+static int read_list(void *ta_parent, struct mpv_node *dst, bstr *src,
+                     uint64_t num, bool is_map, int max_depth)
+{
+    // Every entry takes at least 1 byte, so this also bounds the allocation.
+    if (num > src->len)
+        return -1;
+    struct mpv_node_list *list = talloc_zero(ta_parent, struct mpv_node_list);
+    list->values = talloc_array(list, struct mpv_node, num);
+    if (is_map)
+        list->keys = talloc_array(list, char *, num);
+    for (uint64_t n = 0; n < num; n++) {
+        if (is_map) {
+            struct mpv_node keynode;
+            if (msgpack_parse(list, &keynode, src, max_depth) < 0 ||
+                keynode.format != MPV_FORMAT_STRING)
+                return -1; // key is not a string
+            list->keys[n] = keynode.u.string;
+        }
+        if (msgpack_parse(ta_parent, &list->values[n], src, max_depth) < 0)
+            return -1;
+        list->num++;
+    }
+    dst->format = is_map ? MPV_FORMAT_NODE_MAP : MPV_FORMAT_NODE_ARRAY;
+    dst->u.list = list;
+    return 0;
+}
+
+/* Returns:
+ *   0: success, *dst is valid, *src points after the parsed object
+ *  -1: failure, *dst is invalid, there may be dead allocs under ta_parent
+ * Warning: like json_parse(), this overwrites the input data. All strings and
+ * byte arrays in *dst point into it, so it must outlive *dst.
+ */
+int msgpack_parse(void *ta_parent, struct mpv_node *dst, bstr *src,
+                  int max_depth)
+{
+    max_depth -= 1;
+    if (max_depth < 0)
+        return -1;
+
+    if (!src->len)
+        return -1; // early EOF
+    uint8_t *hdr = src->start;
+    uint8_t c = hdr[0];
+    *src = bstr_cut(*src, 1);
+
+    uint64_t v;
+    if (c <= 0x7f) {
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = c;
+        return 0;
+    } else if (c >= 0xe0) {
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = (int8_t)c;
+        return 0;
+    } else if ((c & 0xf0) == 0x80) {
+        return read_list(ta_parent, dst, src, c & 0x0f, true, max_depth);
+    } else if ((c & 0xf0) == 0x90) {
+        return read_list(ta_parent, dst, src, c & 0x0f, false, max_depth);
+    } else if ((c & 0xe0) == 0xa0) {
+        return read_str(ta_parent, dst, src, hdr, c & 0x1f, false);
+    }
+
+    switch (c) {
+    case 0xc0:
+        dst->format = MPV_FORMAT_NONE;
+        return 0;
+    case 0xc2:
+    case 0xc3:
+        dst->format = MPV_FORMAT_FLAG;
+        dst->u.flag = c == 0xc3;
+        return 0;
+    case 0xc4: case 0xc5: case 0xc6:
+        if (!read_uint(src, 1 << (c - 0xc4), &v))
+            return -1;
+        return read_str(ta_parent, dst, src, hdr, v, true);
+    case 0xd9: case 0xda: case 0xdb:
+        if (!read_uint(src, 1 << (c - 0xd9), &v))
+            return -1;
+        return read_str(ta_parent, dst, src, hdr, v, false);
+    case 0xdc: case 0xdd:
+        if (!read_uint(src, 2 << (c - 0xdc), &v))
+            return -1;
+        return read_list(ta_parent, dst, src, v, false, max_depth);
+    case 0xde: case 0xdf:
+        if (!read_uint(src, 2 << (c - 0xde), &v))
+            return -1;
+        return read_list(ta_parent, dst, src, v, true, max_depth);
+    case 0xca: {
+        if (!read_uint(src, 4, &v))
+            return -1;
+        uint32_t bits = v;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        dst->format = MPV_FORMAT_DOUBLE;
+        dst->u.double_ = f;
+        return 0;
+    }
+    case 0xcb:
+        if (!read_uint(src, 8, &v))
+            return -1;
+        dst->format = MPV_FORMAT_DOUBLE;
+        memcpy(&dst->u.double_, &v, sizeof(v));
+        return 0;
+    case 0xcc: case 0xcd: case 0xce: case 0xcf:
+        if (!read_uint(src, 1 << (c - 0xcc), &v) || v > INT64_MAX)
+            return -1;
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = v;
+        return 0;
+    case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+        int bytes = 1 << (c - 0xd0);
+        if (!read_uint(src, bytes, &v))
+            return -1;
+        // Sign extend.
+        int shift = 64 - bytes * 8;
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = shift ? (int64_t)(v << shift) >> shift : (int64_t)v;
+        return 0;
+    }
+    }
+    return -1; // ext types, or the unused 0xc1
+}
+
+void msgpack_writer_init(struct msgpack_writer *w, void *ta_parent, bstr *dst)
+{
+    *w = (struct msgpack_writer){
+        .ta_parent = ta_parent,
+        .dst = dst,
+    };
+}
+
+static void append_bytes(struct msgpack_writer *w, const void *data, size_t len)
+{
+    bstr_xappend(w->ta_parent, w->dst, (bstr){(unsigned char *)data, len});
+}
+
+// Write the type byte c, followed by v as big endian integer with size bytes.
+static void append_head(struct msgpack_writer *w, uint8_t c, uint64_t v,
+                        int size)
+{
+    uint8_t buf[9] = {c};
+    for (int n = 0; n < size; n++)
+        buf[1 + n] = v >> (8 * (size - 1 - n));
+    append_bytes(w, buf, 1 + size);
+}
+
+// Header for str/bin/array/map. fix is the fixed-size type byte (or 0 if there
+// is none), fix_max the maximum length it can encode, c8 the 8 bit length
+// type (or 0 if there is none), followed by the 16 and 32 bit ones.
+static void append_len(struct msgpack_writer *w, uint8_t fix, uint32_t fix_max,
+                       uint8_t c8, uint8_t c16, uint32_t len)
+{
+    if (fix && len <= fix_max) {
+        append_head(w, fix | len, 0, 0);
+    } else if (c8 && len <= UINT8_MAX) {
+        append_head(w, c8, len, 1);
+    } else if (len <= UINT16_MAX) {
+        append_head(w, c16, len, 2);
+    } else {
+        append_head(w, c16 + 1, len, 4);
+    }
+}
+
+void msgpack_writer_map(struct msgpack_writer *w, uint32_t num_entries)
+{
+    append_len(w, 0x80, 15, 0, 0xde, num_entries);
+}
+
+void msgpack_writer_array(struct msgpack_writer *w, uint32_t num_entries)
+{
+    append_len(w, 0x90, 15, 0, 0xdc, num_entries);
+}
+
+void msgpack_writer_nil(struct msgpack_writer *w)
+{
+    append_head(w, 0xc0, 0, 0);
+}
+
+void msgpack_writer_bool(struct msgpack_writer *w, bool v)
+{
+    append_head(w, v ? 0xc3 : 0xc2, 0, 0);
+}
+
+void msgpack_writer_int64(struct msgpack_writer *w, int64_t v)
+{
+    if (v >= -32 && v <= 127) {
+        append_head(w, (uint8_t)v, 0, 0);
+    } else if (v >= 0) {
+        if (v <= UINT8_MAX) {
+            append_head(w, 0xcc, v, 1);
+        } else if (v <= UINT16_MAX) {
+            append_head(w, 0xcd, v, 2);
+        } else if (v <= UINT32_MAX) {
+            append_head(w, 0xce, v, 4);
+        } else {
+            append_head(w, 0xcf, v, 8);
+        }
+    } else {
+        if (v >= INT8_MIN) {
+            append_head(w, 0xd0, v, 1);
+        } else if (v >= INT16_MIN) {
+            append_head(w, 0xd1, v, 2);
+        } else if (v >= INT32_MIN) {
+            append_head(w, 0xd2, v, 4);
+        } else {
+            append_head(w, 0xd3, v, 8);
+        }
+    }
+}
+
+void msgpack_writer_double(struct msgpack_writer *w, double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    append_head(w, 0xcb, bits, 8);
+}
+
+void msgpack_writer_string(struct msgpack_writer *w, const char *str)
+{
+    size_t len = strlen(str);
+    append_len(w, 0xa0, 31, 0xd9, 0xda, len);
+    append_bytes(w, str, len);
+}
+
+void msgpack_writer_bytes(struct msgpack_writer *w, const void *data,
+                          size_t size)
+{
+    append_len(w, 0, 0, 0xc4, 0xc5, size);
+    append_bytes(w, data, size);
+}
+
+int msgpack_writer_node(struct msgpack_writer *w, const struct mpv_node *src)
+{
+    switch (src->format) {
+    case MPV_FORMAT_NONE:
+        msgpack_writer_nil(w);
+        return 0;
+    case MPV_FORMAT_FLAG:
+        msgpack_writer_bool(w, src->u.flag);
+        return 0;
+    case MPV_FORMAT_INT64:
+        msgpack_writer_int64(w, src->u.int64);
+        return 0;
+    case MPV_FORMAT_DOUBLE:
+        msgpack_writer_double(w, src->u.double_);
+        return 0;
+    case MPV_FORMAT_STRING:
+        msgpack_writer_string(w, src->u.string);
+        return 0;
+    case MPV_FORMAT_BYTE_ARRAY:
+        msgpack_writer_bytes(w, src->u.ba->data, src->u.ba->size);
+        return 0;
+    case MPV_FORMAT_NODE_ARRAY:
+    case MPV_FORMAT_NODE_MAP: {
+        struct mpv_node_list *list = src->u.list;
+        bool is_map = src->format == MPV_FORMAT_NODE_MAP;
+        if (is_map) {
+            msgpack_writer_map(w, list->num);
+        } else {
+            msgpack_writer_array(w, list->num);
+        }
+        for (int n = 0; n < list->num; n++) {
+            if (is_map)
+                msgpack_writer_string(w, list->keys[n]);
+            if (msgpack_writer_node(w, &list->values[n]) < 0)
+                return -1;
+        }
+        return 0;
+    }
+    }
+    return -1;
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_MSGPACK_H
+#define MP_MSGPACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// We reuse mpv_node.
+#include "libmpv/client.h"
+#include "misc/bstr.h"
+
+#define MAX_MSGPACK_DEPTH 50
+
+// Parse a single MessagePack object from the start of *src, and advance *src
+// past it. Map keys must be strings, and bin objects become
+// MPV_FORMAT_BYTE_ARRAY. The input is modified, and strings in *dst point into
+// it. Returns 0 on success, <0 on failure (invalid or truncated data, or
+// unsupported types like ext).
+int msgpack_parse(void *ta_parent, struct mpv_node *dst, bstr *src,
+                  int max_depth);
+
+// Streaming writer, analogous to json_writer. Maps and arrays are written as
+// a header with the number of entries, followed by the entries (for maps,
+// alternating keys and values), so no end call is needed.
+struct msgpack_writer {
+    void *ta_parent;
+    bstr *dst;
+};
+
+void msgpack_writer_init(struct msgpack_writer *w, void *ta_parent, bstr *dst);
+void msgpack_writer_map(struct msgpack_writer *w, uint32_t num_entries);
+void msgpack_writer_array(struct msgpack_writer *w, uint32_t num_entries);
+void msgpack_writer_nil(struct msgpack_writer *w);
+void msgpack_writer_bool(struct msgpack_writer *w, bool v);
+void msgpack_writer_int64(struct msgpack_writer *w, int64_t v);
+void msgpack_writer_double(struct msgpack_writer *w, double v);
+void msgpack_writer_string(struct msgpack_writer *w, const char *str);
+void msgpack_writer_bytes(struct msgpack_writer *w, const void *data,
+                          size_t size);
+int msgpack_writer_node(struct msgpack_writer *w, const struct mpv_node *src);
+
+#endif
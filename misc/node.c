@@ -157,3 +157,77 @@ bool equal_mpv_node(const struct mpv_node *a, const struct mpv_node *b)
         return false;
     return equal_mpv_value(&a->u, &b->u, a->format);
 }
+
+static uint64_t hash_mix(uint64_t h, uint64_t v)
+{
+    // splitmix64 finalizer over the combined state
+    h = (h ^ v) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return h ^ (h >> 29);
+}
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    // FNV-1a, then mixed into h with the length.
+    uint64_t f = 0xcbf29ce484222325ULL;
+    for (size_t n = 0; n < size; n++)
+        f = (f ^ p[n]) * 0x100000001b3ULL;
+    return hash_mix(hash_mix(h, size), f);
+}
+
+static uint64_t hash_value(uint64_t h, const void *v, mpv_format format)
+{
+    h = hash_mix(h, format);
+    switch (format) {
+    case MPV_FORMAT_NONE:
+        return h;
+    case MPV_FORMAT_STRING:
+    case MPV_FORMAT_OSD_STRING: {
+        const char *s = *(char **)v;
+        return hash_bytes(h, s, strlen(s));
+    }
+    case MPV_FORMAT_FLAG:
+        return hash_mix(h, *(int *)v);
+    case MPV_FORMAT_INT64:
+        return hash_mix(h, *(int64_t *)v);
+    case MPV_FORMAT_DOUBLE: {
+        double d = *(double *)v;
+        if (d == 0)
+            d = 0; // -0.0 == 0.0
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        return hash_mix(h, bits);
+    }
+    case MPV_FORMAT_NODE: {
+        const struct mpv_node *node = v;
+        return hash_value(h, &node->u, node->format);
+    }
+    case MPV_FORMAT_BYTE_ARRAY: {
+        const struct mpv_byte_array *ba = *(struct mpv_byte_array **)v;
+        return hash_bytes(h, ba->data, ba->size);
+    }
+    case MPV_FORMAT_NODE_ARRAY:
+    case MPV_FORMAT_NODE_MAP: {
+        const struct mpv_node_list *list = *(mpv_node_list **)v;
+        h = hash_mix(h, list->num);
+        for (int n = 0; n < list->num; n++) {
+            if (format == MPV_FORMAT_NODE_MAP)
+                h = hash_bytes(h, list->keys[n], strlen(list->keys[n]));
+            h = hash_value(h, &list->values[n], MPV_FORMAT_NODE);
+        }
+        return h;
+    }
+    }
+    MP_ASSERT_UNREACHABLE();
+}
+
+// 64 bit hash of a value, consistent with equal_mpv_value(): equal values
+// have equal hashes (NaN is never equal to itself, but hashes the same).
+// Takes the same arguments. MPV_FORMAT_BYTE_ARRAY is supported within nodes
+// only.
+uint64_t hash_mpv_value(const void *v, mpv_format format)
+{
+    return hash_value(0, v, format);
+}
@@ -16,5 +16,6 @@ mpv_node *node_map_get(mpv_node *src, const char *key);
 mpv_node *node_map_bget(mpv_node *src, struct bstr key);
 bool equal_mpv_value(const void *a, const void *b, mpv_format format);
 bool equal_mpv_node(const struct mpv_node *a, const struct mpv_node *b);
+uint64_t hash_mpv_value(const void *v, mpv_format format);
 
 #endif
@@ -0,0 +1,144 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "common/common.h"
+#include "osdep/timer.h"
+
+#include "ring.h"
+
+struct mp_ring {
+    int num_planes;
+    uint8_t **planes;
+    uint64_t size;          // power of 2
+
+    // Total number of bytes written/read. The byte at position pos is stored
+    // at planes[n][pos & (size - 1)].
+    _Atomic uint64_t wpos;  // written by producer
+    _Atomic uint64_t rpos;  // written by consumer
+
+    // Set by mp_ring_discard(); the consumer never reads below this position.
+    _Atomic uint64_t discard_pos;
+
+    // Incremented by the consumer when entering and leaving mp_ring_read(),
+    // so odd values mean it's reading.
+    atomic_uint read_seq;
+};
+
+struct mp_ring *mp_ring_new(void *ta_parent, int num_planes, int size)
+{
+    assert(num_planes > 0 && size > 0);
+
+    struct mp_ring *ring = talloc_zero(ta_parent, struct mp_ring);
+    ring->num_planes = num_planes;
+    ring->size = 1;
+    while (ring->size < size)
+        ring->size *= 2;
+    ring->planes = talloc_array(ring, uint8_t *, num_planes);
+    for (int n = 0; n < num_planes; n++)
+        ring->planes[n] = talloc_size(ring, ring->size);
+    return ring;
+}
+
+// Copy len bytes between the linear buffers and the ring at pos.
+static void copy_planes(struct mp_ring *ring, uint64_t pos, void **planes,
+                        int len, bool to_ring)
+{
+    int offset = pos & (ring->size - 1);
+    int first = MPMIN(len, ring->size - offset);
+    for (int n = 0; n < ring->num_planes; n++) {
+        uint8_t *buf = planes[n];
+        if (to_ring) {
+            memcpy(ring->planes[n] + offset, buf, first);
+            memcpy(ring->planes[n], buf + first, len - first);
+        } else {
+            memcpy(buf, ring->planes[n] + offset, first);
+            memcpy(buf + first, ring->planes[n], len - first);
+        }
+    }
+}
+
+// Read position as seen by the consumer.
+static uint64_t get_read_pos(struct mp_ring *ring)
+{
+    uint64_t rpos = atomic_load(&ring->rpos);
+    return MPMAX(rpos, atomic_load(&ring->discard_pos));
+}
+
+int mp_ring_write(struct mp_ring *ring, void **planes, int len)
+{
+    uint64_t wpos = atomic_load_explicit(&ring->wpos, memory_order_relaxed);
+    int available = mp_ring_available(ring);
+    len = MPMIN(len, available);
+    if (len <= 0)
+        return 0;
+    copy_planes(ring, wpos, planes, len, true);
+    atomic_store(&ring->wpos, wpos + len);
+    return len;
+}
+
+int mp_ring_read(struct mp_ring *ring, void **planes, int len)
+{
+    atomic_fetch_add(&ring->read_seq, 1);
+    uint64_t rpos = get_read_pos(ring);
+    int buffered = atomic_load(&ring->wpos) - rpos;
+    len = MPCLAMP(len, 0, buffered);
+    if (len && planes)
+        copy_planes(ring, rpos, planes, len, false);
+    // Also stores a position skipped due to discard_pos.
+    atomic_store(&ring->rpos, rpos + len);
+    atomic_fetch_add(&ring->read_seq, 1);
+    return len;
+}
+
+void mp_ring_discard(struct mp_ring *ring)
+{
+    atomic_store(&ring->discard_pos, atomic_load(&ring->wpos));
+
+    // A read that started before this could still be copying from below
+    // discard_pos. Reads starting afterwards are guaranteed to see it. Waiting
+    // until the sequence number changes is enough, and practically never
+    // takes longer than a memcpy() of a device period.
+    unsigned seq = atomic_load(&ring->read_seq);
+    if (seq & 1) {
+        while (atomic_load(&ring->read_seq) == seq)
+            mp_sleep_ns(MP_TIME_US_TO_NS(50));
+    }
+}
+
+int mp_ring_buffered(struct mp_ring *ring)
+{
+    // Load the read position first: wpos can only be larger than any read
+    // position seen before.
+    uint64_t rpos = get_read_pos(ring);
+    return atomic_load(&ring->wpos) - rpos;
+}
+
+int mp_ring_available(struct mp_ring *ring)
+{
+    // For the producer, discard_pos can be used only after mp_ring_discard()
+    // returned, which is always the case within the producer thread.
+    return ring->size - mp_ring_buffered(ring);
+}
+
+int mp_ring_size(struct mp_ring *ring)
+{
+    return ring->size;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// Fixed size byte FIFO with one or more planes, for exactly one producer thread
+// and one consumer thread. Reading and writing are wait-free (no locks, no
+// loops waiting for the other side), so the consumer can be a realtime audio
+// callback. All planes always contain the same amount of data.
+struct mp_ring;
+
+// size is the capacity per plane in bytes, and is rounded up to a power of 2.
+// The ring can be freed with talloc_free() if no thread is accessing it.
+struct mp_ring *mp_ring_new(void *ta_parent, int num_planes, int size);
+
+// Producer only. Append up to len bytes from planes[0..num_planes-1]. Returns
+// the number of bytes written, which is less than len if the ring is full.
+int mp_ring_write(struct mp_ring *ring, void **planes, int len);
+
+// Consumer only. Remove up to len bytes and copy them to planes (if planes is
+// NULL, the data is just skipped). Returns the number of bytes read.
+int mp_ring_read(struct mp_ring *ring, void **planes, int len);
+
+// Producer only. Make the consumer skip all data written so far, as if it had
+// read it. If the consumer is inside mp_ring_read() at the same time, this
+// waits until it has returned (this is the only call that can wait).
+void mp_ring_discard(struct mp_ring *ring);
+
+// Number of bytes that can be read. Exact for the consumer, approximate for
+// other threads (the producer only sees it decreasing).
+int mp_ring_buffered(struct mp_ring *ring);
+
+// Number of bytes that can be written. Exact for the producer, approximate for
+// other threads.
+int mp_ring_available(struct mp_ring *ring);
+
+int mp_ring_size(struct mp_ring *ring);
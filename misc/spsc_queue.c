@@ -0,0 +1,201 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "common/common.h"
+
+#include "spsc_queue.h"
+
+#define INITIAL_SIZE 16
+
+struct mp_spsc_queue {
+    size_t item_size;
+
+    // Ring buffer with a power of 2 number of items. Only changed with the
+    // queue locked.
+    char *items;
+    size_t size;
+
+    // Total number of items written/read. The item at position pos is stored
+    // at items[(pos & (size - 1)) * item_size].
+    atomic_size_t wpos;     // written by producer
+    atomic_size_t rpos;     // written by consumer
+
+    atomic_bool waiting[2];
+
+    // Entering protocol: a side sets busy[side] and then checks ctl; the
+    // locking thread sets ctl and then waits until both busy flags are clear.
+    atomic_bool busy[2];
+    atomic_bool ctl;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    bool locked;            // protected by lock
+};
+
+static void destroy_queue(void *ptr)
+{
+    struct mp_spsc_queue *q = ptr;
+
+    pthread_cond_destroy(&q->wakeup);
+    pthread_mutex_destroy(&q->lock);
+}
+
+struct mp_spsc_queue *mp_spsc_queue_create(void *ta_parent, size_t item_size)
+{
+    assert(item_size > 0);
+
+    struct mp_spsc_queue *q = talloc_zero(ta_parent, struct mp_spsc_queue);
+    talloc_set_destructor(q, destroy_queue);
+    q->item_size = item_size;
+    q->size = INITIAL_SIZE;
+    q->items = talloc_size(q, q->size * item_size);
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->wakeup, NULL);
+    return q;
+}
+
+static void *item_ptr(struct mp_spsc_queue *q, size_t pos)
+{
+    return q->items + (pos & (q->size - 1)) * q->item_size;
+}
+
+void mp_spsc_queue_enter(struct mp_spsc_queue *q, enum mp_spsc_side side)
+{
+    while (1) {
+        atomic_store(&q->busy[side], true);
+        if (!atomic_load(&q->ctl))
+            return;
+
+        // Locked by another thread; wait until it's done.
+        mp_spsc_queue_leave(q, side);
+        pthread_mutex_lock(&q->lock);
+        while (atomic_load(&q->ctl))
+            pthread_cond_wait(&q->wakeup, &q->lock);
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+void mp_spsc_queue_leave(struct mp_spsc_queue *q, enum mp_spsc_side side)
+{
+    atomic_store(&q->busy[side], false);
+    if (atomic_load(&q->ctl)) {
+        pthread_mutex_lock(&q->lock);
+        pthread_cond_broadcast(&q->wakeup);
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+void mp_spsc_queue_lock(struct mp_spsc_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->locked)
+        pthread_cond_wait(&q->wakeup, &q->lock);
+    q->locked = true;
+    atomic_store(&q->ctl, true);
+    while (atomic_load(&q->busy[0]) || atomic_load(&q->busy[1]))
+        pthread_cond_wait(&q->wakeup, &q->lock);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void mp_spsc_queue_unlock(struct mp_spsc_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    assert(q->locked);
+    q->locked = false;
+    atomic_store(&q->ctl, false);
+    pthread_cond_broadcast(&q->wakeup);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void mp_spsc_queue_reserve(struct mp_spsc_queue *q)
+{
+    // Only the producer increases wpos, so the count can only decrease
+    // concurrently.
+    if (mp_spsc_queue_count(q) < q->size)
+        return;
+
+    mp_spsc_queue_lock(q);
+
+    size_t rpos = atomic_load(&q->rpos);
+    size_t wpos = atomic_load(&q->wpos);
+    size_t new_size = q->size * 2;
+    char *items = talloc_size(q, new_size * q->item_size);
+    for (size_t pos = rpos; pos != wpos; pos++) {
+        memcpy(items + (pos & (new_size - 1)) * q->item_size, item_ptr(q, pos),
+               q->item_size);
+    }
+    talloc_free(q->items);
+    q->items = items;
+    q->size = new_size;
+
+    mp_spsc_queue_unlock(q);
+}
+
+void mp_spsc_queue_write(struct mp_spsc_queue *q, const void *item)
+{
+    size_t wpos = atomic_load_explicit(&q->wpos, memory_order_relaxed);
+    assert(wpos - atomic_load(&q->rpos) < q->size); // mp_spsc_queue_reserve()
+    memcpy(item_ptr(q, wpos), item, q->item_size);
+    atomic_store(&q->wpos, wpos + 1);
+}
+
+bool mp_spsc_queue_read(struct mp_spsc_queue *q, void *item)
+{
+    size_t rpos = atomic_load_explicit(&q->rpos, memory_order_relaxed);
+    if (rpos == atomic_load(&q->wpos))
+        return false;
+    memcpy(item, item_ptr(q, rpos), q->item_size);
+    atomic_store(&q->rpos, rpos + 1);
+    return true;
+}
+
+void *mp_spsc_queue_peek(struct mp_spsc_queue *q, size_t index)
+{
+    size_t rpos = atomic_load(&q->rpos);
+    size_t wpos = atomic_load(&q->wpos);
+    return index < wpos - rpos ? item_ptr(q, rpos + index) : NULL;
+}
+
+size_t mp_spsc_queue_count(struct mp_spsc_queue *q)
+{
+    // Load rpos first: wpos can only be larger than any rpos seen before.
+    size_t rpos = atomic_load(&q->rpos);
+    return atomic_load(&q->wpos) - rpos;
+}
+
+void mp_spsc_queue_clear(struct mp_spsc_queue *q)
+{
+    assert(q->locked);
+    atomic_store(&q->rpos, atomic_load(&q->wpos));
+}
+
+void mp_spsc_queue_set_waiting(struct mp_spsc_queue *q, enum mp_spsc_side side)
+{
+    atomic_store(&q->waiting[side], true);
+}
+
+bool mp_spsc_queue_take_waiting(struct mp_spsc_queue *q, enum mp_spsc_side side)
+{
+    // Cheap check first, to avoid a read-modify-write on the common path.
+    if (!atomic_load(&q->waiting[side]))
+        return false;
+    return atomic_exchange(&q->waiting[side], false);
+}
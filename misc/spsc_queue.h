@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Unbounded FIFO of fixed size items, for exactly one producer thread and one
+// consumer thread. Writing and reading are lock-free with respect to each
+// other. Other threads can get exclusive access (e.g. to clear the queue) with
+// mp_spsc_queue_lock(), which waits until producer and consumer are outside of
+// their mp_spsc_queue_enter()/mp_spsc_queue_leave() sections, and blocks
+// further entering until mp_spsc_queue_unlock().
+//
+// Producer:
+//      mp_spsc_queue_reserve(q);
+//      mp_spsc_queue_enter(q, MP_SPSC_PRODUCER);
+//      mp_spsc_queue_write(q, &item);
+//      if (mp_spsc_queue_take_waiting(q, MP_SPSC_CONSUMER))
+//          wake_up_consumer();
+//      mp_spsc_queue_leave(q, MP_SPSC_PRODUCER);
+//
+// Consumer:
+//      mp_spsc_queue_enter(q, MP_SPSC_CONSUMER);
+//      if (!mp_spsc_queue_read(q, &item)) {
+//          mp_spsc_queue_set_waiting(q, MP_SPSC_CONSUMER);
+//          // Re-check, the producer might have written before it saw the flag.
+//          if (mp_spsc_queue_count(q) && mp_spsc_queue_take_waiting(q, ...))
+//              ...don't sleep...
+//      }
+//      mp_spsc_queue_leave(q, MP_SPSC_CONSUMER);
+struct mp_spsc_queue;
+
+enum mp_spsc_side {
+    MP_SPSC_PRODUCER,
+    MP_SPSC_CONSUMER,
+};
+
+// The queue can be freed with talloc_free() if no thread is accessing it.
+struct mp_spsc_queue *mp_spsc_queue_create(void *ta_parent, size_t item_size);
+
+// Start/end accessing the queue from the producer or consumer thread. Only
+// blocks if another thread holds mp_spsc_queue_lock(). Sections must not be
+// nested, and the thread must not call mp_spsc_queue_lock() within them.
+void mp_spsc_queue_enter(struct mp_spsc_queue *q, enum mp_spsc_side side);
+void mp_spsc_queue_leave(struct mp_spsc_queue *q, enum mp_spsc_side side);
+
+// Producer only, outside of enter/leave. Make sure there is space for at least
+// 1 more item, so that mp_spsc_queue_write() can't fail. If the queue needs to
+// grow, this briefly takes the queue lock.
+void mp_spsc_queue_reserve(struct mp_spsc_queue *q);
+
+// Producer only, within enter/leave, and after mp_spsc_queue_reserve().
+// Append a copy of the item.
+void mp_spsc_queue_write(struct mp_spsc_queue *q, const void *item);
+
+// Consumer only, within enter/leave. Copy the oldest item to item, remove it,
+// and return true. Return false if the queue is empty.
+bool mp_spsc_queue_read(struct mp_spsc_queue *q, void *item);
+
+// Return the item at the given position (0 is the oldest), or NULL if there
+// are not that many items. Allowed for the producer and consumer within
+// enter/leave, and for the thread holding the lock. Note that for the producer
+// the returned item might be read concurrently by the consumer; it stays valid
+// until the producer calls mp_spsc_queue_reserve().
+void *mp_spsc_queue_peek(struct mp_spsc_queue *q, size_t index);
+
+// Number of items in the queue. Can be called from any thread; if the caller is
+// neither producer, consumer, nor holds the lock, the result is approximate.
+size_t mp_spsc_queue_count(struct mp_spsc_queue *q);
+
+// Get exclusive access to the queue from any thread (see above).
+void mp_spsc_queue_lock(struct mp_spsc_queue *q);
+void mp_spsc_queue_unlock(struct mp_spsc_queue *q);
+
+// Remove all items. The queue must be locked by the caller.
+void mp_spsc_queue_clear(struct mp_spsc_queue *q);
+
+// Wakeup coalescing: a side that is about to sleep (queue empty for the
+// consumer, or a user defined condition for the producer) sets its flag, and
+// then re-checks its condition. The other side calls take_waiting() after
+// changing the queue, and wakes up the waiting side only if it returns true.
+// This avoids a wakeup for every item. The flags use sequentially consistent
+// ordering with the queue positions, so wakeups can't get lost.
+void mp_spsc_queue_set_waiting(struct mp_spsc_queue *q, enum mp_spsc_side side);
+bool mp_spsc_queue_take_waiting(struct mp_spsc_queue *q, enum mp_spsc_side side);
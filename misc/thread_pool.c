@@ -14,6 +14,9 @@
  */
 
 #include <pthread.h>
+#include <stdatomic.h>
+
+#include <libavutil/cpu.h>
 
 #include "common/common.h"
 #include "osdep/threads.h"
@@ -25,9 +28,19 @@
 // and the thread count is above the configured minimum.
 #define DESTROY_TIMEOUT 10
 
+// Upper bound for the number of threads of the shared pool.
+#define MAX_SHARED_THREADS 64
+
 struct work {
     void (*fn)(void *ctx);
     void *fn_ctx;
+    int prio;
+};
+
+enum add_mode {
+    ADD_QUEUE,      // mp_thread_pool_queue()
+    ADD_RUN,        // mp_thread_pool_run()
+    ADD_IDLE,       // fail if no thread can start the item immediately
 };
 
 struct mp_thread_pool {
@@ -46,8 +59,13 @@ struct mp_thread_pool {
 
     bool terminate;
 
+    // Sorted by priority; the next item to run is the last one.
     struct work *work;
     int num_work;
+
+    // Statistics (see mp_thread_pool_get_stats()).
+    int64_t busy_ns;
+    uint64_t completed;
 };
 
 static void *worker_thread(void *arg)
@@ -85,10 +103,14 @@ static void *worker_thread(void *arg)
         pool->busy_threads += 1;
         pthread_mutex_unlock(&pool->lock);
 
+        int64_t start = mp_time_ns();
         work.fn(work.fn_ctx);
+        int64_t busy = mp_time_ns() - start;
 
         pthread_mutex_lock(&pool->lock);
         pool->busy_threads -= 1;
+        pool->busy_ns += busy;
+        pool->completed += 1;
 
         ts = (struct timespec){0};
         got_timeout = false;
@@ -178,31 +200,39 @@ struct mp_thread_pool *mp_thread_pool_create(void *ta_parent, int init_threads,
     return pool;
 }
 
-static bool thread_pool_add(struct mp_thread_pool *pool, void (*fn)(void *ctx),
-                            void *fn_ctx, bool allow_queue)
+static bool thread_pool_add(struct mp_thread_pool *pool, int prio,
+                            void (*fn)(void *ctx), void *fn_ctx,
+                            enum add_mode mode)
 {
     bool ok = true;
 
     assert(fn);
 
     pthread_mutex_lock(&pool->lock);
-    struct work work = {fn, fn_ctx};
+    struct work work = {fn, fn_ctx, prio};
 
     // If there are not enough threads to process all at once, but we can
     // create a new thread, then do so. If work is queued quickly, it can
     // happen that not all available threads have picked up work yet (up to
     // num_threads - busy_threads threads), which has to be accounted for.
-    if (pool->busy_threads + pool->num_work + 1 > pool->num_threads &&
-        pool->num_threads < pool->max_threads)
-    {
-        if (!add_thread(pool)) {
+    if (pool->busy_threads + pool->num_work + 1 > pool->num_threads) {
+        if (pool->num_threads < pool->max_threads && add_thread(pool)) {
+            // ok
+        } else if (mode == ADD_IDLE) {
+            ok = false;
+        } else if (pool->num_threads < pool->max_threads) {
             // If we can queue it, it'll get done as long as there is 1 thread.
-            ok = allow_queue && pool->num_threads > 0;
+            ok = mode == ADD_QUEUE && pool->num_threads > 0;
         }
     }
 
     if (ok) {
-        MP_TARRAY_INSERT_AT(pool, pool->work, pool->num_work, 0, work);
+        // Insert before all items with the same or higher priority, so items
+        // with the same priority are run in FIFO order.
+        int pos = 0;
+        while (pos < pool->num_work && pool->work[pos].prio < prio)
+            pos++;
+        MP_TARRAY_INSERT_AT(pool, pool->work, pool->num_work, pos, work);
         pthread_cond_signal(&pool->wakeup);
     }
 
@@ -213,11 +243,122 @@ static bool thread_pool_add(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                           void *fn_ctx)
 {
-    return thread_pool_add(pool, fn, fn_ctx, true);
+    return thread_pool_add(pool, MP_THREAD_PRIO_NORMAL, fn, fn_ctx, ADD_QUEUE);
+}
+
+bool mp_thread_pool_queue_prio(struct mp_thread_pool *pool, int prio,
+                               void (*fn)(void *ctx), void *fn_ctx)
+{
+    return thread_pool_add(pool, prio, fn, fn_ctx, ADD_QUEUE);
 }
 
 bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                         void *fn_ctx)
 {
-    return thread_pool_add(pool, fn, fn_ctx, false);
+    return thread_pool_add(pool, MP_THREAD_PRIO_NORMAL, fn, fn_ctx, ADD_RUN);
+}
+
+static pthread_once_t shared_pool_once = PTHREAD_ONCE_INIT;
+static struct mp_thread_pool *shared_pool;
+
+static void create_shared_pool(void)
+{
+    int threads = MPCLAMP(av_cpu_count(), 1, MAX_SHARED_THREADS);
+    // Never freed. Idle threads exit after DESTROY_TIMEOUT.
+    shared_pool = mp_thread_pool_create(NULL, 0, 0, threads);
+}
+
+struct mp_thread_pool *mp_thread_pool_shared(void)
+{
+    pthread_once(&shared_pool_once, create_shared_pool);
+    return shared_pool;
+}
+
+struct slice_job {
+    void (*fn)(void *ctx, int slice);
+    void *fn_ctx;
+    int num_slices;
+    atomic_int next_slice;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    int num_helpers;            // helpers not finished yet
+};
+
+static void run_slices(struct slice_job *job)
+{
+    while (1) {
+        int slice = atomic_fetch_add(&job->next_slice, 1);
+        if (slice >= job->num_slices)
+            break;
+        job->fn(job->fn_ctx, slice);
+    }
+}
+
+static void slice_helper(void *ctx)
+{
+    struct slice_job *job = ctx;
+
+    run_slices(job);
+
+    pthread_mutex_lock(&job->lock);
+    job->num_helpers -= 1;
+    if (!job->num_helpers)
+        pthread_cond_signal(&job->wakeup);
+    pthread_mutex_unlock(&job->lock);
+}
+
+void mp_thread_pool_run_slices(struct mp_thread_pool *pool, int prio,
+                               int num_slices,
+                               void (*fn)(void *ctx, int slice), void *fn_ctx)
+{
+    struct slice_job job = {
+        .fn = fn,
+        .fn_ctx = fn_ctx,
+        .num_slices = num_slices,
+    };
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.wakeup, NULL);
+
+    // Helpers are only added if a thread can start them right away. Otherwise
+    // the slices are run by fewer threads (in the worst case only by the
+    // caller), instead of waiting for other work to finish. This also makes
+    // it safe to call this from a worker thread of the same pool.
+    for (int n = 1; n < num_slices && pool; n++) {
+        pthread_mutex_lock(&job.lock);
+        job.num_helpers += 1;
+        pthread_mutex_unlock(&job.lock);
+
+        if (!thread_pool_add(pool, prio, slice_helper, &job, ADD_IDLE)) {
+            pthread_mutex_lock(&job.lock);
+            job.num_helpers -= 1;
+            pthread_mutex_unlock(&job.lock);
+            break;
+        }
+    }
+
+    run_slices(&job);
+
+    pthread_mutex_lock(&job.lock);
+    while (job.num_helpers)
+        pthread_cond_wait(&job.wakeup, &job.lock);
+    pthread_mutex_unlock(&job.lock);
+
+    pthread_cond_destroy(&job.wakeup);
+    pthread_mutex_destroy(&job.lock);
+}
+
+void mp_thread_pool_get_stats(struct mp_thread_pool *pool,
+                              struct mp_thread_pool_stats *st)
+{
+    pthread_mutex_lock(&pool->lock);
+    *st = (struct mp_thread_pool_stats){
+        .threads = pool->num_threads,
+        .max_threads = pool->max_threads,
+        .busy_threads = pool->busy_threads,
+        .queued = pool->num_work,
+        .busy_ns = pool->busy_ns,
+        .completed = pool->completed,
+    };
+    pthread_mutex_unlock(&pool->lock);
 }
@@ -2,6 +2,7 @@
 #define MPV_MP_THREAD_POOL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 struct mp_thread_pool;
 
 // Create a thread pool with the given number of worker threads. This can return
@@ -32,4 +33,47 @@ bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                         void *fn_ctx);
 
+// Priorities for queued work items. Items with higher priority are started
+// first; items with the same priority in FIFO order. mp_thread_pool_queue()
+// and mp_thread_pool_run() use MP_THREAD_PRIO_NORMAL.
+enum {
+    MP_THREAD_PRIO_LOW      = -1,   // background work
+    MP_THREAD_PRIO_NORMAL   = 0,
+    MP_THREAD_PRIO_HIGH     = 1,    // latency sensitive (video/VO path)
+};
+
+// Like mp_thread_pool_queue(), but with the given priority.
+bool mp_thread_pool_queue_prio(struct mp_thread_pool *pool, int prio,
+                               void (*fn)(void *ctx), void *fn_ctx);
+
+// Return the process-wide pool, which is shared by all components of all mpv
+// instances in the process that split CPU bound work into slices. The number
+// of threads is capped to the number of CPUs. The pool is created on first
+// use, and never destroyed (idle threads exit on their own). Don't queue work
+// that blocks on I/O or on other work items.
+// Can return NULL if creation failed.
+struct mp_thread_pool *mp_thread_pool_shared(void);
+
+// Call fn(fn_ctx, slice) for each slice in [0, num_slices), and return once
+// all calls have returned. The calling thread processes slices too, and the
+// slices are distributed dynamically over the caller and as many pool threads
+// as are idle (or can be created) at the time of the call. This never waits
+// for unrelated work, so it's safe to use from within pool threads.
+// pool can be NULL, in which case all slices are run on the calling thread.
+void mp_thread_pool_run_slices(struct mp_thread_pool *pool, int prio,
+                               int num_slices,
+                               void (*fn)(void *ctx, int slice), void *fn_ctx);
+
+struct mp_thread_pool_stats {
+    int threads;            // current number of threads
+    int max_threads;
+    int busy_threads;       // threads currently running an item
+    int queued;             // items waiting for a thread
+    int64_t busy_ns;        // total time spent running items
+    uint64_t completed;     // total number of items run
+};
+
+void mp_thread_pool_get_stats(struct mp_thread_pool *pool,
+                              struct mp_thread_pool_stats *st);
+
 #endif
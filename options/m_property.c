@@ -35,7 +35,7 @@
 #include "common/common.h"
 
 static int m_property_multiply(struct mp_log *log,
-                               const struct m_property *prop_list,
+                               const struct m_property_index *prop_list,
                                const char *property, double f, void *ctx)
 {
     union m_option_value val = m_option_value_default;
@@ -70,16 +70,80 @@ struct m_property *m_property_list_find(const struct m_property *list,
     return NULL;
 }
 
-static int do_action(const struct m_property *prop_list, const char *name,
+struct m_property_index {
+    const struct m_property *list;
+    int *slots;         // indexes into list[], -1 for unused slots
+    uint32_t mask;      // number of slots - 1 (slot count is a power of 2)
+};
+
+// FNV-1a
+static uint32_t hash_name(bstr name)
+{
+    uint32_t h = 2166136261u;
+    for (int n = 0; n < name.len; n++) {
+        h ^= (unsigned char)name.start[n];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+struct m_property_index *m_property_index_create(void *ta_parent,
+                                                 const struct m_property *list)
+{
+    int count = 0;
+    while (list[count].name)
+        count++;
+
+    uint32_t size = 16;
+    while (size < count * 2)
+        size *= 2;
+
+    struct m_property_index *index = talloc_ptrtype(ta_parent, index);
+    *index = (struct m_property_index){
+        .list = list,
+        .slots = talloc_array(index, int, size),
+        .mask = size - 1,
+    };
+    for (int n = 0; n < size; n++)
+        index->slots[n] = -1;
+
+    for (int n = 0; n < count; n++) {
+        uint32_t slot = hash_name(bstr0(list[n].name)) & index->mask;
+        while (index->slots[slot] >= 0) {
+            // Keep the first entry for duplicate names, as the list walk did.
+            if (strcmp(list[index->slots[slot]].name, list[n].name) == 0)
+                break;
+            slot = (slot + 1) & index->mask;
+        }
+        if (index->slots[slot] < 0)
+            index->slots[slot] = n;
+    }
+
+    return index;
+}
+
+struct m_property *m_property_index_find(const struct m_property_index *index,
+                                         bstr name)
+{
+    uint32_t slot = hash_name(name) & index->mask;
+    while (index->slots[slot] >= 0) {
+        const struct m_property *prop = &index->list[index->slots[slot]];
+        if (bstr_equals0(name, prop->name))
+            return (struct m_property *)prop;
+        slot = (slot + 1) & index->mask;
+    }
+    return NULL;
+}
+
+static int do_action(const struct m_property_index *prop_list, const char *name,
                      int action, void *arg, void *ctx)
 {
     struct m_property *prop;
     struct m_property_action_arg ka;
     const char *sep = strchr(name, '/');
     if (sep && sep[1]) {
-        char base[128];
-        snprintf(base, sizeof(base), "%.*s", (int)(sep - name), name);
-        prop = m_property_list_find(prop_list, base);
+        bstr base = bstr_splice(bstr0(name), 0, sep - name);
+        prop = m_property_index_find(prop_list, base);
         ka = (struct m_property_action_arg) {
             .key = sep + 1,
             .action = action,
@@ -88,14 +152,14 @@ static int do_action(const struct m_property *prop_list, const char *name,
         action = M_PROPERTY_KEY_ACTION;
         arg = &ka;
     } else
-        prop = m_property_list_find(prop_list, name);
+        prop = m_property_index_find(prop_list, bstr0(name));
     if (!prop)
         return M_PROPERTY_UNKNOWN;
     return prop->call(ctx, prop, action, arg);
 }
 
 // (as a hack, log can be NULL on read-only paths)
-int m_property_do(struct mp_log *log, const struct m_property *prop_list,
+int m_property_do(struct mp_log *log, const struct m_property_index *prop_list,
                   const char *name, int action, void *arg, void *ctx)
 {
     union m_option_value val = m_option_value_default;
@@ -234,8 +298,8 @@ static void m_property_unkey(int *action, void **arg)
     }
 }
 
-static int m_property_do_bstr(const struct m_property *prop_list, bstr name,
-                              int action, void *arg, void *ctx)
+static int m_property_do_bstr(const struct m_property_index *prop_list,
+                              bstr name, int action, void *arg, void *ctx)
 {
     char *name0 = bstrdup0(NULL, name);
     int ret = m_property_do(NULL, prop_list, name0, action, arg, ctx);
@@ -251,8 +315,9 @@ static void append_str(char **s, int *len, bstr append)
     *len = *len + append.len;
 }
 
-static int expand_property(const struct m_property *prop_list, char **ret,
-                           int *ret_len, bstr prop, bool silent_error, void *ctx)
+static int expand_property(const struct m_property_index *prop_list,
+                           char **ret, int *ret_len, bstr prop,
+                           bool silent_error, void *ctx)
 {
     bool cond_yes = bstr_eatstart0(&prop, "?");
     bool cond_no = !cond_yes && bstr_eatstart0(&prop, "!");
@@ -282,7 +347,7 @@ static int expand_property(const struct m_property *prop_list, char **ret,
     return skip;
 }
 
-char *m_properties_expand_string(const struct m_property *prop_list,
+char *m_properties_expand_string(const struct m_property_index *prop_list,
                                  const char *str0, void *ctx)
 {
     char *ret = NULL;
@@ -530,10 +595,69 @@ int m_property_read_sub(const struct m_sub_property *props, int action, void *ar
 }
 
 
+// Return the items [start, start + count) as node array.
+static struct mpv_node read_list_range(int start, int count,
+                                       m_get_item_cb get_item, void *ctx)
+{
+    struct mpv_node node;
+    node.format = MPV_FORMAT_NODE_ARRAY;
+    node.u.list = talloc_zero(NULL, mpv_node_list);
+    node.u.list->num = count;
+    node.u.list->values = talloc_array(node.u.list, mpv_node, count);
+    for (int n = 0; n < count; n++) {
+        struct mpv_node *sub = &node.u.list->values[n];
+        sub->format = MPV_FORMAT_NONE;
+        int r;
+        r = get_item(start + n, M_PROPERTY_GET_NODE, sub, ctx);
+        if (r == M_PROPERTY_NOT_IMPLEMENTED) {
+            struct m_option opt = {0};
+            r = get_item(start + n, M_PROPERTY_GET_TYPE, &opt, ctx);
+            if (r != M_PROPERTY_OK)
+                goto err;
+            union m_option_value val = m_option_value_default;
+            r = get_item(start + n, M_PROPERTY_GET, &val, ctx);
+            if (r != M_PROPERTY_OK)
+                goto err;
+            m_option_get_node(&opt, node.u.list, sub, &val);
+            m_option_free(&opt, &val);
+        err: ;
+        }
+    }
+    return node;
+}
+
+// Handle "range/<start>/<count>" keys. The range is clipped to the list.
+static int read_list_range_key(struct m_property_action_arg *ka, int count,
+                               m_get_item_cb get_item, void *ctx)
+{
+    bstr rest = bstr0(ka->key);
+    if (!bstr_eatstart0(&rest, "range/"))
+        return M_PROPERTY_UNKNOWN;
+    long long start = bstrtoll(rest, &rest, 10);
+    if (!bstr_eatstart0(&rest, "/"))
+        return M_PROPERTY_UNKNOWN;
+    long long num = bstrtoll(rest, &rest, 10);
+    if (rest.len || start < 0 || num < 0)
+        return M_PROPERTY_UNKNOWN;
+
+    switch (ka->action) {
+    case M_PROPERTY_GET_TYPE:
+        *(struct m_option *)ka->arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    case M_PROPERTY_GET:
+        start = MPMIN(start, MPMAX(count, 0));
+        num = MPMIN(num, count - start);
+        *(struct mpv_node *)ka->arg = read_list_range(start, num, get_item, ctx);
+        return M_PROPERTY_OK;
+    }
+    return M_PROPERTY_NOT_IMPLEMENTED;
+}
+
 // Make a list of items available as indexed sub-properties. E.g. you can access
 // item 0 as "property/0", item 1 as "property/1", etc., where each of these
 // properties is redirected to the get_item(0, ...), get_item(1, ...), callback.
-// Additionally, the number of entries is made available as "property/count".
+// Additionally, the number of entries is made available as "property/count",
+// and the items [START, START + COUNT) as "property/range/START/COUNT".
 // action, arg: property access.
 // count: number of items.
 // get_item: callback to access a single item.
@@ -546,34 +670,9 @@ int m_property_read_list(int action, void *arg, int count,
     case M_PROPERTY_GET_TYPE:
         *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
         return M_PROPERTY_OK;
-    case M_PROPERTY_GET: {
-        struct mpv_node node;
-        node.format = MPV_FORMAT_NODE_ARRAY;
-        node.u.list = talloc_zero(NULL, mpv_node_list);
-        node.u.list->num = count;
-        node.u.list->values = talloc_array(node.u.list, mpv_node, count);
-        for (int n = 0; n < count; n++) {
-            struct mpv_node *sub = &node.u.list->values[n];
-            sub->format = MPV_FORMAT_NONE;
-            int r;
-            r = get_item(n, M_PROPERTY_GET_NODE, sub, ctx);
-            if (r == M_PROPERTY_NOT_IMPLEMENTED) {
-                struct m_option opt = {0};
-                r = get_item(n, M_PROPERTY_GET_TYPE, &opt, ctx);
-                if (r != M_PROPERTY_OK)
-                    goto err;
-                union m_option_value val = m_option_value_default;
-                r = get_item(n, M_PROPERTY_GET, &val, ctx);
-                if (r != M_PROPERTY_OK)
-                    goto err;
-                m_option_get_node(&opt, node.u.list, sub, &val);
-                m_option_free(&opt, &val);
-            err: ;
-            }
-        }
-        *(struct mpv_node *)arg = node;
+    case M_PROPERTY_GET:
+        *(struct mpv_node *)arg = read_list_range(0, count, get_item, ctx);
         return M_PROPERTY_OK;
-    }
     case M_PROPERTY_PRINT: {
         // See m_property_read_sub() remarks.
         char *res = NULL;
@@ -605,6 +704,8 @@ int m_property_read_list(int action, void *arg, int count,
             }
             return M_PROPERTY_NOT_IMPLEMENTED;
         }
+        if (strncmp(ka->key, "range/", 6) == 0)
+            return read_list_range_key(ka, count, get_item, ctx);
         // This is expected of the form "123" or "123/rest"
         char *next = strchr(ka->key, '/');
         char *end = NULL;
@@ -146,11 +146,26 @@ struct m_property {
 struct m_property *m_property_list_find(const struct m_property *list,
                                         const char *name);
 
+// Hash table for looking up properties by name in constant time. This is
+// used for all property accesses that go through m_property_do().
+struct m_property_index;
+
+// Create an index for the {0}-terminated list. The list is referenced, and
+// must not be changed or freed while the index is in use. If names are
+// duplicated, the first entry wins (same as m_property_list_find()).
+struct m_property_index *m_property_index_create(void *ta_parent,
+                                                 const struct m_property *list);
+
+// Like m_property_list_find(), but name does not need to be 0-terminated, so
+// the prefix of a "a/b/c" path can be looked up without copying it.
+struct m_property *m_property_index_find(const struct m_property_index *index,
+                                         bstr name);
+
 // Access a property.
 // action: one of m_property_action
 // ctx: opaque value passed through to property implementation
 // returns: one of mp_property_return
-int m_property_do(struct mp_log *log, const struct m_property* prop_list,
+int m_property_do(struct mp_log *log, const struct m_property_index *prop_list,
                   const char* property_name, int action, void* arg, void *ctx);
 
 // Given a path of the form "a/b/c", this function will set *prefix to "a",
@@ -175,7 +190,7 @@ void m_properties_print_help_list(struct mp_log *log,
 // STR is recursively expanded using the same rules.
 // "$$" can be used to escape "$", and "$}" to escape "}".
 // "$>" disables parsing of "$" for the rest of the string.
-char* m_properties_expand_string(const struct m_property *prop_list,
+char* m_properties_expand_string(const struct m_property_index *prop_list,
                                  const char *str, void *ctx);
 
 // Trivial helpers for implementing properties.
@@ -228,6 +243,8 @@ int m_property_read_sub(const struct m_sub_property *props, int action, void *ar
 // ctx is userdata passed to m_property_read_list.
 typedef int (*m_get_item_cb)(int item, int action, void *arg, void *ctx);
 
+// Implements a list property. Supports "count", "N", "N/subprop" and
+// "range/START/COUNT" keys.
 int m_property_read_list(int action, void *arg, int count,
                          m_get_item_cb get_item, void *ctx);
 
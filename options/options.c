@@ -60,6 +60,7 @@ extern const struct m_sub_options stream_bluray_conf;
 extern const struct m_sub_options stream_cdda_conf;
 extern const struct m_sub_options stream_dvb_conf;
 extern const struct m_sub_options stream_lavf_conf;
+extern const struct m_sub_options stream_file_conf;
 extern const struct m_sub_options sws_conf;
 extern const struct m_sub_options zimg_conf;
 extern const struct m_sub_options drm_conf;
@@ -79,6 +80,7 @@ extern const struct m_sub_options ao_alsa_conf;
 
 extern const struct m_sub_options demux_conf;
 extern const struct m_sub_options demux_cache_conf;
+extern const struct m_sub_options shared_res_conf;
 
 extern const struct m_obj_list vf_obj_list;
 extern const struct m_obj_list af_obj_list;
@@ -597,6 +599,7 @@ static const m_option_t mp_opts[] = {
     {"dvbin", OPT_SUBSTRUCT(stream_dvb_opts, stream_dvb_conf)},
 #endif
     {"", OPT_SUBSTRUCT(stream_lavf_opts, stream_lavf_conf)},
+    {"", OPT_SUBSTRUCT(stream_file_opts, stream_file_conf)},
 
 // ------------------------- a-v sync options --------------------
 
@@ -812,6 +815,7 @@ static const m_option_t mp_opts[] = {
     {"input-terminal", OPT_BOOL(consolecontrols), .flags = UPDATE_TERM},
 
     {"input-ipc-server", OPT_STRING(ipc_path), .flags = M_OPT_FILE},
+    {"input-ipc-multiplex", OPT_BOOL(ipc_multiplex)},
 #if HAVE_POSIX
     {"input-ipc-client", OPT_STRING(ipc_client)},
 #endif
@@ -829,6 +833,7 @@ static const m_option_t mp_opts[] = {
     {"", OPT_SUBSTRUCT(vo, vo_sub_opts)},
     {"", OPT_SUBSTRUCT(demux_opts, demux_conf)},
     {"", OPT_SUBSTRUCT(demux_cache_opts, demux_cache_conf)},
+    {"", OPT_SUBSTRUCT(shared_res_opts, shared_res_conf)},
     {"", OPT_SUBSTRUCT(stream_opts, stream_conf)},
 
     {"", OPT_SUBSTRUCT(ra_ctx_opts, ra_ctx_conf)},
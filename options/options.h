@@ -327,6 +327,7 @@ typedef struct MPOpts {
     struct cdda_opts *stream_cdda_opts;
     struct dvb_opts *stream_dvb_opts;
     struct lavf_opts *stream_lavf_opts;
+    struct stream_file_opts *stream_file_opts;
 
     char *bluray_device;
 
@@ -339,6 +340,7 @@ typedef struct MPOpts {
 
     struct demux_opts *demux_opts;
     struct demux_cache_opts *demux_cache_opts;
+    struct shared_res_opts *shared_res_opts;
     struct stream_opts *stream_opts;
 
     struct vd_lavc_params *vd_lavc_params;
@@ -351,6 +353,7 @@ typedef struct MPOpts {
 
     char *ipc_path;
     char *ipc_client;
+    bool ipc_multiplex;
 
     struct mp_resample_opts *resample_opts;
 
@@ -102,7 +102,28 @@ struct observe_property {
     union m_option_value value;
     uint64_t value_ret_ts;  // logical timestamp of value returned to user
     union m_option_value value_ret;
+    uint64_t value_hash;    // hash_mpv_value() of value (if value_valid)
     bool waiting_for_hook;  // flag for draining old property changes on a hook
+    int64_t min_interval_ns; // rate limit for reading changed values (0: none)
+    int64_t next_update_ns; // earliest time a changed value is read again
+};
+
+// Property values read during one mp_client_send_property_changes() call. This
+// is accessed by the core thread only, and property values can't change while
+// it runs, so observers of the same property and format share a single read.
+struct prop_snapshot {
+    int id;                 // ==mp_get_property_id(name)
+    char *name;
+    mpv_format format;
+    int status;
+    union m_option_value value;
+    uint64_t hash;          // hash_mpv_value() of value (if status >= 0)
+};
+
+struct prop_snapshots {
+    void *ta_ctx;           // allocated on first use
+    struct prop_snapshot *entries;
+    int num_entries;
 };
 
 struct mpv_handle {
@@ -1594,6 +1615,23 @@ int mpv_unobserve_property(mpv_handle *ctx, uint64_t userdata)
     return count;
 }
 
+int mp_client_set_property_rate(struct mpv_handle *ctx, uint64_t userdata,
+                                double max_rate)
+{
+    int64_t interval = max_rate > 0 ? MP_TIME_S_TO_NS(1.0 / max_rate) : 0;
+    pthread_mutex_lock(&ctx->lock);
+    int count = 0;
+    for (int n = 0; n < ctx->num_properties; n++) {
+        struct observe_property *prop = ctx->properties[n];
+        if (prop->reply_id == userdata) {
+            prop->min_interval_ns = interval;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return count;
+}
+
 static bool property_shared_prefix(const char *a0, const char *b0)
 {
     bstr a = bstr0(a0);
@@ -1668,8 +1706,30 @@ static void notify_property_events(struct mpv_handle *ctx, int event)
         mp_dispatch_adjust_timeout(ctx->mpctx->dispatch, 0);
 }
 
+static struct prop_snapshot *find_snapshot(struct prop_snapshots *snaps,
+                                           struct observe_property *prop)
+{
+    for (int n = 0; n < snaps->num_entries; n++) {
+        struct prop_snapshot *snap = &snaps->entries[n];
+        if (snap->id == prop->id && snap->format == prop->format &&
+            strcmp(snap->name, prop->name) == 0)
+            return snap;
+    }
+    return NULL;
+}
+
+static void free_snapshots(struct prop_snapshots *snaps)
+{
+    for (int n = 0; n < snaps->num_entries; n++) {
+        struct prop_snapshot *snap = &snaps->entries[n];
+        m_option_free(get_mp_type_get(snap->format), &snap->value);
+    }
+    talloc_free(snaps->ta_ctx);
+}
+
 // Call with ctx->lock held (only). May temporarily drop the lock.
-static void send_client_property_changes(struct mpv_handle *ctx)
+static void send_client_property_changes(struct mpv_handle *ctx,
+                                         struct prop_snapshots *snaps)
 {
     uint64_t cur_ts = ctx->properties_change_ts;
 
@@ -1681,55 +1741,82 @@ static void send_client_property_changes(struct mpv_handle *ctx)
         if (prop->value_ts == prop->change_ts)
             continue;
 
+        // Don't delay the initial value, or hooks waiting for this property.
+        if (prop->min_interval_ns && prop->value_ts && !prop->waiting_for_hook) {
+            int64_t now = mp_time_ns();
+            if (now < prop->next_update_ns) {
+                // Keep the change pending, and retry when the interval is over.
+                mp_set_timeout(ctx->mpctx, (prop->next_update_ns - now) / 1e9);
+                ctx->has_pending_properties = true;
+                continue;
+            }
+            prop->next_update_ns = now + prop->min_interval_ns;
+        }
+
         bool changed = false;
         if (prop->format) {
             const struct m_option *type = prop->type;
-            union m_option_value val = m_option_value_default;
-            struct getproperty_request req = {
-                .mpctx = ctx->mpctx,
-                .name = prop->name,
-                .format = prop->format,
-                .data = &val,
-            };
-
-            // Temporarily unlock and read the property. The very important
-            // thing is that property getters can do whatever they want, _and_
-            // that they may wait on the client API user thread (if vo_libmpv
-            // or similar things are involved).
-            prop->refcount += 1; // keep prop alive (esp. prop->name)
-            ctx->async_counter += 1; // keep ctx alive
-            pthread_mutex_unlock(&ctx->lock);
-            getproperty_fn(&req);
-            pthread_mutex_lock(&ctx->lock);
-            ctx->async_counter -= 1;
-            prop_unref(prop);
-
-            // Set if observed properties was changed or something similar
-            // => start over, retry next time.
-            if (cur_ts != ctx->properties_change_ts || ctx->destroying) {
-                m_option_free(type, &val);
-                mp_wakeup_core(ctx->mpctx);
-                ctx->has_pending_properties = true;
-                break;
+            struct prop_snapshot *snap = find_snapshot(snaps, prop);
+            if (!snap) {
+                union m_option_value val = m_option_value_default;
+                struct getproperty_request req = {
+                    .mpctx = ctx->mpctx,
+                    .name = prop->name,
+                    .format = prop->format,
+                    .data = &val,
+                };
+
+                // Temporarily unlock and read the property. The very important
+                // thing is that property getters can do whatever they want,
+                // _and_ that they may wait on the client API user thread (if
+                // vo_libmpv or similar things are involved).
+                prop->refcount += 1; // keep prop alive (esp. prop->name)
+                ctx->async_counter += 1; // keep ctx alive
+                pthread_mutex_unlock(&ctx->lock);
+                getproperty_fn(&req);
+                pthread_mutex_lock(&ctx->lock);
+                ctx->async_counter -= 1;
+
+                if (!snaps->ta_ctx)
+                    snaps->ta_ctx = talloc_new(NULL);
+                MP_TARRAY_APPEND(snaps->ta_ctx, snaps->entries,
+                                 snaps->num_entries, (struct prop_snapshot){
+                    .id = prop->id,
+                    .name = talloc_strdup(snaps->ta_ctx, prop->name),
+                    .format = prop->format,
+                    .status = req.status,
+                    .value = val, // moved
+                    .hash = req.status >= 0 ?
+                            hash_mpv_value(&val, prop->format) : 0,
+                });
+                snap = &snaps->entries[snaps->num_entries - 1];
+                prop_unref(prop);
+
+                // Set if observed properties was changed or something similar
+                // => start over, retry next time.
+                if (cur_ts != ctx->properties_change_ts || ctx->destroying) {
+                    mp_wakeup_core(ctx->mpctx);
+                    ctx->has_pending_properties = true;
+                    break;
+                }
+                assert(prop->refcount > 0);
             }
-            assert(prop->refcount > 0);
 
-            bool val_valid = req.status >= 0;
+            // Comparing hashes instead of values makes this independent of the
+            // value size (think of playlist), and the number of observers.
+            bool val_valid = snap->status >= 0;
             changed = prop->value_valid != val_valid;
             if (prop->value_valid && val_valid)
-                changed = !equal_mpv_value(&prop->value, &val, prop->format);
+                changed = prop->value_hash != snap->hash;
             if (prop->value_ts == 0)
                 changed = true; // initial event
 
             prop->value_valid = val_valid;
             if (changed && val_valid) {
-                // move val to prop->value
                 m_option_free(type, &prop->value);
-                memcpy(&prop->value, &val, type->type->size);
-                memset(&val, 0, type->type->size);
+                m_option_copy(type, &prop->value, &snap->value);
+                prop->value_hash = snap->hash;
             }
-
-            m_option_free(prop->type, &val);
         } else {
             changed = true;
         }
@@ -1756,6 +1843,7 @@ static void send_client_property_changes(struct mpv_handle *ctx)
 void mp_client_send_property_changes(struct MPContext *mpctx)
 {
     struct mp_client_api *clients = mpctx->clients;
+    struct prop_snapshots snaps = {0};
 
     pthread_mutex_lock(&clients->lock);
     uint64_t cur_ts = clients->clients_list_change_ts;
@@ -1770,7 +1858,7 @@ void mp_client_send_property_changes(struct MPContext *mpctx)
         }
         // Keep ctx->lock locked (unlock order does not matter).
         pthread_mutex_unlock(&clients->lock);
-        send_client_property_changes(ctx);
+        send_client_property_changes(ctx, &snaps);
         pthread_mutex_unlock(&ctx->lock);
         pthread_mutex_lock(&clients->lock);
         if (cur_ts != clients->clients_list_change_ts) {
@@ -1781,6 +1869,8 @@ void mp_client_send_property_changes(struct MPContext *mpctx)
     }
 
     pthread_mutex_unlock(&clients->lock);
+
+    free_snapshots(&snaps);
 }
 
 // Set ctx->cur_event to a generated property change event, if there is any
@@ -31,6 +31,11 @@ int mp_client_send_event_dup(struct MPContext *mpctx, const char *client_name,
                              int event, void *data);
 void mp_client_property_change(struct MPContext *mpctx, const char *name);
 void mp_client_send_property_changes(struct MPContext *mpctx);
+// Limit how often changed values of the properties observed with the given
+// userdata are read and reported, to at most max_rate times per second (0
+// removes the limit). Returns the number of matching observations.
+int mp_client_set_property_rate(struct mpv_handle *ctx, uint64_t userdata,
+                                double max_rate);
 
 struct mpv_handle *mp_new_client(struct mp_client_api *clients, const char *name);
 void mp_client_set_weak(struct mpv_handle *ctx);
@@ -64,6 +64,7 @@
 #include "video/out/bitmap_packer.h"
 #include "options/path.h"
 #include "screenshot.h"
+#include "storyboard.h"
 #include "misc/dispatch.h"
 #include "misc/node.h"
 #include "misc/thread_pool.h"
@@ -81,6 +82,8 @@
 struct command_ctx {
     // All properties, terminated with a {0} item.
     struct m_property *properties;
+    // Name lookup table for properties[].
+    struct m_property_index *prop_index;
 
     double last_seek_time;
     double last_seek_pts;
@@ -1505,6 +1508,13 @@ static int mp_property_demuxer_cache_state(void *ctx, struct m_property *prop,
         node_map_add_double(r, "debug-seeking", s.seeking);
     node_map_add_int64(r, "debug-low-level-seeks", s.low_level_seeks);
     node_map_add_int64(r, "debug-byte-level-seeks", s.byte_level_seeks);
+    node_map_add_int64(r, "debug-packet-pool-hits", s.packet_pool.packet_hits);
+    node_map_add_int64(r, "debug-packet-pool-misses",
+                       s.packet_pool.packet_misses);
+    node_map_add_int64(r, "debug-buffer-pool-hits", s.packet_pool.buffer_hits);
+    node_map_add_int64(r, "debug-buffer-pool-misses",
+                       s.packet_pool.buffer_misses);
+    node_map_add_int64(r, "debug-buffer-pool-bytes", s.packet_pool.cached_bytes);
     if (s.ts_last != MP_NOPTS_VALUE)
         node_map_add_double(r, "debug-ts-last", s.ts_last);
 
@@ -2625,6 +2635,7 @@ static void get_frame_perf(struct mpv_node *node, struct mp_frame_perf *perf)
         node_map_add(pass, "avg", MPV_FORMAT_INT64)->u.int64 = data->avg;
         node_map_add(pass, "peak", MPV_FORMAT_INT64)->u.int64 = data->peak;
         node_map_add(pass, "count", MPV_FORMAT_INT64)->u.int64 = data->count;
+        node_map_add(pass, "total", MPV_FORMAT_INT64)->u.int64 = data->total;
         struct mpv_node *samples = node_map_add(pass, "samples", MPV_FORMAT_NODE_ARRAY);
         for (int n = 0; n < data->count; n++)
             node_array_add(samples, MPV_FORMAT_INT64)->u.int64 = data->samples[n];
@@ -3139,8 +3150,9 @@ static int mp_property_playlist(void *ctx, struct m_property *prop,
         struct playlist *pl = mpctx->playlist;
         char *res = talloc_strdup(NULL, "");
 
-        for (int n = 0; n < pl->num_entries; n++) {
-            struct playlist_entry *e = pl->entries[n];
+        for (struct playlist_entry *e = playlist_get_first(pl); e;
+             e = playlist_entry_get_rel(e, 1))
+        {
             char *p = e->title;
             if (!p) {
                 p = e->filename;
@@ -4138,16 +4150,20 @@ uint64_t mp_get_property_event_mask(const char *name)
     return mask;
 }
 
-// Return an ID for the property. It might not be unique, but is good enough
-// for property change handling. Return -1 if property unknown.
+// Return an ID for the property. Sub-properties and options share the ID of
+// the top-level property, which is good enough for property change handling.
+// Return -1 if property unknown.
 int mp_get_property_id(struct MPContext *mpctx, const char *name)
 {
     struct command_ctx *ctx = mpctx->command_ctx;
-    for (int n = 0; ctx->properties[n].name; n++) {
-        if (match_property(ctx->properties[n].name, name))
-            return n;
-    }
-    return -1;
+    // Give options and properties the same ID each (see match_property()).
+    if (strncmp(name, "options/", 8) == 0)
+        name += 8;
+    bstr prefix;
+    char *rem;
+    m_property_split_path(name, &prefix, &rem);
+    struct m_property *prop = m_property_index_find(ctx->prop_index, prefix);
+    return prop ? prop - ctx->properties : -1;
 }
 
 static bool is_property_set(int action, void *val)
@@ -4172,7 +4188,7 @@ int mp_property_do(const char *name, int action, void *val,
                    struct MPContext *ctx)
 {
     struct command_ctx *cmd = ctx->command_ctx;
-    int r = m_property_do(ctx->log, cmd->properties, name, action, val, ctx);
+    int r = m_property_do(ctx->log, cmd->prop_index, name, action, val, ctx);
 
     if (mp_msg_test(ctx->log, MSGL_V) && is_property_set(action, val)) {
         struct m_option ot = {0};
@@ -4197,7 +4213,7 @@ int mp_property_do(const char *name, int action, void *val,
 char *mp_property_expand_string(struct MPContext *mpctx, const char *str)
 {
     struct command_ctx *ctx = mpctx->command_ctx;
-    return m_properties_expand_string(ctx->properties, str, mpctx);
+    return m_properties_expand_string(ctx->prop_index, str, mpctx);
 }
 
 // Before expanding properties, parse C-style escapes like "\n"
@@ -6606,6 +6622,20 @@ const struct mp_cmd_def mp_cmds[] = {
                 OPTDEF_INT(2)},
         },
     },
+    { "storyboard", cmd_storyboard,
+        {
+            {"url", OPT_STRING(v.s)},
+            {"filename", OPT_STRING(v.s)},
+            {"columns", OPT_INT(v.i), OPTDEF_INT(5), M_RANGE(1, 100),
+                .flags = MP_CMD_OPT_ARG},
+            {"rows", OPT_INT(v.i), OPTDEF_INT(5), M_RANGE(1, 100),
+                .flags = MP_CMD_OPT_ARG},
+            {"width", OPT_INT(v.i), OPTDEF_INT(160), M_RANGE(16, 4096),
+                .flags = MP_CMD_OPT_ARG},
+        },
+        .spawn_thread = true,
+        .can_abort = true,
+    },
     { "loadfile", cmd_loadfile,
         {
             {"url", OPT_STRING(v.s)},
@@ -6886,6 +6916,8 @@ void command_init(struct MPContext *mpctx)
         ctx->properties[count++] = prop;
     }
 
+    ctx->prop_index = m_property_index_create(ctx, ctx->properties);
+
     node_init(&ctx->udata, MPV_FORMAT_NODE_MAP, NULL);
     talloc_steal(ctx, ctx->udata.u.list);
 }
@@ -7128,6 +7160,9 @@ void mp_option_change_callback(void *ctx, struct m_config_option *co, int flags,
         mp_wakeup_core(mpctx);
     }
 
+    if (opt_ptr == &opts->ab_loop_count)
+        update_ab_loop_cache_pin(mpctx);
+
     if (opt_ptr == &opts->vf_settings)
         set_filters(mpctx, STREAM_VIDEO, opts->vf_settings);
 
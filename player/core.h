@@ -273,6 +273,10 @@ typedef struct MPContext {
     char *stream_open_filename;
     char **playlist_paths; // used strictly for playlist validation
     int playlist_paths_len;
+    // Directory scan that still adds entries after playlist_stream_last.
+    struct demux_playlist_stream *playlist_stream;
+    struct playlist_entry *playlist_stream_last; // reserved reference
+    char *playlist_stream_path;
     enum stop_play_reason stop_play;
     bool playback_initialized; // playloop can be run/is running
     int error_playing;
@@ -448,6 +452,7 @@ typedef struct MPContext {
     char *open_format;
     int open_url_flags;
     bool open_for_prefetch;
+    bool open_stream_playlist;
     // --- All fields below are owned by open_thread, unless open_done was set
     //     to true.
     struct demuxer *open_res_demuxer;
@@ -522,6 +527,7 @@ struct playlist_entry *mp_next_file(struct MPContext *mpctx, int direction,
                                     bool force);
 void mp_set_playlist_entry(struct MPContext *mpctx, struct playlist_entry *e);
 void mp_play_files(struct MPContext *mpctx);
+void handle_playlist_stream(struct MPContext *mpctx);
 void update_demuxer_properties(struct MPContext *mpctx);
 void print_track_list(struct MPContext *mpctx, const char *msg);
 void reselect_demux_stream(struct MPContext *mpctx, struct track *track,
@@ -599,6 +605,7 @@ int handle_force_window(struct MPContext *mpctx, bool force);
 void seek_to_last_frame(struct MPContext *mpctx);
 void update_screensaver_state(struct MPContext *mpctx);
 void update_ab_loop_clip(struct MPContext *mpctx);
+void update_ab_loop_cache_pin(struct MPContext *mpctx);
 bool get_internal_paused(struct MPContext *mpctx);
 
 // scripting.c
@@ -1078,12 +1078,17 @@ void prepare_playlist(struct MPContext *mpctx, struct playlist *pl)
 
 // Replace the current playlist entry with playlist contents. Moves the entries
 // from the given playlist pl, so the entries don't actually need to be copied.
-static void transfer_playlist(struct MPContext *mpctx, struct playlist *pl,
-                              int64_t *start_id, int *num_new_entries)
+// Returns the last added entry (NULL if pl was empty).
+static struct playlist_entry *transfer_playlist(struct MPContext *mpctx,
+                                                struct playlist *pl,
+                                                int64_t *start_id,
+                                                int *num_new_entries)
 {
+    struct playlist_entry *last = NULL;
     if (pl->num_entries) {
         prepare_playlist(mpctx, pl);
         struct playlist_entry *new = pl->current;
+        last = playlist_get_last(pl);
         *num_new_entries = pl->num_entries;
         *start_id = playlist_transfer_entries(mpctx->playlist, pl);
         // current entry is replaced
@@ -1094,6 +1099,85 @@ static void transfer_playlist(struct MPContext *mpctx, struct playlist *pl,
     } else {
         MP_WARN(mpctx, "Empty playlist!\n");
     }
+    return last;
+}
+
+static void stop_playlist_stream(struct MPContext *mpctx)
+{
+    if (!mpctx->playlist_stream)
+        return;
+    TA_FREEP(&mpctx->playlist_stream);
+    TA_FREEP(&mpctx->playlist_stream_path);
+    playlist_entry_unref(mpctx->playlist_stream_last);
+    mpctx->playlist_stream_last = NULL;
+}
+
+// Keep adding the entries of a directory that is still being scanned, after
+// last (the last entry transferred from it so far).
+static void start_playlist_stream(struct MPContext *mpctx,
+                                  struct demuxer *demuxer,
+                                  struct playlist_entry *last)
+{
+    stop_playlist_stream(mpctx);
+    if (!demuxer->playlist_stream)
+        return;
+    mpctx->playlist_stream = talloc_steal(mpctx, demuxer->playlist_stream);
+    demuxer->playlist_stream = NULL;
+    // The remaining entries can't be merged or shuffled into the entries that
+    // were already added. start_open() doesn't request streaming in this case,
+    // but the options could have changed since the demuxer was opened.
+    if (mpctx->opts->merge_files || mpctx->opts->shuffle) {
+        MP_WARN(mpctx, "Directory scan aborted because the playlist was "
+                "merged or shuffled.\n");
+        last = NULL;
+    }
+    if (!last || last->pl != mpctx->playlist) {
+        TA_FREEP(&mpctx->playlist_stream);
+        return;
+    }
+    mpctx->playlist_stream_path = talloc_strdup(NULL, mpctx->filename);
+    mpctx->playlist_stream_last = last;
+    last->reserved += 1;
+    demux_playlist_stream_set_wakeup_cb(mpctx->playlist_stream,
+                                        mp_wakeup_core_cb, mpctx);
+}
+
+void handle_playlist_stream(struct MPContext *mpctx)
+{
+    if (!mpctx->playlist_stream)
+        return;
+
+    struct playlist *pl = talloc_zero(NULL, struct playlist);
+    bool more = demux_playlist_stream_read(mpctx->playlist_stream, pl);
+    struct playlist_entry *last = mpctx->playlist_stream_last;
+    if (last->pl != mpctx->playlist) {
+        // The user removed the entries; don't add the rest either.
+        more = false;
+    } else if (pl->num_entries) {
+        struct playlist_entry *new_last = playlist_get_last(pl);
+        playlist_populate_playlist_path(pl, mpctx->playlist_stream_path);
+        playlist_insert_entries_after(mpctx->playlist, last, pl);
+        playlist_entry_unref(last);
+        mpctx->playlist_stream_last = new_last;
+        new_last->reserved += 1;
+        mp_notify_property(mpctx, "playlist");
+    }
+    talloc_free(pl);
+
+    if (!more)
+        stop_playlist_stream(mpctx);
+}
+
+// Don't run into the end of a playlist that is still being added to.
+static void wait_playlist_stream(struct MPContext *mpctx)
+{
+    enum stop_play_reason stop_play = mpctx->stop_play;
+    if (stop_play != PT_NEXT_ENTRY && stop_play != PT_ERROR &&
+        stop_play != AT_END_OF_FILE)
+        return;
+    while (mpctx->playlist_stream && mpctx->stop_play == stop_play &&
+           !playlist_get_next(mpctx->playlist, +1))
+        mp_idle(mpctx);
 }
 
 static void process_hooks(struct MPContext *mpctx, char *name)
@@ -1165,6 +1249,7 @@ static void *open_demux_thread(void *ctx)
         .force_format = mpctx->open_format,
         .stream_flags = mpctx->open_url_flags,
         .stream_record = true,
+        .stream_playlist = mpctx->open_stream_playlist,
         .is_top_level = true,
     };
     struct demuxer *demux =
@@ -1236,6 +1321,9 @@ static void start_open(struct MPContext *mpctx, char *url, int url_flags,
     mpctx->open_format = talloc_strdup(NULL, mpctx->opts->demuxer_name);
     mpctx->open_url_flags = url_flags;
     mpctx->open_for_prefetch = for_prefetch && mpctx->opts->demuxer_thread;
+    // Merged or shuffled playlists need all entries at once.
+    mpctx->open_stream_playlist =
+        !mpctx->opts->merge_files && !mpctx->opts->shuffle;
 
     if (pthread_create(&mpctx->open_thread, NULL, open_demux_thread, mpctx)) {
         cancel_open(mpctx);
@@ -1313,8 +1401,8 @@ static void clear_playlist_paths(struct MPContext *mpctx)
 
 static bool infinite_playlist_loading_loop(struct MPContext *mpctx, struct playlist *pl)
 {
-    if (pl->num_entries) {
-        struct playlist_entry *e = pl->entries[0];
+    struct playlist_entry *e = playlist_get_first(pl);
+    if (e) {
         for (int n = 0; n < mpctx->playlist_paths_len; n++) {
             if (strcmp(mpctx->playlist_paths[n], e->filename) == 0) {
                 clear_playlist_paths(mpctx);
@@ -1682,8 +1770,10 @@ static void play_current_file(struct MPContext *mpctx)
             MP_ERR(mpctx, "Infinite playlist loading loop detected.\n");
             goto terminate_playback;
         }
-        transfer_playlist(mpctx, pl, &end_event.playlist_insert_id,
-                          &end_event.playlist_insert_num_entries);
+        struct playlist_entry *last =
+            transfer_playlist(mpctx, pl, &end_event.playlist_insert_id,
+                              &end_event.playlist_insert_num_entries);
+        start_playlist_stream(mpctx, mpctx->demuxer, last);
         mp_notify_property(mpctx, "playlist");
         mpctx->error_playing = 2;
         goto terminate_playback;
@@ -1979,11 +2069,9 @@ struct playlist_entry *mp_next_file(struct MPContext *mpctx, int direction,
         if (!force && next && next->init_failed && !ignore_failures) {
             // Don't endless loop if no file in playlist is playable
             bool all_failed = true;
-            for (int n = 0; n < mpctx->playlist->num_entries; n++) {
-                all_failed &= mpctx->playlist->entries[n]->init_failed;
-                if (!all_failed)
-                    break;
-            }
+            for (struct playlist_entry *e = playlist_get_first(mpctx->playlist);
+                 e && all_failed; e = playlist_entry_get_rel(e, 1))
+                all_failed &= e->init_failed;
             if (all_failed)
                 next = NULL;
         }
@@ -2022,6 +2110,10 @@ void mp_play_files(struct MPContext *mpctx)
         if (mpctx->stop_play == PT_QUIT)
             break;
 
+        wait_playlist_stream(mpctx);
+        if (mpctx->stop_play == PT_QUIT)
+            break;
+
         struct playlist_entry *new_entry = NULL;
         if (mpctx->stop_play == PT_NEXT_ENTRY || mpctx->stop_play == PT_ERROR ||
             mpctx->stop_play == AT_END_OF_FILE)
@@ -2039,6 +2131,7 @@ void mp_play_files(struct MPContext *mpctx)
             break;
     }
 
+    stop_playlist_stream(mpctx);
     cancel_open(mpctx);
 
     if (mpctx->encode_lavc_ctx) {
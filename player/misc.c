@@ -303,9 +303,10 @@ void merge_playlist_files(struct playlist *pl)
     if (!pl->num_entries)
         return;
     char *edl = talloc_strdup(NULL, "edl://");
-    for (int n = 0; n < pl->num_entries; n++) {
-        struct playlist_entry *e = pl->entries[n];
-        if (n)
+    for (struct playlist_entry *e = playlist_get_first(pl); e;
+         e = playlist_entry_get_rel(e, 1))
+    {
+        if (e != playlist_get_first(pl))
             edl = talloc_strdup_append_buffer(edl, ";");
         // Escape if needed
         if (e->filename[strcspn(e->filename, "=%,;\n")] ||
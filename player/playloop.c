@@ -642,6 +642,20 @@ void update_ab_loop_clip(struct MPContext *mpctx)
     mpctx->ab_loop_clip = pts != MP_NOPTS_VALUE &&
                           get_ab_loop_times(mpctx, ab) &&
                           pts * mpctx->play_dir <= ab[1] * mpctx->play_dir;
+
+    update_ab_loop_cache_pin(mpctx);
+}
+
+// Make the demuxer cache keep the A-B loop range, instead of reading past it.
+void update_ab_loop_cache_pin(struct MPContext *mpctx)
+{
+    if (!mpctx->demuxer)
+        return;
+
+    double ab[2];
+    if (!get_ab_loop_times(mpctx, ab) || mpctx->play_dir < 0)
+        ab[0] = ab[1] = MP_NOPTS_VALUE;
+    demux_set_cache_pin(mpctx->demuxer, ab[0], ab[1]);
 }
 
 static void handle_osd_redraw(struct MPContext *mpctx)
@@ -1210,6 +1224,7 @@ void run_playloop(struct MPContext *mpctx)
     handle_cursor_autohide(mpctx);
     handle_vo_events(mpctx);
     handle_command_updates(mpctx);
+    handle_playlist_stream(mpctx);
 
     if (mpctx->lavfi && mp_filter_has_failed(mpctx->lavfi))
         mpctx->stop_play = AT_END_OF_FILE;
@@ -1266,6 +1281,7 @@ void mp_idle(struct MPContext *mpctx)
     mp_wait_events(mpctx);
     mp_process_input(mpctx);
     handle_command_updates(mpctx);
+    handle_playlist_stream(mpctx);
     handle_update_cache(mpctx);
     handle_cursor_autohide(mpctx);
     handle_vo_events(mpctx);
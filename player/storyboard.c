@@ -0,0 +1,323 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libavcodec/avcodec.h>
+
+#include "common/av_common.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "demux/demux.h"
+#include "demux/packet.h"
+#include "demux/stheader.h"
+#include "input/cmd.h"
+#include "misc/node.h"
+#include "misc/thread_tools.h"
+#include "mpv_talloc.h"
+#include "options/options.h"
+#include "options/path.h"
+#include "osdep/timer.h"
+#include "stream/stream.h"
+#include "video/image_writer.h"
+#include "video/mp_image.h"
+#include "video/sws_utils.h"
+
+#include "command.h"
+#include "core.h"
+#include "storyboard.h"
+
+// Give up if the demuxer returns this many packets after a seek without a
+// keyframe among them (avoids reading the whole file on broken indexes).
+#define MAX_SKIPPED_PACKETS 1000
+
+struct storyboard {
+    struct mp_log *log;
+    struct mpv_global *global;
+    struct mp_cancel *cancel;
+
+    struct demuxer *demuxer;
+    struct sh_stream *sh;
+
+    AVCodecContext *avctx;
+    AVPacket *avpkt;
+    AVFrame *avframe;
+    AVRational codec_timebase;
+
+    struct mp_sws_context *sws;
+    int cols, rows, tile_w, tile_h;
+    struct mp_image *sprite;
+
+    // Last decoded keyframe; reused if a seek lands on the same one again.
+    struct mp_image *last_image;
+    int64_t last_pos;
+
+    int keyframes; // number of frames decoded
+};
+
+static void storyboard_destroy(void *ptr)
+{
+    struct storyboard *sb = ptr;
+
+    avcodec_free_context(&sb->avctx);
+    av_frame_free(&sb->avframe);
+    mp_free_av_packet(&sb->avpkt);
+    if (sb->demuxer)
+        demux_free(sb->demuxer);
+}
+
+static bool open_decoder(struct storyboard *sb)
+{
+    struct mp_codec_params *codec = sb->sh->codec;
+
+    const AVCodec *lavc_codec =
+        avcodec_find_decoder(mp_codec_to_av_codec_id(codec->codec));
+    if (!lavc_codec) {
+        MP_ERR(sb, "No decoder for codec '%s'.\n", codec->codec);
+        return false;
+    }
+
+    sb->avctx = avcodec_alloc_context3(lavc_codec);
+    sb->avframe = av_frame_alloc();
+    sb->avpkt = av_packet_alloc();
+    MP_HANDLE_OOM(sb->avctx && sb->avframe && sb->avpkt);
+
+    sb->codec_timebase = mp_get_codec_timebase(codec);
+    sb->avctx->pkt_timebase = sb->codec_timebase;
+
+    // Only keyframes are ever sent to the decoder, and the output is scaled
+    // down to thumbnail size, so deblocking is a waste of time.
+    sb->avctx->skip_loop_filter = AVDISCARD_ALL;
+    sb->avctx->skip_frame = AVDISCARD_NONKEY;
+
+    if (mp_set_avctx_codec_headers(sb->avctx, codec) < 0) {
+        MP_ERR(sb, "Could not set decoder parameters.\n");
+        return false;
+    }
+
+    mp_set_avcodec_threads(sb->log, sb->avctx, 0);
+
+    if (avcodec_open2(sb->avctx, lavc_codec, NULL) < 0) {
+        MP_ERR(sb, "Could not open codec.\n");
+        return false;
+    }
+    return true;
+}
+
+// Seek to the keyframe at or before pts, and return its packet.
+static struct demux_packet *read_keyframe(struct storyboard *sb, double pts)
+{
+    if (!demux_seek(sb->demuxer, pts, 0))
+        return NULL;
+
+    for (int n = 0; n < MAX_SKIPPED_PACKETS; n++) {
+        if (mp_cancel_test(sb->cancel))
+            return NULL;
+        struct demux_packet *dp = demux_read_any_packet(sb->demuxer);
+        if (!dp || dp->keyframe)
+            return dp;
+        free_demux_packet(dp);
+    }
+    return NULL;
+}
+
+// Decode a single keyframe packet (draining the decoder).
+static struct mp_image *decode_keyframe(struct storyboard *sb,
+                                        struct demux_packet *dp)
+{
+    avcodec_flush_buffers(sb->avctx);
+
+    mp_set_av_packet(sb->avpkt, dp, &sb->codec_timebase);
+    if (avcodec_send_packet(sb->avctx, sb->avpkt) < 0)
+        return NULL;
+    avcodec_send_packet(sb->avctx, NULL);
+
+    struct mp_image *img = NULL;
+    while (!img) {
+        int ret = avcodec_receive_frame(sb->avctx, sb->avframe);
+        if (ret < 0)
+            break;
+        img = mp_image_from_av_frame(sb->avframe);
+        av_frame_unref(sb->avframe);
+    }
+    if (img)
+        sb->keyframes++;
+    return img;
+}
+
+static bool init_sprite(struct storyboard *sb, struct mp_image *img)
+{
+    int d_w, d_h;
+    mp_image_params_get_dsize(&img->params, &d_w, &d_h);
+    if (d_w < 1 || d_h < 1)
+        return false;
+    sb->tile_h = MPMAX(2, MP_ALIGN_UP(sb->tile_w * d_h / d_w, 2));
+
+    sb->sprite = mp_image_alloc(IMGFMT_RGB24, sb->tile_w * sb->cols,
+                                sb->tile_h * sb->rows);
+    if (!sb->sprite)
+        return false;
+    talloc_steal(sb, sb->sprite);
+    mp_image_params_guess_csp(&sb->sprite->params);
+    mp_image_clear(sb->sprite, 0, 0, sb->sprite->w, sb->sprite->h);
+    return true;
+}
+
+static bool draw_tile(struct storyboard *sb, int index, struct mp_image *img)
+{
+    if (!sb->sprite && !init_sprite(sb, img))
+        return false;
+
+    int x = (index % sb->cols) * sb->tile_w;
+    int y = (index / sb->cols) * sb->tile_h;
+
+    struct mp_image *tile = mp_image_new_dummy_ref(sb->sprite);
+    mp_image_crop(tile, x, y, x + sb->tile_w, y + sb->tile_h);
+    bool ok = mp_sws_scale(sb->sws, tile, img) >= 0;
+    talloc_free(tile);
+    return ok;
+}
+
+static bool make_storyboard(struct storyboard *sb, const char *url)
+{
+    struct demuxer_params params = {
+        .stream_flags = STREAM_ORIGIN_DIRECT,
+    };
+    sb->demuxer = demux_open_url(url, &params, sb->cancel, sb->global);
+    if (!sb->demuxer) {
+        MP_ERR(sb, "Could not open '%s'.\n", url);
+        return false;
+    }
+
+    for (int n = 0; n < demux_get_num_stream(sb->demuxer); n++) {
+        struct sh_stream *sh = demux_get_stream(sb->demuxer, n);
+        bool selected = !sb->sh && sh->type == STREAM_VIDEO &&
+                        !sh->attached_picture;
+        if (selected)
+            sb->sh = sh;
+        demuxer_select_track(sb->demuxer, sh, MP_NOPTS_VALUE, selected);
+    }
+    if (!sb->sh) {
+        MP_ERR(sb, "No video stream in '%s'.\n", url);
+        return false;
+    }
+
+    double start = sb->demuxer->start_time;
+    double duration = sb->demuxer->duration;
+    if (!sb->demuxer->seekable || duration <= 0) {
+        MP_ERR(sb, "'%s' is not seekable or has unknown duration.\n", url);
+        return false;
+    }
+
+    if (!open_decoder(sb))
+        return false;
+
+    sb->sws = mp_sws_alloc(sb);
+    mp_sws_enable_cmdline_opts(sb->sws, sb->global);
+
+    int num_tiles = sb->cols * sb->rows;
+    int drawn = 0;
+    for (int n = 0; n < num_tiles; n++) {
+        // Center of each of the num_tiles equal parts of the file. The seek
+        // snaps this to the preceding keyframe from the demuxer's index.
+        double pts = start + duration * (n + 0.5) / num_tiles;
+
+        struct demux_packet *dp = read_keyframe(sb, pts);
+        if (!dp)
+            break;
+        if (!sb->last_image || dp->pos < 0 || dp->pos != sb->last_pos) {
+            struct mp_image *img = decode_keyframe(sb, dp);
+            if (img) {
+                talloc_free(sb->last_image);
+                sb->last_image = talloc_steal(sb, img);
+                sb->last_pos = dp->pos;
+            }
+        }
+        free_demux_packet(dp);
+
+        if (!sb->last_image || !draw_tile(sb, n, sb->last_image))
+            break;
+        drawn++;
+    }
+
+    if (mp_cancel_test(sb->cancel))
+        return false;
+    // Don't write a sheet with blank tiles, which would show wrong previews.
+    if (drawn < num_tiles) {
+        MP_ERR(sb, "Could only create %d of %d tiles from '%s'.\n",
+               drawn, num_tiles, url);
+        return false;
+    }
+    return true;
+}
+
+void cmd_storyboard(void *p)
+{
+    struct mp_cmd_ctx *cmd = p;
+    struct MPContext *mpctx = cmd->mpctx;
+    const char *url = cmd->args[0].v.s;
+    const char *filename = cmd->args[1].v.s;
+
+    struct storyboard *sb = talloc_zero(NULL, struct storyboard);
+    talloc_set_destructor(sb, storyboard_destroy);
+    *sb = (struct storyboard){
+        .log = mp_log_new(sb, mpctx->log, "storyboard"),
+        .global = mpctx->global,
+        .cancel = cmd->abort->cancel,
+        .cols = cmd->args[2].v.i,
+        .rows = cmd->args[3].v.i,
+        .tile_w = MP_ALIGN_UP(cmd->args[4].v.i, 2),
+        .last_pos = -1,
+    };
+
+    struct image_writer_opts opts = *mpctx->opts->screenshot_image_opts;
+    int format = image_writer_format_from_ext(mp_splitext(filename, NULL));
+    if (format)
+        opts.format = format;
+
+    mp_core_unlock(mpctx);
+
+    int64_t start = mp_time_ns();
+    bool ok = make_storyboard(sb, url);
+    if (ok) {
+        ok = write_image(sb->sprite, &opts, filename, sb->global, sb->log);
+        if (!ok)
+            MP_ERR(sb, "Could not write '%s'.\n", filename);
+    }
+    double secs = MP_TIME_NS_TO_S(mp_time_ns() - start);
+    if (ok) {
+        MP_VERBOSE(sb, "Wrote '%s': %d keyframes decoded in %.3f s.\n",
+                   filename, sb->keyframes, secs);
+    }
+
+    int w = ok ? sb->sprite->w : 0, h = ok ? sb->sprite->h : 0;
+    int tile_w = sb->tile_w, tile_h = sb->tile_h, keyframes = sb->keyframes;
+    // Closing the demuxer may block on network I/O, so do it unlocked.
+    talloc_free(sb);
+
+    mp_core_lock(mpctx);
+
+    if (ok) {
+        struct mpv_node *res = &cmd->result;
+        node_init(res, MPV_FORMAT_NODE_MAP, NULL);
+        node_map_add_int64(res, "width", w);
+        node_map_add_int64(res, "height", h);
+        node_map_add_int64(res, "tile-width", tile_w);
+        node_map_add_int64(res, "tile-height", tile_h);
+        node_map_add_int64(res, "keyframes", keyframes);
+        node_map_add_double(res, "time", secs);
+    }
+    cmd->success = ok;
+}
@@ -64,6 +64,9 @@ enum stream_ctrl {
     STREAM_CTRL_AVSEEK,
     STREAM_CTRL_HAS_AVSEEK,
     STREAM_CTRL_GET_METADATA,
+    // char** (talloc'ed string, freed by caller): opaque identifier that
+    // changes if the contents of the media change (e.g. modification time)
+    STREAM_CTRL_GET_IDENTITY,
 
     // Optical discs (internal interface between streams and demux_disc)
     STREAM_CTRL_GET_TIME_LENGTH,
@@ -30,12 +30,17 @@
 #include <poll.h>
 #endif
 
+#if HAVE_POSIX
+#include <sys/mman.h>
+#endif
+
 #include "osdep/io.h"
 
 #include "common/common.h"
 #include "common/msg.h"
 #include "misc/thread_tools.h"
 #include "stream.h"
+#include "options/m_config.h"
 #include "options/m_option.h"
 #include "options/path.h"
 
@@ -58,6 +63,26 @@
 #endif
 #endif
 
+struct stream_file_opts {
+    bool mmap;
+    int64_t readahead;
+};
+
+#define OPT_BASE_STRUCT struct stream_file_opts
+
+const struct m_sub_options stream_file_conf = {
+    .opts = (const struct m_option[]){
+        {"stream-file-mmap", OPT_BOOL(mmap)},
+        {"stream-file-readahead", OPT_BYTE_SIZE(readahead),
+            M_RANGE(0, M_MAX_MEM_BYTES)},
+        {0}
+    },
+    .size = sizeof(struct stream_file_opts),
+};
+
+// Granularity of readahead hints given to the kernel.
+#define READAHEAD_CHUNK (1024 * 1024)
+
 struct priv {
     int fd;
     bool close;
@@ -66,6 +91,12 @@ struct priv {
     bool appending;
     int64_t orig_size;
     struct mp_cancel *cancel;
+
+    int64_t pos;        // file offset of the next fill_buffer() call
+    uint8_t *map;       // if non-NULL, file contents mapped via mmap()
+    int64_t map_size;
+    int64_t readahead;  // bytes to keep hinted ahead of pos (0: disabled)
+    int64_t ra_end;     // end of the range hinted so far
 };
 
 // Total timeout = RETRY_TIMEOUT * MAX_RETRIES
@@ -85,10 +116,77 @@ static int64_t get_size(stream_t *s)
     return -1;
 }
 
+static int control(stream_t *s, int cmd, void *arg)
+{
+    struct priv *p = s->priv;
+    switch (cmd) {
+    case STREAM_CTRL_GET_IDENTITY: {
+        struct stat st;
+        if (!p->regular_file || fstat(p->fd, &st) != 0)
+            break;
+        *(char **)arg = talloc_asprintf(NULL, "file:%llx:%llx:%lld",
+                                        (unsigned long long)st.st_dev,
+                                        (unsigned long long)st.st_ino,
+                                        (long long)st.st_mtime);
+        return STREAM_OK;
+    }
+    }
+    return STREAM_UNSUPPORTED;
+}
+
+// Ask the kernel to start reading the data ahead of p->pos, so that the
+// following fill_buffer() calls find it in the page cache. The hints are
+// asynchronous, so this keeps up to p->readahead bytes of I/O in flight
+// without blocking the caller.
+static void update_readahead(struct priv *p)
+{
+    if (!p->readahead)
+        return;
+    int64_t target = p->pos + p->readahead;
+    if (p->ra_end < p->pos)
+        p->ra_end = p->pos & ~(int64_t)(READAHEAD_CHUNK - 1);
+    // Issue the hints in whole chunks to avoid a syscall per small read.
+    if (target - p->ra_end < READAHEAD_CHUNK)
+        return;
+    int64_t len = (target - p->ra_end) & ~(int64_t)(READAHEAD_CHUNK - 1);
+#if HAVE_POSIX
+    if (p->map) {
+        if (p->ra_end < p->map_size) {
+            int64_t map_len = MPMIN(len, p->map_size - p->ra_end);
+            madvise(p->map + p->ra_end, map_len, MADV_WILLNEED);
+        }
+    } else {
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(p->fd, p->ra_end, len, POSIX_FADV_WILLNEED);
+#endif
+    }
+#endif
+    p->ra_end += len;
+}
+
+static int fill_buffer_mmap(stream_t *s, void *buffer, int max_len)
+{
+    struct priv *p = s->priv;
+    int len = MPMIN(max_len, p->map_size - p->pos);
+    memcpy(buffer, p->map + p->pos, len);
+    p->pos += len;
+    update_readahead(p);
+    return len;
+}
+
 static int fill_buffer(stream_t *s, void *buffer, int max_len)
 {
     struct priv *p = s->priv;
 
+    if (p->map && p->pos < p->map_size)
+        return fill_buffer_mmap(s, buffer, max_len);
+
+    if (p->map) {
+        // Past the mapped area (file was appended to): continue with read().
+        if (lseek(p->fd, p->pos, SEEK_SET) == (off_t)-1)
+            return 0;
+    }
+
 #ifndef __MINGW32__
     if (p->use_poll) {
         int c = mp_cancel_get_fd(p->cancel);
@@ -104,8 +202,11 @@ static int fill_buffer(stream_t *s, void *buffer, int max_len)
 
     for (int retries = 0; retries < MAX_RETRIES; retries++) {
         int r = read(p->fd, buffer, max_len);
-        if (r > 0)
+        if (r > 0) {
+            p->pos += r;
+            update_readahead(p);
             return r;
+        }
 
         // Try to detect and handle files being appended during playback.
         int64_t size = get_size(s);
@@ -134,16 +235,49 @@ static int write_buffer(stream_t *s, void *buffer, int len)
 static int seek(stream_t *s, int64_t newpos)
 {
     struct priv *p = s->priv;
-    return lseek(p->fd, newpos, SEEK_SET) != (off_t)-1;
+    if (p->map) {
+        // lseek() is deferred until reading past the mapped area.
+        p->pos = newpos;
+        return 1;
+    }
+    if (lseek(p->fd, newpos, SEEK_SET) == (off_t)-1)
+        return 0;
+    p->pos = newpos;
+    return 1;
 }
 
 static void s_close(stream_t *s)
 {
     struct priv *p = s->priv;
+#if HAVE_POSIX
+    if (p->map)
+        munmap(p->map, p->map_size);
+#endif
     if (p->close)
         close(p->fd);
 }
 
+// Map the whole file for reading. On failure, the normal read() path is used.
+static void try_mmap(stream_t *s, int64_t size)
+{
+    struct priv *p = s->priv;
+#if HAVE_POSIX
+    if (size <= 0 || size != (size_t)size)
+        return;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, p->fd, 0);
+    if (map == MAP_FAILED) {
+        MP_VERBOSE(s, "mmap() failed: %s\n", mp_strerror(errno));
+        return;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    p->map = map;
+    p->map_size = size;
+    MP_VERBOSE(s, "Reading file via mmap().\n");
+#else
+    MP_VERBOSE(s, "mmap() not supported on this platform.\n");
+#endif
+}
+
 // If url is a file:// URL, return the local filename, otherwise return NULL.
 char *mp_file_url_to_filename(void *talloc_ctx, bstr url)
 {
@@ -338,6 +472,7 @@ static int open_f(stream_t *stream, const struct stream_open_args *args)
     stream->fill_buffer = fill_buffer;
     stream->write_buffer = write_buffer;
     stream->get_size = get_size;
+    stream->control = control;
     stream->close = s_close;
 
     if (check_stream_network(p->fd)) {
@@ -352,6 +487,16 @@ static int open_f(stream_t *stream, const struct stream_open_args *args)
 
     p->orig_size = get_size(stream);
 
+    if (p->regular_file && !write && !stream->streaming) {
+        struct stream_file_opts *opts =
+            mp_get_config_group(p, stream->global, &stream_file_conf);
+        // Appended files may be truncated again, which would crash with mmap.
+        if (opts->mmap && !p->appending)
+            try_mmap(stream, p->orig_size);
+        p->readahead = opts->readahead;
+        talloc_free(opts);
+    }
+
     p->cancel = mp_cancel_new(p);
     if (stream->cancel)
         mp_cancel_set_parent(p->cancel, stream->cancel);
@@ -21,9 +21,12 @@
 #include <math.h>
 #include <inttypes.h>
 
+#include <libavutil/cpu.h>
+
 #include "common/common.h"
 #include "draw_bmp.h"
 #include "img_convert.h"
+#include "misc/thread_pool.h"
 #include "video/mp_image.h"
 #include "video/repack.h"
 #include "video/sws_utils.h"
@@ -54,10 +57,31 @@ struct part {
 #define SCALE_IN_TILES 1
 #define TILE_H 4u
 
+// Minimum number of marked pixels per blend thread. Most subtitles are smaller
+// than this, and are blended on the calling thread only.
+#define MIN_BLEND_PIXELS (256 * 256)
+#define MAX_BLEND_THREADS 16
+
 struct slice {
     uint16_t x0, x1;
 };
 
+// Blends lines [y0, y1) of the target image. The repackers and the temporary
+// slice images are stateful, so every thread needs its own set.
+struct blend_state {
+    struct mp_repack *overlay_to_f32;
+    struct mp_repack *calpha_to_f32;
+    struct mp_repack *video_to_f32;
+    struct mp_repack *video_from_f32;
+    struct mp_image *overlay_tmp;
+    struct mp_image *calpha_tmp;
+    struct mp_image *video_tmp;
+
+    struct mp_image *target;
+    int y0, y1;
+    bool ok;
+};
+
 struct mp_draw_sub_cache
 {
     struct mpv_global *global;
@@ -100,37 +124,55 @@ struct mp_draw_sub_cache
     struct mp_sws_context *unpremul; // reverse
     struct mp_image *premul_tmp;
 
+    int rflags;                     // REPACK_CREATE_* flags of the above
+
     // Function that works on the _f32 data.
     void (*blend_line)(void *dst, void *src, void *src_a, int w);
 
+    // blend_states[0] references the repackers and images above, the others
+    // are created on demand for the worker threads.
+    struct blend_state *blend_states;
+    int num_blend_states;
+
     struct mp_image res_overlay;    // returned by mp_draw_sub_overlay()
 };
 
+// The blend functions process the part of the line that is a multiple of 16
+// pixels and the remainder in separate loops. With the restrict pointers, this
+// lets the compiler vectorize the first loop.
+static inline void blend_f32(float *restrict dst, const float *restrict src,
+                             const float *restrict src_a, int x0, int x1)
+{
+    for (int x = x0; x < x1; x++)
+        dst[x] = src[x] + dst[x] * (1.0f - src_a[x]);
+}
+
 static void blend_line_f32(void *dst, void *src, void *src_a, int w)
 {
-    float *dst_f = dst;
-    float *src_f = src;
-    float *src_a_f = src_a;
+    int wv = w & ~15;
+    blend_f32(dst, src, src_a, 0, wv);
+    blend_f32(dst, src, src_a, wv, w);
+}
 
-    for (int x = 0; x < w; x++)
-        dst_f[x] = src_f[x] + dst_f[x] * (1.0f - src_a_f[x]);
+static inline void blend_u8(uint8_t *restrict dst, const uint8_t *restrict src,
+                            const uint8_t *restrict src_a, int x0, int x1)
+{
+    for (int x = x0; x < x1; x++)
+        dst[x] = src[x] + dst[x] * (255u - src_a[x]) / 255u;
 }
 
 static void blend_line_u8(void *dst, void *src, void *src_a, int w)
 {
-    uint8_t *dst_i = dst;
-    uint8_t *src_i = src;
-    uint8_t *src_a_i = src_a;
-
-    for (int x = 0; x < w; x++)
-        dst_i[x] = src_i[x] + dst_i[x] * (255u - src_a_i[x]) / 255u;
+    int wv = w & ~15;
+    blend_u8(dst, src, src_a, 0, wv);
+    blend_u8(dst, src, src_a, wv, w);
 }
 
-static void blend_slice(struct mp_draw_sub_cache *p)
+static void blend_slice(struct mp_draw_sub_cache *p, struct blend_state *st)
 {
-    struct mp_image *ov = p->overlay_tmp;
-    struct mp_image *ca = p->calpha_tmp;
-    struct mp_image *vid = p->video_tmp;
+    struct mp_image *ov = st->overlay_tmp;
+    struct mp_image *ca = st->calpha_tmp;
+    struct mp_image *vid = st->video_tmp;
 
     for (int plane = 0; plane < vid->num_planes; plane++) {
         int xs = vid->fmt.xs[plane];
@@ -147,18 +189,20 @@ static void blend_slice(struct mp_draw_sub_cache *p)
     }
 }
 
-static bool blend_overlay_with_video(struct mp_draw_sub_cache *p,
-                                     struct mp_image *dst)
+static void blend_lines(struct mp_draw_sub_cache *p, struct blend_state *st)
 {
-    if (!repack_config_buffers(p->video_to_f32, 0, p->video_tmp, 0, dst, NULL))
-        return false;
-    if (!repack_config_buffers(p->video_from_f32, 0, dst, 0, p->video_tmp, NULL))
-        return false;
+    struct mp_image *dst = st->target;
+
+    st->ok = false;
+    if (!repack_config_buffers(st->video_to_f32, 0, st->video_tmp, 0, dst, NULL))
+        return;
+    if (!repack_config_buffers(st->video_from_f32, 0, dst, 0, st->video_tmp, NULL))
+        return;
 
     int xs = dst->fmt.chroma_xs;
     int ys = dst->fmt.chroma_ys;
 
-    for (int y = 0; y < dst->h; y += p->align_y) {
+    for (int y = st->y0; y < st->y1; y += p->align_y) {
         struct slice *line = &p->slices[y * p->s_w];
 
         for (int sx = 0; sx < p->s_w; sx++) {
@@ -173,20 +217,143 @@ static bool blend_overlay_with_video(struct mp_draw_sub_cache *p,
             assert(MP_IS_ALIGNED(w, p->align_x));
             assert(x + w <= p->w);
 
-            repack_line(p->overlay_to_f32, 0, 0, x, y, w);
-            repack_line(p->video_to_f32, 0, 0, x, y, w);
-            if (p->calpha_to_f32)
-                repack_line(p->calpha_to_f32, 0, 0, x >> xs, y >> ys, w >> xs);
+            repack_line(st->overlay_to_f32, 0, 0, x, y, w);
+            repack_line(st->video_to_f32, 0, 0, x, y, w);
+            if (st->calpha_to_f32)
+                repack_line(st->calpha_to_f32, 0, 0, x >> xs, y >> ys, w >> xs);
 
-            blend_slice(p);
+            blend_slice(p, st);
 
-            repack_line(p->video_from_f32, x, y, 0, 0, w);
+            repack_line(st->video_from_f32, x, y, 0, 0, w);
         }
     }
 
+    st->ok = true;
+}
+
+static void blend_lines_thread(void *ptr, int slice)
+{
+    struct mp_draw_sub_cache *p = ptr;
+
+    blend_lines(p, &p->blend_states[slice]);
+}
+
+static struct mp_image *alloc_tmp_like(struct mp_draw_sub_cache *p,
+                                       struct mp_image *tmp)
+{
+    if (!tmp)
+        return NULL;
+    struct mp_image *img = mp_image_alloc(tmp->imgfmt, tmp->w, tmp->h);
+    if (img)
+        img->params.color = tmp->params.color;
+    return talloc_steal(p, img);
+}
+
+// Create a blend state for an additional thread, mirroring the first one.
+static bool init_blend_state(struct mp_draw_sub_cache *p, struct blend_state *st)
+{
+    struct blend_state *ref = &p->blend_states[0];
+
+    *st = (struct blend_state){0};
+
+    st->overlay_to_f32 = talloc_steal(p, mp_repack_create_planar(
+        mp_repack_get_format_src(ref->overlay_to_f32), false, p->rflags));
+    st->video_to_f32 = talloc_steal(p, mp_repack_create_planar(
+        p->params.imgfmt, false, p->rflags));
+    st->video_from_f32 = talloc_steal(p, mp_repack_create_planar(
+        p->params.imgfmt, true, p->rflags));
+    st->overlay_tmp = alloc_tmp_like(p, ref->overlay_tmp);
+    st->video_tmp = alloc_tmp_like(p, ref->video_tmp);
+    if (!st->overlay_to_f32 || !st->video_to_f32 || !st->video_from_f32 ||
+        !st->overlay_tmp || !st->video_tmp)
+        return false;
+
+    struct mp_image *ov = p->video_overlay ? p->video_overlay : p->rgba_overlay;
+    if (!repack_config_buffers(st->overlay_to_f32, 0, st->overlay_tmp, 0, ov, NULL))
+        return false;
+
+    if (ref->calpha_to_f32) {
+        st->calpha_to_f32 = talloc_steal(p, mp_repack_create_planar(
+            mp_repack_get_format_src(ref->calpha_to_f32), false, p->rflags));
+        st->calpha_tmp = alloc_tmp_like(p, ref->calpha_tmp);
+        if (!st->calpha_to_f32 || !st->calpha_tmp)
+            return false;
+        if (!repack_config_buffers(st->calpha_to_f32, 0, st->calpha_tmp,
+                                   0, p->calpha_overlay, NULL))
+            return false;
+    }
+
     return true;
 }
 
+// Number of marked pixels on the given line.
+static size_t line_pixels(struct mp_draw_sub_cache *p, int y)
+{
+    struct slice *line = &p->slices[y * p->s_w];
+    size_t count = 0;
+    for (int sx = 0; sx < p->s_w; sx++)
+        count += MPMAX(line[sx].x1 - line[sx].x0, 0);
+    return count;
+}
+
+// Split the lines of dst into ranges with about the same amount of marked
+// pixels, one per thread, and return the number of ranges.
+static int split_blend_work(struct mp_draw_sub_cache *p, struct mp_image *dst)
+{
+    size_t total = 0;
+    for (int y = 0; y < dst->h; y += p->align_y)
+        total += line_pixels(p, y);
+
+    int max_threads = MPCLAMP(av_cpu_count(), 1, MAX_BLEND_THREADS);
+    int num = MPCLAMP(total / MIN_BLEND_PIXELS, 1, max_threads);
+
+    if (num > p->num_blend_states) {
+        MP_TARRAY_GROW(p, p->blend_states, num - 1);
+        while (p->num_blend_states < num) {
+            if (!init_blend_state(p, &p->blend_states[p->num_blend_states]))
+                break;
+            p->num_blend_states++;
+        }
+        num = p->num_blend_states;
+    }
+
+    struct blend_state *states = p->blend_states;
+    for (int n = 0; n < num; n++) {
+        states[n].target = dst;
+        states[n].y0 = states[n].y1 = dst->h;
+    }
+    states[0].y0 = 0;
+
+    int cur = 0;
+    size_t done = 0;
+    for (int y = 0; y < dst->h && cur < num - 1; y += p->align_y) {
+        done += line_pixels(p, y);
+        if (done >= total * (cur + 1) / num) {
+            states[cur].y1 = y + p->align_y;
+            states[++cur].y0 = y + p->align_y;
+        }
+    }
+    states[cur].y1 = dst->h;
+
+    return cur + 1;
+}
+
+static bool blend_overlay_with_video(struct mp_draw_sub_cache *p,
+                                     struct mp_image *dst)
+{
+    int num = split_blend_work(p, dst);
+
+    struct mp_thread_pool *tp = num > 1 ? mp_thread_pool_shared() : NULL;
+    mp_thread_pool_run_slices(tp, MP_THREAD_PRIO_HIGH, num,
+                              blend_lines_thread, p);
+
+    bool ok = true;
+    for (int n = 0; n < num; n++)
+        ok &= p->blend_states[n].ok;
+
+    return ok;
+}
+
 static bool convert_overlay_part(struct mp_draw_sub_cache *p,
                                  int x0, int y0, int w, int h)
 {
@@ -769,6 +936,20 @@ static bool reinit_to_video(struct mp_draw_sub_cache *p)
         p->unpremul->force_scaler = MP_SWS_ZIMG;
     }
 
+    p->rflags = rflags;
+
+    p->blend_states = talloc_zero_array(p, struct blend_state, 1);
+    p->blend_states[0] = (struct blend_state){
+        .overlay_to_f32 = p->overlay_to_f32,
+        .calpha_to_f32 = p->calpha_to_f32,
+        .video_to_f32 = p->video_to_f32,
+        .video_from_f32 = p->video_from_f32,
+        .overlay_tmp = p->overlay_tmp,
+        .calpha_tmp = p->calpha_tmp,
+        .video_tmp = p->video_tmp,
+    };
+    p->num_blend_states = 1;
+
     init_general(p);
 
     return true;
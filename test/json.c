@@ -1,5 +1,10 @@
+#include <stdio.h>
+#include <string.h>
+
 #include "misc/json.h"
 #include "misc/node.h"
+#include "options/m_option.h"
+#include "osdep/timer.h"
 #include "test_utils.h"
 
 struct entry {
@@ -63,12 +68,197 @@ static const struct entry entries[] = {
         NODE_MAP(L("_a12"), L(NODE_STR("b")))},
 };
 
-int main(void)
+// Check that all string values point into the parsed input.
+static void check_views(struct mpv_node *node, char *start, char *end)
+{
+    if (node->format == MPV_FORMAT_STRING)
+        assert_true(node->u.string >= start && node->u.string < end);
+    if (node->format == MPV_FORMAT_NODE_ARRAY ||
+        node->format == MPV_FORMAT_NODE_MAP)
+    {
+        for (int n = 0; n < node->u.list->num; n++)
+            check_views(&node->u.list->values[n], start, end);
+    }
+}
+
+static void test_writer(void)
+{
+    void *tmp = talloc_new(NULL);
+    bstr buf = {0};
+    struct json_writer w;
+
+    struct mpv_node list = NODE_ARRAY(NODE_INT64(1), NODE_STR("x\"y"), NODE_NONE());
+    json_writer_init(&w, tmp, &buf);
+    json_writer_begin(&w, true);
+    json_writer_key(&w, "a");
+    json_writer_node(&w, &list);
+    json_writer_key(&w, "b");
+    json_writer_begin(&w, false);
+    json_writer_null(&w);
+    json_writer_int64(&w, -5);
+    json_writer_string(&w, "\n");
+    json_writer_begin(&w, true);
+    json_writer_end(&w, true);
+    json_writer_end(&w, false);
+    json_writer_end(&w, true);
+    assert_string_equal(TEXT({"a":[1,"x\"y",null],"b":[null,-5,"\n",{}]}),
+                        (char *)buf.start);
+
+    // Reusing the buffer must not reallocate it.
+    void *start = buf.start;
+    buf.len = 0;
+    json_writer_init(&w, tmp, &buf);
+    json_writer_node(&w, &list);
+    assert_string_equal(TEXT([1,"x\"y",null]), (char *)buf.start);
+    assert_true(buf.start == start);
+
+    talloc_free(tmp);
+}
+
+// Something like the playlist property of a large playlist.
+static struct mpv_node *make_playlist(void *ta_parent, int num)
+{
+    struct mpv_node *root = talloc_zero(ta_parent, struct mpv_node);
+    node_init(root, MPV_FORMAT_NODE_ARRAY, NULL);
+    for (int n = 0; n < num; n++) {
+        struct mpv_node *e = node_array_add(root, MPV_FORMAT_NODE_MAP);
+        char *path = talloc_asprintf(root, "/home/user/Music/Some Artist/"
+                                     "Album \"%d\"/%02d - Track title.flac",
+                                     n / 12, n % 12 + 1);
+        node_map_add_string(e, "filename", path);
+        node_map_add_string(e, "title", "Track title");
+        node_map_add_int64(e, "id", n + 1);
+        if (n == 3)
+            node_map_add_flag(e, "current", true);
+    }
+    return root;
+}
+
+// Old IPC reply path: copy the result into a reply tree, serialize it to a
+// new string, and copy that into the output buffer.
+static void encode_tree(bstr *out, struct mpv_node *data)
+{
+    void *tmp = talloc_new(NULL);
+    struct mpv_node reply;
+    node_init(&reply, MPV_FORMAT_NODE_MAP, NULL);
+    talloc_steal(tmp, reply.u.list);
+    static const struct m_option type = { .type = CONF_TYPE_NODE };
+    m_option_get_node(&type, tmp, node_map_add(&reply, "data", MPV_FORMAT_NONE),
+                      data);
+    node_map_add_int64(&reply, "request_id", 1);
+    node_map_add_string(&reply, "error", "success");
+    char *s = talloc_strdup(tmp, "");
+    json_write(&s, &reply);
+    s = ta_talloc_strdup_append(s, "\n");
+    bstr_xappend(NULL, out, bstr0(s));
+    talloc_free(tmp);
+}
+
+static void encode_stream(bstr *out, struct mpv_node *data)
+{
+    struct json_writer w;
+    json_writer_init(&w, NULL, out);
+    json_writer_begin(&w, true);
+    json_writer_key(&w, "data");
+    json_writer_node(&w, data);
+    json_writer_key(&w, "request_id");
+    json_writer_int64(&w, 1);
+    json_writer_key(&w, "error");
+    json_writer_string(&w, "success");
+    json_writer_end(&w, true);
+    bstr_xappend(NULL, out, bstr0("\n"));
+}
+
+static const char *const bench_commands[] = {
+    TEXT({"command":["get_property","playback-time"],"request_id":1}),
+    TEXT({"command":["set_property","pause",false],"request_id":2}),
+    TEXT({"command":["observe_property",3,"volume"]}),
+    TEXT({"command":["loadfile","C:\\Videos\\some \"file\".mkv","append"]}),
+    TEXT({"command":["script-message-to","ui","update",{"x":1.5,"y":[1,2,3]}],"async":true,"request_id":5}),
+};
+
+// Parse pipelined commands as the old IPC code did (copy the line, and copy
+// the remaining buffer), or in place.
+static int parse_commands(bstr input, bool in_place)
+{
+    int count = 0;
+    bstr buf = bstrdup(NULL, input);
+    size_t pos = 0;
+    while (1) {
+        void *tmp = talloc_new(NULL);
+        bstr rest = bstr_cut(buf, pos);
+        int len = bstrchr(rest, '\n');
+        if (len < 0) {
+            talloc_free(tmp);
+            break;
+        }
+        char *line;
+        if (in_place) {
+            rest.start[len] = '\0';
+            line = (char *)rest.start;
+            pos += len + 1;
+        } else {
+            bstr r;
+            line = bstrto0(tmp, bstr_getline(rest, &r));
+            talloc_steal(tmp, buf.start);
+            buf = bstrdup(NULL, r);
+        }
+        struct mpv_node node;
+        if (json_parse(tmp, &node, &line, MAX_JSON_DEPTH) >= 0)
+            count++;
+        talloc_free(tmp);
+    }
+    talloc_free(buf.start);
+    return count;
+}
+
+static void benchmark(void)
+{
+    void *tmp = talloc_new(NULL);
+
+    for (int size = 10; size <= 10000; size *= 10) {
+        struct mpv_node *list = make_playlist(tmp, size);
+        int iters = 2000000 / size;
+        for (int stream = 0; stream < 2; stream++) {
+            bstr out = {0};
+            int64_t start = mp_time_ns();
+            for (int n = 0; n < iters; n++) {
+                out.len = 0;
+                (stream ? encode_stream : encode_tree)(&out, list);
+            }
+            double secs = (mp_time_ns() - start) / 1e9;
+            printf("encode playlist (%5d entries) %-6s %9.0f msgs/sec, "
+                   "%7.1f MB/sec\n", size, stream ? "stream" : "tree",
+                   iters / secs, iters * out.len / secs / 1e6);
+            talloc_free(out.start);
+        }
+    }
+
+    bstr input = {0};
+    int num = 0;
+    while (input.len < 1000000) {
+        const char *cmd = bench_commands[num++ % MP_ARRAY_SIZE(bench_commands)];
+        bstr_xappend_asprintf(tmp, &input, "%s\n", cmd);
+    }
+    for (int in_place = 0; in_place < 2; in_place++) {
+        int64_t start = mp_time_ns();
+        int parsed = parse_commands(input, in_place);
+        double secs = (mp_time_ns() - start) / 1e9;
+        assert_int_equal(parsed, num);
+        printf("parse %d pipelined commands %-8s %9.0f commands/sec\n", num,
+               in_place ? "in-place" : "copy", num / secs);
+    }
+
+    talloc_free(tmp);
+}
+
+int main(int argc, char *argv[])
 {
     for (int n = 0; n < MP_ARRAY_SIZE(entries); n++) {
         const struct entry *e = &entries[n];
         void *tmp = talloc_new(NULL);
         char *s = talloc_strdup(tmp, e->src);
+        char *start = s;
         json_skip_whitespace(&s);
         struct mpv_node res;
         bool ok = json_parse(tmp, &res, &s, MAX_JSON_DEPTH) >= 0;
@@ -81,7 +271,17 @@ int main(void)
         assert_true(json_write(&d, &res) >= 0);
         assert_string_equal(e->out_txt, d);
         assert_true(equal_mpv_node(&e->out_data, &res));
+        assert_true(hash_mpv_value(&e->out_data, MPV_FORMAT_NODE) ==
+                    hash_mpv_value(&res, MPV_FORMAT_NODE));
+        check_views(&res, start, start + strlen(e->src) + 1);
         talloc_free(tmp);
     }
+
+    test_writer();
+
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        mp_time_init();
+        benchmark();
+    }
     return 0;
 }
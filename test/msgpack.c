@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "misc/json.h"
+#include "misc/msgpack.h"
+#include "misc/node.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+#define VAL_LIST(...) (struct mpv_node[]){__VA_ARGS__}
+
+#define L(...) __VA_ARGS__
+
+#define NODE_INT64(v) {.format = MPV_FORMAT_INT64,  .u = { .int64 = (v) }}
+#define NODE_STR(v)   {.format = MPV_FORMAT_STRING, .u = { .string = (v) }}
+#define NODE_BOOL(v)  {.format = MPV_FORMAT_FLAG,   .u = { .flag = (bool)(v) }}
+#define NODE_FLOAT(v) {.format = MPV_FORMAT_DOUBLE, .u = { .double_ = (v) }}
+#define NODE_NONE()   {.format = MPV_FORMAT_NONE }
+#define NODE_ARRAY(...) {.format = MPV_FORMAT_NODE_ARRAY, .u = { .list =    \
+    &(struct mpv_node_list) {                                               \
+        .num = sizeof(VAL_LIST(__VA_ARGS__)) / sizeof(struct mpv_node),     \
+        .values = VAL_LIST(__VA_ARGS__)}}}
+#define NODE_MAP(k, v) {.format = MPV_FORMAT_NODE_MAP, .u = { .list =       \
+    &(struct mpv_node_list) {                                               \
+        .num = sizeof(VAL_LIST(v)) / sizeof(struct mpv_node),               \
+        .values = VAL_LIST(v),                                              \
+        .keys = (char**)(const char *[]){k}}}}
+
+#define BYTES(...) (bstr){(unsigned char *)(const char[]){__VA_ARGS__},     \
+                          sizeof((const char[]){__VA_ARGS__})}
+
+struct entry {
+    bstr src;
+    struct mpv_node out_data;
+    bool expect_fail;
+    bool no_roundtrip;      // not the shortest encoding
+};
+
+static const struct entry entries[] = {
+    { BYTES(0xc0), NODE_NONE()},
+    { BYTES(0xc3), NODE_BOOL(true)},
+    { BYTES(0xc2), NODE_BOOL(false)},
+    { BYTES(0x7f), NODE_INT64(127)},
+    { BYTES(0xe0), NODE_INT64(-32)},
+    { BYTES(0xcc, 0x80), NODE_INT64(128)},
+    { BYTES(0xcd, 0x01, 0x00), NODE_INT64(256)},
+    { BYTES(0xce, 0x00, 0x01, 0x00, 0x00), NODE_INT64(65536)},
+    { BYTES(0xcf, 0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff),
+        NODE_INT64(INT64_MAX)},
+    { BYTES(0xcf, 0x80, 0, 0, 0, 0, 0, 0, 0), .expect_fail = true},
+    { BYTES(0xd0, 0xdf), NODE_INT64(-33)},
+    { BYTES(0xd1, 0xff, 0x7f), NODE_INT64(-129)},
+    { BYTES(0xd2, 0xff, 0xff, 0x7f, 0xff), NODE_INT64(-32769)},
+    { BYTES(0xd3, 0x80, 0, 0, 0, 0, 0, 0, 0), NODE_INT64(INT64_MIN)},
+    { BYTES(0xd0, 0x05), NODE_INT64(5), .no_roundtrip = true},
+    { BYTES(0xca, 0x3f, 0xc0, 0x00, 0x00), NODE_FLOAT(1.5),
+        .no_roundtrip = true},
+    { BYTES(0xcb, 0x40, 0x5e, 0xd0, 0, 0, 0, 0, 0), NODE_FLOAT(123.25)},
+    { BYTES(0xa3, 'a', 'b', 'c'), NODE_STR("abc")},
+    { BYTES(0xa0), NODE_STR("")},
+    { BYTES(0xd9, 0x01, 'x'), NODE_STR("x"), .no_roundtrip = true},
+    { BYTES(0xa2, 'a', 0), .expect_fail = true},
+    { BYTES(0xa3, 'a', 'b'), .expect_fail = true},
+    { BYTES(0x93, 0x01, 0x02, 0x03),
+        NODE_ARRAY(NODE_INT64(1), NODE_INT64(2), NODE_INT64(3))},
+    { BYTES(0x90), NODE_ARRAY()},
+    { BYTES(0xdc, 0x00, 0x01, 0xc0), NODE_ARRAY(NODE_NONE()),
+        .no_roundtrip = true},
+    { BYTES(0x94, 0x01), .expect_fail = true},
+    { BYTES(0x82, 0xa1, 'a', 0x01, 0xa1, 'b', 0x92, 0xc3, 0xa0),
+        NODE_MAP(L("a", "b"), L(NODE_INT64(1),
+                                NODE_ARRAY(NODE_BOOL(true), NODE_STR(""))))},
+    { BYTES(0x80), NODE_MAP(L(), L())},
+    { BYTES(0x81, 0x01, 0x02), .expect_fail = true},
+    { BYTES(0xdd, 0xff, 0xff, 0xff, 0xff), .expect_fail = true},
+    { BYTES(0xd4, 0x01, 0x02), .expect_fail = true},
+    { BYTES(0xc1), .expect_fail = true},
+};
+
+static void check_entries(void)
+{
+    for (int n = 0; n < MP_ARRAY_SIZE(entries); n++) {
+        const struct entry *e = &entries[n];
+        void *tmp = talloc_new(NULL);
+        bstr src = bstrdup(tmp, e->src);
+        struct mpv_node res;
+        bool ok = msgpack_parse(tmp, &res, &src, MAX_MSGPACK_DEPTH) >= 0;
+        assert_true(ok != e->expect_fail);
+        if (!ok) {
+            talloc_free(tmp);
+            continue;
+        }
+        assert_int_equal(src.len, 0);
+        assert_true(equal_mpv_node(&e->out_data, &res));
+
+        bstr out = {0};
+        struct msgpack_writer w;
+        msgpack_writer_init(&w, tmp, &out);
+        assert_true(msgpack_writer_node(&w, &e->out_data) >= 0);
+        if (!e->no_roundtrip)
+            assert_true(bstr_equals(out, e->src));
+        talloc_free(tmp);
+    }
+}
+
+// Write and parse back values that need the larger length/size encodings.
+static void test_roundtrip(void)
+{
+    void *tmp = talloc_new(NULL);
+    struct mpv_node root;
+    node_init(&root, MPV_FORMAT_NODE_MAP, NULL);
+    talloc_steal(tmp, root.u.list);
+
+    char *s = talloc_strdup(tmp, "");
+    for (int n = 0; n < 70000; n++)
+        s = talloc_asprintf_append(s, "%c", 'a' + n % 26);
+    node_map_add_string(&root, "long", s);
+    node_map_add_string(&root, "medium", s + 70000 - 300);
+    node_map_add_string(&root, "short", s + 70000 - 40);
+    struct mpv_node *arr = node_map_add(&root, "array", MPV_FORMAT_NODE_ARRAY);
+    for (int n = 0; n < 20; n++)
+        node_array_add(arr, MPV_FORMAT_INT64)->u.int64 = (int64_t)1 << (n * 3);
+    node_array_add(arr, MPV_FORMAT_DOUBLE)->u.double_ = -0.1;
+    node_array_add(arr, MPV_FORMAT_FLAG)->u.flag = true;
+    for (int n = 0; n < 20; n++) {
+        char *key = talloc_asprintf(tmp, "key%d", n);
+        node_map_add_int64(&root, key, -n * 1000);
+    }
+
+    bstr out = {0};
+    struct msgpack_writer w;
+    msgpack_writer_init(&w, tmp, &out);
+    assert_true(msgpack_writer_node(&w, &root) >= 0);
+    // map 16, with str 32, str 16, fixstr, array 16 values
+    assert_int_equal(out.start[0], 0xde);
+
+    struct mpv_node res;
+    bstr src = out;
+    assert_true(msgpack_parse(tmp, &res, &src, MAX_MSGPACK_DEPTH) >= 0);
+    assert_int_equal(src.len, 0);
+    assert_true(equal_mpv_node(&root, &res));
+
+    // bin (equal_mpv_node() can't compare byte arrays within nodes)
+    static const char bytes[] = {0, 1, 2, 255};
+    bstr bin = {0};
+    msgpack_writer_init(&w, tmp, &bin);
+    msgpack_writer_bytes(&w, bytes, sizeof(bytes));
+    assert_true(bstr_equals(bin, BYTES(0xc4, 4, 0, 1, 2, 255)));
+    assert_true(msgpack_parse(tmp, &res, &bin, MAX_MSGPACK_DEPTH) >= 0);
+    assert_int_equal(res.format, MPV_FORMAT_BYTE_ARRAY);
+    assert_int_equal(res.u.ba->size, sizeof(bytes));
+    assert_true(memcmp(res.u.ba->data, bytes, sizeof(bytes)) == 0);
+
+    // Truncated input must fail at any position.
+    for (size_t len = 0; len < 400; len++) {
+        bstr cut = bstrdup(tmp, (bstr){out.start, len});
+        assert_true(msgpack_parse(tmp, &res, &cut, MAX_MSGPACK_DEPTH) < 0);
+    }
+
+    // Depth limit.
+    bstr deep = {0};
+    msgpack_writer_init(&w, tmp, &deep);
+    for (int n = 0; n < MAX_MSGPACK_DEPTH; n++)
+        msgpack_writer_array(&w, 1);
+    msgpack_writer_nil(&w);
+    assert_true(msgpack_parse(tmp, &res, &deep, MAX_MSGPACK_DEPTH) < 0);
+
+    talloc_free(tmp);
+}
+
+// Typical IPC traffic of a client observing playback state.
+static const char *const bench_props[] = {"time-pos", "audio-pts",
+                                          "estimated-vf-fps"};
+
+static struct mpv_node *make_event(void *ta_parent, int n)
+{
+    struct mpv_node *root = talloc_zero(ta_parent, struct mpv_node);
+    node_init(root, MPV_FORMAT_NODE_MAP, NULL);
+    talloc_steal(root, root->u.list);
+    node_map_add_string(root, "event", "property-change");
+    node_map_add_int64(root, "id", n % 3 + 1);
+    node_map_add_string(root, "name", bench_props[n % 3]);
+    node_map_add_double(root, "data", n % 3 == 2 ? 23.976 : n * 0.0416);
+    return root;
+}
+
+static void benchmark(void)
+{
+    void *tmp = talloc_new(NULL);
+
+    struct mpv_node *events[3];
+    for (int n = 0; n < 3; n++)
+        events[n] = make_event(tmp, n + 1000);
+
+    int iters = 3000000;
+    for (int pack = 0; pack < 2; pack++) {
+        bstr out = {0};
+        int64_t start = mp_time_ns();
+        size_t bytes = 0;
+        for (int n = 0; n < iters; n++) {
+            out.len = 0;
+            if (pack) {
+                struct msgpack_writer w;
+                msgpack_writer_init(&w, tmp, &out);
+                msgpack_writer_node(&w, events[n % 3]);
+            } else {
+                struct json_writer w;
+                json_writer_init(&w, tmp, &out);
+                json_writer_node(&w, events[n % 3]);
+            }
+            bytes += out.len;
+        }
+        double secs = (mp_time_ns() - start) / 1e9;
+        printf("encode property-change %-8s %10.0f events/sec, %5.1f bytes/event\n",
+               pack ? "msgpack" : "json", iters / secs, bytes / (double)iters);
+    }
+
+    // A pipelined stream of get_property commands, as a client polling the
+    // same properties would send.
+    bstr json_in = {0}, pack_in = {0};
+    int num = 0;
+    while (json_in.len < 4000000) {
+        const char *prop = bench_props[num % 3];
+        struct mpv_node cmd;
+        node_init(&cmd, MPV_FORMAT_NODE_MAP, NULL);
+        talloc_steal(tmp, cmd.u.list);
+        struct mpv_node *args = node_map_add(&cmd, "command",
+                                             MPV_FORMAT_NODE_ARRAY);
+        *node_array_add(args, MPV_FORMAT_NONE) = (struct mpv_node){
+            .format = MPV_FORMAT_STRING, .u.string = "get_property"};
+        *node_array_add(args, MPV_FORMAT_NONE) = (struct mpv_node){
+            .format = MPV_FORMAT_STRING, .u.string = (char *)prop};
+        node_map_add_int64(&cmd, "request_id", num);
+
+        struct json_writer jw;
+        json_writer_init(&jw, tmp, &json_in);
+        json_writer_node(&jw, &cmd);
+        bstr_xappend(tmp, &json_in, bstr0("\n"));
+        struct msgpack_writer mw;
+        msgpack_writer_init(&mw, tmp, &pack_in);
+        msgpack_writer_node(&mw, &cmd);
+        num++;
+    }
+    for (int pack = 0; pack < 2; pack++) {
+        bstr in = bstrdup(tmp, pack ? pack_in : json_in);
+        int64_t start = mp_time_ns();
+        int parsed = 0;
+        while (in.len) {
+            void *ctx = talloc_new(NULL);
+            struct mpv_node node;
+            if (pack) {
+                assert_true(msgpack_parse(ctx, &node, &in, MAX_MSGPACK_DEPTH) >= 0);
+            } else {
+                int len = bstrchr(in, '\n');
+                in.start[len] = '\0';
+                char *line = (char *)in.start;
+                assert_true(json_parse(ctx, &node, &line, MAX_JSON_DEPTH) >= 0);
+                in = bstr_cut(in, len + 1);
+            }
+            talloc_free(ctx);
+            parsed++;
+        }
+        double secs = (mp_time_ns() - start) / 1e9;
+        assert_int_equal(parsed, num);
+        printf("parse %d get_property commands %-8s %10.0f commands/sec, "
+               "%5.1f bytes/command\n", num, pack ? "msgpack" : "json",
+               num / secs, (pack ? pack_in : json_in).len / (double)num);
+    }
+
+    talloc_free(tmp);
+}
+
+int main(int argc, char *argv[])
+{
+    check_entries();
+    test_roundtrip();
+
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        mp_time_init();
+        benchmark();
+    }
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "common/playlist.h"
+#include "demux/demux.h"
+#include "misc/node.h"
+#include "misc/random.h"
+#include "options/m_property.h"
+#include "test_utils.h"
+
+// Stubs for playlist_parse_file(), which is not tested here.
+struct mp_log *mp_log_new(void *talloc_ctx, struct mp_log *parent,
+                          const char *name)
+{
+    return NULL;
+}
+
+struct demuxer *demux_open_url(const char *url, struct demuxer_params *params,
+                               struct mp_cancel *cancel,
+                               struct mpv_global *global)
+{
+    return NULL;
+}
+
+void demux_free(struct demuxer *demuxer)
+{
+}
+
+// The playlist is compared against a plain array of the same entries (model),
+// after random edits that cross the internal chunk boundaries.
+struct model {
+    struct playlist *pl;
+    struct playlist_entry **entries;
+    int num_entries;
+    int next_name;
+};
+
+static int rand_int(int max)
+{
+    return max > 0 ? mp_rand_next() % max : 0;
+}
+
+static struct playlist_entry *new_entry(struct model *m)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "file%d", m->next_name++);
+    return playlist_entry_new(name);
+}
+
+static void check_index(struct model *m, int index)
+{
+    struct playlist_entry *e = playlist_entry_from_index(m->pl, index);
+    assert_true(e == m->entries[index]);
+    assert_int_equal(playlist_entry_to_index(m->pl, e), index);
+}
+
+static void check_all(struct model *m)
+{
+    assert_int_equal(playlist_entry_count(m->pl), m->num_entries);
+    assert_true(playlist_get_first(m->pl) ==
+                (m->num_entries ? m->entries[0] : NULL));
+    assert_true(playlist_get_last(m->pl) ==
+                (m->num_entries ? m->entries[m->num_entries - 1] : NULL));
+    struct playlist_entry *e = playlist_get_first(m->pl);
+    for (int n = 0; n < m->num_entries; n++) {
+        assert_true(e == m->entries[n]);
+        assert_true(e->pl == m->pl);
+        assert_true(playlist_entry_get_rel(e, -1) ==
+                    (n > 0 ? m->entries[n - 1] : NULL));
+        e = playlist_entry_get_rel(e, 1);
+    }
+    assert_true(!e);
+    assert_true(!playlist_entry_from_index(m->pl, -1));
+    assert_true(!playlist_entry_from_index(m->pl, m->num_entries));
+}
+
+// Insert count new entries before index (index == num_entries: append).
+static void do_insert(struct model *m, int index, int count)
+{
+    struct playlist *src = talloc_zero(NULL, struct playlist);
+    for (int n = 0; n < count; n++)
+        playlist_add(src, new_entry(m));
+    struct playlist_entry **added = talloc_array(NULL, struct playlist_entry *,
+                                                 count);
+    struct playlist_entry *e = playlist_get_first(src);
+    for (int n = 0; n < count; n++) {
+        added[n] = e;
+        e = playlist_entry_get_rel(e, 1);
+    }
+
+    if (index == m->num_entries) {
+        playlist_append_entries(m->pl, src);
+    } else if (index == 0) {
+        // Insert after the first entry, then swap it behind the new ones.
+        struct playlist_entry *first = m->entries[0];
+        playlist_insert_entries_after(m->pl, first, src);
+        playlist_move(m->pl, first, playlist_entry_from_index(m->pl, count + 1));
+    } else {
+        playlist_insert_entries_after(m->pl, m->entries[index - 1], src);
+    }
+    talloc_free(src);
+
+    MP_TARRAY_INSERT_N_AT(m, m->entries, m->num_entries, index, count);
+    for (int n = 0; n < count; n++)
+        m->entries[index + n] = added[n];
+    talloc_free(added);
+}
+
+static void do_remove(struct model *m, int index)
+{
+    playlist_remove(m->pl, m->entries[index]);
+    MP_TARRAY_REMOVE_AT(m->entries, m->num_entries, index);
+}
+
+// Like playlist_move(): entry at index from takes the place of the entry at
+// index to (to == num_entries: move to the end).
+static void do_move(struct model *m, int from, int to)
+{
+    struct playlist_entry *e = m->entries[from];
+    struct playlist_entry *at = to < m->num_entries ? m->entries[to] : NULL;
+    playlist_move(m->pl, e, at);
+    if (e == at)
+        return;
+    MP_TARRAY_REMOVE_AT(m->entries, m->num_entries, from);
+    if (to > from)
+        to--;
+    MP_TARRAY_INSERT_AT(m, m->entries, m->num_entries, to, e);
+}
+
+static void do_shuffle(struct model *m, bool unshuffle)
+{
+    if (unshuffle) {
+        playlist_unshuffle(m->pl);
+    } else {
+        playlist_shuffle(m->pl);
+    }
+    // The order is random, but it must be a permutation of the old entries.
+    struct playlist_entry **old = talloc_memdup(NULL, m->entries,
+        m->num_entries * sizeof(m->entries[0]));
+    struct playlist_entry *e = playlist_get_first(m->pl);
+    for (int n = 0; n < m->num_entries; n++) {
+        assert_true(e);
+        m->entries[n] = e;
+        e = playlist_entry_get_rel(e, 1);
+    }
+    assert_true(!e);
+    for (int n = 0; n < m->num_entries; n++) {
+        int index = playlist_entry_to_index(m->pl, old[n]);
+        assert_true(index >= 0 && m->entries[index] == old[n]);
+    }
+    talloc_free(old);
+}
+
+static int get_item(int item, int action, void *arg, void *ctx)
+{
+    struct model *m = ctx;
+    struct playlist_entry *e = playlist_entry_from_index(m->pl, item);
+    if (!e)
+        return M_PROPERTY_ERROR;
+    return m_property_strdup_ro(action, arg, e->filename);
+}
+
+// Read range/START/COUNT like the playlist property does.
+static void check_range(struct model *m, int start, int count)
+{
+    char key[64];
+    snprintf(key, sizeof(key), "range/%d/%d", start, count);
+    struct mpv_node node = {0};
+    struct m_property_action_arg ka = {
+        .key = key,
+        .action = M_PROPERTY_GET,
+        .arg = &node,
+    };
+    int r = m_property_read_list(M_PROPERTY_KEY_ACTION, &ka, m->num_entries,
+                                 get_item, m);
+    assert_int_equal(r, M_PROPERTY_OK);
+    assert_int_equal(node.format, MPV_FORMAT_NODE_ARRAY);
+
+    int clipped_start = MPMIN(start, m->num_entries);
+    int clipped_count = MPMIN(count, m->num_entries - clipped_start);
+    assert_int_equal(node.u.list->num, clipped_count);
+    for (int n = 0; n < clipped_count; n++) {
+        struct mpv_node *sub = &node.u.list->values[n];
+        assert_int_equal(sub->format, MPV_FORMAT_STRING);
+        assert_string_equal(sub->u.string,
+                            m->entries[clipped_start + n]->filename);
+    }
+    talloc_free(node.u.list);
+}
+
+int main(void)
+{
+    mp_rand_seed(1234);
+
+    struct model *m = talloc_zero(NULL, struct model);
+    m->pl = talloc_zero(m, struct playlist);
+
+    /* empty playlist */
+    check_all(m);
+    check_range(m, 0, 10);
+
+    /* randomized edits against the model */
+    do_insert(m, 0, 3000);
+    check_all(m);
+
+    for (int i = 0; i < 10000; i++) {
+        int op = rand_int(100);
+        if (op < 20) {
+            // Mostly single entries, sometimes more than a chunk.
+            int count = rand_int(50) ? 1 + rand_int(5) : 1 + rand_int(1500);
+            do_insert(m, rand_int(m->num_entries + 1), count);
+        } else if (op < 45) {
+            if (m->num_entries)
+                do_remove(m, rand_int(m->num_entries));
+        } else if (op < 70) {
+            if (m->num_entries) {
+                do_move(m, rand_int(m->num_entries),
+                        rand_int(m->num_entries + 1));
+            }
+        } else if (op < 71) {
+            do_shuffle(m, rand_int(2));
+        } else if (op < 90) {
+            if (m->num_entries)
+                check_index(m, rand_int(m->num_entries));
+        } else {
+            check_range(m, rand_int(m->num_entries + 10), rand_int(600));
+        }
+        if (i % 1000 == 0)
+            check_all(m);
+    }
+    check_all(m);
+
+    /* remove everything */
+    while (m->num_entries)
+        do_remove(m, rand_int(m->num_entries));
+    check_all(m);
+
+    talloc_free(m);
+    return 0;
+}
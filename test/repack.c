@@ -5,6 +5,8 @@
 #include "common/common.h"
 #include "common/global.h"
 #include "img_utils.h"
+#include "misc/random.h"
+#include "osdep/timer.h"
 #include "sub/draw_bmp.h"
 #include "sub/osd.h"
 #include "test_utils.h"
@@ -433,6 +435,131 @@ static void check_float_repack(int imgfmt, enum mp_csp csp,
     talloc_free(from_f);
 }
 
+static void fill_random(struct mp_image *img)
+{
+    bool is_float = img->fmt.flags & MP_IMGFLAG_TYPE_FLOAT;
+    for (int p = 0; p < img->num_planes; p++) {
+        for (int y = 0; y < mp_image_plane_h(img, p); y++) {
+            uint8_t *ptr = img->planes[p] + img->stride[p] * (ptrdiff_t)y;
+            size_t size = mp_image_plane_bytes(img, p, 0, img->w);
+            if (is_float) {
+                for (size_t x = 0; x < size / sizeof(float); x++)
+                    ((float *)ptr)[x] = mp_rand_next_double();
+            } else {
+                for (size_t x = 0; x < size; x++)
+                    ptr[x] = mp_rand_next();
+            }
+        }
+    }
+}
+
+// The repack_tests entries are too small to reach the vectorizable part of the
+// packers. Check that converting a wide line at once gives the same result as
+// converting it one macro pixel at a time (which only uses the scalar remainder
+// loops).
+static void check_wide_repack(int imgfmt, int flags)
+{
+    for (int pack = 0; pack < 2; pack++) {
+        struct mp_repack *rp = mp_repack_create_planar(imgfmt, pack, flags);
+        if (!rp)
+            continue;
+
+        int ax = mp_repack_get_align_x(rp);
+        int ay = mp_repack_get_align_y(rp);
+        int w = 67 * ax;
+
+        struct mp_image *src = mp_image_alloc(mp_repack_get_format_src(rp), w, ay);
+        struct mp_image *d_line = mp_image_alloc(mp_repack_get_format_dst(rp), w, ay);
+        struct mp_image *d_px = mp_image_alloc(d_line->imgfmt, w, ay);
+        assert(src && d_line && d_px);
+
+        fill_random(src);
+        mp_image_clear(d_line, 0, 0, w, ay);
+        mp_image_clear(d_px, 0, 0, w, ay);
+
+        bool r = repack_config_buffers(rp, 0, d_line, 0, src, NULL);
+        assert(r);
+        repack_line(rp, 0, 0, 0, 0, w);
+
+        r = repack_config_buffers(rp, 0, d_px, 0, src, NULL);
+        assert(r);
+        for (int x = 0; x < w; x += ax)
+            repack_line(rp, x, 0, x, 0, ax);
+
+        for (int p = 0; p < d_line->num_planes; p++) {
+            for (int y = 0; y < mp_image_plane_h(d_line, p); y++) {
+                assert_memcmp(d_line->planes[p] + d_line->stride[p] * (ptrdiff_t)y,
+                              d_px->planes[p] + d_px->stride[p] * (ptrdiff_t)y,
+                              mp_image_plane_bytes(d_line, p, 0, w));
+            }
+        }
+
+        talloc_free(src);
+        talloc_free(d_line);
+        talloc_free(d_px);
+        talloc_free(rp);
+    }
+}
+
+// Print the throughput of unpacking and packing a 1920x1080 image.
+static void benchmark_repack(int imgfmt, int flags)
+{
+    imgfmt = UNFUCK(imgfmt);
+
+    for (int pack = 0; pack < 2; pack++) {
+        struct mp_repack *rp = mp_repack_create_planar(imgfmt, pack, flags);
+        if (!rp)
+            continue;
+
+        int ax = mp_repack_get_align_x(rp);
+        int ay = mp_repack_get_align_y(rp);
+        int w = 1920 / ax * ax;
+        int h = 1080 / ay * ay;
+        int runs = 20;
+
+        struct mp_image *src = mp_image_alloc(mp_repack_get_format_src(rp), w, h);
+        struct mp_image *dst = mp_image_alloc(mp_repack_get_format_dst(rp), w, h);
+        assert(src && dst);
+        fill_random(src);
+
+        bool r = repack_config_buffers(rp, 0, dst, 0, src, NULL);
+        assert(r);
+
+        int64_t start = mp_time_ns();
+        for (int n = 0; n < runs; n++) {
+            for (int y = 0; y < h; y += ay)
+                repack_line(rp, 0, y, 0, y, w);
+        }
+        double secs = MP_TIME_NS_TO_S(mp_time_ns() - start);
+
+        printf("%-15s %-6s %-13s => %-15s %8.1f MPix/s\n",
+               mp_imgfmt_to_name(imgfmt), pack ? "pack" : "unpack",
+               (flags & REPACK_CREATE_PLANAR_F32) ? "[planar-f32]" : "",
+               mp_imgfmt_to_name(pack ? src->imgfmt : dst->imgfmt),
+               (double)w * h * runs / secs / 1e6);
+
+        talloc_free(src);
+        talloc_free(dst);
+        talloc_free(rp);
+    }
+}
+
+static int run_benchmark(void)
+{
+    static const int fmts[] = {
+        -AV_PIX_FMT_NV12, -AV_PIX_FMT_P010, -AV_PIX_FMT_RGBA,
+        -AV_PIX_FMT_BGR0, -AV_PIX_FMT_RGB24, -AV_PIX_FMT_RGBA64,
+        -AV_PIX_FMT_X2RGB10, -AV_PIX_FMT_YA8, -AV_PIX_FMT_GRAY16BE,
+        -AV_PIX_FMT_YUV420P, -AV_PIX_FMT_YUV420P10,
+    };
+
+    for (int n = 0; n < MP_ARRAY_SIZE(fmts); n++) {
+        benchmark_repack(fmts[n], 0);
+        benchmark_repack(fmts[n], REPACK_CREATE_PLANAR_F32);
+    }
+    return 0;
+}
+
 static bool try_draw_bmp(FILE *f, int imgfmt)
 {
     bool ok = false;
@@ -484,6 +611,12 @@ done:
 
 int main(int argc, char *argv[])
 {
+    mp_rand_seed(0x5eed);
+
+    // Not run by the test suite. Use: repack --benchmark
+    if (argc > 1 && !strcmp(argv[1], "--benchmark"))
+        return run_benchmark();
+
     const char *refdir = argv[1];
     const char *outdir = argv[2];
     FILE *f = test_open_out(outdir, "repack.txt");
@@ -496,6 +629,11 @@ int main(int argc, char *argv[])
         try_repack(f, imgfmt, REPACK_CREATE_ROUND_DOWN, other);
         try_repack(f, imgfmt, REPACK_CREATE_EXPAND_8BIT, other);
         try_repack(f, imgfmt, REPACK_CREATE_PLANAR_F32, other);
+
+        check_wide_repack(imgfmt, 0);
+        check_wide_repack(imgfmt, REPACK_CREATE_ROUND_DOWN);
+        check_wide_repack(imgfmt, REPACK_CREATE_EXPAND_8BIT);
+        check_wide_repack(imgfmt, REPACK_CREATE_PLANAR_F32);
     }
 
     fclose(f);
@@ -0,0 +1,155 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "common/common.h"
+#include "misc/ring.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+// Bytes are numbered by stream position; check that the consumer sees them in
+// order, with only discards causing gaps.
+static uint8_t byte_at(uint64_t pos, int plane)
+{
+    return (pos * 7 + plane * 31) & 0xFF;
+}
+
+#define STRESS_BYTES (8 * 1024 * 1024)
+#define STRESS_PLANES 2
+
+struct stress {
+    struct mp_ring *ring;
+    atomic_bool producer_done;
+    _Atomic uint64_t discarded;   // number of mp_ring_discard() calls
+};
+
+static void *stress_producer(void *ctx)
+{
+    struct stress *s = ctx;
+    uint8_t buf[STRESS_PLANES][1000];
+    void *planes[STRESS_PLANES] = {buf[0], buf[1]};
+    uint64_t pos = 0;
+    int iter = 0;
+    while (pos < STRESS_BYTES) {
+        int len = 1 + iter % 1000;
+        for (int p = 0; p < STRESS_PLANES; p++) {
+            for (int n = 0; n < len; n++)
+                buf[p][n] = byte_at(pos + n, p);
+        }
+        int written = mp_ring_write(s->ring, planes, len);
+        if (!written)
+            mp_sleep_ns(MP_TIME_US_TO_NS(10)); // let the consumer run
+        pos += written;
+        assert_true(mp_ring_buffered(s->ring) <= mp_ring_size(s->ring));
+        // Every now and then, simulate a seek.
+        if (++iter % 5000 == 0) {
+            mp_ring_discard(s->ring);
+            atomic_fetch_add(&s->discarded, 1);
+            assert_int_equal(mp_ring_available(s->ring), mp_ring_size(s->ring));
+        }
+    }
+    atomic_store(&s->producer_done, true);
+    return NULL;
+}
+
+static void *stress_consumer(void *ctx)
+{
+    struct stress *s = ctx;
+    uint8_t buf[STRESS_PLANES][700];
+    void *planes[STRESS_PLANES] = {buf[0], buf[1]};
+    uint64_t pos = 0;
+    int iter = 0;
+    while (1) {
+        bool done = atomic_load(&s->producer_done);
+        iter = (iter + 13) % 700;
+        int len = 1 + iter;
+        int got = mp_ring_read(s->ring, planes, len);
+        assert_true(got >= 0 && got <= len);
+        if (!got) {
+            if (done)
+                break;
+            mp_sleep_ns(MP_TIME_US_TO_NS(10));
+            continue;
+        }
+        // A discard can skip data; resync to the first byte, whose position
+        // is unknown (but the byte sequence repeats every 256 bytes).
+        if (buf[0][0] != byte_at(pos, 0)) {
+            assert_true(atomic_load(&s->discarded) > 0);
+            for (int n = 0; n < 256; n++) {
+                if (byte_at(pos + n, 0) == buf[0][0]) {
+                    pos += n;
+                    break;
+                }
+            }
+        }
+        for (int p = 0; p < STRESS_PLANES; p++) {
+            for (int n = 0; n < got; n++)
+                assert_int_equal(buf[p][n], byte_at(pos + n, p));
+        }
+        pos += got;
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    /* basic operations, wraparound, skipping, discarding */
+    {
+        struct mp_ring *ring = mp_ring_new(NULL, 2, 100);
+        assert_int_equal(mp_ring_size(ring), 128);
+        assert_int_equal(mp_ring_available(ring), 128);
+        assert_int_equal(mp_ring_buffered(ring), 0);
+
+        uint8_t in[2][100], out[2][100];
+        void *ip[2] = {in[0], in[1]}, *op[2] = {out[0], out[1]};
+        uint64_t wpos = 0, rpos = 0;
+        for (int round = 0; round < 20; round++) {
+            int len = 10 + round * 3;
+            for (int p = 0; p < 2; p++) {
+                for (int n = 0; n < len; n++)
+                    in[p][n] = byte_at(wpos + n, p);
+            }
+            int written = mp_ring_write(ring, ip, len);
+            assert_int_equal(written, MPMIN(len, 128 - (wpos - rpos)));
+            wpos += written;
+            assert_int_equal(mp_ring_buffered(ring), wpos - rpos);
+
+            int got = mp_ring_read(ring, op, len - 5);
+            assert_int_equal(got, MPMIN(len - 5, wpos - rpos));
+            for (int p = 0; p < 2; p++) {
+                for (int n = 0; n < got; n++)
+                    assert_int_equal(out[p][n], byte_at(rpos + n, p));
+            }
+            rpos += got;
+            assert_int_equal(mp_ring_available(ring), 128 - (wpos - rpos));
+        }
+
+        assert_int_equal(mp_ring_read(ring, NULL, 3), MPMIN(3, wpos - rpos));
+        mp_ring_discard(ring);
+        assert_int_equal(mp_ring_buffered(ring), 0);
+        assert_int_equal(mp_ring_available(ring), 128);
+        assert_int_equal(mp_ring_read(ring, op, 10), 0);
+
+        for (int n = 0; n < 10; n++)
+            in[0][n] = in[1][n] = n;
+        assert_int_equal(mp_ring_write(ring, ip, 10), 10);
+        assert_int_equal(mp_ring_read(ring, op, 100), 10);
+        assert_int_equal(out[1][9], 9);
+
+        talloc_free(ring);
+    }
+
+    /* concurrent producer and consumer */
+    {
+        struct stress *s = talloc_zero(NULL, struct stress);
+        s->ring = mp_ring_new(s, STRESS_PLANES, 4096);
+        pthread_t threads[2];
+        pthread_create(&threads[0], NULL, stress_producer, s);
+        pthread_create(&threads[1], NULL, stress_consumer, s);
+        for (int n = 0; n < 2; n++)
+            pthread_join(threads[n], NULL);
+        assert_int_equal(mp_ring_buffered(s->ring), 0);
+        talloc_free(s);
+    }
+
+    return 0;
+}
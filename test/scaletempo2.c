@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio/chmap.h"
+#include "audio/filter/af_scaletempo2_internals.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+#define RATE 48000
+#define BLOCK_FRAMES 1024
+
+static const struct mp_scaletempo2_opts default_opts = {
+    .min_playback_rate = 0.25,
+    .max_playback_rate = 8.0,
+    .ola_window_size_ms = 12,
+    .wsola_search_interval_ms = 40,
+};
+
+struct audio {
+    int channels;
+    int frames;
+    float **planes;
+};
+
+static struct audio *audio_alloc(int channels, int frames)
+{
+    struct audio *a = talloc_zero(NULL, struct audio);
+    a->channels = channels;
+    a->frames = frames;
+    a->planes = talloc_array(a, float *, channels);
+    for (int c = 0; c < channels; c++)
+        a->planes[c] = talloc_zero_array(a, float, frames);
+    return a;
+}
+
+// Run the whole input through scaletempo2, the same way af_scaletempo2 feeds
+// it, and return the number of output frames. If out is not NULL, the output
+// of the first channel is written to it (up to out_size frames).
+static int process(struct audio *in, double rate, float *out, int out_size)
+{
+    struct mp_scaletempo2_opts opts = default_opts;
+    struct mp_scaletempo2 st = {.opts = &opts};
+    mp_scaletempo2_init(&st, in->channels, RATE);
+
+    float **dst = talloc_array(NULL, float *, in->channels);
+    for (int c = 0; c < in->channels; c++)
+        dst[c] = talloc_array(dst, float, BLOCK_FRAMES);
+    uint8_t **planes = talloc_array(dst, uint8_t *, in->channels);
+
+    int pos = 0, total = 0;
+    while (true) {
+        if (pos < in->frames) {
+            for (int c = 0; c < in->channels; c++)
+                planes[c] = (uint8_t *)(in->planes[c] + pos);
+            pos += mp_scaletempo2_fill_input_buffer(&st, planes,
+                                                    in->frames - pos, rate);
+            if (pos == in->frames)
+                mp_scaletempo2_set_final(&st);
+        }
+        if (!mp_scaletempo2_frames_available(&st, rate))
+            break;
+        int got = mp_scaletempo2_fill_buffer(&st, dst, BLOCK_FRAMES, rate);
+        if (out) {
+            int copy = MPMIN(got, out_size - total);
+            if (copy > 0)
+                memcpy(out + total, dst[0], copy * sizeof(float));
+        }
+        total += got;
+        if (!got && pos == in->frames)
+            break;
+    }
+
+    talloc_free(dst);
+    mp_scaletempo2_destroy(&st);
+    return total;
+}
+
+// A pure tone must come out as the same tone with (nearly) unchanged level;
+// a search that picks bad candidate blocks causes phase cancellation in the
+// overlap-add, which lowers the level and adds extra zero crossings.
+static void check_tone(int channels, double rate)
+{
+    const double freq = 440;
+    int frames = RATE * 2;
+    struct audio *in = audio_alloc(channels, frames);
+    for (int c = 0; c < channels; c++) {
+        for (int n = 0; n < frames; n++)
+            in->planes[c][n] = 0.5 * sin(2 * M_PI * freq * n / RATE + c);
+    }
+
+    int out_size = frames * 4;
+    float *out = talloc_array(in, float, out_size);
+    int total = process(in, rate, out, out_size);
+
+    // Output duration follows the playback rate.
+    assert_float_equal(total, frames / rate, RATE * 0.05);
+
+    // Check the middle part, away from startup and final silence.
+    int start = total / 4, end = total * 3 / 4;
+    double energy = 0;
+    int crossings = 0;
+    for (int n = start; n < end; n++) {
+        energy += out[n] * out[n];
+        crossings += (out[n - 1] < 0) != (out[n] < 0);
+    }
+    double rms = sqrt(energy / (end - start));
+    double out_freq = crossings / 2.0 / ((end - start) / (double)RATE);
+    assert_float_equal(rms, 0.5 / sqrt(2), 0.02);
+    assert_float_equal(out_freq, freq, 3);
+
+    talloc_free(in);
+}
+
+// Minimal RIFF/WAVE reader for 16 bit PCM and 32 bit float files.
+static struct audio *read_wav(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    struct audio *a = NULL;
+    uint8_t hdr[12];
+    if (fread(hdr, 12, 1, f) != 1 || memcmp(hdr, "RIFF", 4) ||
+        memcmp(hdr + 8, "WAVE", 4))
+        goto done;
+    int format = 0, channels = 0, bits = 0;
+    uint8_t chunk[8];
+    while (fread(chunk, 8, 1, f) == 1) {
+        uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 |
+                        (uint32_t)chunk[7] << 24;
+        if (!memcmp(chunk, "fmt ", 4) && size >= 16) {
+            uint8_t fmt[16];
+            if (fread(fmt, 16, 1, f) != 1)
+                goto done;
+            format = fmt[0] | fmt[1] << 8;
+            channels = fmt[2] | fmt[3] << 8;
+            bits = fmt[14] | fmt[15] << 8;
+            fseek(f, size - 16 + (size & 1), SEEK_CUR);
+        } else if (!memcmp(chunk, "data", 4) && channels > 0 &&
+                   channels <= MP_NUM_CHANNELS)
+        {
+            bool s16 = format == 1 && bits == 16;
+            bool f32 = format == 3 && bits == 32;
+            if (!s16 && !f32)
+                goto done;
+            int sample_size = bits / 8;
+            int frames = size / (sample_size * channels);
+            uint8_t *data = malloc(size);
+            if (data && fread(data, size, 1, f) == 1) {
+                a = audio_alloc(channels, frames);
+                for (int n = 0; n < frames; n++) {
+                    for (int c = 0; c < channels; c++) {
+                        uint8_t *s = data + (n * channels + c) * sample_size;
+                        float v;
+                        if (s16) {
+                            v = (int16_t)(s[0] | s[1] << 8) / 32768.0f;
+                        } else {
+                            memcpy(&v, s, 4);
+                        }
+                        a->planes[c][n] = v;
+                    }
+                }
+            }
+            free(data);
+            goto done;
+        } else {
+            fseek(f, size + (size & 1), SEEK_CUR);
+        }
+    }
+done:
+    fclose(f);
+    return a;
+}
+
+// Upmix/downmix by repeating the source channels.
+static struct audio *remap_channels(struct audio *src, int channels)
+{
+    struct audio *a = audio_alloc(channels, src->frames);
+    for (int c = 0; c < channels; c++) {
+        memcpy(a->planes[c], src->planes[c % src->channels],
+               src->frames * sizeof(float));
+    }
+    return a;
+}
+
+// Print how many times faster than realtime the input is processed.
+static int run_benchmark(const char *path)
+{
+    struct audio *src;
+    if (path) {
+        src = read_wav(path);
+        if (!src) {
+            fprintf(stderr, "Could not read '%s' (16 bit PCM or float WAV).\n",
+                    path);
+            return 1;
+        }
+    } else {
+        // 20 seconds of noise with a few tones mixed in.
+        src = audio_alloc(2, RATE * 20);
+        for (int c = 0; c < 2; c++) {
+            for (int n = 0; n < src->frames; n++) {
+                src->planes[c][n] = 0.2 * sin(2 * M_PI * 220 * n / RATE) +
+                                    0.1 * sin(2 * M_PI * 1375 * n / RATE + c) +
+                                    0.1 * (rand() / (double)RAND_MAX - 0.5);
+            }
+        }
+    }
+
+    static const int channel_counts[] = {1, 2, 6};
+    static const double rates[] = {0.5, 0.8, 1.25, 1.5, 2.0};
+    for (int i = 0; i < MP_ARRAY_SIZE(channel_counts); i++) {
+        struct audio *in = remap_channels(src, channel_counts[i]);
+        for (int j = 0; j < MP_ARRAY_SIZE(rates); j++) {
+            int64_t start = mp_time_ns();
+            process(in, rates[j], NULL, 0);
+            double secs = MP_TIME_NS_TO_S(mp_time_ns() - start);
+            printf("%d ch  %.2fx  %8.1fx realtime\n", channel_counts[i],
+                   rates[j], in->frames / (double)RATE / secs);
+        }
+        talloc_free(in);
+    }
+    talloc_free(src);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    // Not run by the test suite. Use: scaletempo2 --benchmark [file.wav]
+    if (argc > 1 && !strcmp(argv[1], "--benchmark"))
+        return run_benchmark(argc > 2 ? argv[2] : NULL);
+
+    static const double rates[] = {0.5, 0.75, 1.5, 2.0};
+    for (int channels = 1; channels <= 6; channels += 5) {
+        for (int n = 0; n < MP_ARRAY_SIZE(rates); n++)
+            check_tone(channels, rates[n]);
+    }
+    return 0;
+}
@@ -0,0 +1,354 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common/common.h"
+#include "misc/spsc_queue.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+// Roughly what filters/f_async_queue.c stores per frame.
+struct item {
+    uint64_t seq;
+    int64_t time;
+    void *data;
+};
+
+#define STRESS_ITEMS 200000
+
+struct stress {
+    struct mp_spsc_queue *q;
+    atomic_bool locker_done;
+    atomic_bool consumer_done;
+};
+
+static void *stress_producer(void *ctx)
+{
+    struct stress *s = ctx;
+    for (uint64_t n = 0; n < STRESS_ITEMS; n++) {
+        mp_spsc_queue_reserve(s->q);
+        mp_spsc_queue_enter(s->q, MP_SPSC_PRODUCER);
+        mp_spsc_queue_write(s->q, &(struct item){.seq = n});
+        mp_spsc_queue_leave(s->q, MP_SPSC_PRODUCER);
+    }
+    return NULL;
+}
+
+static void *stress_consumer(void *ctx)
+{
+    struct stress *s = ctx;
+    uint64_t next = 0;
+    while (next < STRESS_ITEMS) {
+        mp_spsc_queue_enter(s->q, MP_SPSC_CONSUMER);
+        struct item it;
+        while (mp_spsc_queue_read(s->q, &it)) {
+            assert_int_equal(it.seq, next);
+            next++;
+        }
+        mp_spsc_queue_leave(s->q, MP_SPSC_CONSUMER);
+    }
+    atomic_store(&s->consumer_done, true);
+    return NULL;
+}
+
+// Third thread taking the lock concurrently; checks that the sides are really
+// excluded while locked.
+static void *stress_locker(void *ctx)
+{
+    struct stress *s = ctx;
+    while (!atomic_load(&s->consumer_done)) {
+        mp_spsc_queue_lock(s->q);
+        size_t count = mp_spsc_queue_count(s->q);
+        uint64_t first = 0;
+        for (size_t n = 0; n < count; n++) {
+            struct item *it = mp_spsc_queue_peek(s->q, n);
+            assert_true(it);
+            if (n == 0)
+                first = it->seq;
+            assert_int_equal(it->seq, first + n);
+        }
+        assert_int_equal(mp_spsc_queue_count(s->q), count);
+        mp_spsc_queue_unlock(s->q);
+    }
+    atomic_store(&s->locker_done, true);
+    return NULL;
+}
+
+// A wakeup mechanism similar to what the filter framework does.
+struct event {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool signaled;
+    int64_t signals;
+};
+
+static void event_init(struct event *ev)
+{
+    *ev = (struct event){0};
+    pthread_mutex_init(&ev->lock, NULL);
+    pthread_cond_init(&ev->cond, NULL);
+}
+
+static void event_destroy(struct event *ev)
+{
+    pthread_cond_destroy(&ev->cond);
+    pthread_mutex_destroy(&ev->lock);
+}
+
+static void event_signal(struct event *ev)
+{
+    pthread_mutex_lock(&ev->lock);
+    ev->signaled = true;
+    ev->signals++;
+    pthread_cond_signal(&ev->cond);
+    pthread_mutex_unlock(&ev->lock);
+}
+
+static void event_wait(struct event *ev)
+{
+    pthread_mutex_lock(&ev->lock);
+    while (!ev->signaled)
+        pthread_cond_wait(&ev->cond, &ev->lock);
+    ev->signaled = false;
+    pthread_mutex_unlock(&ev->lock);
+}
+
+#define BENCH_CAPACITY 64
+
+struct bench {
+    const char *name;
+    int64_t num_items;
+    int64_t interval_ns; // >0: producer is paced, measure latency
+    struct event ev[2]; // producer (0), consumer (1)
+
+    // spsc variant
+    struct mp_spsc_queue *q;
+
+    // mutex variant: what the old f_async_queue.c did
+    pthread_mutex_t lock;
+    struct item *items;
+    int num_items_queued;
+
+    // results (written by consumer)
+    int64_t latency_sum;
+    int64_t latency_max;
+};
+
+static void pace(struct bench *b, int64_t n, int64_t start)
+{
+    if (b->interval_ns) {
+        int64_t wait = start + n * b->interval_ns - mp_time_ns();
+        if (wait > 0)
+            mp_sleep_ns(wait);
+    }
+}
+
+static void record(struct bench *b, struct item *it)
+{
+    if (b->interval_ns) {
+        int64_t latency = mp_time_ns() - it->time;
+        b->latency_sum += latency;
+        b->latency_max = MPMAX(b->latency_max, latency);
+    }
+}
+
+static void *spsc_producer(void *ctx)
+{
+    struct bench *b = ctx;
+    int64_t start = mp_time_ns();
+    for (int64_t n = 0; n < b->num_items; n++) {
+        pace(b, n, start);
+        mp_spsc_queue_reserve(b->q);
+        mp_spsc_queue_enter(b->q, MP_SPSC_PRODUCER);
+        while (mp_spsc_queue_count(b->q) >= BENCH_CAPACITY) {
+            mp_spsc_queue_set_waiting(b->q, MP_SPSC_PRODUCER);
+            if (mp_spsc_queue_count(b->q) < BENCH_CAPACITY) {
+                mp_spsc_queue_take_waiting(b->q, MP_SPSC_PRODUCER);
+                break;
+            }
+            mp_spsc_queue_leave(b->q, MP_SPSC_PRODUCER);
+            event_wait(&b->ev[0]);
+            mp_spsc_queue_enter(b->q, MP_SPSC_PRODUCER);
+        }
+        struct item it = {.seq = n, .time = mp_time_ns()};
+        mp_spsc_queue_write(b->q, &it);
+        if (mp_spsc_queue_take_waiting(b->q, MP_SPSC_CONSUMER))
+            event_signal(&b->ev[1]);
+        mp_spsc_queue_leave(b->q, MP_SPSC_PRODUCER);
+    }
+    return NULL;
+}
+
+static void *spsc_consumer(void *ctx)
+{
+    struct bench *b = ctx;
+    int64_t n = 0;
+    while (n < b->num_items) {
+        mp_spsc_queue_enter(b->q, MP_SPSC_CONSUMER);
+        struct item it;
+        bool got = mp_spsc_queue_read(b->q, &it);
+        if (got) {
+            record(b, &it);
+            n++;
+            if (mp_spsc_queue_take_waiting(b->q, MP_SPSC_PRODUCER))
+                event_signal(&b->ev[0]);
+        } else {
+            mp_spsc_queue_set_waiting(b->q, MP_SPSC_CONSUMER);
+            got = mp_spsc_queue_count(b->q) &&
+                  mp_spsc_queue_take_waiting(b->q, MP_SPSC_CONSUMER);
+        }
+        mp_spsc_queue_leave(b->q, MP_SPSC_CONSUMER);
+        if (!got)
+            event_wait(&b->ev[1]);
+    }
+    return NULL;
+}
+
+static void *mutex_producer(void *ctx)
+{
+    struct bench *b = ctx;
+    int64_t start = mp_time_ns();
+    for (int64_t n = 0; n < b->num_items; n++) {
+        pace(b, n, start);
+        pthread_mutex_lock(&b->lock);
+        while (b->num_items_queued >= BENCH_CAPACITY) {
+            pthread_mutex_unlock(&b->lock);
+            event_wait(&b->ev[0]);
+            pthread_mutex_lock(&b->lock);
+        }
+        struct item it = {.seq = n, .time = mp_time_ns()};
+        MP_TARRAY_INSERT_AT(b, b->items, b->num_items_queued, 0, it);
+        event_signal(&b->ev[1]);
+        pthread_mutex_unlock(&b->lock);
+    }
+    return NULL;
+}
+
+static void *mutex_consumer(void *ctx)
+{
+    struct bench *b = ctx;
+    int64_t n = 0;
+    while (n < b->num_items) {
+        pthread_mutex_lock(&b->lock);
+        bool got = b->num_items_queued > 0;
+        if (got) {
+            struct item it = b->items[--b->num_items_queued];
+            record(b, &it);
+            n++;
+            event_signal(&b->ev[0]);
+        }
+        pthread_mutex_unlock(&b->lock);
+        if (!got)
+            event_wait(&b->ev[1]);
+    }
+    return NULL;
+}
+
+static void run_benchmark(const char *name, bool spsc, int64_t num_items,
+                          int64_t interval_ns)
+{
+    struct bench *b = talloc_zero(NULL, struct bench);
+    b->num_items = num_items;
+    b->interval_ns = interval_ns;
+    event_init(&b->ev[0]);
+    event_init(&b->ev[1]);
+    pthread_mutex_init(&b->lock, NULL);
+    b->q = mp_spsc_queue_create(b, sizeof(struct item));
+
+    int64_t start = mp_time_ns();
+    pthread_t threads[2];
+    pthread_create(&threads[0], NULL, spsc ? spsc_producer : mutex_producer, b);
+    pthread_create(&threads[1], NULL, spsc ? spsc_consumer : mutex_consumer, b);
+    for (int n = 0; n < 2; n++)
+        pthread_join(threads[n], NULL);
+    double secs = (mp_time_ns() - start) / 1e9;
+
+    double wakeups = (b->ev[0].signals + b->ev[1].signals) / (double)num_items;
+    if (interval_ns) {
+        printf("%-6s %-9s latency mean %7.2f us, max %8.2f us, "
+               "%.2f wakeups/frame\n", name, spsc ? "spsc" : "mutex",
+               b->latency_sum / 1e3 / num_items, b->latency_max / 1e3, wakeups);
+    } else {
+        printf("%-6s %-9s %10.0f frames/sec, %.2f wakeups/frame\n", name,
+               spsc ? "spsc" : "mutex", num_items / secs, wakeups);
+    }
+
+    pthread_mutex_destroy(&b->lock);
+    event_destroy(&b->ev[0]);
+    event_destroy(&b->ev[1]);
+    talloc_free(b);
+}
+
+static void benchmark(void)
+{
+    for (int n = 0; n < 2; n++)
+        run_benchmark("burst", n, 2000000, 0);
+    for (int n = 0; n < 2; n++)
+        run_benchmark("paced", n, 20000, MP_TIME_US_TO_NS(50));
+}
+
+int main(int argc, char *argv[])
+{
+    mp_time_init();
+
+    /* FIFO order, growing, clearing */
+    {
+        struct mp_spsc_queue *q = mp_spsc_queue_create(NULL, sizeof(struct item));
+        uint64_t wseq = 0, rseq = 0;
+        for (int round = 0; round < 10; round++) {
+            for (int n = 0; n < round * 17; n++) {
+                mp_spsc_queue_reserve(q);
+                mp_spsc_queue_enter(q, MP_SPSC_PRODUCER);
+                mp_spsc_queue_write(q, &(struct item){.seq = wseq++});
+                mp_spsc_queue_leave(q, MP_SPSC_PRODUCER);
+            }
+            assert_int_equal(mp_spsc_queue_count(q), wseq - rseq);
+            struct item *it = mp_spsc_queue_peek(q, wseq - rseq - 1);
+            if (wseq != rseq)
+                assert_int_equal(it->seq, wseq - 1);
+            assert_true(!mp_spsc_queue_peek(q, wseq - rseq));
+            mp_spsc_queue_enter(q, MP_SPSC_CONSUMER);
+            for (int n = 0; n < round * 11; n++) {
+                struct item r;
+                assert_true(mp_spsc_queue_read(q, &r));
+                assert_int_equal(r.seq, rseq++);
+            }
+            mp_spsc_queue_leave(q, MP_SPSC_CONSUMER);
+        }
+
+        mp_spsc_queue_lock(q);
+        mp_spsc_queue_clear(q);
+        mp_spsc_queue_unlock(q);
+        assert_int_equal(mp_spsc_queue_count(q), 0);
+        struct item r;
+        assert_true(!mp_spsc_queue_read(q, &r));
+
+        assert_true(!mp_spsc_queue_take_waiting(q, MP_SPSC_CONSUMER));
+        mp_spsc_queue_set_waiting(q, MP_SPSC_CONSUMER);
+        assert_true(mp_spsc_queue_take_waiting(q, MP_SPSC_CONSUMER));
+        assert_true(!mp_spsc_queue_take_waiting(q, MP_SPSC_CONSUMER));
+
+        talloc_free(q);
+    }
+
+    /* concurrent producer, consumer, and locking thread */
+    {
+        struct stress *s = talloc_zero(NULL, struct stress);
+        s->q = mp_spsc_queue_create(s, sizeof(struct item));
+        pthread_t threads[3];
+        pthread_create(&threads[0], NULL, stress_producer, s);
+        pthread_create(&threads[1], NULL, stress_consumer, s);
+        pthread_create(&threads[2], NULL, stress_locker, s);
+        for (int n = 0; n < 3; n++)
+            pthread_join(threads[n], NULL);
+        assert_true(atomic_load(&s->locker_done));
+        assert_int_equal(mp_spsc_queue_count(s->q), 0);
+        talloc_free(s);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0)
+        benchmark();
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "common/common.h"
+#include "misc/thread_pool.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+#define NUM_SLICES 1000
+
+struct slices {
+    atomic_int hits[NUM_SLICES];
+    struct mp_thread_pool *pool;
+};
+
+static void count_slice(void *ctx, int slice)
+{
+    struct slices *s = ctx;
+    atomic_fetch_add(&s->hits[slice], 1);
+}
+
+// Run slices from within slices, which must not deadlock even if all pool
+// threads are taken.
+static void nested_slice(void *ctx, int slice)
+{
+    struct slices *s = ctx;
+    mp_thread_pool_run_slices(s->pool, MP_THREAD_PRIO_HIGH, 10, count_slice, s);
+}
+
+static void check_hits(struct slices *s, int num, int expected)
+{
+    for (int n = 0; n < num; n++)
+        assert_int_equal(atomic_load(&s->hits[n]), expected);
+    for (int n = num; n < NUM_SLICES; n++)
+        assert_int_equal(atomic_load(&s->hits[n]), 0);
+}
+
+struct order {
+    pthread_mutex_t lock;
+    int items[4];
+    int num_items;
+    atomic_bool release;
+};
+
+static void block_item(void *ctx)
+{
+    struct order *o = ctx;
+    while (!atomic_load(&o->release))
+        mp_sleep_ns(MP_TIME_MS_TO_NS(1));
+}
+
+static void log_item(struct order *o, int v)
+{
+    pthread_mutex_lock(&o->lock);
+    o->items[o->num_items++] = v;
+    pthread_mutex_unlock(&o->lock);
+}
+
+static void item_low(void *ctx) { log_item(ctx, MP_THREAD_PRIO_LOW); }
+static void item_normal(void *ctx) { log_item(ctx, MP_THREAD_PRIO_NORMAL); }
+static void item_high(void *ctx) { log_item(ctx, MP_THREAD_PRIO_HIGH); }
+
+int main(void)
+{
+    mp_time_init();
+
+    /* slices on the shared pool */
+    {
+        struct slices *s = talloc_zero(NULL, struct slices);
+        s->pool = mp_thread_pool_shared();
+        assert_true(s->pool);
+
+        for (int n = 0; n < 10; n++)
+            mp_thread_pool_run_slices(s->pool, MP_THREAD_PRIO_NORMAL,
+                                      NUM_SLICES, count_slice, s);
+        check_hits(s, NUM_SLICES, 10);
+
+        struct mp_thread_pool_stats st;
+        mp_thread_pool_get_stats(s->pool, &st);
+        assert_true(st.max_threads >= 1);
+        assert_true(st.threads <= st.max_threads);
+        assert_int_equal(st.queued, 0);
+
+        talloc_free(s);
+    }
+
+    /* nested slices, and slices without pool */
+    {
+        struct slices *s = talloc_zero(NULL, struct slices);
+        s->pool = mp_thread_pool_shared();
+
+        mp_thread_pool_run_slices(s->pool, MP_THREAD_PRIO_NORMAL, 64,
+                                  nested_slice, s);
+        check_hits(s, 10, 64);
+
+        mp_thread_pool_run_slices(NULL, MP_THREAD_PRIO_NORMAL, 10,
+                                  count_slice, s);
+        check_hits(s, 10, 65);
+
+        talloc_free(s);
+    }
+
+    /* queued items run in priority order */
+    {
+        struct order o = {.lock = PTHREAD_MUTEX_INITIALIZER};
+        struct mp_thread_pool *pool = mp_thread_pool_create(NULL, 1, 1, 1);
+        assert_true(pool);
+
+        mp_thread_pool_queue(pool, block_item, &o);
+        // Make sure the thread picked up the blocking item.
+        struct mp_thread_pool_stats st = {0};
+        while (!st.busy_threads) {
+            mp_sleep_ns(MP_TIME_MS_TO_NS(1));
+            mp_thread_pool_get_stats(pool, &st);
+        }
+
+        mp_thread_pool_queue_prio(pool, MP_THREAD_PRIO_LOW, item_low, &o);
+        mp_thread_pool_queue(pool, item_normal, &o);
+        mp_thread_pool_queue_prio(pool, MP_THREAD_PRIO_HIGH, item_high, &o);
+        atomic_store(&o.release, true);
+
+        talloc_free(pool); // waits for all items
+
+        assert_int_equal(o.num_items, 3);
+        assert_int_equal(o.items[0], MP_THREAD_PRIO_HIGH);
+        assert_int_equal(o.items[1], MP_THREAD_PRIO_NORMAL);
+        assert_int_equal(o.items[2], MP_THREAD_PRIO_LOW);
+    }
+
+    return 0;
+}
@@ -38,6 +38,7 @@
 #include "misc/bstr.h"
 #include "common/av_common.h"
 #include "common/codecs.h"
+#include "common/shared_res.h"
 
 #include "video/fmt-conversion.h"
 
@@ -192,6 +193,7 @@ typedef struct lavc_ctx {
     int framedrop_flags;
 
     bool hw_probing;
+    int shared_threads; // accounted with mp_shared_res_acquire_threads()
     struct demux_packet **sent_packets;
     int num_sent_packets;
 
@@ -753,7 +755,12 @@ static void init_avctx(struct mp_filter *vd)
             ctx->max_delay_queue = HWDEC_DELAY_QUEUE_COUNT;
         ctx->hw_probing = true;
     } else {
-        mp_set_avcodec_threads(vd->log, avctx, lavc_param->threads);
+        int threads = lavc_param->threads;
+        ctx->shared_threads =
+            mp_shared_res_acquire_threads(vd->global, lavc_param->threads);
+        if (ctx->shared_threads)
+            threads = ctx->shared_threads;
+        mp_set_avcodec_threads(vd->log, avctx, threads);
     }
 
     if (!ctx->use_hwdec && ctx->vo && lavc_param->dr) {
@@ -883,6 +890,9 @@ static void uninit_avctx(struct mp_filter *vd)
 
     avcodec_free_context(&ctx->avctx);
 
+    mp_shared_res_release_threads(ctx->shared_threads);
+    ctx->shared_threads = 0;
+
     av_buffer_unref(&ctx->hwdec_dev);
 
     ctx->hwdec_failed = false;
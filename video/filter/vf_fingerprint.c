@@ -16,6 +16,7 @@
  */
 
 #include <math.h>
+#include <stdio.h>
 
 #include "common/common.h"
 #include "common/tags.h"
@@ -23,23 +24,41 @@
 #include "filters/filter_internal.h"
 #include "filters/user_filters.h"
 #include "options/m_option.h"
+#include "options/path.h"
 #include "video/img_format.h"
 #include "video/sws_utils.h"
 #include "video/zimg.h"
 
+#include "osdep/io.h"
 #include "osdep/timer.h"
 
-#define PRINT_ENTRY_NUM 10
+// Maximum size of a fingerprint in bytes (gray-hex-16x16).
+#define MAX_PRINT_SIZE (16 * 16)
+
+// pHash: DCT of a 32x32 image, of which the 8x8 lowest frequencies are used.
+#define PHASH_SIZE 32
+#define PHASH_FREQS 8
+
+enum {
+    TYPE_AHASH = 1,
+    TYPE_DHASH,
+    TYPE_PHASH,
+};
 
 struct f_opts {
     int type;
     bool clear;
     bool print;
+    int history;
+    char *file;
 };
 
 const struct m_opt_choice_alternatives type_names[] = {
     {"gray-hex-8x8",    8},
     {"gray-hex-16x16",  16},
+    {"ahash",           TYPE_AHASH},
+    {"dhash",           TYPE_DHASH},
+    {"phash",           TYPE_PHASH},
     {0}
 };
 
@@ -48,17 +67,20 @@ static const struct m_option f_opts_list[] = {
     {"type", OPT_CHOICE_C(type, type_names)},
     {"clear-on-query", OPT_BOOL(clear)},
     {"print", OPT_BOOL(print)},
+    {"history", OPT_INT(history), M_RANGE(1, 10000)},
+    {"file", OPT_STRING(file), .flags = M_OPT_FILE},
     {0}
 };
 
 static const struct f_opts f_opts_def = {
     .type = 16,
     .clear = true,
+    .history = 10,
 };
 
 struct print_entry {
     double pts;
-    char *print;
+    uint8_t data[MAX_PRINT_SIZE];
 };
 
 struct priv {
@@ -66,8 +88,13 @@ struct priv {
     struct mp_image *scaled;
     struct mp_sws_context *sws;
     struct mp_zimg_context *zimg;
-    struct print_entry entries[PRINT_ENTRY_NUM];
+    int print_size;                 // number of bytes in print_entry.data
+    // Ring buffer of the last opts->history frames.
+    struct print_entry *entries;
+    int first_entry;
     int num_entries;
+    float phash_cos[PHASH_FREQS][PHASH_SIZE];
+    FILE *file;
     bool fallback_warning;
 };
 
@@ -76,11 +103,127 @@ static void f_reset(struct mp_filter *f)
 {
     struct priv *p = f->priv;
 
-    for (int n = 0; n < p->num_entries; n++)
-        talloc_free(p->entries[n].print);
+    p->first_entry = 0;
     p->num_entries = 0;
 }
 
+static void hex_encode(char *dst, const uint8_t *src, int size)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int n = 0; n < size; n++) {
+        dst[n * 2 + 0] = digits[src[n] >> 4];
+        dst[n * 2 + 1] = digits[src[n] & 15];
+    }
+    dst[size * 2] = '\0';
+}
+
+static void put_hash(uint8_t *dst, uint64_t hash)
+{
+    for (int n = 0; n < 8; n++)
+        dst[n] = hash >> (56 - n * 8);
+}
+
+// Average hash: each bit is set if the pixel is brighter than the mean.
+static uint64_t compute_ahash(struct mp_image *img)
+{
+    unsigned sum = 0;
+    for (int y = 0; y < 8; y++) {
+        uint8_t *line = img->planes[0] + y * img->stride[0];
+        for (int x = 0; x < 8; x++)
+            sum += line[x];
+    }
+
+    uint64_t hash = 0;
+    for (int y = 0; y < 8; y++) {
+        uint8_t *line = img->planes[0] + y * img->stride[0];
+        for (int x = 0; x < 8; x++)
+            hash = (hash << 1) | (line[x] * 64u > sum);
+    }
+    return hash;
+}
+
+// Difference hash: each bit is set if the pixel is brighter than its left
+// neighbor (on a 9x8 image).
+static uint64_t compute_dhash(struct mp_image *img)
+{
+    uint64_t hash = 0;
+    for (int y = 0; y < 8; y++) {
+        uint8_t *line = img->planes[0] + y * img->stride[0];
+        for (int x = 0; x < 8; x++)
+            hash = (hash << 1) | (line[x + 1] > line[x]);
+    }
+    return hash;
+}
+
+static int cmp_float(const void *a, const void *b)
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return fa < fb ? -1 : fa > fb;
+}
+
+// Perceptual hash: each bit is set if the DCT coefficient (of the 8x8 lowest
+// frequencies) is larger than the median of them.
+static uint64_t compute_phash(struct priv *p, struct mp_image *img)
+{
+    // Only the PHASH_FREQS lowest frequencies are needed, so compute the
+    // separable DCT as 2 matrix multiplications with the cosine table, first
+    // over the columns, then over the rows. The inner loops run over
+    // contiguous arrays, so compilers can vectorize them.
+    float cols[PHASH_FREQS][PHASH_SIZE] = {0};
+    for (int y = 0; y < PHASH_SIZE; y++) {
+        uint8_t *line = img->planes[0] + y * img->stride[0];
+        float pixels[PHASH_SIZE];
+        for (int x = 0; x < PHASH_SIZE; x++)
+            pixels[x] = line[x];
+        for (int k = 0; k < PHASH_FREQS; k++) {
+            float c = p->phash_cos[k][y];
+            for (int x = 0; x < PHASH_SIZE; x++)
+                cols[k][x] += c * pixels[x];
+        }
+    }
+
+    float coeffs[PHASH_FREQS * PHASH_FREQS];
+    for (int k = 0; k < PHASH_FREQS; k++) {
+        for (int l = 0; l < PHASH_FREQS; l++) {
+            float sum = 0;
+            for (int x = 0; x < PHASH_SIZE; x++)
+                sum += cols[k][x] * p->phash_cos[l][x];
+            coeffs[k * PHASH_FREQS + l] = sum;
+        }
+    }
+
+    float sorted[PHASH_FREQS * PHASH_FREQS];
+    memcpy(sorted, coeffs, sizeof(sorted));
+    qsort(sorted, MP_ARRAY_SIZE(sorted), sizeof(sorted[0]), cmp_float);
+    float median = (sorted[31] + sorted[32]) / 2;
+
+    uint64_t hash = 0;
+    for (int n = 0; n < MP_ARRAY_SIZE(coeffs); n++)
+        hash = (hash << 1) | (coeffs[n] > median);
+    return hash;
+}
+
+static void compute_print(struct priv *p, struct print_entry *e)
+{
+    struct mp_image *img = p->scaled;
+
+    switch (p->opts->type) {
+    case TYPE_AHASH:
+        put_hash(e->data, compute_ahash(img));
+        break;
+    case TYPE_DHASH:
+        put_hash(e->data, compute_dhash(img));
+        break;
+    case TYPE_PHASH:
+        put_hash(e->data, compute_phash(p, img));
+        break;
+    default:
+        for (int y = 0; y < img->h; y++)
+            memcpy(&e->data[y * img->w], img->planes[0] + y * img->stride[0],
+                   img->w);
+    }
+}
+
 static void f_process(struct mp_filter *f)
 {
     struct priv *p = f->priv;
@@ -115,28 +258,26 @@ static void f_process(struct mp_filter *f)
             goto error;
     }
 
-    if (p->num_entries >= PRINT_ENTRY_NUM) {
-        talloc_free(p->entries[0].print);
-        MP_TARRAY_REMOVE_AT(p->entries, p->num_entries, 0);
+    int history = p->opts->history;
+    if (p->num_entries >= history) {
+        p->first_entry = (p->first_entry + 1) % history;
+        p->num_entries--;
     }
 
-    int size = p->scaled->w;
-
-    struct print_entry *e = &p->entries[p->num_entries++];
+    struct print_entry *e =
+        &p->entries[(p->first_entry + p->num_entries++) % history];
     e->pts = mpi->pts;
-    e->print = talloc_array(p, char, size * size * 2 + 1);
-
-    for (int y = 0; y < size; y++) {
-        for (int x = 0; x < size; x++) {
-            char *offs = &e->print[(y * size + x) * 2];
-            uint8_t v = p->scaled->planes[0][y * p->scaled->stride[0] + x];
-            snprintf(offs, 3, "%02x", v);
-        }
+    compute_print(p, e);
+
+    if (p->opts->print || p->file) {
+        char hex[MAX_PRINT_SIZE * 2 + 1];
+        hex_encode(hex, e->data, p->print_size);
+        if (p->opts->print)
+            MP_INFO(f, "%f: %s\n", e->pts, hex);
+        if (p->file)
+            fprintf(p->file, "%f %s\n", e->pts, hex);
     }
 
-    if (p->opts->print)
-        MP_INFO(f, "%f: %s\n", e->pts, e->print);
-
     mp_pin_in_write(f->ppins[1], frame);
     return;
 
@@ -153,15 +294,18 @@ static bool f_command(struct mp_filter *f, struct mp_filter_command *cmd)
     switch (cmd->type) {
     case MP_FILTER_COMMAND_GET_META: {
         struct mp_tags *t = talloc_zero(NULL, struct mp_tags);
+        char hex[MAX_PRINT_SIZE * 2 + 1];
 
         for (int n = 0; n < p->num_entries; n++) {
-            struct print_entry *e = &p->entries[n];
+            struct print_entry *e =
+                &p->entries[(p->first_entry + n) % p->opts->history];
 
             if (e->pts != MP_NOPTS_VALUE) {
                 mp_tags_set_str(t, mp_tprintf(80, "fp%d.pts", n),
                                    mp_tprintf(80, "%f", e->pts));
             }
-            mp_tags_set_str(t, mp_tprintf(80, "fp%d.hex", n), e->print);
+            hex_encode(hex, e->data, p->print_size);
+            mp_tags_set_str(t, mp_tprintf(80, "fp%d.hex", n), hex);
         }
 
         mp_tags_set_str(t, "type", m_opt_choice_str(type_names, p->opts->type));
@@ -177,11 +321,20 @@ static bool f_command(struct mp_filter *f, struct mp_filter_command *cmd)
     }
 }
 
+static void f_destroy(struct mp_filter *f)
+{
+    struct priv *p = f->priv;
+
+    if (p->file)
+        fclose(p->file);
+}
+
 static const struct mp_filter_info filter = {
     .name = "fingerprint",
     .process = f_process,
     .command = f_command,
     .reset = f_reset,
+    .destroy = f_destroy,
     .priv_size = sizeof(struct priv),
 };
 
@@ -198,8 +351,36 @@ static struct mp_filter *f_create(struct mp_filter *parent, void *options)
 
     struct priv *p = f->priv;
     p->opts = talloc_steal(p, options);
-    int size = p->opts->type;
-    p->scaled = mp_image_alloc(IMGFMT_Y8, size, size);
+
+    int w, h;
+    switch (p->opts->type) {
+    case TYPE_AHASH: w = 8; h = 8; break;
+    case TYPE_DHASH: w = 9; h = 8; break;
+    case TYPE_PHASH: w = PHASH_SIZE; h = PHASH_SIZE; break;
+    default: w = h = p->opts->type;
+    }
+    p->print_size = p->opts->type >= 8 ? w * h : 8;
+    assert(p->print_size <= MAX_PRINT_SIZE);
+
+    for (int k = 0; k < PHASH_FREQS; k++) {
+        for (int n = 0; n < PHASH_SIZE; n++)
+            p->phash_cos[k][n] = cos(M_PI / PHASH_SIZE * (n + 0.5) * k);
+    }
+
+    p->entries = talloc_array(p, struct print_entry, p->opts->history);
+
+    if (p->opts->file && p->opts->file[0]) {
+        char *path = mp_get_user_path(NULL, f->global, p->opts->file);
+        p->file = fopen(path, "a");
+        talloc_free(path);
+        if (!p->file) {
+            MP_ERR(f, "Could not open '%s'.\n", p->opts->file);
+            talloc_free(f);
+            return NULL;
+        }
+    }
+
+    p->scaled = mp_image_alloc(IMGFMT_Y8, w, h);
     MP_HANDLE_OOM(p->scaled);
     talloc_steal(p, p->scaled);
     p->sws = mp_sws_alloc(p);
@@ -35,10 +35,15 @@
 
 #if HAVE_LCMS2
 
+#include <pthread.h>
+
 #include <lcms2.h>
 #include <libavutil/sha.h>
 #include <libavutil/mem.h>
 
+#include "misc/thread_pool.h"
+#include "utils.h"
+
 struct gl_lcms {
     void *icc_data;
     size_t icc_size;
@@ -52,13 +57,46 @@ struct gl_lcms {
     struct mp_log *log;
     struct mpv_global *global;
     struct mp_icc_opts *opts;
+
+    // For generating LUTs in the background (see gl_lcms_prefetch_lut3d()).
+    struct mp_thread_pool *pool;    // created on first use
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    struct lut_job *pending;        // owned by the render thread
+};
+
+// All inputs of a 3D LUT computation. This owns copies of the inputs, so that
+// it can run on a worker thread while the gl_lcms state changes.
+struct lut_job {
+    struct mp_log *log;
+    struct mpv_global *global;
+    struct gl_lcms *owner;
+
+    void *icc_data;
+    size_t icc_size;
+    struct AVBufferRef *vid_profile;
+    enum mp_csp_prim prim;
+    enum mp_csp_trc trc;
+    bool use_embedded;
+    int intent;
+    int contrast;
+    int size[3];
+    uint8_t hash[32];       // identifies the result, and names the cache file
+    char *cache_dir;        // NULL if the cache is disabled
+    int64_t cache_max_bytes;
+
+    // Result, set by compute_lut(). If the job was queued, done and abandoned
+    // are protected by gl_lcms.lock.
+    struct lut3d *lut;      // NULL on failure
+    bool done;
+    bool abandoned;         // the worker frees the job when done
 };
 
 static void lcms2_error_handler(cmsContext ctx, cmsUInt32Number code,
                                 const char *msg)
 {
-    struct gl_lcms *p = cmsGetContextUserData(ctx);
-    MP_ERR(p, "lcms2: %s\n", msg);
+    struct lut_job *job = cmsGetContextUserData(ctx);
+    MP_ERR(job, "lcms2: %s\n", msg);
 }
 
 static void load_profile(struct gl_lcms *p)
@@ -88,9 +126,16 @@ static void load_profile(struct gl_lcms *p)
     p->current_profile = talloc_strdup(p, p->opts->profile);
 }
 
+static void drop_pending(struct gl_lcms *p);
+
 static void gl_lcms_destructor(void *ptr)
 {
     struct gl_lcms *p = ptr;
+    // Waits until background work (including abandoned jobs) is done.
+    talloc_free(p->pool);
+    drop_pending(p);
+    pthread_cond_destroy(&p->wakeup);
+    pthread_mutex_destroy(&p->lock);
     av_buffer_unref(&p->vid_profile);
 }
 
@@ -105,6 +150,8 @@ struct gl_lcms *gl_lcms_init(void *talloc_ctx, struct mp_log *log,
         .log = log,
         .opts = opts,
     };
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wakeup, NULL);
     gl_lcms_update_options(p);
     return p;
 }
@@ -178,11 +225,11 @@ bool gl_lcms_has_profile(struct gl_lcms *p)
     return p->icc_size > 0;
 }
 
-static cmsHPROFILE get_vid_profile(struct gl_lcms *p, cmsContext cms,
+static cmsHPROFILE get_vid_profile(struct lut_job *p, cmsContext cms,
                                    cmsHPROFILE disp_profile,
                                    enum mp_csp_prim prim, enum mp_csp_trc trc)
 {
-    if (p->opts->use_embedded && p->vid_profile) {
+    if (p->use_embedded && p->vid_profile) {
         // Try using the embedded ICC profile
         cmsHPROFILE prof = cmsOpenProfileFromMemTHR(cms, p->vid_profile->data,
                                                     p->vid_profile->size);
@@ -228,14 +275,14 @@ static cmsHPROFILE get_vid_profile(struct gl_lcms *p, cmsContext cms,
 
     case MP_CSP_TRC_BT_1886: {
         double src_black[3];
-        if (p->opts->contrast < 0) {
+        if (p->contrast < 0) {
             // User requested infinite contrast, return 2.4 profile
             tonecurve[0] = cmsBuildGamma(cms, 2.4);
             break;
-        } else if (p->opts->contrast > 0) {
-            MP_VERBOSE(p, "Using specified contrast: %d\n", p->opts->contrast);
+        } else if (p->contrast > 0) {
+            MP_VERBOSE(p, "Using specified contrast: %d\n", p->contrast);
             for (int i = 0; i < 3; i++)
-                src_black[i] = 1.0 / p->opts->contrast;
+                src_black[i] = 1.0 / p->contrast;
         } else {
             // To build an appropriate BT.1886 transformation we need access to
             // the display's black point, so we use LittleCMS' detection
@@ -299,32 +346,22 @@ static cmsHPROFILE get_vid_profile(struct gl_lcms *p, cmsContext cms,
     return vid_profile;
 }
 
-bool gl_lcms_get_lut3d(struct gl_lcms *p, struct lut3d **result_lut3d,
-                       enum mp_csp_prim prim, enum mp_csp_trc trc,
-                       struct AVBufferRef *vid_profile)
+static void lut_job_destructor(void *ptr)
 {
-    int s_r, s_g, s_b;
-    bool result = false;
-
-    p->changed = false;
-    p->current_prim = prim;
-    p->current_trc = trc;
-
-    // We need to hold on to a reference to the video's ICC profile for as long
-    // as we still need to perform equality checking, so generate a new
-    // reference here
-    av_buffer_unref(&p->vid_profile);
-    if (vid_profile) {
-        MP_VERBOSE(p, "Got an embedded ICC profile.\n");
-        p->vid_profile = av_buffer_ref(vid_profile);
-        MP_HANDLE_OOM(p->vid_profile);
-    }
+    struct lut_job *job = ptr;
+    av_buffer_unref(&job->vid_profile);
+}
 
+static struct lut_job *create_job(struct gl_lcms *p, enum mp_csp_prim prim,
+                                  enum mp_csp_trc trc,
+                                  struct AVBufferRef *vid_profile)
+{
+    int s_r, s_g, s_b;
     if (!gl_parse_3dlut_size(p->opts->size_str, &s_r, &s_g, &s_b))
-        return false;
+        return NULL;
 
     if (!gl_lcms_has_profile(p))
-        return false;
+        return NULL;
 
     // For simplicity, default to 65x65x65, which is large enough to cover
     // typical profiles with good accuracy while not being too wasteful
@@ -332,72 +369,138 @@ bool gl_lcms_get_lut3d(struct gl_lcms *p, struct lut3d **result_lut3d,
     s_g = s_g ? s_g : 65;
     s_b = s_b ? s_b : 65;
 
-    void *tmp = talloc_new(NULL);
-    uint16_t *output = talloc_array(tmp, uint16_t, s_r * s_g * s_b * 4);
-    struct lut3d *lut = NULL;
-    cmsContext cms = NULL;
+    struct lut_job *job = talloc_ptrtype(NULL, job);
+    talloc_set_destructor(job, lut_job_destructor);
+    *job = (struct lut_job) {
+        .log = p->log,
+        .global = p->global,
+        .owner = p,
+        .icc_data = talloc_memdup(job, p->icc_data, p->icc_size),
+        .icc_size = p->icc_size,
+        .prim = prim,
+        .trc = trc,
+        .use_embedded = p->opts->use_embedded,
+        .intent = p->opts->intent,
+        .contrast = p->opts->contrast,
+        .size = {s_r, s_g, s_b},
+        .cache_max_bytes = p->opts->cache_max_bytes,
+    };
 
-    char *cache_file = NULL;
-    if (p->opts->cache) {
-        // Gamma is included in the header to help uniquely identify it,
-        // because we may change the parameter in the future or make it
-        // customizable, same for the primaries.
-        char *cache_info = talloc_asprintf(tmp,
-                "ver=1.4, intent=%d, size=%dx%dx%d, prim=%d, trc=%d, "
-                "contrast=%d\n",
-                p->opts->intent, s_r, s_g, s_b, prim, trc, p->opts->contrast);
-
-        uint8_t hash[32];
-        struct AVSHA *sha = av_sha_alloc();
-        MP_HANDLE_OOM(sha);
-        av_sha_init(sha, 256);
-        av_sha_update(sha, cache_info, strlen(cache_info));
-        if (vid_profile)
-            av_sha_update(sha, vid_profile->data, vid_profile->size);
-        av_sha_update(sha, p->icc_data, p->icc_size);
-        av_sha_final(sha, hash);
-        av_free(sha);
+    if (vid_profile) {
+        job->vid_profile = av_buffer_ref(vid_profile);
+        MP_HANDLE_OOM(job->vid_profile);
+    }
+
+    // Gamma is included in the header to help uniquely identify it,
+    // because we may change the parameter in the future or make it
+    // customizable, same for the primaries.
+    char *cache_info = talloc_asprintf(job,
+            "ver=1.4, intent=%d, size=%dx%dx%d, prim=%d, trc=%d, "
+            "contrast=%d\n",
+            job->intent, s_r, s_g, s_b, prim, trc, job->contrast);
+
+    struct AVSHA *sha = av_sha_alloc();
+    MP_HANDLE_OOM(sha);
+    av_sha_init(sha, 256);
+    av_sha_update(sha, cache_info, strlen(cache_info));
+    if (vid_profile)
+        av_sha_update(sha, vid_profile->data, vid_profile->size);
+    av_sha_update(sha, p->icc_data, p->icc_size);
+    av_sha_final(sha, job->hash);
+    av_free(sha);
+    talloc_free(cache_info);
 
+    if (p->opts->cache) {
         char *cache_dir = p->opts->cache_dir;
         if (cache_dir && cache_dir[0]) {
-            cache_dir = mp_get_user_path(tmp, p->global, cache_dir);
+            cache_dir = mp_get_user_path(job, p->global, cache_dir);
         } else {
-            cache_dir = mp_find_user_file(tmp, p->global, "cache", "");
+            cache_dir = mp_find_user_file(job, p->global, "cache", "");
         }
+        if (cache_dir && cache_dir[0])
+            job->cache_dir = cache_dir;
+    }
 
-        if (cache_dir && cache_dir[0]) {
-            cache_file = talloc_strdup(tmp, "");
-            for (int i = 0; i < sizeof(hash); i++)
-                cache_file = talloc_asprintf_append(cache_file, "%02X", hash[i]);
-            cache_file = mp_path_join(tmp, cache_dir, cache_file);
-            mp_mkdirp(cache_dir);
+    return job;
+}
+
+static bool job_equals(struct lut_job *a, struct lut_job *b)
+{
+    return memcmp(a->hash, b->hash, sizeof(a->hash)) == 0 &&
+           a->use_embedded == b->use_embedded;
+}
+
+struct cube_ctx {
+    cmsHTRANSFORM trafo;
+    uint16_t *output;
+    int s_r, s_g, s_b;
+};
+
+// Transform the plane with blue value b. cmsDoTransform() can be called from
+// multiple threads on the same transform, because it was created with
+// cmsFLAGS_NOCACHE.
+static void transform_plane(void *ptr, int b)
+{
+    struct cube_ctx *ctx = ptr;
+    int s_r = ctx->s_r, s_g = ctx->s_g, s_b = ctx->s_b;
+    uint16_t input[512 * 3]; // gl_parse_3dlut_size() limits sizes to 512
+
+    for (int g = 0; g < s_g; g++) {
+        for (int r = 0; r < s_r; r++) {
+            input[r * 3 + 0] = r * 65535 / (s_r - 1);
+            input[r * 3 + 1] = g * 65535 / (s_g - 1);
+            input[r * 3 + 2] = b * 65535 / (s_b - 1);
         }
+        size_t base = (b * s_r * s_g + g * s_r) * 4;
+        cmsDoTransform(ctx->trafo, input, ctx->output + base, s_r);
+    }
+}
+
+// Compute job->lut. prio is the priority of the slices run on the shared
+// thread pool.
+static void compute_lut(struct lut_job *job, int prio)
+{
+    int s_r = job->size[0], s_g = job->size[1], s_b = job->size[2];
+
+    void *tmp = talloc_new(NULL);
+    uint16_t *output = talloc_array(tmp, uint16_t, s_r * s_g * s_b * 4);
+    cmsContext cms = NULL;
+
+    char *cache_file = NULL;
+    if (job->cache_dir) {
+        cache_file = talloc_strdup(tmp, "");
+        for (int i = 0; i < sizeof(job->hash); i++)
+            cache_file = talloc_asprintf_append(cache_file, "%02X", job->hash[i]);
+        cache_file = mp_path_join(tmp, job->cache_dir, cache_file);
+        mp_mkdirp(job->cache_dir);
     }
 
     // check cache
     if (cache_file && stat(cache_file, &(struct stat){0}) == 0) {
-        MP_VERBOSE(p, "Opening 3D LUT cache in file '%s'.\n", cache_file);
-        struct bstr cachedata = stream_read_file(cache_file, tmp, p->global,
+        MP_VERBOSE(job, "Opening 3D LUT cache in file '%s'.\n", cache_file);
+        struct bstr cachedata = stream_read_file(cache_file, tmp, job->global,
                                                  1000000000); // 1 GB
         if (cachedata.len == talloc_get_size(output)) {
             memcpy(output, cachedata.start, cachedata.len);
+            gpu_cache_touch(cache_file);
             goto done;
         } else {
-            MP_WARN(p, "3D LUT cache invalid!\n");
+            MP_WARN(job, "3D LUT cache invalid!\n");
         }
     }
 
-    cms = cmsCreateContext(NULL, p);
+    cms = cmsCreateContext(NULL, job);
     if (!cms)
         goto error_exit;
     cmsSetLogErrorHandlerTHR(cms, lcms2_error_handler);
 
     cmsHPROFILE profile =
-        cmsOpenProfileFromMemTHR(cms, p->icc_data, p->icc_size);
+        cmsOpenProfileFromMemTHR(cms, job->icc_data, job->icc_size);
     if (!profile)
         goto error_exit;
 
-    cmsHPROFILE vid_hprofile = get_vid_profile(p, cms, profile, prim, trc);
+    cmsHPROFILE vid_hprofile = get_vid_profile(job, cms, profile, job->prim,
+                                               job->trc);
     if (!vid_hprofile) {
         cmsCloseProfile(profile);
         goto error_exit;
@@ -405,7 +508,7 @@ bool gl_lcms_get_lut3d(struct gl_lcms *p, struct lut3d **result_lut3d,
 
     cmsHTRANSFORM trafo = cmsCreateTransformTHR(cms, vid_hprofile, TYPE_RGB_16,
                                                 profile, TYPE_RGBA_16,
-                                                p->opts->intent,
+                                                job->intent,
                                                 cmsFLAGS_NOCACHE |
                                                 cmsFLAGS_NOOPTIMIZE |
                                                 cmsFLAGS_BLACKPOINTCOMPENSATION);
@@ -416,18 +519,9 @@ bool gl_lcms_get_lut3d(struct gl_lcms *p, struct lut3d **result_lut3d,
         goto error_exit;
 
     // transform a (s_r)x(s_g)x(s_b) cube, with 3 components per channel
-    uint16_t *input = talloc_array(tmp, uint16_t, s_r * 3);
-    for (int b = 0; b < s_b; b++) {
-        for (int g = 0; g < s_g; g++) {
-            for (int r = 0; r < s_r; r++) {
-                input[r * 3 + 0] = r * 65535 / (s_r - 1);
-                input[r * 3 + 1] = g * 65535 / (s_g - 1);
-                input[r * 3 + 2] = b * 65535 / (s_b - 1);
-            }
-            size_t base = (b * s_r * s_g + g * s_r) * 4;
-            cmsDoTransform(trafo, input, output + base, s_r);
-        }
-    }
+    struct cube_ctx ctx = {trafo, output, s_r, s_g, s_b};
+    mp_thread_pool_run_slices(mp_thread_pool_shared(), prio, s_b,
+                              transform_plane, &ctx);
 
     cmsDeleteTransform(trafo);
 
@@ -436,29 +530,139 @@ bool gl_lcms_get_lut3d(struct gl_lcms *p, struct lut3d **result_lut3d,
         if (out) {
             fwrite(output, talloc_get_size(output), 1, out);
             fclose(out);
+            gpu_cache_prune(job->log, job->cache_dir, job->cache_max_bytes);
         }
     }
 
 done: ;
 
-    lut = talloc_ptrtype(NULL, lut);
+    struct lut3d *lut = talloc_ptrtype(job, lut);
     *lut = (struct lut3d) {
         .data = talloc_steal(lut, output),
         .size = {s_r, s_g, s_b},
     };
-
-    *result_lut3d = lut;
-    result = true;
+    job->lut = lut;
 
 error_exit:
 
     if (cms)
         cmsDeleteContext(cms);
 
-    if (!lut)
-        MP_FATAL(p, "Error loading ICC profile.\n");
+    if (!job->lut)
+        MP_FATAL(job, "Error loading ICC profile.\n");
 
     talloc_free(tmp);
+}
+
+static void run_job(void *ptr)
+{
+    struct lut_job *job = ptr;
+    struct gl_lcms *p = job->owner;
+
+    compute_lut(job, MP_THREAD_PRIO_LOW);
+
+    pthread_mutex_lock(&p->lock);
+    job->done = true;
+    bool abandoned = job->abandoned;
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+
+    if (abandoned)
+        talloc_free(job);
+}
+
+static void drop_pending(struct gl_lcms *p)
+{
+    if (!p->pending)
+        return;
+
+    pthread_mutex_lock(&p->lock);
+    bool done = p->pending->done;
+    p->pending->abandoned = true;
+    pthread_mutex_unlock(&p->lock);
+
+    if (done)
+        talloc_free(p->pending);
+    p->pending = NULL;
+}
+
+// Start computing the LUT gl_lcms_get_lut3d() will need for these parameters
+// on a background thread, unless the current LUT already matches. If the
+// parameters change before gl_lcms_get_lut3d() is called, the result is
+// discarded. Loading the LUT from the cache is done in the background too.
+void gl_lcms_prefetch_lut3d(struct gl_lcms *p, enum mp_csp_prim prim,
+                            enum mp_csp_trc trc,
+                            struct AVBufferRef *vid_profile)
+{
+    if (!gl_lcms_has_changed(p, prim, trc, vid_profile))
+        return;
+
+    struct lut_job *job = create_job(p, prim, trc, vid_profile);
+    if (!job)
+        return;
+
+    if (p->pending && job_equals(p->pending, job)) {
+        talloc_free(job);
+        return;
+    }
+
+    drop_pending(p);
+
+    if (!p->pool)
+        p->pool = mp_thread_pool_create(p, 0, 0, 1);
+
+    MP_VERBOSE(p, "Generating 3D LUT in the background.\n");
+    p->pending = job;
+    if (!mp_thread_pool_queue_prio(p->pool, MP_THREAD_PRIO_LOW, run_job, job)) {
+        p->pending = NULL;
+        talloc_free(job);
+    }
+}
+
+bool gl_lcms_get_lut3d(struct gl_lcms *p, struct lut3d **result_lut3d,
+                       enum mp_csp_prim prim, enum mp_csp_trc trc,
+                       struct AVBufferRef *vid_profile)
+{
+    p->changed = false;
+    p->current_prim = prim;
+    p->current_trc = trc;
+
+    // We need to hold on to a reference to the video's ICC profile for as long
+    // as we still need to perform equality checking, so generate a new
+    // reference here
+    av_buffer_unref(&p->vid_profile);
+    if (vid_profile) {
+        MP_VERBOSE(p, "Got an embedded ICC profile.\n");
+        p->vid_profile = av_buffer_ref(vid_profile);
+        MP_HANDLE_OOM(p->vid_profile);
+    }
+
+    struct lut_job *job = create_job(p, prim, trc, vid_profile);
+    if (!job) {
+        drop_pending(p);
+        return false;
+    }
+
+    struct lut_job *pending = p->pending;
+    if (pending && job_equals(pending, job)) {
+        pthread_mutex_lock(&p->lock);
+        if (!pending->done)
+            MP_VERBOSE(p, "Waiting for 3D LUT generated in the background.\n");
+        while (!pending->done)
+            pthread_cond_wait(&p->wakeup, &p->lock);
+        pthread_mutex_unlock(&p->lock);
+        p->pending = NULL;
+        talloc_free(job);
+        job = pending;
+    } else {
+        drop_pending(p);
+        compute_lut(job, MP_THREAD_PRIO_HIGH);
+    }
+
+    bool result = !!job->lut;
+    if (result)
+        *result_lut3d = talloc_steal(NULL, job->lut);
+    talloc_free(job);
     return result;
 }
 
@@ -485,6 +689,12 @@ bool gl_lcms_has_profile(struct gl_lcms *p)
     return false;
 }
 
+void gl_lcms_prefetch_lut3d(struct gl_lcms *p, enum mp_csp_prim prim,
+                            enum mp_csp_trc trc,
+                            struct AVBufferRef *vid_profile)
+{
+}
+
 bool gl_lcms_get_lut3d(struct gl_lcms *p, struct lut3d **result_lut3d,
                        enum mp_csp_prim prim, enum mp_csp_trc trc,
                        struct AVBufferRef *vid_profile)
@@ -509,6 +719,8 @@ const struct m_sub_options mp_icc_conf = {
         {"icc-profile-auto", OPT_BOOL(profile_auto)},
         {"icc-cache", OPT_BOOL(cache)},
         {"icc-cache-dir", OPT_STRING(cache_dir), .flags = M_OPT_FILE},
+        {"icc-cache-max-bytes", OPT_BYTE_SIZE(cache_max_bytes),
+            M_RANGE(0, INT64_MAX)},
         {"icc-intent", OPT_INT(intent)},
         {"icc-force-contrast", OPT_CHOICE(contrast, {"no", 0}, {"inf", -1}),
             M_RANGE(0, 1000000)},
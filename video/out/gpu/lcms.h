@@ -15,6 +15,7 @@ struct mp_icc_opts {
     bool profile_auto;
     bool cache;
     char *cache_dir;
+    int64_t cache_max_bytes;
     char *size_str;
     int intent;
     int contrast;
@@ -36,6 +37,9 @@ struct gl_lcms *gl_lcms_init(void *talloc_ctx, struct mp_log *log,
 void gl_lcms_update_options(struct gl_lcms *p);
 bool gl_lcms_set_memory_profile(struct gl_lcms *p, bstr profile);
 bool gl_lcms_has_profile(struct gl_lcms *p);
+void gl_lcms_prefetch_lut3d(struct gl_lcms *p, enum mp_csp_prim prim,
+                            enum mp_csp_trc trc,
+                            struct AVBufferRef *vid_profile);
 bool gl_lcms_get_lut3d(struct gl_lcms *p, struct lut3d **,
                        enum mp_csp_prim prim, enum mp_csp_trc trc,
                        struct AVBufferRef *vid_profile);
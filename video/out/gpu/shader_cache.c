@@ -105,6 +105,7 @@ struct gl_shader_cache {
 
     // For the disk-cache.
     char *cache_dir;
+    int64_t cache_max_bytes;
     struct mpv_global *global; // can be NULL
 };
 
@@ -557,8 +558,12 @@ static void update_uniform(struct gl_shader_cache *sc, struct sc_entry *e,
     }
 }
 
-void gl_sc_set_cache_dir(struct gl_shader_cache *sc, char *dir)
+// max_bytes: if not 0, remove the least recently used cache files after writing
+//            a new one, so that all files in dir stay below this size.
+void gl_sc_set_cache_dir(struct gl_shader_cache *sc, char *dir,
+                         int64_t max_bytes)
 {
+    sc->cache_max_bytes = max_bytes;
     talloc_free(sc->cache_dir);
     if (dir && dir[0]) {
         dir = mp_get_user_path(NULL, sc->global, dir);
@@ -602,8 +607,10 @@ static bool create_pass(struct gl_shader_cache *sc, struct sc_entry *entry)
             MP_DBG(sc, "Trying to load shader from disk...\n");
             struct bstr cachedata =
                 stream_read_file(cache_filename, tmp, sc->global, 1000000000);
-            if (bstr_eatstart0(&cachedata, cache_header))
+            if (bstr_eatstart0(&cachedata, cache_header)) {
                 params.cached_program = cachedata;
+                gpu_cache_touch(cache_filename);
+            }
         }
     }
 
@@ -655,6 +662,7 @@ static bool create_pass(struct gl_shader_cache *sc, struct sc_entry *entry)
                 fwrite(cache_header, strlen(cache_header), 1, out);
                 fwrite(nc.start, nc.len, 1, out);
                 fclose(out);
+                gpu_cache_prune(sc->log, cache_dir, sc->cache_max_bytes);
             }
         }
     }
@@ -63,4 +63,5 @@ struct mp_pass_perf gl_sc_dispatch_compute(struct gl_shader_cache *sc,
 // The application can call this on errors, to reset the current shader. This
 // is normally done implicitly by gl_sc_dispatch_*
 void gl_sc_reset(struct gl_shader_cache *sc);
-void gl_sc_set_cache_dir(struct gl_shader_cache *sc, char *dir);
+void gl_sc_set_cache_dir(struct gl_shader_cache *sc, char *dir,
+                         int64_t max_bytes);
@@ -1,4 +1,13 @@
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
 #include "common/msg.h"
+#include "misc/ctype.h"
+#include "options/path.h"
+#include "osdep/io.h"
 #include "video/out/vo.h"
 #include "utils.h"
 
@@ -234,6 +243,7 @@ struct timer_pool {
     uint64_t samples[VO_PERF_SAMPLE_COUNT];
     int sample_idx;
     int sample_count;
+    uint64_t sample_total;
 
     uint64_t sum;
     uint64_t peak;
@@ -290,6 +300,7 @@ void timer_pool_stop(struct timer_pool *pool)
         // Input res into the buffer and grab the previous value
         uint64_t old = pool->samples[pool->sample_idx];
         pool->sample_count = MPMIN(pool->sample_count + 1, VO_PERF_SAMPLE_COUNT);
+        pool->sample_total++;
         pool->samples[pool->sample_idx++] = res;
         pool->sample_idx %= VO_PERF_SAMPLE_COUNT;
         pool->sum = pool->sum + res - old;
@@ -316,6 +327,7 @@ struct mp_pass_perf timer_pool_measure(struct timer_pool *pool)
     struct mp_pass_perf res = {
         .peak = pool->peak,
         .count = pool->sample_count,
+        .total = pool->sample_total,
     };
 
     int idx = pool->sample_idx - pool->sample_count + VO_PERF_SAMPLE_COUNT;
@@ -347,3 +359,73 @@ void mp_log_source(struct mp_log *log, int lev, const char *src)
         src = next;
     }
 }
+
+// Mark a cache file as used, so that gpu_cache_prune() removes it last.
+void gpu_cache_touch(const char *path)
+{
+    utime(path, NULL);
+}
+
+static bool is_cache_file_name(const char *name)
+{
+    int len = 0;
+    for (; name[len]; len++) {
+        if (!mp_isdigit(name[len]) && !(name[len] >= 'A' && name[len] <= 'F'))
+            return false;
+    }
+    return len == 64;
+}
+
+struct cache_entry {
+    char *path;
+    int64_t size;
+    time_t mtime;
+};
+
+static int compare_mtime(const void *a, const void *b)
+{
+    const struct cache_entry *e1 = a, *e2 = b;
+    return e1->mtime < e2->mtime ? -1 : (e1->mtime > e2->mtime ? 1 : 0);
+}
+
+// Delete the least recently used cache files in dir until their total size is
+// at most max_bytes (0 means unlimited). Other files in the directory (which
+// is often shared with other caches) are never touched.
+void gpu_cache_prune(struct mp_log *log, const char *dir, int64_t max_bytes)
+{
+    if (!max_bytes || !dir || !dir[0])
+        return;
+
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+
+    void *tmp = talloc_new(NULL);
+    struct cache_entry *entries = NULL;
+    int num_entries = 0;
+    int64_t total = 0;
+
+    struct dirent *ep;
+    while ((ep = readdir(d))) {
+        if (!is_cache_file_name(ep->d_name))
+            continue;
+        char *path = mp_path_join(tmp, dir, ep->d_name);
+        struct stat st;
+        if (stat(path, &st) || !S_ISREG(st.st_mode))
+            continue;
+        struct cache_entry e = {path, st.st_size, st.st_mtime};
+        MP_TARRAY_APPEND(tmp, entries, num_entries, e);
+        total += e.size;
+    }
+    closedir(d);
+
+    qsort(entries, num_entries, sizeof(entries[0]), compare_mtime);
+
+    for (int n = 0; n < num_entries && total > max_bytes; n++) {
+        mp_verbose(log, "Removing old cache file %s\n", entries[n].path);
+        if (unlink(entries[n].path) == 0)
+            total -= entries[n].size;
+    }
+
+    talloc_free(tmp);
+}
@@ -106,3 +106,8 @@ struct mp_pass_perf timer_pool_measure(struct timer_pool *pool);
 // print a multi line string with line numbers (e.g. for shader sources)
 // log, lev: module and log level, as in mp_msg()
 void mp_log_source(struct mp_log *log, int lev, const char *src);
+
+// Disk caches (shaders, 3D LUTs) store files named after the SHA-256 of their
+// key (64 upper case hex digits) directly in the cache directory.
+void gpu_cache_touch(const char *path);
+void gpu_cache_prune(struct mp_log *log, const char *dir, int64_t max_bytes);
@@ -470,6 +470,8 @@ const struct m_sub_options gl_video_conf = {
         {"", OPT_SUBSTRUCT(icc_opts, mp_icc_conf)},
         {"gpu-shader-cache", OPT_BOOL(shader_cache)},
         {"gpu-shader-cache-dir", OPT_STRING(shader_cache_dir), .flags = M_OPT_FILE},
+        {"gpu-shader-cache-max-bytes", OPT_BYTE_SIZE(shader_cache_max_bytes),
+            M_RANGE(0, INT64_MAX)},
         {"gpu-hwdec-interop",
             OPT_STRING_VALIDATE(hwdec_interop, ra_hwdec_validate_opt)},
         {"gamut-warning", OPT_REMOVED("Replaced by --gamut-mapping-mode=warn")},
@@ -626,6 +628,44 @@ bool gl_video_icc_auto_enabled(struct gl_video *p)
     return p->opts.icc_opts ? p->opts.icc_opts->profile_auto : false;
 }
 
+// The 3DLUT is always generated against the video's original source space,
+// *not* the reference space. (To avoid having to regenerate the 3DLUT for the
+// OSD on every frame)
+static void get_lut3d_csp(struct gl_video *p, enum mp_csp_prim *prim,
+                          enum mp_csp_trc *trc)
+{
+    *prim = p->image_params.color.primaries;
+    *trc = p->image_params.color.gamma;
+
+    // One exception: HDR is not implemented by LittleCMS for technical
+    // limitation reasons, so we use a gamma 2.2 input curve here instead.
+    // We could pick any value we want here, the difference is just coding
+    // efficiency.
+    if (mp_trc_is_hdr(*trc))
+        *trc = MP_CSP_TRC_GAMMA22;
+}
+
+// Start generating the 3DLUT for the current video in the background, so that
+// gl_video_get_lut3d() doesn't stall rendering of the first frame.
+static void prefetch_lut3d(struct gl_video *p)
+{
+    if (!p->use_lut_3d || !p->image_params.imgfmt ||
+        !(p->ra->caps & RA_CAP_TEX_3D))
+        return;
+
+    enum mp_csp_prim prim;
+    enum mp_csp_trc trc;
+    get_lut3d_csp(p, &prim, &trc);
+
+    // The embedded profile of the first frame is not known yet; if there is
+    // one, the LUT is regenerated when rendering it.
+    struct AVBufferRef *icc = NULL;
+    if (p->image.mpi)
+        icc = p->image.mpi->icc_profile;
+
+    gl_lcms_prefetch_lut3d(p->cms, prim, trc, icc);
+}
+
 static bool gl_video_get_lut3d(struct gl_video *p, enum mp_csp_prim prim,
                                enum mp_csp_trc trc)
 {
@@ -2589,18 +2629,9 @@ static void pass_colormanage(struct gl_video *p, struct mp_colorspace src,
         dst.light = MP_CSP_LIGHT_SCENE_HLG;
 
     if (p->use_lut_3d) {
-        // The 3DLUT is always generated against the video's original source
-        // space, *not* the reference space. (To avoid having to regenerate
-        // the 3DLUT for the OSD on every frame)
-        enum mp_csp_prim prim_orig = p->image_params.color.primaries;
-        enum mp_csp_trc trc_orig = p->image_params.color.gamma;
-
-        // One exception: HDR is not implemented by LittleCMS for technical
-        // limitation reasons, so we use a gamma 2.2 input curve here instead.
-        // We could pick any value we want here, the difference is just coding
-        // efficiency.
-        if (mp_trc_is_hdr(trc_orig))
-            trc_orig = MP_CSP_TRC_GAMMA22;
+        enum mp_csp_prim prim_orig;
+        enum mp_csp_trc trc_orig;
+        get_lut3d_csp(p, &prim_orig, &trc_orig);
 
         if (gl_video_get_lut3d(p, prim_orig, trc_orig)) {
             dst.primaries = prim_orig;
@@ -4021,8 +4052,10 @@ void gl_video_config(struct gl_video *p, struct mp_image_params *params)
         uninit_video(p);
         p->real_image_params = *params;
         p->image_params = *params;
-        if (params->imgfmt)
+        if (params->imgfmt) {
             init_video(p);
+            prefetch_lut3d(p);
+        }
     }
 
     gl_video_reset_surfaces(p);
@@ -4117,10 +4150,12 @@ static void reinit_from_options(struct gl_video *p)
     check_gl_features(p);
     uninit_rendering(p);
     if (p->opts.shader_cache)
-        gl_sc_set_cache_dir(p->sc, p->opts.shader_cache_dir);
+        gl_sc_set_cache_dir(p->sc, p->opts.shader_cache_dir,
+                            p->opts.shader_cache_max_bytes);
     p->ra->use_pbo = p->opts.pbo;
     gl_video_setup_hooks(p);
     reinit_osd(p);
+    prefetch_lut3d(p);
 
     struct mp_vo_opts *vo_opts = mp_get_config_group(p, p->global, &vo_sub_opts);
     if (p->opts.interpolation && !vo_opts->video_sync && !p->dsi_warned) {
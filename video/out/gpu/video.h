@@ -170,6 +170,7 @@ struct gl_video_opts {
     bool shader_cache;
     int early_flush;
     char *shader_cache_dir;
+    int64_t shader_cache_max_bytes;
     char *hwdec_interop;
 };
 
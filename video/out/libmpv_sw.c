@@ -13,6 +13,9 @@ struct priv {
     struct mp_rect src_rc, dst_rc;
     struct mp_osd_res osd_rc;
     bool anything_changed;
+    // Source already has the target format and size; copy it instead of
+    // going through the scaler.
+    bool passthrough;
 };
 
 static int init(struct render_backend *ctx, mpv_render_param *params)
@@ -133,8 +136,22 @@ static int render(struct render_backend *ctx, mpv_render_param *params,
 
         mp_image_params_guess_csp(&p->dst_params);
 
+        p->passthrough = false;
+
         // Can be unset if rendering before any video was loaded.
         if (p->src_params.imgfmt) {
+            struct mp_image_params src = p->src_params;
+            mp_image_params_guess_csp(&src);
+            p->passthrough = src.imgfmt == p->dst_params.imgfmt &&
+                             !src.rotate &&
+                             mp_rect_w(p->src_rc) == mp_rect_w(p->dst_rc) &&
+                             mp_rect_h(p->src_rc) == mp_rect_h(p->dst_rc) &&
+                             mp_colorspace_equal(src.color, p->dst_params.color);
+            if (p->passthrough)
+                MP_VERBOSE(ctx, "Copying frames without conversion.\n");
+        }
+
+        if (p->src_params.imgfmt && !p->passthrough) {
             p->sws->src = p->src_params;
             p->sws->src.w = mp_rect_w(p->src_rc);
             p->sws->src.h = mp_rect_h(p->src_rc);
@@ -175,7 +192,9 @@ static int render(struct render_backend *ctx, mpv_render_param *params,
         struct mp_image dst = wrap_img;
         mp_image_crop_rc(&dst, p->dst_rc);
 
-        if (mp_sws_scale(p->sws, &dst, &src) < 0) {
+        if (p->passthrough) {
+            mp_image_copy(&dst, &src);
+        } else if (mp_sws_scale(p->sws, &dst, &src) < 0) {
             mp_image_clear(&wrap_img, 0, 0, wrap_img.w, wrap_img.h);
             return MPV_ERROR_GENERIC;
         }
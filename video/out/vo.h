@@ -155,6 +155,8 @@ struct mp_pass_perf {
     uint64_t last, avg, peak;
     uint64_t samples[VO_PERF_SAMPLE_COUNT];
     uint64_t count;
+    // number of samples measured since the pass was created (0 if unknown)
+    uint64_t total;
 };
 
 #define VO_PASS_PERF_MAX 64
@@ -15,16 +15,20 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
+#include <libavutil/cpu.h>
 #include <libswscale/swscale.h>
 
 #include "misc/bstr.h"
+#include "misc/thread_pool.h"
 #include "osdep/io.h"
 #include "options/m_config.h"
 #include "options/path.h"
@@ -49,6 +53,7 @@ static const struct m_sub_options image_writer_conf = {
 struct vo_image_opts {
     struct image_writer_opts *opts;
     char *outdir;
+    int threads;
 };
 
 #define OPT_BASE_STRUCT struct vo_image_opts
@@ -57,16 +62,34 @@ static const struct m_sub_options vo_image_conf = {
     .opts = (const struct m_option[]) {
         {"vo-image", OPT_SUBSTRUCT(opts, image_writer_conf)},
         {"vo-image-outdir", OPT_STRING(outdir), .flags = M_OPT_FILE},
+        {"vo-image-threads", OPT_CHOICE(threads, {"auto", 0}), M_RANGE(1, 64)},
         {0},
     },
     .size = sizeof(struct vo_image_opts),
 };
 
+// Frames being encoded (or waiting for a thread) per worker thread, before
+// flip_page() blocks.
+#define FRAMES_PER_THREAD 2
+
+struct job {
+    struct vo *vo;
+    struct mp_image *image;
+    char *filename;
+};
+
 struct priv {
     struct vo_image_opts *opts;
 
     struct mp_image *current;
     int frame;
+
+    struct mp_thread_pool *pool;
+    int max_jobs;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    int num_jobs; // jobs queued or being encoded
 };
 
 static bool checked_mkdir(struct vo *vo, const char *buf)
@@ -102,6 +125,33 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
     osd_draw_on_image(vo->osd, dim, frame->current->pts, OSD_DRAW_SUB_ONLY, p->current);
 }
 
+// Runs on a worker thread. The encoders in image_writer.c don't share any
+// state between calls, so any number of these can run concurrently.
+static void encode_job(void *ptr)
+{
+    struct job *job = ptr;
+    struct vo *vo = job->vo;
+    struct priv *p = vo->priv;
+
+    write_image(job->image, p->opts->opts, job->filename, vo->global, vo->log);
+    talloc_free(job);
+
+    pthread_mutex_lock(&p->lock);
+    p->num_jobs -= 1;
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void wait_jobs(struct vo *vo, int max_jobs)
+{
+    struct priv *p = vo->priv;
+
+    pthread_mutex_lock(&p->lock);
+    while (p->num_jobs > max_jobs)
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
 static void flip_page(struct vo *vo)
 {
     struct priv *p = vo->priv;
@@ -110,17 +160,30 @@ static void flip_page(struct vo *vo)
 
     (p->frame)++;
 
-    void *t = talloc_new(NULL);
-    char *filename = talloc_asprintf(t, "%08d.%s", p->frame,
-                                     image_writer_file_ext(p->opts->opts));
+    struct job *job = talloc_zero(NULL, struct job);
+    job->vo = vo;
+    // The file name is fixed here, so the frame numbering follows the
+    // presentation order, regardless of the order the encoders finish in.
+    job->filename = talloc_asprintf(job, "%08d.%s", p->frame,
+                                    image_writer_file_ext(p->opts->opts));
 
     if (p->opts->outdir && strlen(p->opts->outdir))
-        filename = mp_path_join(t, p->opts->outdir, filename);
+        job->filename = mp_path_join(job, p->opts->outdir, job->filename);
+
+    job->image = mp_image_new_ref(p->current);
+    MP_HANDLE_OOM(job->image);
+    talloc_steal(job, job->image);
+
+    // Backpressure: don't let the decoder run ahead of the encoders.
+    wait_jobs(vo, p->max_jobs - 1);
 
-    MP_INFO(vo, "Saving %s\n", filename);
-    write_image(p->current, p->opts->opts, filename, vo->global, vo->log);
+    MP_INFO(vo, "Saving %s\n", job->filename);
 
-    talloc_free(t);
+    pthread_mutex_lock(&p->lock);
+    p->num_jobs += 1;
+    pthread_mutex_unlock(&p->lock);
+
+    mp_thread_pool_queue(p->pool, encode_job, job);
 }
 
 static int query_format(struct vo *vo, int fmt)
@@ -132,6 +195,13 @@ static int query_format(struct vo *vo, int fmt)
 
 static void uninit(struct vo *vo)
 {
+    struct priv *p = vo->priv;
+
+    // Blocks until all queued frames are written.
+    talloc_free(p->pool);
+    assert(!p->num_jobs);
+    pthread_cond_destroy(&p->wakeup);
+    pthread_mutex_destroy(&p->lock);
 }
 
 static int preinit(struct vo *vo)
@@ -140,6 +210,18 @@ static int preinit(struct vo *vo)
     p->opts = mp_get_config_group(vo, vo->global, &vo_image_conf);
     if (p->opts->outdir && !checked_mkdir(vo, p->opts->outdir))
         return -1;
+
+    int threads = p->opts->threads;
+    if (!threads)
+        threads = MPCLAMP(av_cpu_count(), 1, 64);
+    p->pool = mp_thread_pool_create(NULL, threads, threads, threads);
+    if (!p->pool) {
+        MP_ERR(vo, "Failed to create encoder threads.\n");
+        return -1;
+    }
+    p->max_jobs = threads * FRAMES_PER_THREAD;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wakeup, NULL);
     return 0;
 }
 
@@ -33,7 +33,9 @@
 
 #include <libswscale/swscale.h>
 #include <libavutil/base64.h>
+#include <libavutil/cpu.h>
 
+#include "misc/thread_pool.h"
 #include "options/m_config.h"
 #include "osdep/terminal.h"
 #include "sub/osd.h"
@@ -48,7 +50,13 @@
 #define DEFAULT_WIDTH 80
 #define DEFAULT_HEIGHT 25
 
-static inline void write_str(const char *s)
+// Minimum number of input bytes base64 encoded by a thread.
+#define MIN_SLICE_BYTES (256 * 1024)
+
+// Size of the base64 payload per escape sequence.
+#define CHUNK_SIZE 4096
+
+static inline void write_buf(const char *s, int len)
 {
     // On POSIX platforms, write() is the fastest method. It also is the only
     // one that allows atomic writes so mpv’s output will not be interrupted
@@ -57,7 +65,7 @@ static inline void write_str(const char *s)
     // exceeding PIPE_BUF, but at least Linux does seem to implement it that
     // way.
 #if HAVE_POSIX
-    int remain = strlen(s);
+    int remain = len;
     while (remain > 0) {
         ssize_t written = write(STDOUT_FILENO, s, remain);
         if (written < 0)
@@ -66,11 +74,16 @@ static inline void write_str(const char *s)
         s += written;
     }
 #else
-    printf("%s", s);
+    printf("%.*s", len, s);
     fflush(stdout);
 #endif
 }
 
+static inline void write_str(const char *s)
+{
+    write_buf(s, strlen(s));
+}
+
 #define KITTY_ESC_IMG        "\033_Ga=T,f=24,s=%d,v=%d,C=1,q=2,m=1;"
 #define KITTY_ESC_IMG_SHM    "\033_Ga=T,t=s,f=24,s=%d,v=%d,C=1,q=2,m=1;%s\033\\"
 #define KITTY_ESC_CONTINUE   "\033_Gm=%d;"
@@ -81,6 +94,13 @@ struct vo_kitty_opts {
     int width, height, top, left, rows, cols;
     bool config_clear, alt_screen;
     bool use_shm;
+    int threads;
+};
+
+// Part of the frame that is base64 encoded by one thread.
+struct kitty_slice {
+    struct priv *p;
+    int start, end;         // byte range in priv.buffer
 };
 
 struct priv {
@@ -91,6 +111,12 @@ struct priv {
     char    *shm_path, *shm_path_b64;
     int     buffer_size, output_size;
     int     shm_fd;
+    bool    skip_frame_draw;
+
+    char    *cmd;           // escape sequences written by flip_page
+
+    struct kitty_slice *slices;
+    int num_slices;
 
     int left, top, width, height, cols, rows;
 
@@ -126,6 +152,7 @@ static void free_bufs(struct vo* vo)
 
     talloc_free(p->frame);
     talloc_free(p->output);
+    TA_FREEP(&p->cmd);
 
     if (p->opts.use_shm) {
         close_shm(p);
@@ -168,6 +195,69 @@ static void set_out_params(struct vo *vo)
     p->output_size = AV_BASE64_SIZE(p->buffer_size);
 }
 
+static void setup_slices(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    int slices = p->opts.threads;
+    if (slices < 1)
+        slices = av_cpu_count();
+    slices = MPCLAMP(slices, 1, 64);
+    slices = MPMAX(MPMIN(slices, p->buffer_size / MIN_SLICE_BYTES), 1);
+
+    // Slices must start on a multiple of 3 bytes, so that the base64 output
+    // of each slice can be concatenated.
+    int slice_bytes = (p->buffer_size + slices - 1) / slices;
+    slice_bytes = MPMAX((slice_bytes + 2) / 3 * 3, 3);
+    slices = MPMAX((p->buffer_size + slice_bytes - 1) / slice_bytes, 1);
+
+    if (slices != p->num_slices && slices > 1)
+        MP_VERBOSE(vo, "using %d slices\n", slices);
+    p->num_slices = slices;
+
+    MP_TARRAY_GROW(p, p->slices, slices);
+    for (int n = 0; n < slices; n++) {
+        p->slices[n] = (struct kitty_slice) {
+            .p = p,
+            .start = n * slice_bytes,
+            .end = n == slices - 1 ? p->buffer_size : (n + 1) * slice_bytes,
+        };
+    }
+}
+
+static void encode_slice(struct kitty_slice *s)
+{
+    struct priv *p = s->p;
+    // av_base64_encode() writes a terminating 0 past its output, which would
+    // overlap with the next slice. Leave the last 3 bytes to encode_frame().
+    int end = s->end < p->buffer_size ? s->end - 3 : s->end;
+    av_base64_encode(p->output + s->start / 3 * 4, AV_BASE64_SIZE(end - s->start),
+                     p->buffer + s->start, end - s->start);
+}
+
+static void encode_slice_thread(void *ptr, int slice)
+{
+    struct priv *p = ptr;
+    encode_slice(&p->slices[slice]);
+}
+
+static void encode_frame(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    struct mp_thread_pool *tp =
+        p->num_slices > 1 ? mp_thread_pool_shared() : NULL;
+    mp_thread_pool_run_slices(tp, MP_THREAD_PRIO_HIGH, p->num_slices,
+                              encode_slice_thread, p);
+
+    for (int n = 0; n < p->num_slices - 1; n++) {
+        int pos = p->slices[n].end - 3;
+        char tmp[AV_BASE64_SIZE(3)];
+        av_base64_encode(tmp, sizeof(tmp), p->buffer + pos, 3);
+        memcpy(p->output + pos / 3 * 4, tmp, 4);
+    }
+}
+
 static int reconfig(struct vo *vo, struct mp_image_params *params)
 {
     struct priv *p = vo->priv;
@@ -202,6 +292,7 @@ static int reconfig(struct vo *vo, struct mp_image_params *params)
     if (!p->opts.use_shm) {
         p->buffer = talloc_array(NULL, uint8_t, p->buffer_size);
         p->output = talloc_array(NULL, char, p->output_size);
+        setup_slices(vo);
     }
 
     return 0;
@@ -251,11 +342,18 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
     bool resized = (prev_width != vo->dwidth || prev_height != vo->dheight);
 #endif
 
+    bool need_redraw = resized || frame->redraw || !frame->repeat;
     if (resized)
         reconfig(vo, vo->params);
 
     resized = false;
 
+    // If the frame is repeated and the OSD doesn't change, the image on the
+    // terminal is still up to date.
+    p->skip_frame_draw = !need_redraw;
+    if (p->skip_frame_draw)
+        return;
+
     if (frame->current) {
         mpi = mp_image_new_ref(frame->current);
         struct mp_rect src_rc = p->src;
@@ -279,7 +377,7 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
                p->height, p->width * BYTES_PER_PX, p->frame->stride[0]);
 
     if (!p->opts.use_shm)
-        av_base64_encode(p->output, p->output_size, p->buffer, p->buffer_size);
+        encode_frame(vo);
 
     talloc_free(mpi);
 }
@@ -288,34 +386,40 @@ static void flip_page(struct vo *vo)
 {
     struct priv* p = vo->priv;
 
-    if (p->buffer == NULL)
+    if (p->buffer == NULL || p->skip_frame_draw)
         return;
 
-    char *cmd = talloc_asprintf(NULL, TERM_ESC_GOTO_YX, p->top, p->left);
-
     if (p->opts.use_shm) {
+        char *cmd = talloc_asprintf(NULL, TERM_ESC_GOTO_YX, p->top, p->left);
         cmd = talloc_asprintf_append(cmd, KITTY_ESC_IMG_SHM, p->width, p->height, p->shm_path_b64);
+        write_str(cmd);
+        talloc_free(cmd);
     } else {
-        if (p->output == NULL) {
-            talloc_free(cmd);
+        if (p->output == NULL)
             return;
-        }
 
-        cmd = talloc_asprintf_append(cmd, KITTY_ESC_IMG, p->width, p->height);
-        for (int offset = 0, noffset;; offset += noffset) {
-            if (offset)
-                cmd = talloc_asprintf_append(cmd, KITTY_ESC_CONTINUE, offset < p->output_size);
-            noffset = MPMIN(4096, p->output_size - offset);
-            cmd = talloc_strndup_append(cmd, p->output + offset, noffset);
-            cmd = talloc_strdup_append(cmd, KITTY_ESC_END);
+        // Build all escape sequences in one buffer, so that the frame is
+        // written with a single call.
+        int len = p->output_size - 1; // without terminating 0
+        int chunks = (len + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        int size = len + (chunks + 2) * 64;
+        MP_TARRAY_GROW(NULL, p->cmd, size);
 
-            if (offset >= p->output_size)
-                break;
+        int pos = snprintf(p->cmd, size, TERM_ESC_GOTO_YX KITTY_ESC_IMG,
+                           p->top, p->left, p->width, p->height);
+        for (int offset = 0; offset < len; offset += CHUNK_SIZE) {
+            if (offset)
+                pos += snprintf(p->cmd + pos, size - pos, KITTY_ESC_CONTINUE, 1);
+            int n = MPMIN(CHUNK_SIZE, len - offset);
+            memcpy(p->cmd + pos, p->output + offset, n);
+            pos += n;
+            pos += snprintf(p->cmd + pos, size - pos, KITTY_ESC_END);
         }
-    }
+        pos += snprintf(p->cmd + pos, size - pos,
+                        KITTY_ESC_CONTINUE KITTY_ESC_END, 0);
 
-    write_str(cmd);
-    talloc_free(cmd);
+        write_buf(p->cmd, pos);
+    }
 
 #if HAVE_POSIX
     if (p->opts.use_shm)
@@ -427,6 +531,7 @@ const struct vo_driver video_out_kitty = {
         {"config-clear", OPT_BOOL(opts.config_clear), },
         {"alt-screen", OPT_BOOL(opts.alt_screen), },
         {"use-shm", OPT_BOOL(opts.use_shm), },
+        {"threads", OPT_CHOICE(opts.threads, {"auto", 0}), M_RANGE(1, 64)},
         {0}
     },
     .options_prefix = "vo-kitty",
@@ -23,10 +23,12 @@
 #include <sys/ioctl.h>
 #endif
 
+#include <libavutil/cpu.h>
 #include <libswscale/swscale.h>
 
 #include "options/m_config.h"
 #include "config.h"
+#include "misc/thread_pool.h"
 #include "osdep/terminal.h"
 #include "osdep/io.h"
 #include "vo.h"
@@ -53,6 +55,7 @@ struct vo_tct_opts {
     int width;   // 0 -> default
     int height;  // 0 -> default
     bool term256;  // 0 -> true color
+    int threads;   // 0 -> auto
 };
 
 struct lut_item {
@@ -60,16 +63,36 @@ struct lut_item {
     int width;
 };
 
+// Minimum number of terminal rows encoded by a thread.
+#define MIN_SLICE_ROWS 16
+
+// Encoder state for a range of terminal rows. Each slice appends its output to
+// its own buffer, so slices can be encoded concurrently.
+struct tct_slice {
+    struct vo *vo;
+    int y0, y1;             // terminal rows [y0, y1)
+    char *buf;
+    int buf_len;
+    uint8_t *x256;          // rgb_to_x256 results (2 rows) and scratch
+};
+
 struct priv {
     struct vo_tct_opts opts;
     size_t buffer_size;
     int swidth;
     int sheight;
     struct mp_image *frame;
+    struct mp_image *prev;  // last frame written to the terminal
+    bool prev_valid;        // if false, redraw everything
+    bool skip_frame_draw;
     struct mp_rect src;
     struct mp_rect dst;
     struct mp_sws_context *sws;
     struct lut_item lut[256];
+
+    struct tct_slice **slices;
+    int num_slices;
+    char *out;
 };
 
 // Convert RGB24 to xterm-256 8-bit value
@@ -78,7 +101,9 @@ struct priv {
 // input is the exact middle:
 // - The r/g/b channels and the gray value: the higher value output is chosen.
 // - If the gray and color have same distance from the input - color is chosen.
-static int rgb_to_x256(uint8_t r, uint8_t g, uint8_t b)
+// This is written without table lookups, so that the loop in rgb_row_to_x256()
+// can be vectorized by the compiler.
+static inline int rgb_to_x256(int r, int g, int b)
 {
     // Calculate the nearest 0-based color index at 16 .. 231
 #   define v2ci(v) (v < 48 ? 0 : v < 115 ? 1 : (v - 35) / 40)
@@ -90,8 +115,9 @@ static int rgb_to_x256(uint8_t r, uint8_t g, uint8_t b)
     int gray_index = average > 238 ? 23 : (average - 3) / 10;  // 0..23
 
     // Calculate the represented colors back from the index
-    static const int i2cv[6] = {0, 0x5f, 0x87, 0xaf, 0xd7, 0xff};
-    int cr = i2cv[ir], cg = i2cv[ig], cb = i2cv[ib];  // r/g/b, 0..255 each
+    // (0, 0x5f, 0x87, 0xaf, 0xd7, 0xff)
+#   define i2cv(i) (i ? 55 + 40 * i : 0)
+    int cr = i2cv(ir), cg = i2cv(ig), cb = i2cv(ib);  // r/g/b, 0..255 each
     int gv = 8 + 10 * gray_index;  // same value for r/g/b, 0..255
 
     // Return the one which is nearer to the original input rgb value
@@ -101,96 +127,250 @@ static int rgb_to_x256(uint8_t r, uint8_t g, uint8_t b)
     return color_err <= gray_err ? 16 + color_index() : 232 + gray_index;
 }
 
-static void print_seq3(struct lut_item *lut, const char* prefix,
-                       uint8_t r, uint8_t g, uint8_t b)
+// Convert a row of BGR24 pixels. tmp must have space for 3*w bytes.
+static void rgb_row_to_x256(uint8_t *restrict dst, const uint8_t *restrict src,
+                            uint8_t *restrict tmp, int w)
 {
-// The fwrite implementation is about 25% faster than the printf code
-// (even if we use *.s with the lut values), however,
-// on windows we need to use printf in order to translate escape sequences and
-// UTF8 output for the console.
-#ifndef _WIN32
-    fputs(prefix, stdout);
-    fwrite(lut[r].str, lut[r].width, 1, stdout);
-    fwrite(lut[g].str, lut[g].width, 1, stdout);
-    fwrite(lut[b].str, lut[b].width, 1, stdout);
-    fputc('m', stdout);
-#else
-    printf("%s;%d;%d;%dm", prefix, (int)r, (int)g, (int)b);
-#endif
+    // Deinterleaving first is what allows the compiler to vectorize the
+    // conversion loop.
+    uint8_t *restrict r = tmp, *restrict g = tmp + w, *restrict b = tmp + w * 2;
+    for (int x = 0; x < w; x++) {
+        b[x] = src[x * 3 + 0];
+        g[x] = src[x * 3 + 1];
+        r[x] = src[x * 3 + 2];
+    }
+    for (int x = 0; x < w; x++)
+        dst[x] = rgb_to_x256(r[x], g[x], b[x]);
 }
 
-static void print_seq1(struct lut_item *lut, const char* prefix, uint8_t c)
+static inline void append(struct tct_slice *s, const char *data, int len)
 {
-#ifndef _WIN32
-    fputs(prefix, stdout);
-    fwrite(lut[c].str, lut[c].width, 1, stdout);
-    fputc('m', stdout);
-#else
-    printf("%s;%dm", prefix, (int)c);
-#endif
+    MP_TARRAY_GROW(s, s->buf, s->buf_len + len);
+    memcpy(s->buf + s->buf_len, data, len);
+    s->buf_len += len;
 }
 
+#define append_lit(s, str) append(s, str, sizeof(str) - 1)
 
-static void write_plain(
-    const int dwidth, const int dheight,
-    const int swidth, const int sheight,
-    const unsigned char *source, const int source_stride,
-    bool term256, struct lut_item *lut)
+static void append_goto(struct tct_slice *s, int y, int x)
 {
-    assert(source);
-    const int tx = (dwidth - swidth) / 2;
-    const int ty = (dheight - sheight) / 2;
-    for (int y = 0; y < sheight; y++) {
-        const unsigned char *row = source + y * source_stride;
-        printf(TERM_ESC_GOTO_YX, ty + y, tx);
-        for (int x = 0; x < swidth; x++) {
-            unsigned char b = *row++;
-            unsigned char g = *row++;
-            unsigned char r = *row++;
-            if (term256) {
-                print_seq1(lut, TERM_ESC_COLOR256_BG, rgb_to_x256(r, g, b));
-            } else {
-                print_seq3(lut, TERM_ESC_COLOR24BIT_BG, r, g, b);
-            }
-            printf(" ");
-        }
-        printf(TERM_ESC_CLEAR_COLORS);
+    char tmp[32];
+    append(s, tmp, snprintf(tmp, sizeof(tmp), TERM_ESC_GOTO_YX, y, x));
+}
+
+static void append_seq3(struct tct_slice *s, struct lut_item *lut,
+                        const char *prefix, int r, int g, int b)
+{
+    append(s, prefix, strlen(prefix));
+    append(s, lut[r].str, lut[r].width);
+    append(s, lut[g].str, lut[g].width);
+    append(s, lut[b].str, lut[b].width);
+    append_lit(s, "m");
+}
+
+static void append_seq1(struct tct_slice *s, struct lut_item *lut,
+                        const char *prefix, int c)
+{
+    append(s, prefix, strlen(prefix));
+    append(s, lut[c].str, lut[c].width);
+    append_lit(s, "m");
+}
+
+static bool pixel_eq(const uint8_t *a, const uint8_t *b)
+{
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+// Find the range of cells [*x0, *x1) in which any of the num_rows pixel rows
+// of cur and prev differ. Returns false if the rows are equal.
+static bool find_damage(struct mp_image *cur, struct mp_image *prev, int y,
+                        int num_rows, int w, int *x0, int *x1)
+{
+    *x0 = w;
+    *x1 = 0;
+    for (int n = 0; n < num_rows; n++) {
+        const uint8_t *a = cur->planes[0] + (y + n) * cur->stride[0];
+        const uint8_t *b = prev->planes[0] + (y + n) * prev->stride[0];
+        if (!memcmp(a, b, w * 3))
+            continue;
+        int l = 0, r = w;
+        while (pixel_eq(a + l * 3, b + l * 3))
+            l++;
+        while (pixel_eq(a + (r - 1) * 3, b + (r - 1) * 3))
+            r--;
+        *x0 = MPMIN(*x0, l);
+        *x1 = MPMAX(*x1, r);
     }
-    printf("\n");
+    return *x0 < *x1;
 }
 
-static void write_half_blocks(
-    const int dwidth, const int dheight,
-    const int swidth, const int sheight,
-    unsigned char *source, int source_stride,
-    bool term256, struct lut_item *lut)
+// Encode terminal rows [s->y0, s->y1). Only the changed part of each row is
+// written, and color sequences are omitted if the color didn't change from
+// the previous cell.
+static void encode_slice(struct tct_slice *s)
 {
-    assert(source);
-    const int tx = (dwidth - swidth) / 2;
-    const int ty = (dheight - sheight) / 2;
-    for (int y = 0; y < sheight * 2; y += 2) {
-        const unsigned char *row_up = source + y * source_stride;
-        const unsigned char *row_down = source + (y + 1) * source_stride;
-        printf(TERM_ESC_GOTO_YX, ty + y / 2, tx);
-        for (int x = 0; x < swidth; x++) {
-            unsigned char b_up = *row_up++;
-            unsigned char g_up = *row_up++;
-            unsigned char r_up = *row_up++;
-            unsigned char b_down = *row_down++;
-            unsigned char g_down = *row_down++;
-            unsigned char r_down = *row_down++;
+    struct vo *vo = s->vo;
+    struct priv *p = vo->priv;
+    const bool half = p->opts.algo == ALGO_HALF_BLOCKS;
+    const int rows = half ? 2 : 1;
+    const int w = p->swidth;
+    const int tx = (vo->dwidth - w) / 2;
+    const int ty = (vo->dheight - p->sheight) / 2;
+    const bool term256 = p->opts.term256;
+    struct lut_item *lut = p->lut;
+
+    s->buf_len = 0;
+
+    for (int y = s->y0; y < s->y1; y++) {
+        int sy = y * rows;
+        int x0 = 0, x1 = w;
+        if (p->prev_valid && !find_damage(p->frame, p->prev, sy, rows, w,
+                                          &x0, &x1))
+            continue;
+
+        const uint8_t *up = p->frame->planes[0] + sy * p->frame->stride[0];
+        const uint8_t *down = up + p->frame->stride[0];
+        if (term256) {
+            rgb_row_to_x256(s->x256, up, s->x256 + w * 2, w);
+            if (half)
+                rgb_row_to_x256(s->x256 + w, down, s->x256 + w * 2, w);
+        }
+
+        append_goto(s, ty + y, tx + x0);
+        int last_bg = -1, last_fg = -1;
+        for (int x = x0; x < x1; x++) {
+            const uint8_t *pu = up + x * 3, *pd = down + x * 3;
             if (term256) {
-                print_seq1(lut, TERM_ESC_COLOR256_BG, rgb_to_x256(r_up, g_up, b_up));
-                print_seq1(lut, TERM_ESC_COLOR256_FG, rgb_to_x256(r_down, g_down, b_down));
+                int bg = s->x256[x];
+                if (bg != last_bg)
+                    append_seq1(s, lut, TERM_ESC_COLOR256_BG, bg);
+                last_bg = bg;
+                if (half) {
+                    int fg = s->x256[w + x];
+                    if (fg != last_fg)
+                        append_seq1(s, lut, TERM_ESC_COLOR256_FG, fg);
+                    last_fg = fg;
+                }
+            } else {
+                int bg = pu[2] << 16 | pu[1] << 8 | pu[0];
+                if (bg != last_bg)
+                    append_seq3(s, lut, TERM_ESC_COLOR24BIT_BG, pu[2], pu[1], pu[0]);
+                last_bg = bg;
+                if (half) {
+                    int fg = pd[2] << 16 | pd[1] << 8 | pd[0];
+                    if (fg != last_fg)
+                        append_seq3(s, lut, TERM_ESC_COLOR24BIT_FG, pd[2], pd[1], pd[0]);
+                    last_fg = fg;
+                }
+            }
+            if (half) {
+                append_lit(s, "\xe2\x96\x84");  // UTF8 bytes of U+2584 (lower half block)
             } else {
-                print_seq3(lut, TERM_ESC_COLOR24BIT_BG, r_up, g_up, b_up);
-                print_seq3(lut, TERM_ESC_COLOR24BIT_FG, r_down, g_down, b_down);
+                append_lit(s, " ");
             }
-            printf("\xe2\x96\x84");  // UTF8 bytes of U+2584 (lower half block)
         }
-        printf(TERM_ESC_CLEAR_COLORS);
+        append_lit(s, TERM_ESC_CLEAR_COLORS);
+
+        for (int n = 0; n < rows; n++) {
+            memcpy(p->prev->planes[0] + (sy + n) * p->prev->stride[0],
+                   p->frame->planes[0] + (sy + n) * p->frame->stride[0],
+                   w * 3);
+        }
     }
-    printf("\n");
+}
+
+static void encode_slice_thread(void *ptr, int slice)
+{
+    struct priv *p = ptr;
+    encode_slice(p->slices[slice]);
+}
+
+static void write_out(const char *data, int len)
+{
+    // Like vo_kitty/vo_sixel, use a single write() on POSIX, which avoids
+    // stdio overhead and makes it unlikely that other output interleaves.
+#if HAVE_POSIX
+    while (len > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, len);
+        if (written < 0)
+            return;
+        len -= written;
+        data += written;
+    }
+#else
+    // On windows, printf() translates escape sequences and UTF8 output for
+    // the console.
+    printf("%.*s", len, data);
+    fflush(stdout);
+#endif
+}
+
+static void write_str(const char *s)
+{
+    write_out(s, strlen(s));
+}
+
+static void setup_slices(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    int slices = p->opts.threads;
+    if (slices < 1)
+        slices = av_cpu_count();
+    slices = MPCLAMP(slices, 1, 64);
+    slices = MPMAX(MPMIN(slices, p->sheight / MIN_SLICE_ROWS), 1);
+
+    if (slices != p->num_slices) {
+        // Just destroy and recreate all, this happens only on resizing.
+        for (int n = 0; n < p->num_slices; n++)
+            talloc_free(p->slices[n]);
+        p->num_slices = 0;
+        if (slices > 1)
+            MP_VERBOSE(vo, "using %d slices\n", slices);
+        MP_TARRAY_GROW(p, p->slices, slices);
+        for (int n = 0; n < slices; n++)
+            p->slices[n] = talloc_zero(p, struct tct_slice);
+        p->num_slices = slices;
+    }
+
+    int slice_h = (p->sheight + slices - 1) / slices;
+    for (int n = 0; n < slices; n++) {
+        struct tct_slice *s = p->slices[n];
+        s->vo = vo;
+        s->y0 = MPMIN(n * slice_h, p->sheight);
+        s->y1 = MPMIN(s->y0 + slice_h, p->sheight);
+        talloc_free(s->x256);
+        s->x256 = talloc_array(s, uint8_t, MPMAX(p->swidth, 1) * 5);
+    }
+}
+
+static void write_frame(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    struct mp_thread_pool *tp =
+        p->num_slices > 1 ? mp_thread_pool_shared() : NULL;
+    mp_thread_pool_run_slices(tp, MP_THREAD_PRIO_HIGH, p->num_slices,
+                              encode_slice_thread, p);
+
+    p->prev_valid = true;
+
+    // Concatenate the slices, so that the frame is written with one call.
+    // Then move the cursor below the image, where further output goes.
+    struct tct_slice *last = p->slices[p->num_slices - 1];
+    const int ty = (vo->dheight - p->sheight) / 2;
+    append_goto(last, ty + p->sheight, 0);
+    int len = 0;
+    for (int n = 0; n < p->num_slices; n++)
+        len += p->slices[n]->buf_len;
+    MP_TARRAY_GROW(p, p->out, len);
+    len = 0;
+    for (int n = 0; n < p->num_slices; n++) {
+        struct tct_slice *s = p->slices[n];
+        memcpy(p->out + len, s->buf, s->buf_len);
+        len += s->buf_len;
+    }
+    write_out(p->out, len);
 }
 
 static void get_win_size(struct vo *vo, int *out_width, int *out_height) {
@@ -227,16 +407,20 @@ static int reconfig(struct vo *vo, struct mp_image_params *params)
     };
 
     const int mul = (p->opts.algo == ALGO_PLAIN ? 1 : 2);
-    if (p->frame)
-        talloc_free(p->frame);
+    talloc_free(p->frame);
+    talloc_free(p->prev);
     p->frame = mp_image_alloc(IMGFMT, p->swidth, p->sheight * mul);
-    if (!p->frame)
+    p->prev = mp_image_alloc(IMGFMT, p->swidth, p->sheight * mul);
+    p->prev_valid = false;
+    if (!p->frame || !p->prev)
         return -1;
 
     if (mp_sws_reinit(p->sws) < 0)
         return -1;
 
-    printf(TERM_ESC_CLEAR_SCREEN);
+    setup_slices(vo);
+
+    write_str(TERM_ESC_CLEAR_SCREEN);
 
     vo->want_redraw = true;
     return 0;
@@ -246,7 +430,9 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
 {
     struct priv *p = vo->priv;
     struct mp_image *src = frame->current;
-    if (!src)
+    // Nothing to do if the frame is repeated (there is no OSD).
+    p->skip_frame_draw = !src || (frame->repeat && !frame->redraw);
+    if (p->skip_frame_draw)
         return;
     // XXX: pan, crop etc.
     mp_sws_scale(p->sws, p->frame, src);
@@ -259,30 +445,23 @@ static void flip_page(struct vo *vo)
     int width, height;
     get_win_size(vo, &width, &height);
 
-    if (vo->dwidth != width || vo->dheight != height)
-        reconfig(vo, vo->params);
-
-    if (p->opts.algo == ALGO_PLAIN) {
-        write_plain(
-            vo->dwidth, vo->dheight, p->swidth, p->sheight,
-            p->frame->planes[0], p->frame->stride[0],
-            p->opts.term256, p->lut);
-    } else {
-        write_half_blocks(
-            vo->dwidth, vo->dheight, p->swidth, p->sheight,
-            p->frame->planes[0], p->frame->stride[0],
-            p->opts.term256, p->lut);
+    if (vo->dwidth != width || vo->dheight != height) {
+        if (reconfig(vo, vo->params) < 0)
+            return;
+    } else if (p->skip_frame_draw) {
+        return;
     }
-    fflush(stdout);
+
+    write_frame(vo);
 }
 
 static void uninit(struct vo *vo)
 {
-    printf(TERM_ESC_RESTORE_CURSOR);
-    printf(TERM_ESC_NORMAL_SCREEN);
+    write_str(TERM_ESC_RESTORE_CURSOR);
+    write_str(TERM_ESC_NORMAL_SCREEN);
     struct priv *p = vo->priv;
-    if (p->frame)
-        talloc_free(p->frame);
+    talloc_free(p->frame);
+    talloc_free(p->prev);
 }
 
 static int preinit(struct vo *vo)
@@ -302,8 +481,8 @@ static int preinit(struct vo *vo)
         memcpy(p->lut[i].str, buff, 4); // some strings may not end on a null byte, but that's ok.
     }
 
-    printf(TERM_ESC_HIDE_CURSOR);
-    printf(TERM_ESC_ALT_SCREEN);
+    write_str(TERM_ESC_HIDE_CURSOR);
+    write_str(TERM_ESC_ALT_SCREEN);
 
     return 0;
 }
@@ -341,6 +520,7 @@ const struct vo_driver video_out_tct = {
         {"width", OPT_INT(opts.width)},
         {"height", OPT_INT(opts.height)},
         {"256", OPT_BOOL(opts.term256)},
+        {"threads", OPT_CHOICE(opts.threads, {"auto", 0}), M_RANGE(1, 64)},
         {0}
     },
     .options_prefix = "vo-tct",
@@ -139,6 +139,36 @@ static void copy_plane(struct mp_image *dst, int dst_x, int dst_y,
     }
 }
 
+// Number of pixels the vectorizable part of the scanline functions below
+// handles per block. Must be a power of 2.
+#define VEC_PIXELS 16
+
+// Call the scanline kernel fn(..., x0, x1) with the range [0, w) split into a
+// part that is a multiple of VEC_PIXELS, and the remainder. The kernels take
+// restrict pointers and are inlined into both calls. This allows the compiler
+// to vectorize the first call without runtime alias checks or a scalar
+// epilogue (which GCC's default cost model at -O2 requires), while the second
+// call is the plain scalar loop for the remaining pixels.
+#define VEC_SPLIT(fn, w, ...) do {                                          \
+        int w_ = (w), wv_ = w_ & ~(VEC_PIXELS - 1);                         \
+        fn(__VA_ARGS__, 0, wv_);                                            \
+        fn(__VA_ARGS__, wv_, w_);                                           \
+    } while (0)
+
+static inline void swap_words16(uint16_t *restrict d, const uint16_t *restrict s,
+                                int x0, int x1)
+{
+    for (int x = x0; x < x1; x++)
+        d[x] = av_bswap16(s[x]);
+}
+
+static inline void swap_words32(uint32_t *restrict d, const uint32_t *restrict s,
+                                int x0, int x1)
+{
+    for (int x = x0; x < x1; x++)
+        d[x] = av_bswap32(s[x]);
+}
+
 // Swap endian for one line.
 static void swap_endian(struct mp_image *dst, int dst_x, int dst_y,
                         struct mp_image *src, int src_x, int src_y,
@@ -161,12 +191,10 @@ static void swap_endian(struct mp_image *dst, int dst_x, int dst_y,
             void *d = mp_image_pixel_ptr_ny(dst, p, dst_x, dst_y + y);
             switch (endian_size) {
             case 2:
-                for (int x = 0; x < num_words; x++)
-                    ((uint16_t *)d)[x] = av_bswap16(((uint16_t *)s)[x]);
+                VEC_SPLIT(swap_words16, num_words, d, s);
                 break;
             case 4:
-                for (int x = 0; x < num_words; x++)
-                    ((uint32_t *)d)[x] = av_bswap32(((uint32_t *)s)[x]);
+                VEC_SPLIT(swap_words32, num_words, d, s);
                 break;
             default:
                 MP_ASSERT_UNREACHABLE();
@@ -191,36 +219,57 @@ static void swap_endian(struct mp_image *dst, int dst_x, int dst_y,
 // packers will use "z" because they write zero.
 
 #define PA_WORD_4(name, packed_t, plane_t, sh_c0, sh_c1, sh_c2, sh_c3)      \
-    static void name(void *dst, void *src[], int w) {                       \
-        for (int x = 0; x < w; x++) {                                       \
-            ((packed_t *)dst)[x] =                                          \
-                ((packed_t)((plane_t *)src[0])[x] << (sh_c0)) |             \
-                ((packed_t)((plane_t *)src[1])[x] << (sh_c1)) |             \
-                ((packed_t)((plane_t *)src[2])[x] << (sh_c2)) |             \
-                ((packed_t)((plane_t *)src[3])[x] << (sh_c3));              \
+    static inline void name##_k(packed_t *restrict dst,                     \
+                                const plane_t *restrict s0,                 \
+                                const plane_t *restrict s1,                 \
+                                const plane_t *restrict s2,                 \
+                                const plane_t *restrict s3, int x0, int x1) \
+    {                                                                       \
+        for (int x = x0; x < x1; x++) {                                     \
+            dst[x] = ((packed_t)s0[x] << (sh_c0)) |                         \
+                     ((packed_t)s1[x] << (sh_c1)) |                         \
+                     ((packed_t)s2[x] << (sh_c2)) |                         \
+                     ((packed_t)s3[x] << (sh_c3));                          \
         }                                                                   \
+    }                                                                       \
+    static void name(void *dst, void *src[], int w) {                       \
+        VEC_SPLIT(name##_k, w, dst, src[0], src[1], src[2], src[3]);        \
     }
 
 #define UN_WORD_4(name, packed_t, plane_t, sh_c0, sh_c1, sh_c2, sh_c3, mask)\
-    static void name(void *src, void *dst[], int w) {                       \
-        for (int x = 0; x < w; x++) {                                       \
-            packed_t c = ((packed_t *)src)[x];                              \
-            ((plane_t *)dst[0])[x] = (c >> (sh_c0)) & (mask);               \
-            ((plane_t *)dst[1])[x] = (c >> (sh_c1)) & (mask);               \
-            ((plane_t *)dst[2])[x] = (c >> (sh_c2)) & (mask);               \
-            ((plane_t *)dst[3])[x] = (c >> (sh_c3)) & (mask);               \
+    static inline void name##_k(const packed_t *restrict src,               \
+                                plane_t *restrict d0, plane_t *restrict d1, \
+                                plane_t *restrict d2, plane_t *restrict d3, \
+                                int x0, int x1)                             \
+    {                                                                       \
+        for (int x = x0; x < x1; x++) {                                     \
+            packed_t c = src[x];                                            \
+            d0[x] = (c >> (sh_c0)) & (mask);                                \
+            d1[x] = (c >> (sh_c1)) & (mask);                                \
+            d2[x] = (c >> (sh_c2)) & (mask);                                \
+            d3[x] = (c >> (sh_c3)) & (mask);                                \
         }                                                                   \
+    }                                                                       \
+    static void name(void *src, void *dst[], int w) {                       \
+        VEC_SPLIT(name##_k, w, src, dst[0], dst[1], dst[2], dst[3]);        \
     }
 
 
 #define PA_WORD_3(name, packed_t, plane_t, sh_c0, sh_c1, sh_c2, pad)        \
-    static void name(void *dst, void *src[], int w) {                       \
-        for (int x = 0; x < w; x++) {                                       \
-            ((packed_t *)dst)[x] = (pad) |                                  \
-                ((packed_t)((plane_t *)src[0])[x] << (sh_c0)) |             \
-                ((packed_t)((plane_t *)src[1])[x] << (sh_c1)) |             \
-                ((packed_t)((plane_t *)src[2])[x] << (sh_c2));              \
+    static inline void name##_k(packed_t *restrict dst,                     \
+                                const plane_t *restrict s0,                 \
+                                const plane_t *restrict s1,                 \
+                                const plane_t *restrict s2, int x0, int x1) \
+    {                                                                       \
+        for (int x = x0; x < x1; x++) {                                     \
+            dst[x] = (pad) |                                                \
+                     ((packed_t)s0[x] << (sh_c0)) |                         \
+                     ((packed_t)s1[x] << (sh_c1)) |                         \
+                     ((packed_t)s2[x] << (sh_c2));                          \
         }                                                                   \
+    }                                                                       \
+    static void name(void *dst, void *src[], int w) {                       \
+        VEC_SPLIT(name##_k, w, dst, src[0], src[1], src[2]);                \
     }
 
 UN_WORD_4(un_cccc8,  uint32_t, uint8_t,  0, 8,  16, 24, 0xFFu)
@@ -230,13 +279,19 @@ UN_WORD_4(un_cccc16,  uint64_t, uint16_t,  0, 16,  32, 48, 0xFFFFu)
 PA_WORD_4(pa_cccc16,  uint64_t, uint16_t,  0, 16,  32, 48)
 
 #define UN_WORD_3(name, packed_t, plane_t, sh_c0, sh_c1, sh_c2, mask)       \
-    static void name(void *src, void *dst[], int w) {                       \
-        for (int x = 0; x < w; x++) {                                       \
-            packed_t c = ((packed_t *)src)[x];                              \
-            ((plane_t *)dst[0])[x] = (c >> (sh_c0)) & (mask);               \
-            ((plane_t *)dst[1])[x] = (c >> (sh_c1)) & (mask);               \
-            ((plane_t *)dst[2])[x] = (c >> (sh_c2)) & (mask);               \
+    static inline void name##_k(const packed_t *restrict src,               \
+                                plane_t *restrict d0, plane_t *restrict d1, \
+                                plane_t *restrict d2, int x0, int x1)       \
+    {                                                                       \
+        for (int x = x0; x < x1; x++) {                                     \
+            packed_t c = src[x];                                            \
+            d0[x] = (c >> (sh_c0)) & (mask);                                \
+            d1[x] = (c >> (sh_c1)) & (mask);                                \
+            d2[x] = (c >> (sh_c2)) & (mask);                                \
         }                                                                   \
+    }                                                                       \
+    static void name(void *src, void *dst[], int w) {                       \
+        VEC_SPLIT(name##_k, w, src, dst[0], dst[1], dst[2]);                \
     }
 
 UN_WORD_3(un_ccc8x8,  uint32_t, uint8_t,  0, 8,  16, 0xFFu)
@@ -249,21 +304,33 @@ UN_WORD_3(un_ccc16x16, uint64_t, uint16_t, 0, 16, 32, 0xFFFFu)
 PA_WORD_3(pa_ccc16z16, uint64_t, uint16_t, 0, 16, 32, 0)
 
 #define PA_WORD_2(name, packed_t, plane_t, sh_c0, sh_c1, pad)               \
-    static void name(void *dst, void *src[], int w) {                       \
-        for (int x = 0; x < w; x++) {                                       \
-            ((packed_t *)dst)[x] = (pad) |                                  \
-                ((packed_t)((plane_t *)src[0])[x] << (sh_c0)) |             \
-                ((packed_t)((plane_t *)src[1])[x] << (sh_c1));              \
+    static inline void name##_k(packed_t *restrict dst,                     \
+                                const plane_t *restrict s0,                 \
+                                const plane_t *restrict s1, int x0, int x1) \
+    {                                                                       \
+        for (int x = x0; x < x1; x++) {                                     \
+            dst[x] = (pad) |                                                \
+                     ((packed_t)s0[x] << (sh_c0)) |                         \
+                     ((packed_t)s1[x] << (sh_c1));                          \
         }                                                                   \
+    }                                                                       \
+    static void name(void *dst, void *src[], int w) {                       \
+        VEC_SPLIT(name##_k, w, dst, src[0], src[1]);                        \
     }
 
 #define UN_WORD_2(name, packed_t, plane_t, sh_c0, sh_c1, mask)              \
-    static void name(void *src, void *dst[], int w) {                       \
-        for (int x = 0; x < w; x++) {                                       \
-            packed_t c = ((packed_t *)src)[x];                              \
-            ((plane_t *)dst[0])[x] = (c >> (sh_c0)) & (mask);               \
-            ((plane_t *)dst[1])[x] = (c >> (sh_c1)) & (mask);               \
+    static inline void name##_k(const packed_t *restrict src,               \
+                                plane_t *restrict d0, plane_t *restrict d1, \
+                                int x0, int x1)                             \
+    {                                                                       \
+        for (int x = x0; x < x1; x++) {                                     \
+            packed_t c = src[x];                                            \
+            d0[x] = (c >> (sh_c0)) & (mask);                                \
+            d1[x] = (c >> (sh_c1)) & (mask);                                \
         }                                                                   \
+    }                                                                       \
+    static void name(void *src, void *dst[], int w) {                       \
+        VEC_SPLIT(name##_k, w, src, dst[0], dst[1]);                        \
     }
 
 UN_WORD_2(un_cc8,  uint16_t, uint8_t,  0, 8,  0xFFu)
@@ -272,23 +339,34 @@ UN_WORD_2(un_cc16, uint32_t, uint16_t, 0, 16, 0xFFFFu)
 PA_WORD_2(pa_cc16, uint32_t, uint16_t, 0, 16, 0)
 
 #define PA_SEQ_3(name, comp_t)                                              \
-    static void name(void *dst, void *src[], int w) {                       \
-        comp_t *r = dst;                                                    \
-        for (int x = 0; x < w; x++) {                                       \
-            *r++ = ((comp_t *)src[0])[x];                                   \
-            *r++ = ((comp_t *)src[1])[x];                                   \
-            *r++ = ((comp_t *)src[2])[x];                                   \
+    static inline void name##_k(comp_t *restrict dst,                       \
+                                const comp_t *restrict s0,                  \
+                                const comp_t *restrict s1,                  \
+                                const comp_t *restrict s2, int x0, int x1)  \
+    {                                                                       \
+        for (int x = x0; x < x1; x++) {                                     \
+            dst[x * 3 + 0] = s0[x];                                         \
+            dst[x * 3 + 1] = s1[x];                                         \
+            dst[x * 3 + 2] = s2[x];                                         \
         }                                                                   \
+    }                                                                       \
+    static void name(void *dst, void *src[], int w) {                       \
+        VEC_SPLIT(name##_k, w, dst, src[0], src[1], src[2]);                \
     }
 
 #define UN_SEQ_3(name, comp_t)                                              \
-    static void name(void *src, void *dst[], int w) {                       \
-        comp_t *r = src;                                                    \
-        for (int x = 0; x < w; x++) {                                       \
-            ((comp_t *)dst[0])[x] = *r++;                                   \
-            ((comp_t *)dst[1])[x] = *r++;                                   \
-            ((comp_t *)dst[2])[x] = *r++;                                   \
+    static inline void name##_k(const comp_t *restrict src,                 \
+                                comp_t *restrict d0, comp_t *restrict d1,   \
+                                comp_t *restrict d2, int x0, int x1)        \
+    {                                                                       \
+        for (int x = x0; x < x1; x++) {                                     \
+            d0[x] = src[x * 3 + 0];                                         \
+            d1[x] = src[x * 3 + 1];                                         \
+            d2[x] = src[x * 3 + 2];                                         \
         }                                                                   \
+    }                                                                       \
+    static void name(void *src, void *dst[], int w) {                       \
+        VEC_SPLIT(name##_k, w, src, dst[0], dst[1], dst[2]);                \
     }
 
 UN_SEQ_3(un_ccc8,  uint8_t)
@@ -793,6 +871,8 @@ static void setup_nv_packer(struct mp_repack *rp)
     }
 }
 
+// (lrint() prevents vectorization of the packer, but is kept for exact
+// rounding.)
 #define PA_F32(name, packed_t)                                              \
     static void name(void *dst, float *src, int w, float m, float o,        \
                      uint32_t p_max) {                                      \
@@ -803,10 +883,16 @@ static void setup_nv_packer(struct mp_repack *rp)
     }
 
 #define UN_F32(name, packed_t)                                              \
+    static inline void name##_k(const packed_t *restrict src,               \
+                                float *restrict dst, float m, float o,      \
+                                int x0, int x1)                             \
+    {                                                                       \
+        for (int x = x0; x < x1; x++)                                       \
+            dst[x] = src[x] * m + o;                                        \
+    }                                                                       \
     static void name(void *src, float *dst, int w, float m, float o,        \
                      uint32_t unused) {                                     \
-        for (int x = 0; x < w; x++)                                         \
-            dst[x] = ((packed_t *)src)[x] * m + o;                          \
+        VEC_SPLIT(name##_k, w, src, dst, m, o);                             \
     }
 
 PA_F32(pa_f32_8, uint8_t)